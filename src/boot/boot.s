@@ -2,8 +2,8 @@
 .align 4
 multiboot_header:
     .long 0x1BADB002             
-    .long 0x00000000             
-    .long -(0x1BADB002 + 0x00000000) 
+    .long 0x00000002             # MEMORY_INFO: mem_* and the memory map
+    .long -(0x1BADB002 + 0x00000002) 
 
 .section .text
 .global _start
@@ -15,6 +15,9 @@ static uint32_t next_request_id = 1;
 // IPC 客户端端口
 int client_port = -1; // 移除 static 用于调试
 
+// 驱动端口句柄（首次解析后缓存，之后只校验代数计数器）
+static struct ipc_handle driver_handle = IPC_HANDLE_INIT(BLKDEV_PORT_NAME);
+
 // 初始化块设备 IPC 客户端
 int blkdev_ipc_client_init(void)
 {
@@ -51,8 +54,8 @@ int blkdev_ipc_read(uint8_t drive, uint32_t lba, uint32_t count, void *buffer)
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(BLKDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -67,15 +70,9 @@ int blkdev_ipc_read(uint8_t drive, uint32_t lba, uint32_t count, void *buffer)
     req.count = count;
     req.buffer_addr = (uint32_t)buffer;
 
-    // 发送请求 - 使用 client_port 作为源端口
-    if (ipc_send_from_port(client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(client_port, &msg) != 0)
+    if (ipc_call(client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -109,8 +106,8 @@ int blkdev_ipc_write(uint8_t drive, uint32_t lba, uint32_t count, const void *bu
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(BLKDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -125,15 +122,9 @@ int blkdev_ipc_write(uint8_t drive, uint32_t lba, uint32_t count, const void *bu
     req.count = count;
     req.buffer_addr = (uint32_t)buffer;
 
-    // 发送请求
-    if (ipc_send_from_port(client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(client_port, &msg) != 0)
+    if (ipc_call(client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -167,8 +158,8 @@ int blkdev_ipc_flush(uint8_t drive)
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(BLKDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -183,15 +174,9 @@ int blkdev_ipc_flush(uint8_t drive)
     req.count = 0;
     req.buffer_addr = 0;
 
-    // 发送请求
-    if (ipc_send_from_port(client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(client_port, &msg) != 0)
+    if (ipc_call(client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -220,5 +205,5 @@ int blkdev_ipc_flush(uint8_t drive)
 // 检查驱动是否可用
 int blkdev_ipc_driver_available(void)
 {
-    return ipc_find_port(BLKDEV_PORT_NAME) >= 0;
+    return ipc_lookup(&driver_handle) >= 0;
 }
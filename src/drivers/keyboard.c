@@ -1,5 +1,7 @@
 #include "keyboard.h"
 #include "shell.h"
+#include "task.h"
+#include "isr.h"
 
 // Helper functions for port I/O
 static inline uint8_t inb(uint16_t port)
@@ -35,6 +37,10 @@ static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static int buffer_read_pos = 0;
 static int buffer_write_pos = 0;
 
+// Tasks blocked in keyboard_read()
+static struct wait_queue keyboard_waiters;
+static spinlock_t keyboard_lock; // Buffer and waiters (readers may be on any CPU)
+
 // Shell mode flag
 static int shell_mode = 0;
 
@@ -46,6 +52,7 @@ void keyboard_init(void)
     shift_pressed = 0;
     caps_lock = 0;
     shell_mode = 0;
+    wait_queue_init(&keyboard_waiters);
 }
 
 // Enable shell mode
@@ -110,8 +117,11 @@ void keyboard_handler(void)
                 }
 
                 // Add to buffer
+                spin_lock(&keyboard_lock);
                 keyboard_buffer[buffer_write_pos] = c;
                 buffer_write_pos = (buffer_write_pos + 1) % KEYBOARD_BUFFER_SIZE;
+                wait_wake_all(&keyboard_waiters);
+                spin_unlock(&keyboard_lock);
             }
         }
     }
@@ -135,3 +145,21 @@ char keyboard_getchar(void)
     buffer_read_pos = (buffer_read_pos + 1) % KEYBOARD_BUFFER_SIZE;
     return c;
 }
+
+// Read up to `count` characters, blocking until at least one is available
+int keyboard_read(char *buf, int count)
+{
+    if (!buf || count <= 0)
+        return 0;
+
+    uint32_t flags = spin_lock_irqsave(&keyboard_lock);
+    while (keyboard_buffer_empty())
+        wait_sleep(&keyboard_waiters, &keyboard_lock, TASK_WAIT_FOREVER);
+
+    int n = 0;
+    while (n < count && !keyboard_buffer_empty())
+        buf[n++] = keyboard_getchar();
+    spin_unlock_irqrestore(&keyboard_lock, flags);
+
+    return n;
+}
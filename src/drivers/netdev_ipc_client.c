@@ -15,6 +15,9 @@ static uint32_t next_request_id = 1;
 // IPC 客户端端口
 int netdev_client_port = -1;
 
+// 驱动端口句柄（首次解析后缓存，之后只校验代数计数器）
+static struct ipc_handle driver_handle = IPC_HANDLE_INIT(NETDEV_PORT_NAME);
+
 // 初始化网络设备 IPC 客户端
 int netdev_ipc_client_init(void)
 {
@@ -43,8 +46,8 @@ int netdev_ipc_send(const uint8_t *data, uint32_t length)
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(NETDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -57,15 +60,9 @@ int netdev_ipc_send(const uint8_t *data, uint32_t length)
     req.length = length;
     req.buffer_addr = (uint32_t)data;
 
-    // 发送请求
-    if (ipc_send_from_port(netdev_client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(netdev_client_port, &msg) != 0)
+    if (ipc_call(netdev_client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -99,8 +96,8 @@ int netdev_ipc_recv(uint8_t *buffer, uint32_t max_length)
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(NETDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -113,15 +110,9 @@ int netdev_ipc_recv(uint8_t *buffer, uint32_t max_length)
     req.length = max_length;
     req.buffer_addr = (uint32_t)buffer;
 
-    // 发送请求
-    if (ipc_send_from_port(netdev_client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(netdev_client_port, &msg) != 0)
+    if (ipc_call(netdev_client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -160,8 +151,8 @@ int netdev_ipc_get_mac(uint8_t *mac)
         return -1; // 未初始化
     }
 
-    // 查找驱动端口
-    int driver_port = ipc_find_port(NETDEV_PORT_NAME);
+    // 解析驱动端口（缓存句柄，驱动重启后自动重新查找）
+    int driver_port = ipc_lookup(&driver_handle);
     if (driver_port < 0)
     {
         return -1; // 驱动未运行
@@ -174,15 +165,9 @@ int netdev_ipc_get_mac(uint8_t *mac)
     req.length = 0;
     req.buffer_addr = 0;
 
-    // 发送请求
-    if (ipc_send_from_port(netdev_client_port, driver_port, 0, &req, sizeof(req)) != 0)
-    {
-        return -1;
-    }
-
-    // 等待响应
+    // 同步调用：发送请求并等待响应（驱动被直接调度）
     struct ipc_message msg;
-    if (ipc_recv(netdev_client_port, &msg) != 0)
+    if (ipc_call(netdev_client_port, driver_port, 0, &req, sizeof(req), &msg) != 0)
     {
         return -1;
     }
@@ -217,5 +202,5 @@ int netdev_ipc_get_mac(uint8_t *mac)
 // 检查驱动是否可用
 int netdev_ipc_driver_available(void)
 {
-    return ipc_find_port(NETDEV_PORT_NAME) >= 0;
+    return ipc_lookup(&driver_handle) >= 0;
 }
@@ -4,6 +4,7 @@
 #include "paging.h"
 #include "task.h"
 #include "pmm.h"
+#include "ipc.h"
 
 // Helper: copy string
 static void strcpy_local(char *dest, const char *src)
@@ -64,6 +65,9 @@ int exec_load(const char *path, const char **argv)
         return -1;
     }
 
+    // The old image's IPC window pages go with it
+    ipc_release_task(current);
+
     // Allocate new page directory for the process
     page_directory *old_dir = (page_directory *)current->regs.cr3;
     page_directory *kernel_dir = paging_get_kernel_directory();
@@ -73,37 +77,27 @@ int exec_load(const char *path, const char **argv)
     // Otherwise reuse the existing one (clean it up)
     if (old_dir == kernel_dir || old_dir == 0)
     {
-        new_dir = (page_directory *)pmm_alloc_block();
+        // Shares the identity map and kernel space (entries 768-1023)
+        new_dir = paging_create_directory();
         if (!new_dir)
         {
             vfs_close(f);
             return -1;
         }
-
-        // Clear new directory
-        for (int i = 0; i < 1024; i++)
-        {
-            new_dir->entries[i] = 0;
-        }
-
-        // Share kernel space (entries 768-1023)
-        for (int i = 768; i < 1024; i++)
-        {
-            new_dir->entries[i] = kernel_dir->entries[i];
-        }
     }
     else
     {
         // Reuse existing directory, but clear user space
         new_dir = old_dir;
+        page_directory *dir = (page_directory *)phys_to_virt(new_dir);
         for (int i = 0; i < 768; i++)
         {
-            if (new_dir->entries[i] & 0x1) // Present
+            if (!PDE_KERNEL(i) && (dir->entries[i] & 0x1)) // Present
             {
                 // Free the page table (simplified - should free pages too)
-                void *pt = (void *)(new_dir->entries[i] & 0xFFFFF000);
+                void *pt = (void *)(dir->entries[i] & 0xFFFFF000);
                 pmm_free_block(pt);
-                new_dir->entries[i] = 0;
+                dir->entries[i] = 0;
             }
         }
     }
@@ -116,7 +110,7 @@ int exec_load(const char *path, const char **argv)
     uint32_t text_pages = (header.text_size + 0xFFF) / 0x1000;
     for (uint32_t i = 0; i < text_pages; i++)
     {
-        void *phys = pmm_alloc_block();
+        void *phys = pmm_alloc_high_block();
         if (!phys)
         {
             vfs_close(f);
@@ -138,7 +132,7 @@ int exec_load(const char *path, const char **argv)
         uint32_t data_pages = (header.data_size + 0xFFF) / 0x1000;
         for (uint32_t i = 0; i < data_pages; i++)
         {
-            void *phys = pmm_alloc_block();
+            void *phys = pmm_alloc_high_block();
             if (!phys)
             {
                 vfs_close(f);
@@ -159,7 +153,7 @@ int exec_load(const char *path, const char **argv)
         uint32_t bss_pages = (header.bss_size + 0xFFF) / 0x1000;
         for (uint32_t i = 0; i < bss_pages; i++)
         {
-            void *phys = pmm_alloc_block();
+            void *phys = pmm_alloc_high_block();
             if (!phys)
             {
                 vfs_close(f);
@@ -184,7 +178,7 @@ int exec_load(const char *path, const char **argv)
 
     for (uint32_t i = 0; i < stack_pages; i++)
     {
-        void *phys = pmm_alloc_block();
+        void *phys = pmm_alloc_high_block();
         if (!phys)
         {
             vfs_close(f);
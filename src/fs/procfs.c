@@ -2,9 +2,9 @@
 #include "kmalloc.h"
 #include "pmm.h"
 #include "task.h"
-
-// External timer ticks
-extern volatile uint32_t timer_ticks;
+#include "ipc.h"
+#include "timer.h"
+#include "smp.h"
 
 // Helper: string copy
 static void strcpy(char *dest, const char *src)
@@ -112,21 +112,48 @@ static char *procfs_generate_uptime(void)
     if (!buffer)
         return 0;
 
-    uint32_t seconds = timer_ticks / 18; // ~18.2 ticks per second
+    struct timer_stats stats;
+    timer_get_stats(&stats);
+    uint32_t seconds = timer_ticks / stats.hz;
 
     strcpy(buffer, "Uptime: ");
     char num_str[20];
     uint32_to_str(seconds, num_str);
     strcat(buffer, num_str);
-    strcat(buffer, " seconds\n");
+    strcat(buffer, " seconds\nTimer:  ");
+    uint32_to_str(stats.hz, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " Hz, ");
+    uint32_to_str(stats.interrupts, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " interrupts, ");
+    uint32_to_str(stats.idle_oneshots, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " tickless idles, ");
+    uint32_to_str(stats.pending, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " timers\nTSC:    ");
+    uint32_to_str(stats.tsc_khz, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " kHz\n");
 
     return buffer;
 }
 
+// Helper: append a number padded to `width` columns
+static void procfs_append_col(char *buffer, uint32_t num, int width)
+{
+    char num_str[20];
+    uint32_to_str(num, num_str);
+    strcat(buffer, num_str);
+    for (int i = strlen(num_str); i < width; i++)
+        strcat(buffer, " ");
+}
+
 // Generate meminfo content
 static char *procfs_generate_meminfo(void)
 {
-    char *buffer = (char *)kmalloc(512);
+    char *buffer = (char *)kmalloc(1024);
     if (!buffer)
         return 0;
 
@@ -140,7 +167,7 @@ static char *procfs_generate_meminfo(void)
     uint32_t used_blocks = pmm_get_used_blocks();
 
     // Safety check
-    if (total_blocks == 0 || total_blocks > 1000000)
+    if (total_blocks == 0 || total_blocks > 1048576)
     {
         strcat(buffer, "  Error: Invalid memory data\n");
         return buffer;
@@ -172,16 +199,63 @@ static char *procfs_generate_meminfo(void)
     strcat(buffer, num_str);
     strcat(buffer, "\n");
 
+    // Low frames are in the kernel's direct map, high ones only for
+    // user pages and IPC buffers
+    static const char *zone_names[PMM_ZONES] = {"  Normal zone:   ", "  HighMem zone:  "};
+    for (uint32_t z = 0; z < PMM_ZONES; z++)
+    {
+        uint32_t counts[PMM_MAX_ORDER + 1];
+        pmm_get_free_counts(z, counts);
+        uint32_t zone_free = 0;
+        for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+            zone_free += counts[o] << o;
+
+        strcat(buffer, zone_names[z]);
+        procfs_append_col(buffer, pmm_get_zone_blocks(z), 0);
+        strcat(buffer, " blocks, ");
+        procfs_append_col(buffer, zone_free, 0);
+        strcat(buffer, " free\n");
+    }
+
     // Note about block size
     strcat(buffer, "  (1 block = 4KB)\n");
 
+    // Kernel heap: grows from KHEAP_BASE, sizes in KB
+    struct kmalloc_heap_stats heap;
+    kmalloc_get_heap_stats(&heap);
+    strcat(buffer, "\nKernel Heap (KB):\n  Size:          ");
+    procfs_append_col(buffer, heap.size / 1024, 0);
+    strcat(buffer, " (peak ");
+    procfs_append_col(buffer, heap.peak_size / 1024, 0);
+    strcat(buffer, ", max ");
+    procfs_append_col(buffer, heap.max_size / 1024, 0);
+    strcat(buffer, ")\n  Used:          ");
+    procfs_append_col(buffer, heap.used / 1024, 0);
+    strcat(buffer, " (peak ");
+    procfs_append_col(buffer, heap.peak_used / 1024, 0);
+    strcat(buffer, ")\n  Grown:         ");
+    procfs_append_col(buffer, heap.grows, 0);
+    strcat(buffer, " times\n  Trimmed:       ");
+    procfs_append_col(buffer, heap.trims, 0);
+    strcat(buffer, " times, ");
+    procfs_append_col(buffer, heap.trimmed_pages, 0);
+    strcat(buffer, " blocks returned\n");
+
+    uint32_t small_pages, small_used;
+    kmalloc_small_stats(&small_pages, &small_used);
+    strcat(buffer, "  Size classes:  ");
+    procfs_append_col(buffer, small_used / 1024, 0);
+    strcat(buffer, " in use, ");
+    procfs_append_col(buffer, small_pages, 0);
+    strcat(buffer, " blocks\n");
+
     return buffer;
 }
 
 // Generate tasks content
 static char *procfs_generate_tasks(void)
 {
-    char *buffer = (char *)kmalloc(512);
+    char *buffer = (char *)kmalloc(768);
     if (!buffer)
         return 0;
 
@@ -225,6 +299,267 @@ static char *procfs_generate_tasks(void)
         strcat(buffer, "  No task running\n");
     }
 
+    struct task_stats stats;
+    task_get_stats(&stats);
+    char num_str[20];
+
+    strcat(buffer, "\nTasks:        ");
+    uint32_to_str(stats.tasks, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, "\nPID slots:    ");
+    uint32_to_str(stats.pid_slots, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " used / ");
+    uint32_to_str(stats.pid_table_size, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, "\nTask cache:   ");
+    uint32_to_str(stats.task_objs, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " objects, ");
+    uint32_to_str(stats.task_pages, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " pages\nStack cache:  ");
+    uint32_to_str(stats.stack_objs, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " objects, ");
+    uint32_to_str(stats.stack_pages, num_str);
+    strcat(buffer, num_str);
+    strcat(buffer, " pages\n");
+
+    return buffer;
+}
+
+// Generate ipc content (per-port queue, drop and block counters)
+static char *procfs_generate_ipc(void)
+{
+    struct ipc_stats stats;
+    ipc_get_stats(&stats);
+
+    char *buffer = (char *)kmalloc(512 + stats.active_ports * 224);
+    if (!buffer)
+        return 0;
+
+    strcpy(buffer, "Ports:    ");
+    procfs_append_col(buffer, stats.active_ports, 0);
+    strcat(buffer, " active / ");
+    procfs_append_col(buffer, stats.total_ports, 0);
+    strcat(buffer, " slots\nMessages: ");
+    procfs_append_col(buffer, stats.total_messages, 0);
+    strcat(buffer, "\nDrops:    ");
+    procfs_append_col(buffer, stats.total_drops, 0);
+    strcat(buffer, "\nBlocks:   ");
+    procfs_append_col(buffer, stats.total_blocks, 0);
+    strcat(buffer, "\nWaiting:  ");
+    procfs_append_col(buffer, stats.blocked_tasks, 0);
+    strcat(buffer, "\n\nPort Owner Queue     Sent     Recv     Drops  SndBlk RcvBlk Notify Wait Name\n");
+
+    uint32_t shown = 0;
+    for (uint32_t i = 0; i < stats.total_ports && shown < stats.active_ports; i++)
+    {
+        struct ipc_port *port = ipc_get_port(i);
+        if (!port)
+            continue;
+        shown++;
+
+        char num_str[20];
+        procfs_append_col(buffer, port->port_id, 5);
+        procfs_append_col(buffer, port->owner_pid, 6);
+        uint32_to_str(port->queue_count, num_str);
+        strcat(buffer, num_str);
+        strcat(buffer, "/");
+        procfs_append_col(buffer, port->queue_depth, 9 - strlen(num_str));
+        procfs_append_col(buffer, port->total_sent, 9);
+        procfs_append_col(buffer, port->total_received, 9);
+        procfs_append_col(buffer, port->drops, 7);
+        procfs_append_col(buffer, port->send_blocks, 7);
+        procfs_append_col(buffer, port->recv_blocks, 7);
+        procfs_append_col(buffer, port->notifications, 7);
+        procfs_append_col(buffer, port->send_waiters.count + port->recv_waiters.count +
+                                      port->notify_waiters.count, 5);
+        strcat(buffer, port->name[0] ? port->name : "-");
+        strcat(buffer, "\n");
+    }
+
+    // Where messages wait: queue depth at enqueue and enqueue-to-dequeue
+    // latency in TSC cycles, as log2 bucket upper bounds
+    strcat(buffer, "\nPort DepthP50 DepthP99 LatP50     LatP99     Name\n");
+
+    shown = 0;
+    for (uint32_t i = 0; i < stats.total_ports && shown < stats.active_ports; i++)
+    {
+        struct ipc_port *port = ipc_get_port(i);
+        if (!port)
+            continue;
+        shown++;
+
+        procfs_append_col(buffer, port->port_id, 5);
+        procfs_append_col(buffer, ipc_hist_percentile(port->depth_hist, IPC_DEPTH_BUCKETS, 50), 9);
+        procfs_append_col(buffer, ipc_hist_percentile(port->depth_hist, IPC_DEPTH_BUCKETS, 99), 9);
+        procfs_append_col(buffer, ipc_hist_percentile(port->lat_hist, IPC_LAT_BUCKETS, 50), 11);
+        procfs_append_col(buffer, ipc_hist_percentile(port->lat_hist, IPC_LAT_BUCKETS, 99), 11);
+        strcat(buffer, port->name[0] ? port->name : "-");
+        strcat(buffer, "\n");
+    }
+
+    return buffer;
+}
+
+// Generate ipctrace content (most recent trace ring events, oldest first)
+#define PROCFS_TRACE_EVENTS 64
+
+static char *procfs_generate_ipctrace(void)
+{
+    static const char *names[] = {"?", "send", "recv", "call", "reply", "drop", "notify"};
+    static struct ipc_trace_event events[PROCFS_TRACE_EVENTS];
+
+    uint32_t count = ipc_trace_read(events, PROCFS_TRACE_EVENTS);
+    char *buffer = (char *)kmalloc(128 + count * 64);
+    if (!buffer)
+        return 0;
+
+    // Times are cycles before the newest event
+    strcpy(buffer, "Cycles ago  Event  Port  PID   Arg\n");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const struct ipc_trace_event *e = &events[i];
+        uint32_t event = e->event <= IPC_TRACE_NOTIFY ? e->event : 0;
+
+        procfs_append_col(buffer, (uint32_t)(events[count - 1].tsc - e->tsc), 12);
+        strcat(buffer, names[event]);
+        for (int pad = strlen(names[event]); pad < 7; pad++)
+            strcat(buffer, " ");
+        procfs_append_col(buffer, e->port, 6);
+        procfs_append_col(buffer, e->pid, 6);
+        procfs_append_col(buffer, e->arg, 0);
+        strcat(buffer, "\n");
+    }
+
+    return buffer;
+}
+
+// Generate sched content (per-CPU counters, switch latency, and per-task
+// CPU time, switch counts and run delay)
+static char *procfs_generate_sched(void)
+{
+    struct task_stats stats;
+    task_get_stats(&stats);
+
+    // Tasks created while we print are left out rather than overflowing
+    uint32_t max_tasks = stats.tasks + 4;
+    char *buffer = (char *)kmalloc(1536 + cpu_count * 64 + max_tasks * 128);
+    if (!buffer)
+        return 0;
+
+    strcpy(buffer, "CPU Ticks     Busy      Switches  IPIs      Steals\n");
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        struct cpu *cpu = &cpus[i];
+        procfs_append_col(buffer, i, 4);
+        procfs_append_col(buffer, cpu->ticks, 10);
+        procfs_append_col(buffer, cpu->busy_ticks, 10);
+        procfs_append_col(buffer, cpu->switches, 10);
+        procfs_append_col(buffer, cpu->resched_ipis, 10);
+        procfs_append_col(buffer, cpu->steals, 0);
+        strcat(buffer, "\n");
+    }
+
+    // Switch decision to the next task running, in TSC cycles, as log2
+    // bucket upper bounds
+    uint32_t hist[SCHED_LAT_BUCKETS];
+    task_get_switch_hist(hist);
+    uint32_t samples = 0;
+    for (uint32_t b = 0; b < SCHED_LAT_BUCKETS; b++)
+        samples += hist[b];
+
+    strcat(buffer, "\nSwitch latency: ");
+    procfs_append_col(buffer, samples, 0);
+    strcat(buffer, " samples, p50 ");
+    procfs_append_col(buffer, ipc_hist_percentile(hist, SCHED_LAT_BUCKETS, 50), 0);
+    strcat(buffer, " p99 ");
+    procfs_append_col(buffer, ipc_hist_percentile(hist, SCHED_LAT_BUCKETS, 99), 0);
+    strcat(buffer, " cycles\n");
+    for (uint32_t b = 0; b < SCHED_LAT_BUCKETS; b++)
+    {
+        if (!hist[b])
+            continue;
+        strcat(buffer, "  <");
+        procfs_append_col(buffer, b == 0 ? 1 : (b < 31 ? 1u << b : 0xFFFFFFFF), 11);
+        procfs_append_col(buffer, hist[b], 0);
+        strcat(buffer, "\n");
+    }
+
+    // Times in microseconds; Delay is time ready but not running, Vol
+    // counts blocks and yields, Invol preemptions
+    strcat(buffer, "\nPID   CPU Vol      Invol    CPU(us)    Delay(us)  AvgDly(us) MaxDly(us) Name\n");
+
+    uint32_t pos = 0;
+    uint32_t shown = 0;
+    struct task *t;
+    while (shown < max_tasks && (t = task_iterate(&pos)) != 0)
+    {
+        shown++;
+        uint32_t delay = timer_cycles_to_us(t->run_delay);
+        procfs_append_col(buffer, t->pid, 6);
+        procfs_append_col(buffer, t->cpu, 4);
+        procfs_append_col(buffer, t->nvcsw, 9);
+        procfs_append_col(buffer, t->nivcsw, 9);
+        procfs_append_col(buffer, timer_cycles_to_us(t->cpu_cycles), 11);
+        procfs_append_col(buffer, delay, 11);
+        procfs_append_col(buffer, t->context_switches ? delay / t->context_switches : 0, 11);
+        procfs_append_col(buffer, timer_cycles_to_us(t->run_delay_max), 11);
+        strcat(buffer, t->name);
+        strcat(buffer, "\n");
+    }
+
+    return buffer;
+}
+
+// Append one zone's buddyinfo table
+static void procfs_append_zone(char *buffer, uint32_t zone, const char *name)
+{
+    uint32_t counts[PMM_MAX_ORDER + 1];
+    pmm_get_free_counts(zone, counts);
+
+    uint32_t free_frames = 0;
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+        free_frames += counts[o] << o;
+
+    strcat(buffer, "Zone ");
+    strcat(buffer, name);
+    strcat(buffer, ", ");
+    procfs_append_col(buffer, pmm_get_zone_blocks(zone), 0);
+    strcat(buffer, " pages\nOrder Pages  Free blocks Unusable%\n");
+    uint32_t below = 0; // Free frames in blocks of lower orders
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+    {
+        procfs_append_col(buffer, o, 6);
+        procfs_append_col(buffer, 1u << o, 7);
+        procfs_append_col(buffer, counts[o], 12);
+        procfs_append_col(buffer, free_frames ? below * 100 / free_frames : 0, 0);
+        strcat(buffer, "\n");
+        below += counts[o] << o;
+    }
+
+    strcat(buffer, "Free pages: ");
+    procfs_append_col(buffer, free_frames, 0);
+    strcat(buffer, "\n");
+}
+
+// Generate buddyinfo content: per zone, free blocks per order and the
+// share of free memory in smaller blocks (unusable for that order)
+static char *procfs_generate_buddyinfo(void)
+{
+    char *buffer = (char *)kmalloc(PMM_ZONES * (160 + (PMM_MAX_ORDER + 1) * 48));
+    if (!buffer)
+        return 0;
+
+    buffer[0] = '\0';
+    procfs_append_zone(buffer, PMM_ZONE_NORMAL, "Normal");
+    if (pmm_get_zone_blocks(PMM_ZONE_HIGH))
+    {
+        strcat(buffer, "\n");
+        procfs_append_zone(buffer, PMM_ZONE_HIGH, "HighMem");
+    }
     return buffer;
 }
 
@@ -263,6 +598,18 @@ static int procfs_read(struct file *file, char *buffer, uint32_t size, uint32_t
     case PROCFS_TASKS:
         content = procfs_generate_tasks();
         break;
+    case PROCFS_IPC:
+        content = procfs_generate_ipc();
+        break;
+    case PROCFS_IPCTRACE:
+        content = procfs_generate_ipctrace();
+        break;
+    case PROCFS_SCHED:
+        content = procfs_generate_sched();
+        break;
+    case PROCFS_BUDDYINFO:
+        content = procfs_generate_buddyinfo();
+        break;
     default:
         return 0;
     }
@@ -402,6 +749,10 @@ int procfs_mount(void)
     procfs_create_file("uptime", PROCFS_UPTIME);
     procfs_create_file("meminfo", PROCFS_MEMINFO);
     procfs_create_file("tasks", PROCFS_TASKS);
+    procfs_create_file("ipc", PROCFS_IPC);
+    procfs_create_file("ipctrace", PROCFS_IPCTRACE);
+    procfs_create_file("sched", PROCFS_SCHED);
+    procfs_create_file("buddyinfo", PROCFS_BUDDYINFO);
 
     return 0;
 }
@@ -1,9 +1,14 @@
 #include "vfs.h"
 #include "kmalloc.h"
+#include "slab.h"
 
 // Root superblock
 static struct superblock *root_sb = 0;
 
+// Inodes of every file system, and open files
+static struct kmem_cache inode_cache;
+static struct kmem_cache file_cache;
+
 // Next inode number
 static uint32_t next_ino = 1;
 
@@ -78,7 +83,7 @@ static int split_path(const char *path, char components[][VFS_NAME_MAX], int max
 // Allocate an inode
 struct inode *vfs_alloc_inode(struct superblock *sb)
 {
-    struct inode *inode = (struct inode *)kmalloc(sizeof(struct inode));
+    struct inode *inode = (struct inode *)kmem_cache_alloc(&inode_cache);
     if (!inode)
         return 0;
 
@@ -105,7 +110,7 @@ void vfs_free_inode(struct inode *inode)
 {
     if (inode)
     {
-        kfree(inode);
+        kmem_cache_free(&inode_cache, inode);
     }
 }
 
@@ -310,7 +315,7 @@ struct file *vfs_open(const char *path, uint32_t flags)
     if (!inode)
         return 0;
 
-    struct file *file = (struct file *)kmalloc(sizeof(struct file));
+    struct file *file = (struct file *)kmem_cache_alloc(&file_cache);
     if (!file)
         return 0;
 
@@ -326,7 +331,7 @@ struct file *vfs_open(const char *path, uint32_t flags)
     {
         if (file->f_op->open(file->inode, file) < 0)
         {
-            kfree(file);
+            kmem_cache_free(&file_cache, file);
             return 0;
         }
     }
@@ -349,7 +354,7 @@ int vfs_close(struct file *file)
     file->ref_count--;
     if (file->ref_count == 0)
     {
-        kfree(file);
+        kmem_cache_free(&file_cache, file);
     }
 
     return 0;
@@ -562,6 +567,9 @@ int vfs_rmdir(const char *path)
 // Initialize VFS
 void vfs_init(void)
 {
+    kmem_cache_init(&inode_cache, "inode", sizeof(struct inode));
+    kmem_cache_init(&file_cache, "file", sizeof(struct file));
+
     // Allocate root superblock
     root_sb = (struct superblock *)kmalloc(sizeof(struct superblock));
     if (!root_sb)
@@ -1,8 +1,12 @@
 #include "vrfs.h"
 #include "vfs.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include <stdint.h>
 
+// Block buffers and the in-memory bitmaps, one disk block each
+static struct kmem_cache block_cache;
+
 // Helper: Memory set (avoid conflict with potential system memset)
 static void fs_memset(void *ptr, int value, uint32_t num)
 {
@@ -99,13 +103,13 @@ static int vrfs_write_inode(struct vrfs_sb_info *sbi, uint32_t inode_no, struct
     uint32_t offset_in_block = (inode_no % inodes_per_block) * sizeof(struct vrfs_inode);
 
     // Read the block
-    uint8_t *buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!buffer)
         return -1;
 
     if (blkdev_read(sbi->bdev, block_no, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
@@ -114,7 +118,7 @@ static int vrfs_write_inode(struct vrfs_sb_info *sbi, uint32_t inode_no, struct
 
     // Write back
     int result = blkdev_write(sbi->bdev, block_no, buffer);
-    kfree(buffer);
+    kmem_cache_free(&block_cache, buffer);
 
     return result;
 }
@@ -131,20 +135,20 @@ int vrfs_read_inode(struct vrfs_sb_info *sbi, uint32_t inode_no, struct vrfs_ino
     uint32_t offset_in_block = (inode_no % inodes_per_block) * sizeof(struct vrfs_inode);
 
     // Read the block
-    uint8_t *buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!buffer)
         return -1;
 
     if (blkdev_read(sbi->bdev, block_no, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
     // Copy inode from buffer
     fs_memcpy(inode_data, buffer + offset_in_block, sizeof(struct vrfs_inode));
 
-    kfree(buffer);
+    kmem_cache_free(&block_cache, buffer);
 
     return 0;
 }
@@ -156,7 +160,7 @@ int vrfs_mkfs(struct block_device *bdev)
         return -1;
 
     // Allocate temporary buffer
-    uint8_t *buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!buffer)
         return -1;
 
@@ -185,7 +189,7 @@ int vrfs_mkfs(struct block_device *bdev)
     // Write superblock
     if (blkdev_write(bdev, 0, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
@@ -194,7 +198,7 @@ int vrfs_mkfs(struct block_device *bdev)
     bitmap_set(buffer, 0); // Reserve inode 0 for root
     if (blkdev_write(bdev, inode_bitmap_block, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
@@ -205,7 +209,7 @@ int vrfs_mkfs(struct block_device *bdev)
 
     if (blkdev_write(bdev, block_bitmap_block, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
@@ -222,11 +226,11 @@ int vrfs_mkfs(struct block_device *bdev)
     fs_memcpy(buffer, &root_inode, sizeof(struct vrfs_inode));
     if (blkdev_write(bdev, inode_table_block, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return -1;
     }
 
-    kfree(buffer);
+    kmem_cache_free(&block_cache, buffer);
     return 0;
 }
 
@@ -280,13 +284,13 @@ static int vrfs_read(struct file *file, char *buffer, uint32_t size, uint32_t of
         return 0;
 
     // Read data from first block
-    uint8_t *block_buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *block_buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!block_buffer)
         return -1;
 
     if (blkdev_read(sbi->bdev, info->disk_inode.direct[0], block_buffer) < 0)
     {
-        kfree(block_buffer);
+        kmem_cache_free(&block_cache, block_buffer);
         return -1;
     }
 
@@ -294,7 +298,7 @@ static int vrfs_read(struct file *file, char *buffer, uint32_t size, uint32_t of
     uint32_t to_read = (size < inode->size) ? size : inode->size;
     fs_memcpy(buffer, block_buffer, to_read);
 
-    kfree(block_buffer);
+    kmem_cache_free(&block_cache, block_buffer);
     return to_read;
 }
 
@@ -330,7 +334,7 @@ static int vrfs_write(struct file *file, const char *buffer, uint32_t size, uint
     }
 
     // Write data to the block
-    uint8_t *block_buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *block_buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!block_buffer)
         return -1;
 
@@ -339,11 +343,11 @@ static int vrfs_write(struct file *file, const char *buffer, uint32_t size, uint
 
     if (blkdev_write(sbi->bdev, info->disk_inode.direct[0], block_buffer) < 0)
     {
-        kfree(block_buffer);
+        kmem_cache_free(&block_cache, block_buffer);
         return -1;
     }
 
-    kfree(block_buffer);
+    kmem_cache_free(&block_cache, block_buffer);
 
     // Update inode size
     info->disk_inode.size = size;
@@ -373,23 +377,23 @@ static int vrfs_add_dir_entry(struct vrfs_sb_info *sbi, struct vrfs_inode *dir_i
         vrfs_write_inode(sbi, dir_inode_no, dir_inode);
 
         // Clear the block
-        uint8_t *block_buf = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+        uint8_t *block_buf = (uint8_t *)kmem_cache_alloc(&block_cache);
         if (!block_buf)
             return -1;
 
         fs_memset(block_buf, 0, VRFS_BLOCK_SIZE);
         blkdev_write(sbi->bdev, block_no, block_buf);
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
     }
 
     // Read directory block
-    uint8_t *block_buf = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *block_buf = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!block_buf)
         return -1;
 
     if (blkdev_read(sbi->bdev, dir_inode->direct[0], block_buf) < 0)
     {
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
         return -1;
     }
 
@@ -413,7 +417,7 @@ static int vrfs_add_dir_entry(struct vrfs_sb_info *sbi, struct vrfs_inode *dir_i
             // Write back
             if (blkdev_write(sbi->bdev, dir_inode->direct[0], block_buf) < 0)
             {
-                kfree(block_buf);
+                kmem_cache_free(&block_cache, block_buf);
                 return -1;
             }
 
@@ -421,12 +425,12 @@ static int vrfs_add_dir_entry(struct vrfs_sb_info *sbi, struct vrfs_inode *dir_i
             dir_inode->size = (i + 1) * sizeof(struct vrfs_dirent);
             vrfs_write_inode(sbi, dir_inode_no, dir_inode);
 
-            kfree(block_buf);
+            kmem_cache_free(&block_cache, block_buf);
             return 0;
         }
     }
 
-    kfree(block_buf);
+    kmem_cache_free(&block_cache, block_buf);
     return -1; // Directory full
 }
 
@@ -464,14 +468,14 @@ static struct inode *vrfs_create(struct inode *dir, const char *name, uint32_t m
         return 0;
 
     // Allocate VFS inode
-    struct inode *new_inode = (struct inode *)kmalloc(sizeof(struct inode));
+    struct inode *new_inode = vfs_alloc_inode(dir->sb);
     if (!new_inode)
         return 0;
 
     struct vrfs_inode_info *info = (struct vrfs_inode_info *)kmalloc(sizeof(struct vrfs_inode_info));
     if (!info)
     {
-        kfree(new_inode);
+        vfs_free_inode(new_inode);
         return 0;
     }
 
@@ -493,7 +497,7 @@ static struct inode *vrfs_create(struct inode *dir, const char *name, uint32_t m
     {
         // Failed to add directory entry, cleanup
         kfree(info);
-        kfree(new_inode);
+        vfs_free_inode(new_inode);
         return 0;
     }
 
@@ -529,13 +533,13 @@ static struct inode *vrfs_lookup(struct inode *dir, const char *name)
         return 0;
 
     // Read directory block
-    uint8_t *block_buf = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *block_buf = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!block_buf)
         return 0;
 
     if (blkdev_read(sbi->bdev, dir_info->disk_inode.direct[0], block_buf) < 0)
     {
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
         return 0;
     }
 
@@ -565,7 +569,7 @@ static struct inode *vrfs_lookup(struct inode *dir, const char *name)
         {
             // Found! Load the inode
             uint32_t inode_no = entries[i].inode;
-            kfree(block_buf);
+            kmem_cache_free(&block_cache, block_buf);
 
             // Read inode from disk
             struct vrfs_inode disk_inode;
@@ -573,14 +577,14 @@ static struct inode *vrfs_lookup(struct inode *dir, const char *name)
                 return 0;
 
             // Create VFS inode
-            struct inode *found_inode = (struct inode *)kmalloc(sizeof(struct inode));
+            struct inode *found_inode = vfs_alloc_inode(dir->sb);
             if (!found_inode)
                 return 0;
 
             struct vrfs_inode_info *info = (struct vrfs_inode_info *)kmalloc(sizeof(struct vrfs_inode_info));
             if (!info)
             {
-                kfree(found_inode);
+                vfs_free_inode(found_inode);
                 return 0;
             }
 
@@ -600,7 +604,7 @@ static struct inode *vrfs_lookup(struct inode *dir, const char *name)
         }
     }
 
-    kfree(block_buf);
+    kmem_cache_free(&block_cache, block_buf);
     return 0; // Not found
 }
 
@@ -623,13 +627,13 @@ static int vrfs_unlink(struct inode *dir, const char *name)
         return -1; // Empty directory
 
     // Read directory block
-    uint8_t *block_buf = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *block_buf = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!block_buf)
         return -1;
 
     if (blkdev_read(sbi->bdev, dir_info->disk_inode.direct[0], block_buf) < 0)
     {
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
         return -1;
     }
 
@@ -665,7 +669,7 @@ static int vrfs_unlink(struct inode *dir, const char *name)
 
     if (found < 0)
     {
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
         return -1; // File not found
     }
 
@@ -677,11 +681,11 @@ static int vrfs_unlink(struct inode *dir, const char *name)
     // Write back directory block
     if (blkdev_write(sbi->bdev, dir_info->disk_inode.direct[0], block_buf) < 0)
     {
-        kfree(block_buf);
+        kmem_cache_free(&block_cache, block_buf);
         return -1;
     }
 
-    kfree(block_buf);
+    kmem_cache_free(&block_cache, block_buf);
 
     // TODO: Free the inode and its data blocks (for now, just leave them allocated)
 
@@ -711,13 +715,13 @@ struct superblock *vrfs_mount(struct block_device *bdev)
         return 0;
 
     // Read superblock
-    uint8_t *buffer = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    uint8_t *buffer = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!buffer)
         return 0;
 
     if (blkdev_read(bdev, 0, buffer) < 0)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -726,7 +730,7 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     // Verify magic
     if (sb_disk->magic != VRFS_MAGIC)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -734,7 +738,7 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     struct vrfs_sb_info *sbi = (struct vrfs_sb_info *)kmalloc(sizeof(struct vrfs_sb_info));
     if (!sbi)
     {
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -743,22 +747,22 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     sbi->bdev = bdev;
 
     // Allocate and read inode bitmap
-    sbi->inode_bitmap = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    sbi->inode_bitmap = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!sbi->inode_bitmap)
     {
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
     blkdev_read(bdev, sbi->sb.inode_bitmap_block, sbi->inode_bitmap);
 
     // Allocate and read block bitmap
-    sbi->block_bitmap = (uint8_t *)kmalloc(VRFS_BLOCK_SIZE);
+    sbi->block_bitmap = (uint8_t *)kmem_cache_alloc(&block_cache);
     if (!sbi->block_bitmap)
     {
-        kfree(sbi->inode_bitmap);
+        kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
     blkdev_read(bdev, sbi->sb.block_bitmap_block, sbi->block_bitmap);
@@ -767,10 +771,10 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     struct superblock *vfs_sb = (struct superblock *)kmalloc(sizeof(struct superblock));
     if (!vfs_sb)
     {
-        kfree(sbi->block_bitmap);
-        kfree(sbi->inode_bitmap);
+        kmem_cache_free(&block_cache, sbi->block_bitmap);
+        kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -779,14 +783,14 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     vfs_sb->private_data = sbi;
 
     // Create root inode
-    struct inode *root_inode = (struct inode *)kmalloc(sizeof(struct inode));
+    struct inode *root_inode = vfs_alloc_inode(vfs_sb);
     if (!root_inode)
     {
         kfree(vfs_sb);
-        kfree(sbi->block_bitmap);
-        kfree(sbi->inode_bitmap);
+        kmem_cache_free(&block_cache, sbi->block_bitmap);
+        kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -794,24 +798,24 @@ struct superblock *vrfs_mount(struct block_device *bdev)
     struct vrfs_inode_info *root_info = (struct vrfs_inode_info *)kmalloc(sizeof(struct vrfs_inode_info));
     if (!root_info)
     {
-        kfree(root_inode);
+        vfs_free_inode(root_inode);
         kfree(vfs_sb);
-        kfree(sbi->block_bitmap);
-        kfree(sbi->inode_bitmap);
+        kmem_cache_free(&block_cache, sbi->block_bitmap);
+        kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
     if (vrfs_read_inode(sbi, 0, &root_info->disk_inode) < 0)
     {
         kfree(root_info);
-        kfree(root_inode);
+        vfs_free_inode(root_inode);
         kfree(vfs_sb);
-        kfree(sbi->block_bitmap);
-        kfree(sbi->inode_bitmap);
+        kmem_cache_free(&block_cache, sbi->block_bitmap);
+        kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
-        kfree(buffer);
+        kmem_cache_free(&block_cache, buffer);
         return 0;
     }
 
@@ -828,7 +832,7 @@ struct superblock *vrfs_mount(struct block_device *bdev)
 
     vfs_sb->root_inode = root_inode;
 
-    kfree(buffer);
+    kmem_cache_free(&block_cache, buffer);
     return vfs_sb;
 }
 
@@ -842,14 +846,14 @@ int vrfs_unmount(struct superblock *sb)
     if (sbi)
     {
         if (sbi->block_bitmap)
-            kfree(sbi->block_bitmap);
+            kmem_cache_free(&block_cache, sbi->block_bitmap);
         if (sbi->inode_bitmap)
-            kfree(sbi->inode_bitmap);
+            kmem_cache_free(&block_cache, sbi->inode_bitmap);
         kfree(sbi);
     }
 
     if (sb->root_inode)
-        kfree(sb->root_inode);
+        vfs_free_inode(sb->root_inode);
 
     kfree(sb);
     return 0;
@@ -858,6 +862,6 @@ int vrfs_unmount(struct superblock *sb)
 // Initialize VRFS
 int vrfs_init(void)
 {
-    // Nothing to do for now
+    kmem_cache_init(&block_cache, "vrfs-block", VRFS_BLOCK_SIZE);
     return 0;
 }
@@ -0,0 +1,46 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// Local APIC and I/O APIC
+//
+// Once apic_enable() has run, ISA IRQ n arrives through the I/O APIC on
+// vector 32 + n at the BSP, exactly where the PIC delivered it, and is
+// acknowledged at the local APIC. The PIC is masked. irq_line_unmask(),
+// irq_line_eoi() and irq_line_pending() hide which controller is in use.
+
+#define LAPIC_TIMER_VECTOR 48
+#define RESCHED_VECTOR 49
+#define TLB_VECTOR 50
+#define SPURIOUS_VECTOR 0xFF
+
+// Interrupt Command Register delivery modes
+#define ICR_FIXED 0x00000000
+#define ICR_INIT 0x00000500
+#define ICR_STARTUP 0x00000600
+#define ICR_ASSERT 0x00004000
+#define ICR_LEVEL 0x00008000
+
+// MP table polarity/trigger for an I/O APIC pin
+#define IOAPIC_ACTIVE_LOW 0x1
+#define IOAPIC_LEVEL 0x2
+
+int lapic_init(uint32_t base);         // BSP: map and enable, calibrate the timer
+void lapic_init_ap(void);              // AP: enable, start the periodic tick
+void lapic_timer_enable(int on);       // AP tick on/off (idle)
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr); // Waits for delivery
+
+int ioapic_init(uint32_t base);                   // Map, mask every pin
+void ioapic_route_isa(uint8_t irq, uint32_t pin); // From an MP interrupt entry
+void ioapic_set_pin_flags(uint32_t pin, uint32_t flags);
+void apic_enable(uint32_t bsp_apic_id);           // Switch IRQ delivery from the PIC
+
+// Controller-independent IRQ line control
+void irq_line_unmask(uint8_t irq);
+void irq_line_eoi(uint8_t irq);
+int irq_line_pending(uint8_t irq); // Raised but not yet taken (interrupts disabled)
+
+#endif // APIC_H
@@ -10,6 +10,12 @@ struct driver_config
     void (*entry_point)(void); // 驱动入口函数
     int enabled;               // 是否启用 (1=启用, 0=禁用)
     const char *description;   // 描述信息
+
+    // 截止期调度（EDF，见 task_set_deadline）：每 rt_period_ms 毫秒最多运行
+    // rt_budget_ms 毫秒，优先于所有普通任务，中断唤醒后立即抢占。
+    // rt_budget_ms=0 表示普通优先级任务
+    uint32_t rt_budget_ms;
+    uint32_t rt_period_ms;
 };
 
 // 驱动配置表（在 driver_config.c 中定义）
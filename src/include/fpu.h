@@ -0,0 +1,52 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+struct task;
+
+// Lazy FPU/SSE context switching
+//
+// The FPU registers hold the state of one task, the owner. Switching to
+// any other task sets CR0.TS, so that task's first FPU/SSE instruction
+// raises #NM (exception 7); the handler saves the owner's state, loads
+// (or, on first use, initializes) the current task's and makes it the
+// owner. Tasks that never touch the FPU never get a state area and never
+// pay for a save or restore. State is saved with XSAVE when the CPU has
+// it, FXSAVE otherwise.
+//
+// Kernel code that wants SIMD (checksums, copies) brackets it with
+// fpu_kernel_begin()/fpu_kernel_end(), which park the owner's state and
+// keep interrupts off in between; it must not block there.
+//
+// Each CPU has its own owner (struct cpu); a task's registers can only be
+// live on the CPU it last ran on, so the scheduler does not migrate a
+// task while it is still the owner there.
+
+struct fpu_stats
+{
+    uint32_t mode;         // FPU_MODE_*
+    uint32_t state_size;   // Bytes per task state area
+    uint32_t traps;        // #NM exceptions taken
+    uint32_t saves;        // Owner states written back to memory
+    uint32_t restores;     // States loaded from memory
+    uint32_t first_uses;   // Tasks that got a fresh state
+    uint32_t states;       // State areas allocated
+};
+
+#define FPU_MODE_NONE 0    // No usable FPU: #NM halts as before
+#define FPU_MODE_FXSAVE 1
+#define FPU_MODE_XSAVE 2
+
+void fpu_init(void);                  // Detect features, enable SSE, set TS
+void fpu_init_cpu(void);              // Same setup on an application processor
+void fpu_switch(struct task *next);   // Context switch hook (interrupts disabled)
+void fpu_release(struct task *task);  // Task is gone: drop its state
+int fpu_handle_nm(void);              // #NM handler, 0 if handled
+
+uint32_t fpu_kernel_begin(void);    // Returns the flags for fpu_kernel_end()
+void fpu_kernel_end(uint32_t flags);
+
+void fpu_get_stats(struct fpu_stats *stats);
+
+#endif // FPU_H
@@ -25,6 +25,7 @@ struct idt_descriptor
 
 // Function declarations
 void idt_init(void);
+void idt_reload(void); // Load the IDT on another CPU
 void idt_set_gate(uint8_t num, uint32_t handler, uint16_t selector, uint8_t flags);
 
 #endif // IDT_H
@@ -2,6 +2,7 @@
 #define IPC_H
 
 #include <stdint.h>
+#include "wait.h"
 
 // IPC message structure
 #define IPC_MSG_MAX_SIZE 256
@@ -15,11 +16,52 @@ struct ipc_message
     char data[IPC_MSG_MAX_SIZE]; // Message data
 };
 
+// Page grants (zero-copy bulk transfer)
+// A grant moves whole pages of the IPC window from the sender to the
+// receiver instead of copying them through the port queue. The receiver
+// gets the message with IPC_TYPE_GRANT set in `type` and a struct
+// ipc_grant_desc in `data` describing where the pages were mapped.
+#define IPC_TYPE_GRANT 0x80000000
+#define IPC_GRANT_MAX_PAGES 1024 // 4MB per grant
+
+struct ipc_grant_desc
+{
+    uint32_t vaddr;  // Where the pages are mapped for the receiver
+    uint32_t npages; // Number of 4KB pages granted
+};
+
+// Queued message record in a port's ring (header + payload, 4-byte aligned)
+struct ipc_grant;
+struct ipc_record
+{
+    uint32_t len;            // Record length incl. padding, 0 = wrap marker
+    uint32_t enqueue_tsc;    // Low 32 bits of the TSC when queued
+    uint32_t sender_pid;
+    uint32_t sender_port;
+    uint32_t type;
+    uint32_t size;           // Payload size in bytes
+    struct ipc_grant *grant; // Non-NULL for page grants
+    char data[];
+};
+
+
 // IPC port structure
-#define IPC_MAX_PORTS 32
-#define IPC_PORT_QUEUE_SIZE 16
+// Ports are allocated on demand; the port table grows by doubling up to
+// IPC_MAX_PORTS. Each port queues up to `queue_depth` messages in a ring
+// sized for IPC_RECORD_AVG_DATA bytes of payload per message (a ring that
+// is out of bytes counts as full, like one that is out of messages).
+#define IPC_MAX_PORTS 1024         // Hard limit on port IDs
+#define IPC_PORT_TABLE_INITIAL 32  // Initial port table size
+#define IPC_PORT_QUEUE_SIZE 16     // Default queue depth (messages)
+#define IPC_PORT_QUEUE_MAX 1024    // Largest configurable queue depth
+#define IPC_RECORD_AVG_DATA 64     // Payload bytes budgeted per queued message
 #define IPC_PORT_NAME_MAX 32
 
+// Per-port histograms use log2 buckets: bucket 0 counts zeros, bucket k
+// counts values in [2^(k-1), 2^k - 1]
+#define IPC_LAT_BUCKETS 32   // Enqueue-to-dequeue latency in TSC cycles
+#define IPC_DEPTH_BUCKETS 12 // Queue depth after each enqueue (up to 1024)
+
 struct ipc_port
 {
     uint32_t port_id;             // Port ID
@@ -27,42 +69,152 @@ struct ipc_port
     int in_use;                   // Port is allocated
     char name[IPC_PORT_NAME_MAX]; // Port name (optional)
 
-    // Message queue
-    struct ipc_message queue[IPC_PORT_QUEUE_SIZE];
-    uint32_t queue_head;  // Next message to read
-    uint32_t queue_tail;  // Next position to write
+    // Message queue (ring of struct ipc_record)
+    uint8_t *ring;
+    uint32_t ring_size;   // Ring size in bytes
+    uint32_t ring_used;   // Bytes in use, including wrap padding
+    uint32_t queue_head;  // Offset of the next record to read
+    uint32_t queue_tail;  // Offset of the next record to write
     uint32_t queue_count; // Number of messages in queue
+    uint32_t queue_depth; // Maximum number of queued messages
 
     // Statistics
     uint32_t total_sent;     // Total messages sent to this port
     uint32_t total_received; // Total messages received
     uint32_t drops;          // Dropped messages (queue full)
+    uint32_t send_blocks;    // Times a sender blocked on a full queue
+    uint32_t recv_blocks;    // Times a receiver blocked on an empty queue
+    uint32_t notifications;  // ipc_notify() calls (IRQs delivered)
+    uint32_t lat_hist[IPC_LAT_BUCKETS];
+    uint32_t depth_hist[IPC_DEPTH_BUCKETS];
 
-    // Waiting process
-    struct task *waiting_task; // Task blocked on recv
+    // Notification word: bits ORed in by ipc_notify(), cleared by the
+    // owner in ipc_wait_notification()
+    volatile uint32_t notify_bits;
+
+    // Waiting tasks (FIFO)
+    struct wait_queue recv_waiters;   // Blocked in receive
+    struct wait_queue send_waiters;   // Blocked in ipc_send_wait()
+    struct wait_queue notify_waiters; // Blocked in ipc_wait_notification()
+
+    // Name registry
+    uint32_t generation;        // Port table slot generation when created
+    uint32_t name_hash;         // Hash of `name` (valid for named ports)
+    struct ipc_port *name_next; // Next port in the same hash bucket
+};
+
+// Cached name-to-port handle. Resolve once with ipc_lookup(); later calls
+// only check that the port still has the same generation.
+#define IPC_NAME_BUCKETS 64
+#define IPC_INVALID_PORT 0xFFFFFFFF
+
+struct ipc_handle
+{
+    uint32_t port_id;    // Cached port (IPC_INVALID_PORT until resolved)
+    uint32_t generation; // Port generation when it was resolved
+    const char *name;    // Service name to resolve
 };
 
+#define IPC_HANDLE_INIT(n) {IPC_INVALID_PORT, 0, (n)}
+
 // IPC system calls
 int ipc_create_port(void);                   // Create a new port, returns port_id
 int ipc_create_named_port(const char *name); // Create a named port
 int ipc_destroy_port(uint32_t port_id);      // Destroy a port
 int ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t size);
 int ipc_send_from_port(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size);
+int ipc_send_wait(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size); // Blocks while full
 int ipc_recv(uint32_t port_id, struct ipc_message *msg);     // Blocking receive
 int ipc_try_recv(uint32_t port_id, struct ipc_message *msg); // Non-blocking receive
 int ipc_find_port(const char *name);                         // Find port by name
+int ipc_lookup(struct ipc_handle *handle);                   // Resolve/revalidate a cached handle
+int ipc_set_queue_depth(uint32_t port_id, uint32_t depth);   // Resize an owned port's queue
+
+// Synchronous call/reply (direct handoff between client and server)
+#define IPC_NO_REPLY 0xFFFFFFFF // reply_port value for the first ipc_reply_wait()
+int ipc_call(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size,
+             struct ipc_message *reply);
+int ipc_reply_wait(uint32_t port_id, uint32_t reply_port, uint32_t type, const void *data, uint32_t size,
+                   struct ipc_message *msg);
+
+// Batched send/receive (one trap and one port lookup per batch)
+#define IPC_SEND_BLOCK 0x1 // ipc_sendv(): wait for room instead of stopping
+
+struct ipc_iovec
+{
+    uint32_t type;    // Message type
+    uint32_t size;    // Data size in bytes
+    const void *data; // Message data
+};
+
+int ipc_sendv(uint32_t src_port, uint32_t dest_port, const struct ipc_iovec *vec, uint32_t count, uint32_t flags);
+int ipc_recvv(uint32_t port_id, struct ipc_message *msgs, uint32_t max);
+
+// Notifications (bitmask signals, safe to raise from interrupt context)
+// Each port carries a word of pending bits next to its message queue.
+// Raising bits never allocates or fails on a full queue: repeated
+// notifications before the owner wakes up coalesce into one.
+int ipc_notify(uint32_t port_id, uint32_t bits);                  // OR bits in, wake the owner
+int ipc_wait_notification(uint32_t port_id, uint32_t *bits);      // Block until non-zero, fetch and clear
+int ipc_poll_notification(uint32_t port_id, uint32_t *bits);      // Fetch and clear without blocking
+
+// Readiness wait across several owned ports. A port is ready when it has
+// a queued message or pending notification bits; nothing is consumed.
+// Returns the number of ready ports (bit i of `*ready` set for ports[i]),
+// 0 on timeout, -1 on error. `timeout` is in timer ticks (timer.h).
+#define IPC_WAIT_ANY_MAX 16
+#define IPC_WAIT_FOREVER 0xFFFFFFFF
+
+int ipc_wait_any(const uint32_t *ports, uint32_t count, uint32_t timeout, uint32_t *ready);
+
+// Page grants
+struct task;
+void *ipc_buf_alloc(uint32_t npages);                        // Allocate pages in the IPC window
+int ipc_buf_free(void *vaddr, uint32_t npages);              // Release window pages
+void ipc_release_task(struct task *task);                    // Free the window pages of a dead (or exec'ing) task
+int ipc_send_grant(uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages);
+int ipc_send_grant_from_port(uint32_t src_port, uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages);
 
 // Statistics
 struct ipc_stats
 {
-    uint32_t total_ports;    // Total ports created
+    uint32_t total_ports;    // Port table size (valid port IDs are below this)
     uint32_t active_ports;   // Currently active ports
     uint32_t total_messages; // Total messages sent
-    uint32_t blocked_tasks;  // Tasks blocked on recv
+    uint32_t blocked_tasks;  // Tasks blocked on send or recv
+    uint32_t total_drops;    // Messages dropped on full queues
+    uint32_t total_blocks;   // Times a sender or receiver blocked
 };
 
 void ipc_get_stats(struct ipc_stats *stats);
 
+// Upper bound of the bucket holding the `pct`th percentile (0 if empty)
+uint32_t ipc_hist_percentile(const uint32_t *hist, uint32_t buckets, uint32_t pct);
+
+// Trace ring: the last IPC_TRACE_SIZE IPC events, overwritten in a
+// circle. Writers claim slots with an atomic increment and never wait.
+#define IPC_TRACE_SIZE 256 // Power of two
+
+#define IPC_TRACE_SEND 1   // Message queued (arg: payload size)
+#define IPC_TRACE_RECV 2   // Message dequeued (arg: cycles spent queued)
+#define IPC_TRACE_CALL 3   // ipc_call() entered (port: destination, arg: type)
+#define IPC_TRACE_REPLY 4  // ipc_reply_wait() sent a reply (port: reply port, arg: type)
+#define IPC_TRACE_DROP 5   // Message dropped on a full queue (arg: size)
+#define IPC_TRACE_NOTIFY 6 // Notification bits raised (arg: bits)
+
+struct ipc_trace_event
+{
+    uint64_t tsc;
+    uint32_t seq;   // Event number + 1, written last (0 = slot unused)
+    uint32_t event; // IPC_TRACE_*
+    uint32_t port;
+    uint32_t pid;   // Task that caused the event
+    uint32_t arg;
+};
+
+// Copy up to `max` of the most recent events, oldest first; returns count
+uint32_t ipc_trace_read(struct ipc_trace_event *events, uint32_t max);
+
 // Internal functions
 void ipc_init(void);
 struct ipc_port *ipc_get_port(uint32_t port_id);
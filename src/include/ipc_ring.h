@@ -0,0 +1,178 @@
+#ifndef IPC_RING_H
+#define IPC_RING_H
+
+#include <stdint.h>
+
+// Single-producer/single-consumer ring in shared pages
+//
+// The producer allocates the pages (ipc_buf_alloc), calls ipc_ring_init()
+// and sends the consumer an IPC_RING_TYPE_SETUP message carrying a struct
+// ipc_ring_desc. After that, records move through the ring without any
+// syscall. ipc_ring_put() returns 1 when the consumer had drained the ring
+// and may be asleep: the producer then sends one IPC_RING_TYPE_DOORBELL
+// message. The consumer drains the ring until ipc_ring_idle() says it is
+// really empty and then blocks on its port until the next doorbell.
+//
+// Layout: one control page (producer and consumer indices on separate
+// cache lines) followed by a power-of-two data area. Indices are
+// free-running byte counters; records are 8-byte aligned and never split
+// across the end of the data area (a wrap marker skips the tail end).
+
+#define IPC_RING_CTRL_SIZE 4096
+#define IPC_RING_MAGIC 0x52494E47 // "RING"
+#define IPC_RING_WRAP 0xFFFFFFFF  // Record length: continue at offset 0
+
+// Message types used for the handshake (outside the range services use)
+#define IPC_RING_TYPE_SETUP 0x7FFF0001    // data: struct ipc_ring_desc
+#define IPC_RING_TYPE_DOORBELL 0x7FFF0002 // Ring went from empty to non-empty
+
+struct ipc_ring_desc
+{
+    uint32_t vaddr;  // Ring base (control page)
+    uint32_t npages; // Control page + data pages
+};
+
+struct ipc_ring_ctrl
+{
+    volatile uint32_t tail; // Written by the producer only
+    uint32_t pad0[15];
+    volatile uint32_t head; // Written by the consumer only
+    uint32_t pad1[15];
+    uint32_t data_size; // Bytes in the data area (power of two)
+    uint32_t magic;
+};
+
+struct ipc_ring_rec
+{
+    uint32_t len;  // Payload length in bytes (IPC_RING_WRAP for the marker)
+    uint32_t type; // Record type (service-defined)
+    uint8_t data[];
+};
+
+// Compiler barrier (x86 keeps stores in order and loads in order)
+static inline void ipc_ring_barrier(void)
+{
+    __asm__ volatile("" : : : "memory");
+}
+
+// Full barrier: orders our index store before reading the other side's
+static inline void ipc_ring_mb(void)
+{
+    __asm__ volatile("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+static inline uint8_t *ipc_ring_data(struct ipc_ring_ctrl *ring)
+{
+    return (uint8_t *)ring + IPC_RING_CTRL_SIZE;
+}
+
+static inline uint32_t ipc_ring_rec_size(uint32_t len)
+{
+    return (sizeof(struct ipc_ring_rec) + len + 7) & ~7u;
+}
+
+// Producer: set up a ring over `npages` pages (control page + data pages,
+// the data area is rounded down to a power of two)
+static inline struct ipc_ring_ctrl *ipc_ring_init(void *base, uint32_t npages)
+{
+    if (!base || npages < 2)
+        return 0;
+
+    uint32_t data_pages = 1;
+    while (data_pages * 2 <= npages - 1)
+        data_pages *= 2;
+
+    struct ipc_ring_ctrl *ring = (struct ipc_ring_ctrl *)base;
+    ring->tail = 0;
+    ring->head = 0;
+    ring->data_size = data_pages * 4096;
+    ring->magic = IPC_RING_MAGIC;
+    return ring;
+}
+
+// Consumer: validate a ring received in an IPC_RING_TYPE_SETUP message
+static inline struct ipc_ring_ctrl *ipc_ring_attach(const struct ipc_ring_desc *desc)
+{
+    struct ipc_ring_ctrl *ring = (struct ipc_ring_ctrl *)desc->vaddr;
+    if (!ring || desc->npages < 2 || ring->magic != IPC_RING_MAGIC)
+        return 0;
+    if ((ring->data_size & (ring->data_size - 1)) != 0 ||
+        ring->data_size > (desc->npages - 1) * 4096)
+        return 0;
+    return ring;
+}
+
+// Producer: copy one record into the ring.
+// Returns 1 if the consumer needs a doorbell, 0 if not, -1 if it does not fit.
+static inline int ipc_ring_put(struct ipc_ring_ctrl *ring, uint32_t type, const void *data, uint32_t len)
+{
+    uint32_t size = ring->data_size;
+    uint32_t need = ipc_ring_rec_size(len);
+    if (need > size / 2)
+        return -1; // Too large to ever fit after a wrap
+
+    uint32_t old_tail = ring->tail;
+    uint32_t tail = old_tail;
+    uint32_t off = tail & (size - 1);
+    uint32_t pad = size - off < need ? size - off : 0;
+    if ((tail - ring->head) + pad + need > size)
+        return -1; // Full
+
+    uint8_t *area = ipc_ring_data(ring);
+    if (pad)
+    {
+        ((struct ipc_ring_rec *)(area + off))->len = IPC_RING_WRAP;
+        tail += pad;
+        off = 0;
+    }
+
+    struct ipc_ring_rec *rec = (struct ipc_ring_rec *)(area + off);
+    rec->len = len;
+    rec->type = type;
+    for (uint32_t i = 0; i < len; i++)
+        rec->data[i] = ((const uint8_t *)data)[i];
+
+    // Publish the record, then check whether the consumer had drained the
+    // ring before it (it may be asleep waiting for a doorbell)
+    ipc_ring_barrier();
+    ring->tail = tail + need;
+    ipc_ring_mb();
+    return ring->head == old_tail ? 1 : 0;
+}
+
+// Consumer: next record, or 0 when the ring is empty
+static inline struct ipc_ring_rec *ipc_ring_peek(struct ipc_ring_ctrl *ring)
+{
+    uint32_t head = ring->head;
+    if (head == ring->tail)
+        return 0;
+    ipc_ring_barrier();
+
+    uint32_t size = ring->data_size;
+    uint32_t off = head & (size - 1);
+    struct ipc_ring_rec *rec = (struct ipc_ring_rec *)(ipc_ring_data(ring) + off);
+    if (rec->len == IPC_RING_WRAP)
+    {
+        // The producer always writes a record right after a wrap marker
+        ring->head = head + (size - off);
+        rec = (struct ipc_ring_rec *)ipc_ring_data(ring);
+    }
+    return rec;
+}
+
+// Consumer: release the record returned by ipc_ring_peek()
+static inline void ipc_ring_pop(struct ipc_ring_ctrl *ring, struct ipc_ring_rec *rec)
+{
+    ipc_ring_barrier();
+    ring->head += ipc_ring_rec_size(rec->len);
+}
+
+// Consumer: check before sleeping. Returns 1 if the ring is empty, in
+// which case any later put will ring the doorbell.
+static inline int ipc_ring_idle(struct ipc_ring_ctrl *ring)
+{
+    ipc_ring_mb();
+    return ring->head == ring->tail;
+}
+
+#endif // IPC_RING_H
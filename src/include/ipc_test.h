@@ -3,5 +3,9 @@
 
 void ipc_test_start(void);
 void ipc_test_stop(void);
+void ipc_bench_start(void);
+void ipc_pingpong_start(void);
+void ipc_batch_start(void);
+void ipc_ring_bench_start(void);
 
 #endif // IPC_TEST_H
@@ -3,20 +3,18 @@
 
 #include <stdint.h>
 
+struct task;
+
 // IRQ 到 IPC 桥接
 // 允许用户空间进程通过 IPC 接收硬件中断通知
+//
+// 中断以通知位的形式投递：IRQ n 发生时，把 IRQ_NOTIFY_BIT(n) 按位或进
+// 注册端口的通知字（见 ipc_notify）。驱动用 ipc_wait_notification 阻塞，
+// 醒来后一次取走并清零所有待处理位。多次中断在驱动处理前会合并为一位，
+// 不分配内存，也不会因为消息队列满而丢失。
 
-// IRQ 消息类型
-#define IPC_MSG_IRQ 0x1000
-
-// IRQ 消息结构
-struct irq_message
-{
-    uint32_t type;      // IPC_MSG_IRQ
-    uint8_t irq_number; // IRQ 号 (0-15)
-    uint8_t reserved[3];
-    uint32_t timestamp; // 中断发生的时间戳
-};
+// IRQ 对应的通知位
+#define IRQ_NOTIFY_BIT(irq) (1u << (irq))
 
 // 初始化 IRQ 桥接系统
 void irq_bridge_init(void);
@@ -33,4 +31,21 @@ int irq_bridge_unregister(uint8_t irq);
 // 在 IRQ 发生时调用（从内核 IRQ 处理器调用）
 void irq_bridge_notify(uint8_t irq);
 
+// 中断到驱动运行的延迟
+// irq_bridge_notify 唤醒阻塞中的驱动任务时记下 TSC，调度器切换到该任务
+// 时调用 irq_bridge_account 记入直方图（log2 分桶，单位 TSC 周期，
+// 与 IPC 延迟直方图相同，可用 ipc_hist_percentile 求百分位）
+#define IRQ_LAT_BUCKETS 32
+
+struct irq_latency_stats
+{
+    uint32_t hist[IRQ_LAT_BUCKETS]; // 各桶样本数
+    uint32_t samples;               // 样本总数
+    uint32_t max_cycles;            // 最大延迟
+};
+
+void irq_bridge_account(struct task *task); // 调度器：被中断唤醒的任务开始运行
+void irq_bridge_get_latency(struct irq_latency_stats *stats);
+void irq_bridge_reset_latency(void);
+
 #endif // IRQ_BRIDGE_H
@@ -55,6 +55,12 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+// Local APIC vectors (48-50, 255; see apic.h)
+extern void irq16(void);
+extern void irq17(void);
+extern void irq18(void);
+extern void irq_spurious(void);
+
 // Registers struct
 struct registers
 {
@@ -64,6 +70,26 @@ struct registers
     uint32_t eip, cs, eflags, useresp, ss;
 };
 
+// Disable interrupts and return the previous EFLAGS
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    __asm__ volatile("pushf\n"
+                     "pop %0\n"
+                     "cli"
+                     : "=r"(flags)
+                     :
+                     : "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & 0x200)
+        __asm__ volatile("sti" : : : "memory");
+}
+
 // Function to install ISRs
 void isr_install(void);
 
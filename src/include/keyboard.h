@@ -23,6 +23,7 @@ void keyboard_init(void);
 void keyboard_handler(void);
 int keyboard_buffer_empty(void);
 char keyboard_getchar(void);
+int keyboard_read(char *buf, int count); // Blocks until input is available
 void keyboard_enable_shell(void);
 
 #endif // KEYBOARD_H
@@ -12,10 +12,37 @@ struct heap_block
     struct heap_block *next; // Next block in the list
 };
 
+// Requests up to KMALLOC_MAX_SMALL bytes are served from power-of-two
+// size classes (slab caches, O(1)); larger ones from the first-fit heap.
+// kfree() takes either, and objects of any kmem_cache.
+#define KMALLOC_MIN_SHIFT 4  // 16 bytes
+#define KMALLOC_MAX_SHIFT 11 // 2048 bytes
+#define KMALLOC_MAX_SMALL (1u << KMALLOC_MAX_SHIFT)
+
+// The first-fit heap grows on demand inside KHEAP_BASE..+KHEAP_MAX
+// (paging.h), mapping frames from the PMM
+struct kmalloc_heap_stats
+{
+    uint32_t size;          // Bytes mapped now
+    uint32_t peak_size;     // High-water mark of size
+    uint32_t max_size;      // Reserved virtual range
+    uint32_t used;          // Bytes in allocated blocks, headers included
+    uint32_t peak_used;     // High-water mark of used
+    uint32_t grows;         // Times more frames were mapped
+    uint32_t trims;         // Times a free top went back to the PMM
+    uint32_t trimmed_pages; // Pages returned by those trims
+};
+
 // Function declarations
-void kmalloc_init(void *start, uint32_t size);
+void kmalloc_init(void);
 void *kmalloc(size_t size);
 void kfree(void *ptr);
-void kmalloc_stats(uint32_t *total, uint32_t *used, uint32_t *free);
+void kmalloc_stats(uint32_t *total, uint32_t *used, uint32_t *free); // First-fit heap
+void kmalloc_get_heap_stats(struct kmalloc_heap_stats *stats);
+void kmalloc_trim(void); // Idle loop only: interrupts on, no locks held
+
+void *kmalloc_heap(size_t size); // First-fit heap only, whatever the size
+void kmalloc_heap_frag(uint32_t *free_blocks, uint32_t *largest_free);
+void kmalloc_small_stats(uint32_t *pages, uint32_t *used); // Size classes: pages held, bytes handed out
 
 #endif // KMALLOC_H
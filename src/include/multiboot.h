@@ -18,7 +18,11 @@ struct multiboot_info
     uint32_t mmap_addr;
 } __attribute__((packed));
 
-// Memory map entry
+// multiboot_info.flags
+#define MULTIBOOT_INFO_MEMORY 0x001  // mem_lower, mem_upper
+#define MULTIBOOT_INFO_MEM_MAP 0x040 // mmap_length, mmap_addr
+
+// Memory map entry; `size` does not count itself
 struct multiboot_mmap_entry
 {
     uint32_t size;
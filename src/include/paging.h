@@ -14,8 +14,55 @@
 #define PAGE_PRESENT 0x01
 #define PAGE_WRITE 0x02
 #define PAGE_USER 0x04
+#define PAGE_WRITE_THROUGH 0x08
+#define PAGE_CACHE_DISABLE 0x10 // Device registers (APIC)
 #define PAGE_ACCESSED 0x20
 #define PAGE_DIRTY 0x40
+#define PAGE_COW 0x200 // Available bit: shared read-only until written
+
+// IPC grant window: the top 16MB of user space. Each page directory has
+// window tables of its own, and a window page is mapped only in the
+// directory of the task holding it; clones leave the window out.
+#define IPC_WINDOW_BASE 0xBF000000
+#define IPC_WINDOW_SIZE (16 * 1024 * 1024) // 16MB = 4096 pages
+#define IPC_WINDOW_PAGES (IPC_WINDOW_SIZE / PAGE_SIZE)
+
+// Kernel heap: kmalloc maps frames here as it grows. Its page tables are
+// preallocated and shared by every page directory (entries >= 768).
+#define KHEAP_BASE 0xE1000000
+#define KHEAP_MAX (64 * 1024 * 1024) // 64MB = 16 page tables
+
+// Boot identity map of the low 16MB: kernel image, VGA, AP trampoline.
+// Every page directory shares these tables with the kernel's.
+#define IDENTITY_MAP_SIZE (16 * 1024 * 1024)
+#define IDENTITY_MAP_TABLES (IDENTITY_MAP_SIZE / (PAGES_PER_TABLE * PAGE_SIZE))
+
+// Direct map: physical memory from 0 up to PHYS_MAP_MAX appears at
+// PHYS_MAP_BASE, so the kernel can reach any low frame (page tables, slab
+// pages) by address. Frames above it are highmem, see paging_kmap().
+#define PHYS_MAP_BASE 0xC0000000
+#define PHYS_MAP_MAX (512 * 1024 * 1024) // Up to 0xE0000000
+
+// Per-CPU slots for temporary mappings of highmem frames
+#define KMAP_BASE (KHEAP_BASE + KHEAP_MAX)
+#define KMAP_SLOTS 2 // Per CPU
+
+// Directory entries shared with the kernel directory rather than copied
+#define PDE_KERNEL(i) ((i) < IDENTITY_MAP_TABLES || (i) >= 768)
+
+// Directory entries of the IPC window
+#define PDE_IPC_WINDOW(i) ((uint32_t)(i) >= (IPC_WINDOW_BASE >> 22) && (uint32_t)(i) < ((IPC_WINDOW_BASE + IPC_WINDOW_SIZE) >> 22))
+
+// Direct map address of a low frame, and back
+static inline void *phys_to_virt(const void *phys)
+{
+    return (void *)((uint32_t)phys + PHYS_MAP_BASE);
+}
+
+static inline void *virt_to_phys(const void *virt)
+{
+    return (void *)((uint32_t)virt - PHYS_MAP_BASE);
+}
 
 // Page table entry
 typedef uint32_t pt_entry;
@@ -39,11 +86,24 @@ typedef struct page_directory
 void paging_init(void);
 void paging_map_page(void *phys, void *virt, uint32_t flags);
 void paging_unmap_page(void *virt);
+void *paging_unmap_page_get(void *virt); // Unmap and return the physical frame
+void *paging_unmap_page_get_in(page_directory *dir, void *virt);
 void *paging_get_physical_address(void *virt);
 void paging_enable(void);
 page_directory *paging_get_kernel_directory(void);
-page_directory *paging_clone_directory(page_directory *src);
+page_directory *paging_create_directory(void); // Empty user space
+page_directory *paging_clone_directory(page_directory *src); // Copy-on-write
+page_directory *paging_copy_directory(page_directory *src);  // Copies every page now
 void paging_free_directory(page_directory *dir);
+void paging_map_page_in(page_directory *dir, void *phys, void *virt, uint32_t flags);
+int paging_cow_break(page_directory *dir, void *virt);
+int paging_handle_fault(uint32_t err_code); // #PF hook, 0 if handled
 void paging_switch_directory(page_directory *dir);
 
+// Map a frame for the kernel to touch: the direct map for low frames,
+// otherwise this CPU's `slot`, valid until paging_kunmap(slot). Keep
+// interrupts disabled in between.
+void *paging_kmap(void *phys, uint32_t slot);
+void paging_kunmap(uint32_t slot);
+
 #endif // PAGING_H
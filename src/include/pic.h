@@ -22,6 +22,7 @@
 // Function declarations
 void pic_init(void);
 void pic_send_eoi(uint8_t irq);
+void pic_unmask(uint8_t irq);
 void irq_install(void);
 
 #endif // PIC_H
@@ -6,16 +6,33 @@
 // Page size (4KB)
 #define PAGE_SIZE 4096
 
+// Largest buddy block: 2^10 frames = 4MB
+#define PMM_MAX_ORDER 10
+
+// Zones: low frames are in the kernel's direct map (PHYS_MAP_MAX), high
+// ones can only be used through a mapping (user pages, IPC buffers)
+#define PMM_ZONE_NORMAL 0
+#define PMM_ZONE_HIGH 1
+#define PMM_ZONES 2
+
 // Convert address to page index
 #define ADDR_TO_PAGE(addr) ((addr) / PAGE_SIZE)
 #define PAGE_TO_ADDR(page) ((page) * PAGE_SIZE)
 
 // Function declarations
-void pmm_init(uint32_t mem_size);
+uint32_t pmm_meta_size(uint32_t mem_size); // Frame table bytes for `mem_size`, page aligned
+uint32_t pmm_init(uint32_t mem_size, uint32_t meta); // Frame tables at `meta`, returns their end
 void pmm_init_region(uint32_t base, uint32_t size);
 void pmm_deinit_region(uint32_t base, uint32_t size);
-void *pmm_alloc_block(void);
+void *pmm_alloc_block(void); // One low frame: pmm_alloc_pages(0)
+void *pmm_alloc_high_block(void); // One frame, highmem first
 void pmm_free_block(void *addr);
+void *pmm_alloc_pages(uint32_t order); // 2^order contiguous low frames, aligned to their size
+void pmm_free_pages(void *addr, uint32_t order); // The whole block, same order
+void pmm_ref_block(void *addr); // Shared mapping: pmm_free_block() drops one reference
+uint32_t pmm_get_refs(void *addr);
+void pmm_get_free_counts(uint32_t zone, uint32_t *counts); // Free blocks per order, PMM_MAX_ORDER + 1 entries
+uint32_t pmm_get_zone_blocks(uint32_t zone); // Frames the zone manages
 uint32_t pmm_get_memory_size(void);
 uint32_t pmm_get_used_blocks(void);
 uint32_t pmm_get_free_blocks(void);
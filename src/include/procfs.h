@@ -9,6 +9,10 @@ typedef enum
     PROCFS_UPTIME,
     PROCFS_MEMINFO,
     PROCFS_TASKS,
+    PROCFS_IPC,
+    PROCFS_IPCTRACE,
+    PROCFS_SCHED,
+    PROCFS_BUDDYINFO,
 } procfs_file_type_t;
 
 // procfs node
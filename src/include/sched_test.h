@@ -4,5 +4,14 @@
 // Scheduler test functions
 void sched_test_create_tasks(void);
 void sched_test_stop_tasks(void);
+void sched_bench_start(void);  // Pick-next latency at 1, 32 and 1000 tasks
+void sched_stress_start(void); // Create and reap 10,000 tasks
+void sched_fpu_test_start(void); // SSE registers survive lazy FPU switching
+void sched_smp_bench_start(void); // CPU-bound work split across 1-4 tasks
+void sched_blk_bench_start(void); // blkdev IPC reads with placement hints on/off
+void sched_sys_bench_start(void); // Null system call: int $0x80 vs fast entry
+void sched_heap_bench_start(void); // kmalloc size classes vs the first-fit heap
+void sched_pmm_bench_start(void); // Buddy allocator throughput per order, fragmentation
+void sched_fork_bench_start(void); // Copying vs copy-on-write fork at 1MB and 16MB resident
 
 #endif // SCHED_TEST_H
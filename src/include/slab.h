@@ -0,0 +1,35 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+// Object cache: fixed-size objects carved out of whole low pages taken
+// from the PMM and reached through the direct map at PHYS_MAP_BASE
+// (phys_to_virt). Freed objects go on the cache's
+// free list and are handed out again before another page is taken; pages
+// stay with the cache once carved, and each page remembers its cache so
+// kmem_cache_of() can find the owner of any object.
+
+struct kmem_cache
+{
+    const char *name;
+    uint32_t obj_size;   // Rounded up to 4 bytes, at most one page
+    void *free_list;     // Free objects, linked through their first word
+    uint32_t pages;      // Pages taken from the PMM
+    uint32_t total;      // Objects carved
+    uint32_t in_use;     // Objects handed out
+    uint32_t id;         // Registry slot + 1 (0 = not registered)
+    spinlock_t lock;     // Free list and counters
+};
+
+#define KMEM_CACHE_MAX 32 // Registered caches
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, uint32_t obj_size);
+void *kmem_cache_alloc(struct kmem_cache *cache); // NULL when out of pages
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+struct kmem_cache *kmem_cache_of(const void *obj); // NULL if not from a cache page
+struct kmem_cache *kmem_cache_iterate(uint32_t *pos); // Next registered cache (start at 0)
+
+#endif // SLAB_H
@@ -0,0 +1,94 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "task.h"
+#include "spinlock.h"
+
+// Symmetric multiprocessing
+//
+// smp_init() reads the MP configuration table left by the BIOS, switches
+// interrupt delivery from the 8259 PIC to the local APIC and I/O APIC and
+// starts every application processor (AP) through a real-mode trampoline
+// copied to AP_TRAMPOLINE_ADDR (INIT, then two STARTUP IPIs). Each CPU gets
+// its own TSS, idle task and run queue; the bootstrap processor (BSP)
+// keeps the PIT for timekeeping and the APs take their scheduler tick
+// from the local APIC timer. Without an MP table the kernel stays on the
+// PIC with one CPU.
+//
+// The GDT is rebuilt here with one TSS descriptor per CPU. The task
+// register doubles as the CPU number: this_cpu() is one `str`.
+
+#define MAX_CPUS 8
+#define AP_TRAMPOLINE_ADDR 0x7000 // Page below 1MB, SIPI vector 0x07
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS_FIRST 5 // GDT index of CPU 0's TSS
+#define GDT_ENTRIES (GDT_TSS_FIRST + MAX_CPUS)
+
+// 32-bit task state segment: only ss0/esp0 are used (ring 3 -> 0 stack)
+struct tss
+{
+    uint32_t prev_task;
+    uint32_t esp0, ss0;
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap, iomap_base;
+} __attribute__((packed));
+
+struct cpu
+{
+    uint32_t index;          // Position in cpus[]
+    uint32_t apic_id;        // Local APIC ID
+    volatile int online;     // Set by the CPU itself once it can schedule
+    int tick_stopped;        // AP idle with its local APIC timer masked
+
+    // Scheduler state, under rq_lock
+    spinlock_t rq_lock;
+    struct run_queue rq;
+    struct task *current;    // Running task
+    struct task *idle;       // Runs when rq is empty, never queued
+    struct task *prev;       // Task being switched away from
+    int need_resched;        // A task woken here should preempt current
+    volatile int tlb_flush;  // Set by smp_flush_tlb_all(), cleared when done
+
+    struct task *fpu_owner;  // Task whose FPU state is in the registers
+
+    // Statistics
+    uint32_t ticks;          // Scheduler ticks taken
+    uint32_t busy_ticks;     // Of which a task other than idle was running
+    uint32_t switches;       // Context switches
+    uint32_t resched_ipis;   // Reschedule IPIs received
+    uint32_t steals;         // Tasks pulled from other CPUs' queues
+    uint64_t switch_tsc;     // Switch in progress since (0 = none)
+    uint32_t switch_hist[SCHED_LAT_BUCKETS]; // See task_get_switch_hist()
+
+    struct tss tss;
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern uint32_t cpu_count; // CPUs online (1 until smp_init)
+
+// The CPU we are running on. Callers that use the result for more than a
+// statistic keep interrupts disabled, or a preemption could move them.
+static inline struct cpu *this_cpu(void)
+{
+    uint32_t tr;
+    __asm__ volatile("str %0" : "=r"(tr));
+    return &cpus[tr ? (tr >> 3) - GDT_TSS_FIRST : 0];
+}
+
+void smp_init(void);                  // BSP: APIC setup and AP startup
+void smp_send_resched(struct cpu *cpu); // Ask `cpu` to run its scheduler
+int smp_apic_enabled(void);           // Interrupts come through the APICs
+
+// Flush the TLB of every online CPU and wait until they have. Call with
+// no spinlock held: a CPU spinning on it with interrupts off cannot answer.
+void smp_flush_tlb_all(void);
+
+#endif // SMP_H
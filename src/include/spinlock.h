@@ -0,0 +1,65 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "isr.h"
+
+// Test-and-test-and-set spinlock. Locks taken from both task and
+// interrupt context must use the _irqsave variants, otherwise an
+// interrupt on the same CPU could spin on a lock its own CPU holds.
+// On a single CPU the lock is never contended and costs one xchg.
+
+typedef struct
+{
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline void spin_init(spinlock_t *lock)
+{
+    lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    uint32_t v = 1;
+    while (1)
+    {
+        __asm__ volatile("xchg %0, %1" : "+r"(v), "+m"(lock->locked) : : "memory");
+        if (v == 0)
+            return;
+        while (lock->locked)
+            __asm__ volatile("pause" : : : "memory");
+        v = 1;
+    }
+}
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+    uint32_t v = 1;
+    __asm__ volatile("xchg %0, %1" : "+r"(v), "+m"(lock->locked) : : "memory");
+    return v == 0;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    // x86 does not reorder stores with older loads or stores
+    __asm__ volatile("" : : : "memory");
+    lock->locked = 0;
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
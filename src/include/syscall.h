@@ -15,16 +15,41 @@
 #define SYS_IPC_CREATE_PORT 8
 #define SYS_IPC_DESTROY_PORT 9
 #define SYS_IPC_SEND 10
+#define SYS_IPC_SEND_GRANT 17 // Zero-copy page grant (see ipc.h)
+#define SYS_IPC_BUF_ALLOC 18
+#define SYS_IPC_BUF_FREE 19
 #define SYS_IPC_RECV 11
 #define SYS_IPC_CREATE_NAMED_PORT 12
 #define SYS_IPC_FIND_PORT 13
 #define SYS_IPC_TRY_RECV 14
 #define SYS_REQUEST_IO_PORT 15
 #define SYS_REGISTER_IRQ_HANDLER 16
+#define SYS_IPC_CALL 20       // Synchronous send + wait for reply
+#define SYS_IPC_REPLY_WAIT 21 // Reply to caller + wait for next request
+#define SYS_IPC_LOOKUP 22     // Resolve/revalidate a struct ipc_handle
+#define SYS_IPC_SET_QUEUE_DEPTH 23
+#define SYS_IPC_SEND_WAIT 24  // Send, blocking while the queue is full
+#define SYS_IPC_SENDV 25      // Send a vector of messages
+#define SYS_IPC_RECVV 26      // Receive up to N messages
+#define SYS_IPC_WAIT_NOTIFICATION 27 // Block until notification bits are set
+#define SYS_IPC_NOTIFY 28            // OR notification bits into a port
+#define SYS_IPC_POLL_NOTIFICATION 29 // Fetch and clear notification bits
+#define SYS_IPC_WAIT_ANY 30          // Wait for readiness on several ports
+#define SYS_NULL 31                  // Does nothing (entry/exit cost)
 
 // Maximum number of system calls
 #define SYSCALL_MAX 256
 
+// Fast entry. The kernel maps a small stub page (like a vDSO) at
+// VSYSCALL_ADDR. Calling it with the int $0x80 registers (EAX = number,
+// EBX, ECX, EDX, ESI, EDI = arguments) makes the system call through the
+// cheapest entry for the caller: SYSENTER/SYSEXIT from ring 3 (int $0x80
+// on CPUs without them) and a direct call from ring 0. Only EAX, the
+// result, is changed. In inline assembly use VSYSCALL in place of
+// "int $0x80".
+#define VSYSCALL_ADDR 0xFFFFE000
+#define VSYSCALL "call 0xFFFFE000"
+
 // System call handler type
 typedef int (*syscall_handler_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 
@@ -33,11 +58,14 @@ struct registers;
 
 // Function declarations
 void syscall_init(void);
+void syscall_init_cpu(void);   // SYSENTER MSRs, on every CPU
+int syscall_sysenter_ok(void); // The CPU supports SYSENTER/SYSEXIT
 void syscall_handler(struct registers *regs);
 int sys_exit(int status);
 int sys_write(int fd, const char *buf, int count);
 int sys_read(int fd, char *buf, int count);
 int sys_getpid(void);
+int sys_null(void);
 int sys_yield(void);
 int sys_fork(struct registers *regs);
 int sys_waitpid(int pid, int *status);
@@ -46,9 +74,23 @@ int sys_ipc_create_port(void);
 int sys_ipc_create_named_port(const char *name);
 int sys_ipc_destroy_port(uint32_t port_id);
 int sys_ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t size);
+int sys_ipc_send_grant(uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages);
+int sys_ipc_buf_alloc(uint32_t npages);
+int sys_ipc_buf_free(void *vaddr, uint32_t npages);
 int sys_ipc_recv(uint32_t port_id, void *msg);
 int sys_ipc_try_recv(uint32_t port_id, void *msg);
 int sys_ipc_find_port(const char *name);
+int sys_ipc_call(uint32_t src_port, uint32_t dest_port, const void *req, void *reply);
+int sys_ipc_lookup(void *handle);
+int sys_ipc_send_wait(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size);
+int sys_ipc_sendv(uint32_t src_port, uint32_t dest_port, const void *vec, uint32_t count, uint32_t flags);
+int sys_ipc_recvv(uint32_t port_id, void *msgs, uint32_t max);
+int sys_ipc_set_queue_depth(uint32_t port_id, uint32_t depth);
+int sys_ipc_wait_notification(uint32_t port_id, uint32_t *bits);
+int sys_ipc_notify(uint32_t port_id, uint32_t bits);
+int sys_ipc_poll_notification(uint32_t port_id, uint32_t *bits);
+int sys_ipc_wait_any(const uint32_t *ports, uint32_t count, uint32_t timeout, uint32_t *ready);
+int sys_ipc_reply_wait(uint32_t port_id, uint32_t reply_port, const void *reply, void *msg);
 int sys_request_io_port(uint16_t port_start, uint16_t port_end);
 int sys_register_irq_handler(uint8_t irq, uint32_t ipc_port);
 
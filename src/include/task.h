@@ -2,6 +2,9 @@
 #define TASK_H
 
 #include <stdint.h>
+#include "wait.h"
+#include "spinlock.h"
+#include "timer.h"
 
 // Process states
 typedef enum
@@ -42,7 +45,14 @@ struct task
     struct registers_state regs; // Saved registers
     uint32_t kernel_stack;       // Kernel stack pointer
     uint32_t time_slice;         // Time slice remaining
-    struct task *next;           // Next task in queue
+    struct task *next;           // Next task in run queue
+    struct task *prev;           // Previous task in run queue
+    int queued;                  // On a run queue
+    uint32_t cpu;                // CPU whose run queue owns the task
+    volatile int on_cpu;         // Context not saved yet (running or switching out)
+    uint32_t last_ran;           // timer_ticks when it last left a CPU
+    uint32_t migrations;         // Moves to another CPU's run queue
+    void (*entry)(void);         // Start function
 
     // Priority and scheduling
     task_priority_t priority;      // Current priority level
@@ -50,10 +60,29 @@ struct task
     uint32_t quantum;              // Time quantum for this priority
     uint32_t ticks_used;           // Ticks used in current quantum
 
+    // Deadline class (rt_period != 0), see task_set_deadline()
+    uint32_t rt_budget;    // Ticks of CPU per period
+    uint32_t rt_period;    // Period and relative deadline in ticks
+    uint32_t rt_deadline;  // Absolute deadline (timer_ticks)
+    uint32_t rt_remaining; // Budget left before the deadline
+    uint32_t rt_util;      // Reserved CPU share in permille
+    int rt_throttled;      // Out of budget: off the run queue until rt_timer
+    uint32_t rt_throttles; // Times the budget ran out
+    uint32_t rt_misses;    // Deadlines passed with budget still left
+    struct timer rt_timer; // Budget replenishment
+    uint64_t irq_tsc;      // TSC of an IRQ that woke us, until we run (irq_bridge.c)
+
     // Statistics
     uint32_t total_ticks;      // Total CPU time used
     uint32_t context_switches; // Number of context switches
     uint32_t created_time;     // When task was created (in ticks)
+    uint32_t nvcsw;            // Switches away by blocking, yielding or exiting
+    uint32_t nivcsw;           // Switches away by preemption
+    uint64_t cpu_cycles;       // TSC cycles on a CPU, up to the last switch
+    uint64_t run_delay;        // TSC cycles spent ready, waiting for a CPU
+    uint32_t run_delay_max;    // Longest single wait
+    uint64_t ready_tsc;        // When it last became ready (0 = not waiting)
+    uint64_t run_tsc;          // When it last got a CPU
 
     // Sleep/Wake
     uint32_t sleep_until; // Wake up time (0 = not sleeping)
@@ -64,40 +93,120 @@ struct task
     struct task *child;   // First child process
     struct task *sibling; // Next sibling process
     int exit_code;        // Exit code (for zombies)
+    int exited;           // Called task_exit(): safe to reap
+    struct wait_queue child_exit; // Waiting in task_waitpid() for a child
+
+    // FPU/SSE state, allocated on first use (see fpu.h)
+    uint8_t *fpu_state;
 
     // I/O Permission Bitmap (for user-space drivers)
     uint8_t *iopb; // I/O Permission Bitmap (8192 bytes)
 };
 
+// Ready tasks: a FIFO per priority level and a bitmap of non-empty
+// levels (bit 0 = PRIORITY_HIGH), so pick-next is O(1). Deadline tasks
+// sit on their own list, earliest deadline first, ahead of all levels.
+struct run_queue
+{
+    struct task *rt_head;
+    uint32_t bitmap;
+    struct task *head[PRIORITY_LEVELS];
+    struct task *tail[PRIORITY_LEVELS];
+    uint32_t count;
+};
+
+void rq_init(struct run_queue *rq);
+void rq_enqueue(struct run_queue *rq, struct task *task); // At the tail of task->priority (or by deadline)
+void rq_remove(struct run_queue *rq, struct task *task);  // No-op if not queued
+struct task *rq_pick(struct run_queue *rq);               // Dequeue the best task, skipping zombies
+
+struct cpu;
+
 // Function declarations
 void task_init(void);
+struct task *task_create_idle(struct cpu *cpu); // Idle task for an AP (smp.c)
 uint32_t task_create(const char *name, void (*entry_point)(void));
 void task_switch(struct registers_state *old_regs, struct registers_state *new_regs);
-void task_schedule(void);
+void task_schedule(void); // Scheduler tick (PIT on CPU 0, local APIC timer elsewhere)
+void task_resched(void);  // Reschedule IPI: preempt if something better is queued
 struct task *task_get_current(void);
 struct task *get_current_task(void); // Alias for task_get_current
 void task_yield(void);
+void task_handoff(struct task *next); // Switch directly to `next`, bypassing the run queue
+void task_kill(struct task *task);    // Make a task a zombie and dequeue it
 
 // Priority management
 void task_set_priority(struct task *task, task_priority_t priority);
 task_priority_t task_get_priority(struct task *task);
 
-// Sleep/Wake
+// Sleep/Wake (ticks are timer ticks, see timer.h)
+#define TASK_WAIT_FOREVER 0xFFFFFFFF
+
 void task_sleep(uint32_t ticks);
 void task_wake(struct task *task);
-void task_check_sleeping(void); // Called by timer
+void task_wake_here(struct task *task); // IPC: wake next to the caller
+// Block until woken or timed out. Called with interrupts disabled and,
+// if `lock` is not NULL, holding the lock that protects the caller's wait
+// queue: it is dropped while blocked and taken again before returning.
+int task_block(spinlock_t *lock, uint32_t timeout); // -1: timeout could not be armed
+void task_block_handoff(spinlock_t *lock, struct task *next); // Block, running `next` if possible
+int task_runnable(void); // Any non-idle task ready to run on this CPU
+
+// Load balancing. An idle CPU pulls a queued task from the busiest other
+// CPU (cache-cold tasks first). With affinity hints on (the default) a
+// woken task goes back to the CPU it last ran on and a synchronous IPC
+// peer is woken on the caller's CPU; off, wakeups go to the least loaded
+// CPU. Tasks whose FPU registers are still live on their CPU never move.
+int task_steal(void);               // Idle: pull one task here, 1 if one was found
+void task_set_affinity(int on);
+int task_get_affinity(void);
+
+// Deadline scheduling (EDF) for driver tasks. A task gets `budget` ticks
+// of CPU every `period` ticks and runs ahead of every priority level,
+// earliest deadline first; a normal task never preempts it. Admission
+// fails (-1) if the reservations would exceed RT_UTIL_MAX of CPU 0, which
+// takes the device interrupts and so runs the deadline tasks. A task
+// that uses up its budget is throttled until its deadline, then gets a
+// new budget and period; one that wakes after its deadline starts a new
+// period at once. budget 0 returns the task to its priority level.
+#define RT_UTIL_MAX 900 // Permille of CPU 0 for deadline tasks
+
+int task_set_deadline(struct task *task, uint32_t budget, uint32_t period);
+uint32_t task_get_rt_util(void); // Reserved permille
 
 // Forward declaration for registers
 struct registers;
 
 // Fork and process management
 int task_fork(void);
-int task_fork_with_regs(struct registers *regs);
+int task_fork_with_regs(struct registers *regs); // Ring 3 callers only
+void task_fork_finish(void);                     // Forked child's first C code
 void task_exit(int exit_code);
 int task_waitpid(int pid, int *status);
-struct task *task_find_by_pid(int pid);
+struct task *task_find_by_pid(int pid);   // O(1); PIDs carry a slot generation
+struct task *task_iterate(uint32_t *pos); // Walk live tasks, *pos starts at 0
 
 // Statistics
+struct task_stats
+{
+    uint32_t tasks;          // Live tasks, zombies included
+    uint32_t pid_slots;      // PID slots ever used
+    uint32_t pid_table_size; // PID slots allocated
+    uint32_t task_objs;      // struct task objects in use
+    uint32_t task_pages;     // Pages held by the task cache
+    uint32_t stack_objs;     // Kernel stacks in use
+    uint32_t stack_pages;    // Pages held by the stack cache
+};
+
+void task_get_stats(struct task_stats *stats);
+
+// Context switch latency: TSC cycles from the switch decision to the next
+// task running, in log2 buckets (bucket 0 counts zeros, bucket k values
+// in [2^(k-1), 2^k)), summed over CPUs. Use ipc_hist_percentile().
+#define SCHED_LAT_BUCKETS 32
+
+void task_get_switch_hist(uint32_t *hist); // SCHED_LAT_BUCKETS entries
+
 uint32_t task_get_ticks(void);
 void task_print_stats(struct task *task);
 
@@ -0,0 +1,67 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// System timer: PIT channel 0 drives IRQ 0 at TIMER_HZ. When only the
+// idle task can run, timer_idle() reprograms the PIT in one-shot mode to
+// fire at the next software timer (or the longest PIT period) and the
+// missed ticks are added back on wakeup, so an idle system takes a
+// fraction of the interrupts. The TSC is calibrated against PIT channel 2
+// at boot for sub-microsecond timestamps. Only CPU 0 takes the PIT
+// interrupt and runs timer callbacks; other CPUs tick from their local
+// APIC timer, which they switch off while idle.
+
+#define TIMER_HZ 1000        // Default tick rate
+#define PIT_BASE_HZ 1193182  // PIT input clock
+#define TIMER_HEAP_MAX 128   // Pending software timers before the heap grows
+
+extern volatile uint32_t timer_ticks; // Ticks since boot (TIMER_HZ per second)
+
+// Software timer. Callbacks run in the timer interrupt with interrupts
+// disabled and must not block.
+struct timer
+{
+    uint32_t expires;        // Tick at which the timer fires
+    void (*fn)(void *arg);
+    void *arg;
+    int index;               // Heap slot, -1 when not pending
+};
+
+void timer_init(uint32_t hz);                 // Program the PIT, calibrate the TSC
+uint32_t timer_get_hz(void);
+void timer_interrupt(void);                   // IRQ 0 handler (before EOI)
+void timer_idle(void);                        // Idle loop body: halt until the next event
+void timer_tick_resume(void);                 // Restart the tick on leaving idle
+
+void timer_setup(struct timer *t, void (*fn)(void *), void *arg);
+int timer_add(struct timer *t, uint32_t expires); // Arm (or re-arm) at an absolute tick; -1 out of memory
+void timer_cancel(struct timer *t);               // Safe on timers that already fired
+
+uint32_t timer_ms_to_ticks(uint32_t ms);          // Rounded up
+
+// Timestamps
+static inline uint64_t timer_rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint32_t timer_tsc_khz(void);                 // Calibrated TSC rate (0 if unknown)
+uint64_t timer_cycles_to_ns(uint64_t cycles); // Convert a TSC delta
+uint32_t timer_cycles_to_us(uint64_t cycles); // Same in microseconds, saturating
+
+// Statistics
+struct timer_stats
+{
+    uint32_t hz;
+    uint32_t tsc_khz;
+    uint32_t interrupts;   // Timer interrupts taken
+    uint32_t idle_oneshots; // Times the PIT was put in one-shot mode
+    uint32_t pending;       // Armed software timers
+};
+
+void timer_get_stats(struct timer_stats *stats);
+
+#endif // TIMER_H
@@ -0,0 +1,46 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+struct task;
+
+// Wait queues: a task waiting for an event queues a wait_entry (living on
+// its own stack) on the event's queue and blocks; whoever signals the
+// event wakes the first or every entry. A woken entry is already off the
+// queue, so the waiter only unlinks itself after a timeout. Entries are
+// FIFO and doubly linked, making both ends and removal O(1).
+//
+// All functions are called with interrupts disabled, holding the lock of
+// the subsystem that owns the queue. Wakeups can be spurious: callers
+// re-check their condition in a loop.
+
+struct wait_entry
+{
+    struct task *task;
+    struct wait_entry *prev;
+    struct wait_entry *next;
+    int woken; // Set when removed from the queue by a wakeup
+};
+
+struct wait_queue
+{
+    struct wait_entry *head;
+    struct wait_entry *tail;
+    uint32_t count;
+};
+
+void wait_queue_init(struct wait_queue *q);
+void wait_add(struct wait_queue *q, struct wait_entry *e);    // Queue the current task
+void wait_remove(struct wait_queue *q, struct wait_entry *e); // No-op once woken
+struct task *wait_wake_one(struct wait_queue *q);             // Oldest waiter, or NULL
+struct task *wait_wake_one_here(struct wait_queue *q);        // Same, woken on this CPU
+void wait_wake_all(struct wait_queue *q);
+
+// Block on `q` until woken or until `timeout` ticks pass
+// (TASK_WAIT_FOREVER for no timeout), dropping `lock` (the queue's lock,
+// may be NULL) meanwhile. Returns 1 if woken through `q`.
+int wait_sleep(struct wait_queue *q, spinlock_t *lock, uint32_t timeout);
+
+#endif // WAIT_H
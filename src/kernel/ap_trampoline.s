@@ -0,0 +1,79 @@
+# Application processor startup code
+#
+# smp_init() copies ap_trampoline..ap_trampoline_end to AP_TRAMPOLINE_ADDR
+# (0x7000) and fills in ap_cr3, ap_stack and ap_entry before sending the
+# STARTUP IPI. The AP starts here in real mode at 0700:0000, enters
+# protected mode with a flat temporary GDT, turns on paging with the kernel
+# page directory and calls ap_entry on its idle task's stack. Every address
+# is computed relative to the copy.
+
+.set AP_BASE, 0x7000
+.set AP_CODE, 0x08
+.set AP_DATA, 0x10
+
+.global ap_trampoline
+.global ap_trampoline_end
+.global ap_cr3
+.global ap_stack
+.global ap_entry
+
+.section .text
+.code16
+ap_trampoline:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+
+    lgdtl (ap_gdt_desc - ap_trampoline + AP_BASE)
+
+    mov %cr0, %eax
+    or $1, %eax
+    mov %eax, %cr0
+
+    ljmpl $AP_CODE, $(ap_pm - ap_trampoline + AP_BASE)
+
+.code32
+ap_pm:
+    mov $AP_DATA, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    mov %ax, %ss
+
+    # The low 16MB are identity mapped, so execution continues here
+    mov (ap_cr3 - ap_trampoline + AP_BASE), %eax
+    mov %eax, %cr3
+    mov %cr0, %eax
+    or $0x80010000, %eax # PG, and WP as on the BSP (see paging_enable)
+    mov %eax, %cr0
+
+    mov (ap_stack - ap_trampoline + AP_BASE), %esp
+    mov (ap_entry - ap_trampoline + AP_BASE), %eax
+    call *%eax
+
+1:
+    cli
+    hlt
+    jmp 1b
+
+.align 8
+ap_gdt:
+    .quad 0
+    .quad 0x00CF9A000000FFFF # Kernel code, flat
+    .quad 0x00CF92000000FFFF # Kernel data, flat
+
+ap_gdt_desc:
+    .word ap_gdt_desc - ap_gdt - 1
+    .long ap_gdt - ap_trampoline + AP_BASE
+
+.align 4
+ap_cr3:
+    .long 0
+ap_stack:
+    .long 0
+ap_entry:
+    .long 0
+
+ap_trampoline_end:
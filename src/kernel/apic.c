@@ -0,0 +1,282 @@
+#include "apic.h"
+#include "paging.h"
+#include "pic.h"
+#include "port_io.h"
+#include "timer.h"
+#include "spinlock.h"
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_IRR 0x200
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV16 0x3
+#define LAPIC_ICR_PENDING 0x1000
+
+#define LAPIC_CALIBRATE_TICKS 10
+
+// I/O APIC registers
+#define IOAPIC_VER 0x01
+#define IOAPIC_REDTBL 0x10
+#define IOAPIC_MAX_PINS 24
+#define IOAPIC_RTE_LOW (1u << 13)
+#define IOAPIC_RTE_LEVEL (1u << 15)
+#define IOAPIC_RTE_MASKED (1u << 16)
+
+#define CPUID1_EDX_APIC (1u << 9)
+#define PIC_READ_IRR 0x0A
+
+static volatile uint32_t *lapic;
+static volatile uint32_t *ioapic;
+static uint32_t ioapic_pins;
+static uint32_t ioapic_dest;        // APIC ID that takes device IRQs (the BSP)
+static spinlock_t ioapic_lock;      // Index/data register pair
+static uint8_t isa_pin[16];         // ISA IRQ -> I/O APIC pin
+static uint8_t pin_flags[IOAPIC_MAX_PINS];
+static uint32_t lapic_timer_count;  // Timer counts per scheduler tick
+static int apic_mode;               // Device IRQs come through the I/O APIC
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+}
+
+static inline uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic[0] = reg;
+    return ioapic[4];
+}
+
+static inline void ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic[0] = reg;
+    ioapic[4] = value;
+}
+
+// Registers are identity mapped, uncached
+static void apic_map(uint32_t base)
+{
+    paging_map_page((void *)base, (void *)base,
+                    PAGE_PRESENT | PAGE_WRITE | PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE);
+}
+
+// ============= Local APIC =============
+
+static void lapic_enable(void)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+}
+
+int lapic_init(uint32_t base)
+{
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    if (!(d & CPUID1_EDX_APIC))
+        return -1;
+
+    apic_map(base);
+    lapic = (volatile uint32_t *)base;
+    lapic_enable();
+
+    // Count timer decrements over a few PIT ticks; the APs share the bus
+    // clock, so one calibration serves every CPU
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    uint32_t start = timer_ticks;
+    uint32_t spins = 0;
+    while (timer_ticks == start)
+    {
+        if (++spins == 100000000)
+            return 0; // No PIT ticks: APs run without a local tick
+        __asm__ volatile("pause");
+    }
+
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    start = timer_ticks;
+    while (timer_ticks - start < LAPIC_CALIBRATE_TICKS)
+        __asm__ volatile("pause");
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_timer_count = elapsed / LAPIC_CALIBRATE_TICKS;
+    return 0;
+}
+
+void lapic_init_ap(void)
+{
+    lapic_enable();
+
+    // Only the BSP takes ExtINT from the PIC
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+
+    if (lapic_timer_count)
+    {
+        lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+        lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+    }
+}
+
+void lapic_timer_enable(int on)
+{
+    if (!lapic_timer_count)
+        return;
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC | (on ? 0 : LAPIC_LVT_MASKED));
+    if (on)
+        lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr)
+{
+    uint32_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, icr);
+    while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+        __asm__ volatile("pause");
+    irq_restore(flags);
+}
+
+// ============= I/O APIC =============
+
+int ioapic_init(uint32_t base)
+{
+    apic_map(base);
+    ioapic = (volatile uint32_t *)base;
+
+    ioapic_pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    if (ioapic_pins > IOAPIC_MAX_PINS)
+        ioapic_pins = IOAPIC_MAX_PINS;
+
+    for (uint32_t pin = 0; pin < ioapic_pins; pin++)
+    {
+        ioapic_write(IOAPIC_REDTBL + 2 * pin, IOAPIC_RTE_MASKED);
+        pin_flags[pin] = 0;
+    }
+    for (uint32_t irq = 0; irq < 16; irq++)
+        isa_pin[irq] = irq;
+    return 0;
+}
+
+void ioapic_route_isa(uint8_t irq, uint32_t pin)
+{
+    if (irq < 16 && pin < IOAPIC_MAX_PINS)
+        isa_pin[irq] = pin;
+}
+
+void ioapic_set_pin_flags(uint32_t pin, uint32_t flags)
+{
+    if (pin < IOAPIC_MAX_PINS)
+        pin_flags[pin] = flags;
+}
+
+// Program the pin behind ISA IRQ `irq` (ioapic_lock held)
+static void ioapic_set_irq(uint8_t irq, int masked)
+{
+    uint32_t pin = isa_pin[irq];
+    if (pin >= ioapic_pins)
+        return;
+
+    uint32_t low = 32 + irq;
+    if (pin_flags[pin] & IOAPIC_ACTIVE_LOW)
+        low |= IOAPIC_RTE_LOW;
+    if (pin_flags[pin] & IOAPIC_LEVEL)
+        low |= IOAPIC_RTE_LEVEL;
+    if (masked)
+        low |= IOAPIC_RTE_MASKED;
+
+    ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, ioapic_dest << 24);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, low);
+}
+
+void apic_enable(uint32_t bsp_apic_id)
+{
+    if (!lapic || !ioapic)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_dest = bsp_apic_id;
+
+    // Lines the PIC had enabled stay enabled (a masked cascade disables
+    // the whole slave); IRQ 2 is the cascade itself
+    uint32_t mask = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    if (mask & (1u << 2))
+        mask |= 0xFF00;
+    for (uint8_t irq = 0; irq < 16; irq++)
+    {
+        if (irq != 2)
+            ioapic_set_irq(irq, (mask >> irq) & 1);
+    }
+
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    apic_mode = 1;
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+// ============= IRQ lines =============
+
+void irq_line_unmask(uint8_t irq)
+{
+    if (!apic_mode)
+    {
+        pic_unmask(irq);
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    if (irq < 16 && irq != 2)
+        ioapic_set_irq(irq, 0);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void irq_line_eoi(uint8_t irq)
+{
+    if (apic_mode)
+        lapic_eoi();
+    else
+        pic_send_eoi(irq);
+}
+
+int irq_line_pending(uint8_t irq)
+{
+    if (apic_mode)
+    {
+        uint32_t vector = 32 + irq;
+        return (lapic_read(LAPIC_IRR + (vector / 32) * 0x10) >> (vector % 32)) & 1;
+    }
+
+    uint16_t port = irq < 8 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, PIC_READ_IRR);
+    return (inb(port) >> (irq % 8)) & 1;
+}
@@ -1,4 +1,6 @@
 #include "driver_config.h"
+#include "task.h"
+#include "timer.h"
 
 // 驱动入口函数声明
 extern void ata_driver_main(void);
@@ -13,11 +15,15 @@ struct driver_config driver_table[] = {
     {.name = "ata_driver",
      .entry_point = ata_driver_main,
      .enabled = 1,
-     .description = "ATA/IDE disk driver (user-space)"},
+     .description = "ATA/IDE disk driver (user-space)",
+     .rt_budget_ms = 2,
+     .rt_period_ms = 10},
     {.name = "ne2000_driver",
      .entry_point = ne2000_driver_main,
      .enabled = 1,
-     .description = "NE2000 network driver (user-space)"},
+     .description = "NE2000 network driver (user-space)",
+     .rt_budget_ms = 2,
+     .rt_period_ms = 10},
     {.name = "netstack",
      .entry_point = netstack_driver_main,
      .enabled = 1,
@@ -38,7 +44,6 @@ int driver_table_size = sizeof(driver_table) / sizeof(driver_table[0]);
 void driver_config_init(void)
 {
     extern void print_string(const char *str, int row);
-    extern uint32_t task_create(const char *name, void (*entry_point)(void));
 
     print_string("============================================", 30);
     print_string("   STARTING USER-SPACE DRIVERS", 31);
@@ -69,6 +74,13 @@ void driver_config_init(void)
             if (pid > 0)
             {
                 started++;
+
+                // 加入截止期调度类（准入失败则保持普通优先级）
+                if (driver_table[i].rt_budget_ms)
+                    task_set_deadline(task_find_by_pid(pid),
+                                      timer_ms_to_ticks(driver_table[i].rt_budget_ms),
+                                      timer_ms_to_ticks(driver_table[i].rt_period_ms));
+
                 msg[0] = ' ';
                 msg[1] = ' ';
                 msg[2] = ' ';
@@ -0,0 +1,245 @@
+#include "fpu.h"
+#include "task.h"
+#include "slab.h"
+#include "isr.h"
+#include "smp.h"
+#include <stddef.h>
+
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_TS (1u << 3)
+#define CR0_NE (1u << 5)
+#define CR4_OSFXSR (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+#define CR4_OSXSAVE (1u << 18)
+
+#define CPUID1_EDX_FPU (1u << 0)
+#define CPUID1_EDX_FXSR (1u << 24)
+#define CPUID1_EDX_SSE (1u << 25)
+#define CPUID1_ECX_XSAVE (1u << 26)
+#define CPUID1_ECX_AVX (1u << 28)
+
+#define XCR0_X87 (1u << 0)
+#define XCR0_SSE (1u << 1)
+#define XCR0_AVX (1u << 2)
+
+#define FXSAVE_SIZE 512
+#define FXSAVE_FCW 0     // Offsets in the FXSAVE/XSAVE legacy area
+#define FXSAVE_MXCSR 24
+#define FCW_DEFAULT 0x037F   // Same as after fninit
+#define MXCSR_DEFAULT 0x1F80 // All SIMD exceptions masked
+
+static uint32_t fpu_mode = FPU_MODE_NONE;
+static uint32_t fpu_state_size;
+static uint32_t fpu_xcr0;      // Components enabled for XSAVE
+static struct kmem_cache fpu_cache;
+static struct fpu_stats stats;
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint32_t read_cr0(void)
+{
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0)
+{
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+}
+
+static inline void clts(void)
+{
+    __asm__ volatile("clts");
+}
+
+static inline void stts(void)
+{
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(uint8_t *area)
+{
+    if (fpu_mode == FPU_MODE_XSAVE)
+        __asm__ volatile("xsave (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    else
+        __asm__ volatile("fxsave (%0)" : : "r"(area) : "memory");
+    stats.saves++;
+}
+
+static void fpu_restore(uint8_t *area)
+{
+    if (fpu_mode == FPU_MODE_XSAVE)
+        __asm__ volatile("xrstor (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    else
+        __asm__ volatile("fxrstor (%0)" : : "r"(area) : "memory");
+    stats.restores++;
+}
+
+// Enable FXSR/SSE (and XSAVE) on the calling CPU and set TS
+void fpu_init_cpu(void)
+{
+    if (fpu_mode == FPU_MODE_NONE)
+        return;
+
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_mode == FPU_MODE_XSAVE)
+        cr4 |= CR4_OSXSAVE;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    if (fpu_mode == FPU_MODE_XSAVE)
+        __asm__ volatile("xsetbv" : : "c"(0), "a"(fpu_xcr0), "d"(0));
+
+    __asm__ volatile("fninit");
+    this_cpu()->fpu_owner = NULL;
+    stts();
+}
+
+void fpu_init(void)
+{
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+
+    // Without FXSR there is no SSE to protect: leave the FPU as it was
+    if (!(d & CPUID1_EDX_FPU) || !(d & CPUID1_EDX_FXSR) || !(d & CPUID1_EDX_SSE))
+        return;
+
+    fpu_mode = FPU_MODE_FXSAVE;
+    fpu_state_size = FXSAVE_SIZE;
+
+    if (c & CPUID1_ECX_XSAVE)
+    {
+        fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+        if (c & CPUID1_ECX_AVX)
+            fpu_xcr0 |= XCR0_AVX;
+        fpu_mode = FPU_MODE_XSAVE;
+    }
+
+    fpu_init_cpu();
+
+    if (fpu_mode == FPU_MODE_XSAVE)
+    {
+        // EBX: area size for the features enabled in XCR0
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        fpu_state_size = b;
+    }
+
+    // XSAVE needs 64-byte alignment: a multiple of 64 keeps every object
+    // in a page-aligned slab aligned
+    kmem_cache_init(&fpu_cache, "fpu", (fpu_state_size + 63) & ~63u);
+
+    stats.mode = fpu_mode;
+    stats.state_size = fpu_state_size;
+}
+
+void fpu_switch(struct task *next)
+{
+    if (fpu_mode == FPU_MODE_NONE)
+        return;
+
+    // The owner's registers are still live: no trap needed
+    if (next == this_cpu()->fpu_owner)
+        clts();
+    else
+        stts();
+}
+
+void fpu_release(struct task *task)
+{
+    uint32_t flags = irq_save();
+
+    // The task is not running anywhere, so no other CPU can be touching
+    // its registers; clearing a remote owner just forgets them
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        if (cpus[i].fpu_owner == task)
+            cpus[i].fpu_owner = NULL;
+    }
+    if (task->fpu_state)
+    {
+        kmem_cache_free(&fpu_cache, task->fpu_state);
+        task->fpu_state = NULL;
+        stats.states--;
+    }
+    irq_restore(flags);
+}
+
+int fpu_handle_nm(void)
+{
+    if (fpu_mode == FPU_MODE_NONE)
+        return -1;
+
+    struct cpu *cpu = this_cpu();
+    struct task *current = cpu->current;
+    struct task *owner = cpu->fpu_owner;
+    stats.traps++;
+    clts();
+
+    if (owner == current)
+        return 0;
+
+    if (owner && owner->fpu_state)
+        fpu_save(owner->fpu_state);
+
+    if (!current->fpu_state)
+    {
+        current->fpu_state = (uint8_t *)kmem_cache_alloc(&fpu_cache);
+        if (!current->fpu_state)
+            return -1;
+
+        // First use: load a clean state rather than the previous
+        // owner's registers (zero XSTATE_BV puts every component in its
+        // init state; FCW and MXCSR still come from the area)
+        uint8_t *area = current->fpu_state;
+        for (uint32_t i = 0; i < fpu_cache.obj_size; i++)
+            area[i] = 0;
+        *(uint16_t *)(area + FXSAVE_FCW) = FCW_DEFAULT;
+        *(uint32_t *)(area + FXSAVE_MXCSR) = MXCSR_DEFAULT;
+        fpu_restore(area);
+
+        stats.first_uses++;
+        stats.states++;
+    }
+    else
+    {
+        fpu_restore(current->fpu_state);
+    }
+
+    cpu->fpu_owner = current;
+    return 0;
+}
+
+uint32_t fpu_kernel_begin(void)
+{
+    uint32_t flags = irq_save();
+    if (fpu_mode == FPU_MODE_NONE)
+        return flags;
+
+    struct cpu *cpu = this_cpu();
+    clts();
+    if (cpu->fpu_owner && cpu->fpu_owner->fpu_state)
+        fpu_save(cpu->fpu_owner->fpu_state);
+    cpu->fpu_owner = NULL;
+    return flags;
+}
+
+void fpu_kernel_end(uint32_t flags)
+{
+    // The next FPU user traps and reloads its own state
+    if (fpu_mode != FPU_MODE_NONE)
+        stts();
+    irq_restore(flags);
+}
+
+void fpu_get_stats(struct fpu_stats *out)
+{
+    *out = stats;
+}
@@ -35,3 +35,9 @@ void idt_init(void)
     // Load IDT
     idt_load((uint32_t)&idt_desc);
 }
+
+// Application processors share the one IDT
+void idt_reload(void)
+{
+    idt_load((uint32_t)&idt_desc);
+}
@@ -1,126 +1,372 @@
 #include "ipc.h"
 #include "task.h"
 #include "kmalloc.h"
+#include "paging.h"
+#include "pmm.h"
+#include "isr.h"
+#include "timer.h"
+#include "spinlock.h"
 #include <stddef.h>
 
-// Global port table
-static struct ipc_port ports[IPC_MAX_PORTS];
+// Guards every port, the name registry and the IPC window. Taken with
+// interrupts disabled: ipc_notify() runs in interrupt handlers.
+static spinlock_t ipc_lock = SPINLOCK_INIT;
+
+// Global port table (grows on demand)
+static struct ipc_port **port_table = NULL;
+static uint32_t *port_generation = NULL; // Per-slot generation, survives port reuse
+static uint32_t port_table_size = 0;
 static uint32_t total_messages_sent = 0;
 
+// Named ports hashed by name (chained through port->name_next)
+static struct ipc_port *name_table[IPC_NAME_BUCKETS];
+
+// Pages in flight between a grant and the matching receive
+struct ipc_grant
+{
+    uint32_t npages;
+    uint32_t frames[]; // Physical frames, in order
+};
+
+// IPC window page allocator (one bit per window page, 1 = in use). The
+// addresses are handed out from one range, but a page is mapped only in
+// the page directory of the task holding it: tasks in other directories
+// (exec'd processes) cannot see it. Tasks sharing a directory, like the
+// drivers in the kernel's, share its window as they share everything
+// else. Each page in use records the PID that may free or grant it, and
+// a task's pages are released when it exits or execs.
+static uint32_t window_map[IPC_WINDOW_PAGES / 32];
+static uint32_t window_owner[IPC_WINDOW_PAGES];
+
+// Trace ring (see ipc_trace())
+static struct ipc_trace_event trace_ring[IPC_TRACE_SIZE];
+static uint32_t trace_next = 0;
+
 // Initialize IPC system
 void ipc_init(void)
 {
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    spin_init(&ipc_lock);
+
+    // The port table is allocated by the first ipc_create_port()
+    port_table = NULL;
+    port_generation = NULL;
+    port_table_size = 0;
+    for (int i = 0; i < IPC_NAME_BUCKETS; i++)
+        name_table[i] = NULL;
+    for (int i = 0; i < IPC_WINDOW_PAGES / 32; i++)
+        window_map[i] = 0;
+    total_messages_sent = 0;
+    trace_next = 0;
+    for (int i = 0; i < IPC_TRACE_SIZE; i++)
+        trace_ring[i].seq = 0;
+}
+
+// ============= Tracing and histograms =============
+
+static inline uint64_t ipc_rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Record an event. The slot is claimed with an atomic increment, so an
+// interrupt handler tracing in the middle of another event gets its own
+// slot; `seq` is written last so readers can skip half-written slots.
+static void ipc_trace(uint32_t event, uint32_t port_id, uint32_t arg)
+{
+    uint32_t seq = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    struct ipc_trace_event *e = &trace_ring[seq & (IPC_TRACE_SIZE - 1)];
+    struct task *current = task_get_current();
+
+    e->seq = 0;
+    e->tsc = ipc_rdtsc();
+    e->event = event;
+    e->port = port_id;
+    e->pid = current ? current->pid : 0;
+    e->arg = arg;
+    __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t ipc_trace_read(struct ipc_trace_event *events, uint32_t max)
+{
+    uint32_t end = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+    uint32_t n = end < IPC_TRACE_SIZE ? end : IPC_TRACE_SIZE;
+    if (n > max)
+        n = max;
+
+    uint32_t count = 0;
+    for (uint32_t seq = end - n; seq != end; seq++)
     {
-        ports[i].port_id = i;
-        ports[i].owner_pid = 0;
-        ports[i].in_use = 0;
-        ports[i].name[0] = '\0';
-        ports[i].queue_head = 0;
-        ports[i].queue_tail = 0;
-        ports[i].queue_count = 0;
-        ports[i].total_sent = 0;
-        ports[i].total_received = 0;
-        ports[i].drops = 0;
-        ports[i].waiting_task = NULL;
+        const struct ipc_trace_event *e = &trace_ring[seq & (IPC_TRACE_SIZE - 1)];
+        events[count] = *e;
+        if (events[count].seq == seq + 1) // Skip slots being rewritten
+            count++;
     }
-    total_messages_sent = 0;
+    return count;
+}
+
+static inline uint32_t ipc_log2_bucket(uint32_t value, uint32_t buckets)
+{
+    uint32_t b = value ? 32 - __builtin_clz(value) : 0;
+    return b < buckets ? b : buckets - 1;
+}
+
+uint32_t ipc_hist_percentile(const uint32_t *hist, uint32_t buckets, uint32_t pct)
+{
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < buckets; i++)
+        total += hist[i];
+    if (total == 0)
+        return 0;
+
+    // Rank of the percentile sample, rounded up (1-based)
+    uint32_t rank = total / 100 * pct + ((total % 100) * pct + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < buckets; i++)
+    {
+        seen += hist[i];
+        if (seen >= rank)
+            return i == 0 ? 0 : (1u << i) - 1;
+    }
+    return 0xFFFFFFFF;
+}
+
+// Count a message that did not fit in `port`'s queue
+static void ipc_count_drop(struct ipc_port *port, uint32_t size)
+{
+    port->drops++;
+    ipc_trace(IPC_TRACE_DROP, port->port_id, size);
 }
 
 // Get port by ID
 struct ipc_port *ipc_get_port(uint32_t port_id)
 {
-    if (port_id >= IPC_MAX_PORTS)
+    if (port_id >= port_table_size)
         return NULL;
 
-    if (!ports[port_id].in_use)
+    return port_table[port_id];
+}
+
+// Get a port only if it is still the one the caller saw with generation
+// `gen`: a port destroyed while the caller slept may have had its id
+// reused by a new one
+static struct ipc_port *ipc_get_port_gen(uint32_t port_id, uint32_t gen)
+{
+    struct ipc_port *port = ipc_get_port(port_id);
+    if (!port || port->generation != gen)
         return NULL;
 
-    return &ports[port_id];
+    return port;
 }
 
-// Create a new port
-int ipc_create_port(void)
+// Get a port owned by the current task
+static struct ipc_port *ipc_owned_port(uint32_t port_id)
 {
+    struct ipc_port *port = ipc_get_port(port_id);
     struct task *current = task_get_current();
 
-    // Find free port
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    if (!port || port->owner_pid != current->pid)
+        return NULL;
+
+    return port;
+}
+
+// Double the port table (up to IPC_MAX_PORTS), ipc_lock held
+static int ipc_grow_table(void)
+{
+    uint32_t new_size = port_table_size ? port_table_size * 2 : IPC_PORT_TABLE_INITIAL;
+    if (new_size > IPC_MAX_PORTS)
+        new_size = IPC_MAX_PORTS;
+    if (new_size <= port_table_size)
+        return -1;
+
+    struct ipc_port **table = (struct ipc_port **)kmalloc(new_size * sizeof(struct ipc_port *));
+    uint32_t *gen = (uint32_t *)kmalloc(new_size * sizeof(uint32_t));
+    if (!table || !gen)
     {
-        if (!ports[i].in_use)
-        {
-            ports[i].in_use = 1;
-            ports[i].owner_pid = current->pid;
-            ports[i].name[0] = '\0';
-            ports[i].queue_head = 0;
-            ports[i].queue_tail = 0;
-            ports[i].queue_count = 0;
-            ports[i].total_sent = 0;
-            ports[i].total_received = 0;
-            ports[i].drops = 0;
-            ports[i].waiting_task = NULL;
-            return i; // Return port ID
-        }
+        if (table)
+            kfree(table);
+        if (gen)
+            kfree(gen);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < new_size; i++)
+    {
+        table[i] = i < port_table_size ? port_table[i] : NULL;
+        gen[i] = i < port_table_size ? port_generation[i] : 0;
     }
 
-    return -1; // No free ports
+    struct ipc_port **old_table = port_table;
+    uint32_t *old_gen = port_generation;
+    port_table = table;
+    port_generation = gen;
+    port_table_size = new_size;
+
+    if (old_table)
+        kfree(old_table);
+    if (old_gen)
+        kfree(old_gen);
+    return 0;
 }
 
-// Create a named port
-int ipc_create_named_port(const char *name)
+// Ring bytes for a queue of `depth` messages
+static uint32_t ipc_ring_bytes(uint32_t depth)
 {
-    if (!name)
-        return -1;
+    uint32_t bytes = depth * (sizeof(struct ipc_record) + IPC_RECORD_AVG_DATA);
+    uint32_t min = sizeof(struct ipc_record) + IPC_MSG_MAX_SIZE; // One full-size message
 
+    return bytes < min ? min : bytes;
+}
+
+// Create a new port (ipc_lock held)
+static int ipc_create_port_locked(void)
+{
     struct task *current = task_get_current();
-    if (!current)
+
+    // Find a free slot, growing the table if needed
+    uint32_t id = 0;
+    while (id < port_table_size && port_table[id])
+        id++;
+    if (id == port_table_size && ipc_grow_table() != 0)
+        return -1; // No free ports
+
+    struct ipc_port *port = (struct ipc_port *)kmalloc(sizeof(struct ipc_port));
+    if (!port)
         return -1;
 
-    // Check if name already exists
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    port->ring_size = ipc_ring_bytes(IPC_PORT_QUEUE_SIZE);
+    port->ring = (uint8_t *)kmalloc(port->ring_size);
+    if (!port->ring)
     {
-        if (ports[i].in_use && ports[i].name[0] != '\0')
-        {
-            int match = 1;
-            for (int j = 0; j < IPC_PORT_NAME_MAX && name[j] && ports[i].name[j]; j++)
-            {
-                if (name[j] != ports[i].name[j])
-                {
-                    match = 0;
-                    break;
-                }
-            }
-            if (match)
-                return -1; // Name already exists
-        }
+        kfree(port);
+        return -1;
     }
 
-    // Find free port
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    port->port_id = id;
+    port->owner_pid = current->pid;
+    port->in_use = 1;
+    port->name[0] = '\0';
+    port->ring_used = 0;
+    port->queue_head = 0;
+    port->queue_tail = 0;
+    port->queue_count = 0;
+    port->queue_depth = IPC_PORT_QUEUE_SIZE;
+    port->total_sent = 0;
+    port->total_received = 0;
+    port->drops = 0;
+    port->send_blocks = 0;
+    port->recv_blocks = 0;
+    port->notifications = 0;
+    port->notify_bits = 0;
+    for (int i = 0; i < IPC_LAT_BUCKETS; i++)
+        port->lat_hist[i] = 0;
+    for (int i = 0; i < IPC_DEPTH_BUCKETS; i++)
+        port->depth_hist[i] = 0;
+    wait_queue_init(&port->recv_waiters);
+    wait_queue_init(&port->send_waiters);
+    wait_queue_init(&port->notify_waiters);
+    port->generation = ++port_generation[id]; // Invalidates handles to the previous owner
+    port->name_hash = 0;
+    port->name_next = NULL;
+
+    port_table[id] = port;
+    return id; // Return port ID
+}
+
+// Create a new port
+int ipc_create_port(void)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int id = ipc_create_port_locked();
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return id;
+}
+
+// ============= Name registry =============
+
+// FNV-1a over the stored (possibly truncated) name
+static uint32_t ipc_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < IPC_PORT_NAME_MAX - 1 && name[i]; i++)
     {
-        if (!ports[i].in_use)
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int ipc_name_equal(const char *a, const char *b)
+{
+    for (int i = 0; i < IPC_PORT_NAME_MAX - 1; i++)
+    {
+        if (a[i] != b[i])
+            return 0;
+        if (a[i] == '\0')
+            return 1;
+    }
+    return 1;
+}
+
+static struct ipc_port *ipc_name_lookup(const char *name, uint32_t hash)
+{
+    struct ipc_port *port = name_table[hash % IPC_NAME_BUCKETS];
+    while (port)
+    {
+        if (port->name_hash == hash && ipc_name_equal(port->name, name))
+            return port;
+        port = port->name_next;
+    }
+    return NULL;
+}
+
+static void ipc_name_unlink(struct ipc_port *port)
+{
+    struct ipc_port **link = &name_table[port->name_hash % IPC_NAME_BUCKETS];
+    while (*link)
+    {
+        if (*link == port)
         {
-            ports[i].in_use = 1;
-            ports[i].owner_pid = current->pid;
-
-            // Copy name
-            int j;
-            for (j = 0; j < IPC_PORT_NAME_MAX - 1 && name[j]; j++)
-                ports[i].name[j] = name[j];
-            ports[i].name[j] = '\0';
-
-            ports[i].queue_head = 0;
-            ports[i].queue_tail = 0;
-            ports[i].queue_count = 0;
-            ports[i].total_sent = 0;
-            ports[i].total_received = 0;
-            ports[i].drops = 0;
-            ports[i].waiting_task = NULL;
-            return i; // Return port ID
+            *link = port->name_next;
+            break;
         }
+        link = &(*link)->name_next;
+    }
+    port->name_next = NULL;
+}
+
+// Create a named port
+int ipc_create_named_port(const char *name)
+{
+    if (!name || name[0] == '\0')
+        return -1;
+
+    uint32_t hash = ipc_name_hash(name);
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int id = -1;
+    if (ipc_name_lookup(name, hash) || (id = ipc_create_port_locked()) < 0)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1; // Name already exists, or no free ports
     }
 
-    return -1; // No free ports
+    struct ipc_port *port = port_table[id];
+    int j;
+    for (j = 0; j < IPC_PORT_NAME_MAX - 1 && name[j]; j++)
+        port->name[j] = name[j];
+    port->name[j] = '\0';
+
+    port->name_hash = hash;
+    port->name_next = name_table[hash % IPC_NAME_BUCKETS];
+    name_table[hash % IPC_NAME_BUCKETS] = port;
+
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return id;
 }
 
 // Find port by name
@@ -129,247 +375,948 @@ int ipc_find_port(const char *name)
     if (!name)
         return -1;
 
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    uint32_t hash = ipc_name_hash(name);
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    struct ipc_port *port = ipc_name_lookup(name, hash);
+    int id = port ? (int)port->port_id : -1;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return id;
+}
+
+// Resolve a cached handle. While the port it points at is still the same
+// incarnation this is two compares; otherwise the name is looked up again.
+int ipc_lookup(struct ipc_handle *handle)
+{
+    if (!handle)
+        return -1;
+
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    uint32_t id = handle->port_id;
+    if (id < port_table_size && port_table[id] && port_generation[id] == handle->generation)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return id;
+    }
+
+    struct ipc_port *port = handle->name ? ipc_name_lookup(handle->name, ipc_name_hash(handle->name)) : NULL;
+    if (port)
+    {
+        handle->port_id = port->port_id;
+        handle->generation = port->generation;
+    }
+    else if (handle->name)
+    {
+        handle->port_id = IPC_INVALID_PORT;
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+
+    return port ? (int)port->port_id : -1;
+}
+
+// ============= IPC window =============
+
+// Reserve `npages` contiguous window pages for `owner`, returns the first
+// page index
+static int window_reserve(uint32_t npages, uint32_t owner)
+{
+    uint32_t run = 0;
+
+    for (uint32_t i = 0; i < IPC_WINDOW_PAGES; i++)
     {
-        if (ports[i].in_use && ports[i].name[0] != '\0')
+        // Skip fully used words quickly
+        if ((i % 32) == 0 && window_map[i / 32] == 0xFFFFFFFF)
+        {
+            run = 0;
+            i += 31;
+            continue;
+        }
+
+        if (window_map[i / 32] & (1u << (i % 32)))
         {
-            int match = 1;
-            for (int j = 0; j < IPC_PORT_NAME_MAX && name[j] && ports[i].name[j]; j++)
+            run = 0;
+            continue;
+        }
+
+        if (++run == npages)
+        {
+            uint32_t first = i + 1 - npages;
+            for (uint32_t j = first; j <= i; j++)
             {
-                if (name[j] != ports[i].name[j])
-                {
-                    match = 0;
-                    break;
-                }
+                window_map[j / 32] |= (1u << (j % 32));
+                window_owner[j] = owner;
             }
-            if (match)
-                return i;
+            return first;
         }
     }
 
-    return -1; // Not found
+    return -1;
 }
 
-// Destroy a port
-int ipc_destroy_port(uint32_t port_id)
+// Return window pages to the allocator
+static void window_release(uint32_t first, uint32_t npages)
 {
-    if (port_id >= IPC_MAX_PORTS)
-        return -1;
+    for (uint32_t j = first; j < first + npages; j++)
+        window_map[j / 32] &= ~(1u << (j % 32));
+}
 
-    struct task *current = task_get_current();
-    struct ipc_port *port = &ports[port_id];
+// Validate a window range held by `owner`, returns the first page index
+// or -1
+static int window_index(void *vaddr, uint32_t npages, uint32_t owner)
+{
+    uint32_t addr = (uint32_t)vaddr;
 
-    // Check ownership
-    if (!port->in_use || port->owner_pid != current->pid)
+    if (npages == 0 || npages > IPC_GRANT_MAX_PAGES || (addr & 0xFFF))
+        return -1;
+    if (addr < IPC_WINDOW_BASE || addr - IPC_WINDOW_BASE + npages * PAGE_SIZE > IPC_WINDOW_SIZE)
         return -1;
 
-    // Wake up any waiting task
-    if (port->waiting_task)
+    uint32_t first = (addr - IPC_WINDOW_BASE) / PAGE_SIZE;
+    for (uint32_t j = first; j < first + npages; j++)
     {
-        port->waiting_task->state = TASK_READY;
-        port->waiting_task = NULL;
+        if (!(window_map[j / 32] & (1u << (j % 32))) || window_owner[j] != owner)
+            return -1;
     }
 
-    // Clear port
-    port->in_use = 0;
-    port->owner_pid = 0;
-    port->queue_count = 0;
+    return first;
+}
 
-    return 0;
+// Map a list of frames at a fresh window range owned by `owner`, returns
+// the virtual address
+static void *window_map_frames(const uint32_t *frames, uint32_t npages, uint32_t owner)
+{
+    int first = window_reserve(npages, owner);
+    if (first < 0)
+        return NULL;
+
+    uint32_t vaddr = IPC_WINDOW_BASE + first * PAGE_SIZE;
+    for (uint32_t i = 0; i < npages; i++)
+        paging_map_page((void *)frames[i], (void *)(vaddr + i * PAGE_SIZE), PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+
+    return (void *)vaddr;
 }
 
-// Send message to port
-int ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+// Allocate pages in the IPC window
+void *ipc_buf_alloc(uint32_t npages)
 {
-    if (dest_port >= IPC_MAX_PORTS)
-        return -1;
+    if (npages == 0 || npages > IPC_GRANT_MAX_PAGES)
+        return NULL;
 
-    struct ipc_port *port = &ports[dest_port];
-    if (!port->in_use)
-        return -1;
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int first = window_reserve(npages, task_get_current()->pid);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    if (first < 0)
+        return NULL;
 
-    if (size > IPC_MSG_MAX_SIZE)
+    // The range is ours now: map it without holding the lock
+    uint32_t vaddr = IPC_WINDOW_BASE + first * PAGE_SIZE;
+    for (uint32_t i = 0; i < npages; i++)
+    {
+        void *frame = pmm_alloc_high_block(); // Only used through the window
+        if (!frame)
+        {
+            // Roll back what we mapped so far
+            for (uint32_t j = 0; j < i; j++)
+                pmm_free_block(paging_unmap_page_get((void *)(vaddr + j * PAGE_SIZE)));
+            flags = spin_lock_irqsave(&ipc_lock);
+            window_release(first, npages);
+            spin_unlock_irqrestore(&ipc_lock, flags);
+            return NULL;
+        }
+        paging_map_page(frame, (void *)(vaddr + i * PAGE_SIZE), PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    }
+
+    return (void *)vaddr;
+}
+
+// Release window pages (and their frames) held by the caller
+int ipc_buf_free(void *vaddr, uint32_t npages)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int first = window_index(vaddr, npages, task_get_current()->pid);
+    if (first < 0)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         return -1;
+    }
 
-    // Check if queue is full
-    if (port->queue_count >= IPC_PORT_QUEUE_SIZE)
+    for (uint32_t i = 0; i < npages; i++)
     {
-        port->drops++;
-        return -1; // Queue full
+        void *frame = paging_unmap_page_get((void *)((uint32_t)vaddr + i * PAGE_SIZE));
+        if (frame)
+            pmm_free_block(frame);
     }
+    window_release(first, npages);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+
+    return 0;
+}
+
+// Release every window page a task holds, with its frame (the task
+// exited, was killed or is replacing its image). The pages are mapped in
+// its directory, which need not be the caller's.
+void ipc_release_task(struct task *task)
+{
+    page_directory *dir = (page_directory *)task->regs.cr3;
+
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    for (uint32_t j = 0; j < IPC_WINDOW_PAGES; j++)
+    {
+        if (!(window_map[j / 32] & (1u << (j % 32))) || window_owner[j] != task->pid)
+            continue;
+
+        void *frame = paging_unmap_page_get_in(dir, (void *)(IPC_WINDOW_BASE + j * PAGE_SIZE));
+        if (frame)
+            pmm_free_block(frame);
+        window_release(j, 1);
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+}
+
+// Free the frames of a grant that will never be received
+static void ipc_grant_discard(struct ipc_grant *grant)
+{
+    for (uint32_t i = 0; i < grant->npages; i++)
+        pmm_free_block((void *)grant->frames[i]);
+    kfree(grant);
+}
+
+// ============= Wait queues =============
+
+// Block the current task on `q`, switching straight to `next` if given.
+// Called with ipc_lock held; it is dropped while the task sleeps.
+// Destroying the port wakes everyone, so a waiter that was not woken can
+// still reach `q`.
+static void ipc_block(struct wait_queue *q, struct task *next)
+{
+    struct wait_entry w;
+
+    wait_add(q, &w);
+    task_block_handoff(&ipc_lock, next);
+    wait_remove(q, &w);
+}
+
+// ============= Message queue =============
+
+#define IPC_QUEUE_FULL -2
+
+// Reserve a record for `size` payload bytes at the ring tail
+static struct ipc_record *ipc_ring_reserve(struct ipc_port *port, uint32_t size)
+{
+    uint32_t len = (sizeof(struct ipc_record) + size + 3) & ~3u;
+
+    if (port->queue_count >= port->queue_depth)
+        return NULL;
+
+    // Restart at the beginning of an empty ring so large records fit
+    if (port->ring_used == 0)
+    {
+        port->queue_head = 0;
+        port->queue_tail = 0;
+    }
+
+    // Records are contiguous: skip the tail end of the ring if too short
+    uint32_t to_end = port->ring_size - port->queue_tail;
+    uint32_t pad = to_end < len ? to_end : 0;
+    if (port->ring_used + pad + len > port->ring_size)
+        return NULL;
+
+    if (pad)
+    {
+        if (pad >= sizeof(struct ipc_record))
+            ((struct ipc_record *)(port->ring + port->queue_tail))->len = 0; // Wrap marker
+        port->ring_used += pad;
+        port->queue_tail = 0;
+    }
+
+    struct ipc_record *rec = (struct ipc_record *)(port->ring + port->queue_tail);
+    rec->len = len;
+    port->queue_tail += len;
+    if (port->queue_tail == port->ring_size)
+        port->queue_tail = 0;
+    port->ring_used += len;
+    port->queue_count++;
+
+    return rec;
+}
+
+// Record at the ring head (queue must not be empty)
+static struct ipc_record *ipc_ring_head(struct ipc_port *port)
+{
+    uint32_t to_end = port->ring_size - port->queue_head;
+    if (to_end < sizeof(struct ipc_record) ||
+        ((struct ipc_record *)(port->ring + port->queue_head))->len == 0)
+    {
+        // Skip the padding left by a wrapping writer
+        port->ring_used -= to_end;
+        port->queue_head = 0;
+    }
+
+    return (struct ipc_record *)(port->ring + port->queue_head);
+}
+
+// Drop the record at the ring head
+static void ipc_ring_pop(struct ipc_port *port, struct ipc_record *rec)
+{
+    port->ring_used -= rec->len;
+    port->queue_head += rec->len;
+    if (port->queue_head == port->ring_size)
+        port->queue_head = 0;
+    port->queue_count--;
+}
+
+// Append a message to a port queue; the task woken by it (if any) is
+// returned through `woken` so synchronous IPC can hand off to it
+static int ipc_enqueue_port(struct ipc_port *port, uint32_t src_port, uint32_t type,
+                            const void *data, uint32_t size, struct ipc_grant *grant,
+                            struct task **woken)
+{
+    if (size > IPC_MSG_MAX_SIZE)
+        return -1;
+
+    // Check if queue is full (the caller decides whether to drop or block)
+    struct ipc_record *rec = ipc_ring_reserve(port, size);
+    if (!rec)
+        return IPC_QUEUE_FULL;
 
     struct task *current = task_get_current();
 
-    // Add message to queue
-    struct ipc_message *msg = &port->queue[port->queue_tail];
-    msg->sender_pid = current->pid;
-    msg->sender_port = 0; // No reply port specified
-    msg->type = type;
-    msg->size = size;
+    // Fill in the record
+    rec->sender_pid = current->pid;
+    rec->sender_port = src_port;
+    rec->type = type;
+    rec->size = size;
+    rec->grant = grant;
+    rec->enqueue_tsc = (uint32_t)ipc_rdtsc();
 
     // Copy data
     if (data && size > 0)
     {
-        for (uint32_t i = 0; i < size && i < IPC_MSG_MAX_SIZE; i++)
+        for (uint32_t i = 0; i < size; i++)
         {
-            msg->data[i] = ((const char *)data)[i];
+            rec->data[i] = ((const char *)data)[i];
         }
     }
 
-    // Update queue
-    port->queue_tail = (port->queue_tail + 1) % IPC_PORT_QUEUE_SIZE;
-    port->queue_count++;
     port->total_sent++;
     total_messages_sent++;
+    port->depth_hist[ipc_log2_bucket(port->queue_count, IPC_DEPTH_BUCKETS)]++;
+    ipc_trace(IPC_TRACE_SEND, port->port_id, size);
+
+    // Wake up one waiting receiver. A synchronous peer (the caller wants
+    // it back through `woken`) is woken on this CPU for the handoff.
+    if (woken)
+        *woken = wait_wake_one_here(&port->recv_waiters);
+    else
+        wait_wake_one(&port->recv_waiters);
+
+    return 0; // Success
+}
 
-    // Wake up waiting task if any
-    if (port->waiting_task)
+static int ipc_enqueue(uint32_t src_port, uint32_t dest_port, uint32_t type,
+                       const void *data, uint32_t size, struct ipc_grant *grant,
+                       struct task **woken)
+{
+    struct ipc_port *port = ipc_get_port(dest_port);
+    if (!port)
+        return -1;
+
+    return ipc_enqueue_port(port, src_port, type, data, size, grant, woken);
+}
+
+// Enqueue, dropping the message if the queue is full
+static int ipc_enqueue_nowait(uint32_t src_port, uint32_t dest_port, uint32_t type,
+                              const void *data, uint32_t size, struct task **woken)
+{
+    int ret = ipc_enqueue(src_port, dest_port, type, data, size, NULL, woken);
+    if (ret == IPC_QUEUE_FULL)
     {
-        port->waiting_task->state = TASK_READY;
-        port->waiting_task = NULL;
+        ipc_count_drop(ipc_get_port(dest_port), size);
+        return -1;
     }
+    return ret;
+}
 
-    return 0; // Success
+// Enqueue, blocking while the queue is full (ipc_lock held)
+static int ipc_enqueue_wait(uint32_t src_port, uint32_t dest_port, uint32_t type,
+                            const void *data, uint32_t size, struct task **woken)
+{
+    struct ipc_port *port = ipc_get_port(dest_port);
+    if (!port)
+        return -1;
+
+    uint32_t gen = port->generation;
+    while (1)
+    {
+        int ret = ipc_enqueue_port(port, src_port, type, data, size, NULL, woken);
+        if (ret != IPC_QUEUE_FULL)
+            return ret;
+
+        port->send_blocks++;
+        ipc_block(&port->send_waiters, NULL);
+
+        port = ipc_get_port_gen(dest_port, gen); // May have been destroyed
+        if (!port)
+            return -1;
+    }
 }
 
-// Send message from a specific port (for replies)
-int ipc_send_from_port(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+// Pop the head message of a port queue into `msg`
+static int ipc_dequeue(struct ipc_port *port, struct ipc_message *msg)
+{
+    struct ipc_record *rec = ipc_ring_head(port);
+
+    msg->sender_pid = rec->sender_pid;
+    msg->sender_port = rec->sender_port;
+    msg->type = rec->type;
+    port->total_received++;
+
+    // Time spent queued (exact for waits under 2^32 cycles)
+    uint32_t waited = (uint32_t)ipc_rdtsc() - rec->enqueue_tsc;
+    port->lat_hist[ipc_log2_bucket(waited, IPC_LAT_BUCKETS)]++;
+    ipc_trace(IPC_TRACE_RECV, port->port_id, waited);
+
+    if (rec->grant)
+    {
+        // The record is consumed even if the grant fails
+        struct ipc_grant *grant = rec->grant;
+        ipc_ring_pop(port, rec);
+        wait_wake_one(&port->send_waiters);
+
+        // Map the granted frames into the window, owned by the receiver
+        void *vaddr = window_map_frames(grant->frames, grant->npages, task_get_current()->pid);
+        if (!vaddr)
+        {
+            ipc_grant_discard(grant);
+            return -1;
+        }
+
+        struct ipc_grant_desc *desc = (struct ipc_grant_desc *)msg->data;
+        desc->vaddr = (uint32_t)vaddr;
+        desc->npages = grant->npages;
+        msg->type |= IPC_TYPE_GRANT;
+        msg->size = sizeof(struct ipc_grant_desc);
+        kfree(grant);
+        return 0;
+    }
+
+    // Copy to user buffer
+    msg->size = rec->size;
+    for (uint32_t i = 0; i < rec->size; i++)
+    {
+        msg->data[i] = rec->data[i];
+    }
+    ipc_ring_pop(port, rec);
+
+    // Room for one more message: let one blocked sender retry
+    wait_wake_one(&port->send_waiters);
+
+    return 0;
+}
+
+// Change the queue depth of an owned port, keeping queued messages
+int ipc_set_queue_depth(uint32_t port_id, uint32_t depth)
 {
-    if (dest_port >= IPC_MAX_PORTS)
+    if (depth == 0 || depth > IPC_PORT_QUEUE_MAX)
         return -1;
 
-    struct ipc_port *port = &ports[dest_port];
-    if (!port->in_use)
+    uint32_t ring_size = ipc_ring_bytes(depth);
+    uint8_t *ring = (uint8_t *)kmalloc(ring_size);
+    if (!ring)
         return -1;
 
-    if (size > IPC_MSG_MAX_SIZE)
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    struct ipc_port *port = ipc_owned_port(port_id);
+    if (!port || depth < port->queue_count)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        kfree(ring);
         return -1;
+    }
+
+    // Move the queued records to the front of the new ring
+    struct ipc_port saved = *port;
+    struct ipc_port old = saved;
+    port->ring = ring;
+    port->ring_size = ring_size;
+    port->ring_used = 0;
+    port->queue_head = 0;
+    port->queue_tail = 0;
+    port->queue_count = 0;
+    port->queue_depth = depth;
 
-    // Check if queue is full
-    if (port->queue_count >= IPC_PORT_QUEUE_SIZE)
+    while (old.queue_count > 0)
     {
-        port->drops++;
-        return -1; // Queue full
+        struct ipc_record *src = ipc_ring_head(&old);
+        struct ipc_record *dst = ipc_ring_reserve(port, src->size);
+        if (!dst)
+        {
+            // Queued bytes do not fit: keep the old ring
+            *port = saved;
+            spin_unlock_irqrestore(&ipc_lock, flags);
+            kfree(ring);
+            return -1;
+        }
+        for (uint32_t i = sizeof(uint32_t); i < src->len; i++)
+            ((uint8_t *)dst)[i] = ((uint8_t *)src)[i];
+        ipc_ring_pop(&old, src);
     }
 
-    struct task *current = task_get_current();
+    // Blocked senders may fit now
+    wait_wake_all(&port->send_waiters);
 
-    // Add message to queue
-    struct ipc_message *msg = &port->queue[port->queue_tail];
-    msg->sender_pid = current->pid;
-    msg->sender_port = src_port; // Include reply port for responses
-    msg->type = type;
-    msg->size = size;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    kfree(old.ring);
+    return 0;
+}
 
-    // Copy data
-    if (data && size > 0)
+// Destroy a port
+int ipc_destroy_port(uint32_t port_id)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    struct ipc_port *port = ipc_owned_port(port_id);
+    if (!port)
     {
-        for (uint32_t i = 0; i < size && i < IPC_MSG_MAX_SIZE; i++)
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
+    }
+
+    // Wake up all waiting tasks (they re-check the port table)
+    wait_wake_all(&port->recv_waiters);
+    wait_wake_all(&port->send_waiters);
+    wait_wake_all(&port->notify_waiters);
+
+    // Release pages of grants nobody will receive
+    while (port->queue_count > 0)
+    {
+        struct ipc_record *rec = ipc_ring_head(port);
+        if (rec->grant)
+            ipc_grant_discard(rec->grant);
+        ipc_ring_pop(port, rec);
+    }
+
+    // Clear port
+    if (port->name[0] != '\0')
+        ipc_name_unlink(port);
+    port_table[port_id] = NULL;
+    port_generation[port_id]++;
+
+    spin_unlock_irqrestore(&ipc_lock, flags);
+
+    kfree(port->ring);
+    kfree(port);
+    return 0;
+}
+
+// Send message to port
+int ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+{
+    return ipc_send_from_port(0, dest_port, type, data, size); // No reply port specified
+}
+
+// Send message from a specific port (for replies)
+int ipc_send_from_port(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int ret = ipc_enqueue_nowait(src_port, dest_port, type, data, size, NULL);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+// Send message, waiting for room if the destination queue is full
+int ipc_send_wait(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int ret = ipc_enqueue_wait(src_port, dest_port, type, data, size, NULL);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+// Send a batch of messages with one port lookup. Returns the number of
+// messages queued; without IPC_SEND_BLOCK the batch stops at the first
+// message that does not fit (counted as a drop).
+int ipc_sendv(uint32_t src_port, uint32_t dest_port, const struct ipc_iovec *vec, uint32_t count, uint32_t flags)
+{
+    if (!vec || count == 0)
+        return -1;
+
+    uint32_t irq_flags = spin_lock_irqsave(&ipc_lock);
+
+    struct ipc_port *port = ipc_get_port(dest_port);
+    uint32_t gen = port ? port->generation : 0;
+    uint32_t sent = 0;
+    while (port && sent < count)
+    {
+        int ret = ipc_enqueue_port(port, src_port, vec[sent].type, vec[sent].data, vec[sent].size, NULL, NULL);
+        if (ret == 0)
         {
-            msg->data[i] = ((const char *)data)[i];
+            sent++;
+            continue;
         }
+
+        if (ret != IPC_QUEUE_FULL)
+            break; // Bad message
+
+        if (!(flags & IPC_SEND_BLOCK))
+        {
+            ipc_count_drop(port, vec[sent].size);
+            break;
+        }
+
+        port->send_blocks++;
+        ipc_block(&port->send_waiters, NULL);
+        port = ipc_get_port_gen(dest_port, gen); // May have been destroyed
     }
 
-    // Update queue
-    port->queue_tail = (port->queue_tail + 1) % IPC_PORT_QUEUE_SIZE;
-    port->queue_count++;
-    port->total_sent++;
-    total_messages_sent++;
+    spin_unlock_irqrestore(&ipc_lock, irq_flags);
+    return sent > 0 ? (int)sent : -1;
+}
+
+// Grant window pages to a port (ipc_lock held)
+static int ipc_send_grant_locked(uint32_t src_port, uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages)
+{
+    struct ipc_port *port = ipc_get_port(dest_port);
+    if (!port)
+        return -1;
 
-    // Wake up waiting task if any
-    if (port->waiting_task)
+    int first = window_index(vaddr, npages, task_get_current()->pid);
+    if (first < 0)
+        return -1;
+
+    struct ipc_grant *grant = (struct ipc_grant *)kmalloc(sizeof(struct ipc_grant) + npages * sizeof(uint32_t));
+    if (!grant)
+        return -1;
+
+    grant->npages = npages;
+    for (uint32_t i = 0; i < npages; i++)
+        grant->frames[i] = (uint32_t)paging_get_physical_address((void *)((uint32_t)vaddr + i * PAGE_SIZE));
+
+    // Queue first: a port full by count or by ring bytes leaves the
+    // sender's pages mapped. Nobody can dequeue before ipc_lock is dropped.
+    int ret = ipc_enqueue(src_port, dest_port, type & ~IPC_TYPE_GRANT, NULL, 0, grant, NULL);
+    if (ret != 0)
     {
-        port->waiting_task->state = TASK_READY;
-        port->waiting_task = NULL;
+        if (ret == IPC_QUEUE_FULL)
+            ipc_count_drop(port, 0);
+        kfree(grant);
+        return -1; // Sender keeps its pages
     }
 
-    return 0; // Success
+    // Take the frames away from the sender's mapping
+    for (uint32_t i = 0; i < npages; i++)
+        paging_unmap_page((void *)((uint32_t)vaddr + i * PAGE_SIZE));
+    window_release(first, npages);
+
+    return 0;
+}
+
+// Grant window pages to a port (zero-copy, the sender loses the pages)
+int ipc_send_grant_from_port(uint32_t src_port, uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages)
+{
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int ret = ipc_send_grant_locked(src_port, dest_port, type, vaddr, npages);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+int ipc_send_grant(uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages)
+{
+    return ipc_send_grant_from_port(0, dest_port, type, vaddr, npages);
+}
+
+// Block on an owned port until a message arrives, switching straight to
+// `next` (the peer that will answer) when there is one.
+// Called with ipc_lock held.
+static struct ipc_port *ipc_wait_on(uint32_t port_id, struct task *next)
+{
+    struct ipc_port *port;
+
+    // Look the port up again after every wakeup: it may have been destroyed
+    while ((port = ipc_owned_port(port_id)) != NULL && port->queue_count == 0)
+    {
+        port->recv_blocks++;
+        ipc_block(&port->recv_waiters, next);
+        next = NULL;
+    }
+
+    return port;
 }
 
 // Receive message from port (blocking)
 int ipc_recv(uint32_t port_id, struct ipc_message *msg)
 {
-    if (port_id >= IPC_MAX_PORTS)
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    // If no messages, block
+    struct ipc_port *port = ipc_wait_on(port_id, NULL);
+    if (!port)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1; // Not our port, or it was destroyed
+    }
+
+    int ret = ipc_dequeue(port, msg);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+// ============= Synchronous call/reply =============
+
+// Send a request from `src_port` and wait for the reply on the same port.
+// The server blocked in ipc_reply_wait() runs immediately instead of
+// waiting for its turn in the round-robin.
+int ipc_call(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size,
+             struct ipc_message *reply)
+{
+    if (!reply)
         return -1;
 
-    struct ipc_port *port = &ports[port_id];
-    struct task *current = task_get_current();
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
 
     // Check ownership
-    if (!port->in_use || port->owner_pid != current->pid)
+    if (!ipc_owned_port(src_port))
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         return -1;
+    }
+    ipc_trace(IPC_TRACE_CALL, dest_port, type);
 
-    // If no messages, block
-    if (port->queue_count == 0)
+    struct task *server = NULL;
+    struct ipc_port *port = NULL;
+    if (ipc_enqueue_wait(src_port, dest_port, type, data, size, &server) != 0 ||
+        (port = ipc_wait_on(src_port, server)) == NULL)
     {
-        port->waiting_task = current;
-        current->state = TASK_BLOCKED;
-        task_yield(); // Give up CPU
-
-        // After waking up, check again
-        if (port->queue_count == 0)
-            return -1; // Port was destroyed
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
     }
 
-    // Get message from queue
-    struct ipc_message *queued_msg = &port->queue[port->queue_head];
+    int ret = ipc_dequeue(port, reply);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
 
-    // Copy to user buffer
-    msg->sender_pid = queued_msg->sender_pid;
-    msg->sender_port = queued_msg->sender_port;
-    msg->type = queued_msg->type;
-    msg->size = queued_msg->size;
+// Server side of ipc_call(): reply to `reply_port` (skipped when it is
+// IPC_NO_REPLY) and wait for the next request on `port_id`. If the queue
+// is empty the CPU goes straight back to the caller we just answered.
+int ipc_reply_wait(uint32_t port_id, uint32_t reply_port, uint32_t type, const void *data, uint32_t size,
+                   struct ipc_message *msg)
+{
+    if (!msg)
+        return -1;
 
-    for (uint32_t i = 0; i < queued_msg->size && i < IPC_MSG_MAX_SIZE; i++)
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    // Check ownership
+    if (!ipc_owned_port(port_id))
     {
-        msg->data[i] = queued_msg->data[i];
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
     }
 
-    // Update queue
-    port->queue_head = (port->queue_head + 1) % IPC_PORT_QUEUE_SIZE;
-    port->queue_count--;
-    port->total_received++;
+    // A lost reply (caller gone) must not stop the server loop
+    struct task *caller = NULL;
+    if (reply_port != IPC_NO_REPLY)
+    {
+        ipc_trace(IPC_TRACE_REPLY, reply_port, type);
+        ipc_enqueue_nowait(port_id, reply_port, type, data, size, &caller);
+    }
 
-    return 0; // Success
+    struct ipc_port *port = ipc_wait_on(port_id, caller);
+    if (!port)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
+    }
+
+    int ret = ipc_dequeue(port, msg);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+// Receive up to `max` messages with one trap, blocking until at least one
+// is available. Returns the number of messages received.
+int ipc_recvv(uint32_t port_id, struct ipc_message *msgs, uint32_t max)
+{
+    if (!msgs || max == 0)
+        return -1;
+
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    struct ipc_port *port = ipc_wait_on(port_id, NULL);
+    uint32_t received = 0;
+    while (port && received < max && port->queue_count > 0)
+    {
+        if (ipc_dequeue(port, &msgs[received]) == 0)
+            received++;
+    }
+
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return port ? (int)received : -1;
 }
 
 // Non-blocking receive
 int ipc_try_recv(uint32_t port_id, struct ipc_message *msg)
 {
-    if (port_id >= IPC_MAX_PORTS)
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    // Check ownership
+    struct ipc_port *port = ipc_owned_port(port_id);
+    int ret;
+    if (!port)
+        ret = -1;
+    else if (port->queue_count == 0)
+        ret = -2; // No messages available
+    else
+        ret = ipc_dequeue(port, msg);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return ret;
+}
+
+// ============= Notifications =============
+
+// OR `bits` into a port's notification word and wake its owner.
+// Callable from interrupt handlers: no allocation, no queue, and bits
+// raised while nobody is waiting stay pending until the next wait.
+int ipc_notify(uint32_t port_id, uint32_t bits)
+{
+    if (bits == 0)
         return -1;
 
-    struct ipc_port *port = &ports[port_id];
-    struct task *current = task_get_current();
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
 
-    // Check ownership
-    if (!port->in_use || port->owner_pid != current->pid)
+    struct ipc_port *port = ipc_get_port(port_id);
+    if (!port)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         return -1;
+    }
+
+    port->notify_bits |= bits;
+    port->notifications++;
+    ipc_trace(IPC_TRACE_NOTIFY, port_id, bits);
+    wait_wake_all(&port->notify_waiters);
 
-    // If no messages, return immediately
-    if (port->queue_count == 0)
-        return -2; // No messages available
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return 0;
+}
 
-    // Get message from queue
-    struct ipc_message *queued_msg = &port->queue[port->queue_head];
+// Block until any notification bit is set on an owned port, then return
+// the pending bits in `*bits` and clear them
+int ipc_wait_notification(uint32_t port_id, uint32_t *bits)
+{
+    if (!bits)
+        return -1;
 
-    // Copy to user buffer
-    msg->sender_pid = queued_msg->sender_pid;
-    msg->sender_port = queued_msg->sender_port;
-    msg->type = queued_msg->type;
-    msg->size = queued_msg->size;
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
 
-    for (uint32_t i = 0; i < queued_msg->size && i < IPC_MSG_MAX_SIZE; i++)
+    // Look the port up again after every wakeup: it may have been destroyed
+    struct ipc_port *port;
+    while ((port = ipc_owned_port(port_id)) != NULL && port->notify_bits == 0)
     {
-        msg->data[i] = queued_msg->data[i];
+        port->recv_blocks++;
+        ipc_block(&port->notify_waiters, NULL);
     }
 
-    // Update queue
-    port->queue_head = (port->queue_head + 1) % IPC_PORT_QUEUE_SIZE;
-    port->queue_count--;
-    port->total_received++;
+    if (!port)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
+    }
 
-    return 0; // Success
+    *bits = port->notify_bits;
+    port->notify_bits = 0;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return 0;
+}
+
+// Non-blocking variant: `*bits` is 0 when nothing was pending
+int ipc_poll_notification(uint32_t port_id, uint32_t *bits)
+{
+    if (!bits)
+        return -1;
+
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    struct ipc_port *port = ipc_owned_port(port_id);
+    if (!port)
+    {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
+    }
+
+    *bits = port->notify_bits;
+    port->notify_bits = 0;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return 0;
+}
+
+// ============= Multi-port wait =============
+
+// Collect ready ports into `*ready`. Returns how many, or -1 if one of
+// them is not (or no longer) owned by the caller.
+static int ipc_ready_mask(const uint32_t *ports, uint32_t count, uint32_t *ready)
+{
+    int n = 0;
+    *ready = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct ipc_port *port = ipc_owned_port(ports[i]);
+        if (!port)
+            return -1;
+        if (port->queue_count > 0 || port->notify_bits != 0)
+        {
+            *ready |= 1u << i;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Block until any of `ports` has a message or notification bits, or until
+// `timeout` timer ticks pass (0 polls, IPC_WAIT_FOREVER never times out)
+int ipc_wait_any(const uint32_t *ports, uint32_t count, uint32_t timeout, uint32_t *ready)
+{
+    if (!ports || !ready || count == 0 || count > IPC_WAIT_ANY_MAX)
+        return -1;
+
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+
+    uint32_t deadline = timer_ticks + timeout;
+    int n;
+
+    while ((n = ipc_ready_mask(ports, count, ready)) == 0)
+    {
+        if (timeout == 0 ||
+            (timeout != IPC_WAIT_FOREVER && (int32_t)(timer_ticks - deadline) >= 0))
+            break;
+
+        // Queue one waiter per port and kind of event; the first wakeup
+        // (or the timeout) makes the task runnable again
+        struct wait_entry msg_w[IPC_WAIT_ANY_MAX];
+        struct wait_entry ntf_w[IPC_WAIT_ANY_MAX];
+        struct ipc_port *waited[IPC_WAIT_ANY_MAX];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            struct ipc_port *port = ipc_get_port(ports[i]);
+            wait_add(&port->recv_waiters, &msg_w[i]);
+            wait_add(&port->notify_waiters, &ntf_w[i]);
+            port->recv_blocks++;
+            waited[i] = port;
+        }
+
+        task_block(&ipc_lock, timeout == IPC_WAIT_FOREVER ? TASK_WAIT_FOREVER : deadline - timer_ticks);
+
+        // Leave the queues we were added to, not those of whatever port
+        // has the id now. Destroying a port wakes all its waiters, so an
+        // entry not woken still sits in a live port's queue.
+        for (uint32_t i = 0; i < count; i++)
+        {
+            wait_remove(&waited[i]->recv_waiters, &msg_w[i]);
+            wait_remove(&waited[i]->notify_waiters, &ntf_w[i]);
+        }
+    }
+
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return n;
 }
 
 // Get IPC statistics
@@ -378,18 +1325,25 @@ void ipc_get_stats(struct ipc_stats *stats)
     if (!stats)
         return;
 
-    stats->total_ports = IPC_MAX_PORTS;
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    stats->total_ports = port_table_size;
     stats->active_ports = 0;
     stats->total_messages = total_messages_sent;
     stats->blocked_tasks = 0;
+    stats->total_drops = 0;
+    stats->total_blocks = 0;
 
-    for (int i = 0; i < IPC_MAX_PORTS; i++)
+    for (uint32_t i = 0; i < port_table_size; i++)
     {
-        if (ports[i].in_use)
+        struct ipc_port *port = port_table[i];
+        if (port)
         {
             stats->active_ports++;
-            if (ports[i].waiting_task)
-                stats->blocked_tasks++;
+            stats->blocked_tasks += port->recv_waiters.count + port->send_waiters.count +
+                                    port->notify_waiters.count;
+            stats->total_drops += port->drops;
+            stats->total_blocks += port->send_blocks + port->recv_blocks;
         }
     }
+    spin_unlock_irqrestore(&ipc_lock, flags);
 }
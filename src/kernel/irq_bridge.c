@@ -1,6 +1,8 @@
 #include "irq_bridge.h"
 #include "ipc.h"
 #include "task.h"
+#include "apic.h"
+#include "timer.h"
 #include <stdint.h>
 
 // IRQ 处理器注册表
@@ -12,7 +14,9 @@ struct irq_handler_entry
 };
 
 static struct irq_handler_entry irq_handlers[16];
-static uint32_t irq_counter = 0; // 全局 IRQ 计数器
+
+// 中断到驱动运行的延迟统计（统计用，多 CPU 并发更新不加锁）
+static struct irq_latency_stats irq_latency;
 
 // 初始化 IRQ 桥接系统
 void irq_bridge_init(void)
@@ -49,6 +53,9 @@ int irq_bridge_register(uint8_t irq, uint32_t ipc_port)
     irq_handlers[irq].pid = current->pid;
     irq_handlers[irq].registered = 1;
 
+    // 固件可能屏蔽了该中断线
+    irq_line_unmask(irq);
+
     return 0;
 }
 
@@ -83,19 +90,44 @@ void irq_bridge_notify(uint8_t irq)
     if (!irq_handlers[irq].registered)
         return; // 没有注册的处理器
 
-    // 构造 IRQ 消息
-    struct irq_message msg;
-    msg.type = IPC_MSG_IRQ;
-    msg.irq_number = irq;
-    msg.reserved[0] = 0;
-    msg.reserved[1] = 0;
-    msg.reserved[2] = 0;
-    msg.timestamp = irq_counter++;
-
-    // 发送到注册的 IPC 端口（非阻塞）
-    // 注意：这里我们直接调用 IPC 发送，不通过系统调用
-    // 因为我们在中断上下文中
-    // 使用内核内部的 IPC 发送函数
-    extern int ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t size);
-    ipc_send(irq_handlers[irq].ipc_port, IPC_MSG_IRQ, &msg, sizeof(msg));
+    // 驱动正阻塞等待：记下中断时间，到它被调度运行时计入延迟直方图
+    struct task *driver = task_find_by_pid(irq_handlers[irq].pid);
+    if (driver && driver->state == TASK_BLOCKED && !driver->on_cpu && !driver->irq_tsc)
+        driver->irq_tsc = timer_rdtsc();
+
+    // 置位通知字并唤醒驱动（O(1)，可在中断上下文调用）
+    ipc_notify(irq_handlers[irq].ipc_port, IRQ_NOTIFY_BIT(irq));
+}
+
+// 被中断唤醒的驱动任务开始运行（调度器在切换时调用，持有运行队列锁）
+void irq_bridge_account(struct task *task)
+{
+    uint64_t delta = timer_rdtsc() - task->irq_tsc;
+    task->irq_tsc = 0;
+
+    uint32_t cycles = (delta >> 32) ? 0xFFFFFFFF : (uint32_t)delta;
+    uint32_t bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+    if (bucket >= IRQ_LAT_BUCKETS)
+        bucket = IRQ_LAT_BUCKETS - 1;
+
+    irq_latency.hist[bucket]++;
+    irq_latency.samples++;
+    if (cycles > irq_latency.max_cycles)
+        irq_latency.max_cycles = cycles;
+}
+
+void irq_bridge_get_latency(struct irq_latency_stats *stats)
+{
+    for (int i = 0; i < IRQ_LAT_BUCKETS; i++)
+        stats->hist[i] = irq_latency.hist[i];
+    stats->samples = irq_latency.samples;
+    stats->max_cycles = irq_latency.max_cycles;
+}
+
+void irq_bridge_reset_latency(void)
+{
+    for (int i = 0; i < IRQ_LAT_BUCKETS; i++)
+        irq_latency.hist[i] = 0;
+    irq_latency.samples = 0;
+    irq_latency.max_cycles = 0;
 }
@@ -81,6 +81,16 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+# Local APIC vectors (see apic.h)
+IRQ 16, 48 # Local APIC timer
+IRQ 17, 49 # Reschedule IPI
+IRQ 18, 50 # TLB shootdown IPI
+
+# Spurious APIC interrupts need no EOI
+.global irq_spurious
+irq_spurious:
+    iret
+
 # Common ISR stub
 isr_common_stub:
     pusha
@@ -3,6 +3,12 @@
 #include "pic.h"
 #include "keyboard.h"
 #include "task.h"
+#include "irq_bridge.h"
+#include "timer.h"
+#include "fpu.h"
+#include "apic.h"
+#include "smp.h"
+#include "paging.h"
 
 // Exception messages
 const char *exception_messages[] = {
@@ -83,6 +89,14 @@ void isr_install(void)
 // ISR handler
 void isr_handler(struct registers regs)
 {
+    // Device Not Available: first FPU/SSE use since the last task switch
+    if (regs.int_no == 7 && fpu_handle_nm() == 0)
+        return;
+
+    // Page Fault: write to a copy-on-write page
+    if (regs.int_no == 14 && paging_handle_fault(regs.err_code) == 0)
+        return;
+
     print_string("Received interrupt: ", 4);
 
     if (regs.int_no < 32)
@@ -98,9 +112,6 @@ void isr_handler(struct registers regs)
     }
 }
 
-// Timer tick counter
-volatile uint32_t timer_ticks = 0;
-
 // External function to print a character
 extern void print_char(char c, int col, int row);
 
@@ -135,16 +146,43 @@ static void int_to_str(uint32_t num, char *str)
 // IRQ handler
 void irq_handler(struct registers regs)
 {
+    // TLB shootdown: reloading CR3 drops every (non-global) translation
+    if (regs.int_no == TLB_VECTOR)
+    {
+        __asm__ volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+        this_cpu()->tlb_flush = 0;
+        lapic_eoi();
+        return;
+    }
+
+    // Local APIC timer (application processors) and reschedule IPIs
+    if (regs.int_no == LAPIC_TIMER_VECTOR || regs.int_no == RESCHED_VECTOR)
+    {
+        lapic_eoi();
+        if (regs.int_no == LAPIC_TIMER_VECTOR)
+        {
+            task_schedule();
+        }
+        else
+        {
+            task_resched();
+        }
+        return;
+    }
+
     // IRQ 0: Timer interrupt
     if (regs.int_no == 32)
     {
-        timer_ticks++;
+        timer_interrupt();
 
-        // Display timer ticks every 18.2 ticks (approximately 1 second)
-        if (timer_ticks % 18 == 0)
+        // Display uptime once a second (ticks can jump after a tickless idle)
+        static uint32_t shown_seconds = 0;
+        uint32_t seconds = timer_ticks / timer_get_hz();
+        if (seconds != shown_seconds)
         {
+            shown_seconds = seconds;
             char tick_str[20];
-            int_to_str(timer_ticks / 18, tick_str);
+            int_to_str(seconds, tick_str);
 
             // Print timer in top-right corner (row 0)
             // Format: "Time: XXs"
@@ -178,9 +216,6 @@ void irq_handler(struct registers regs)
             // Print "s"
             print_char('s', col++, 0);
         }
-
-        // Call task scheduler
-        task_schedule();
     }
     // IRQ 1: Keyboard interrupt
     else if (regs.int_no == 33)
@@ -188,6 +223,16 @@ void irq_handler(struct registers regs)
         keyboard_handler();
     }
 
-    // Send EOI to PIC
-    pic_send_eoi(regs.int_no - 32);
+    // Wake the driver registered for this line (IRQ 0 drives the scheduler)
+    if (regs.int_no > 32)
+        irq_bridge_notify(regs.int_no - 32);
+
+    // Send EOI before switching tasks: the next task may not return
+    // through this handler for a long time
+    irq_line_eoi(regs.int_no - 32);
+
+    if (regs.int_no == 32)
+        task_schedule();
+    else if (this_cpu()->need_resched)
+        task_resched(); // Woke a task that should run now (a driver)
 }
@@ -3,6 +3,7 @@
 #include "idt.h"
 #include "isr.h"
 #include "pic.h"
+#include "timer.h"
 #include "keyboard.h"
 #include "shell.h"
 #include "multiboot.h"
@@ -10,6 +11,8 @@
 #include "paging.h"
 #include "kmalloc.h"
 #include "task.h"
+#include "fpu.h"
+#include "smp.h"
 #include "syscall.h"
 #include "ipc.h"
 #include "vfs.h"
@@ -52,6 +55,87 @@ void print_string(const char *str, int row)
 // External multiboot info pointer
 extern uint32_t multiboot_info_ptr;
 
+// End of the kernel image (from linker.ld)
+extern uint8_t kernel_end[];
+
+// Usable RAM reported by the boot loader. Copied out first: the PMM's frame
+// tables go after the kernel image and may overwrite the multiboot data.
+#define MEM_REGIONS_MAX 32
+static uint32_t mem_region_base[MEM_REGIONS_MAX];
+static uint32_t mem_region_size[MEM_REGIONS_MAX];
+static uint32_t mem_region_count;
+
+// Collect the available regions, in whole frames below 4GB (no PAE).
+// Returns the end of the highest one.
+static uint32_t memory_map_read(struct multiboot_info *mbi)
+{
+    uint32_t top = 0;
+
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP))
+    {
+        // Only the amount above 1MB; without even that, assume 16MB
+        uint32_t upper = (mbi->flags & MULTIBOOT_INFO_MEMORY) ? mbi->mem_upper * 1024 : 15 * 1024 * 1024;
+        mem_region_base[0] = 0x100000;
+        mem_region_size[0] = upper & ~(PAGE_SIZE - 1);
+        mem_region_count = 1;
+        return 0x100000 + mem_region_size[0];
+    }
+
+    uint32_t addr = mbi->mmap_addr;
+    while (addr < mbi->mmap_addr + mbi->mmap_length && mem_region_count < MEM_REGIONS_MAX)
+    {
+        struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *)addr;
+        addr += entry->size + sizeof(entry->size);
+
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr >= 0xFFFFF000ULL)
+            continue;
+
+        uint64_t end = entry->addr + entry->len;
+        if (end > 0xFFFFF000ULL)
+            end = 0xFFFFF000ULL;
+        uint32_t base = ((uint32_t)entry->addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint32_t limit = (uint32_t)end & ~(PAGE_SIZE - 1);
+        if (base >= limit)
+            continue;
+
+        mem_region_base[mem_region_count] = base;
+        mem_region_size[mem_region_count] = limit - base;
+        mem_region_count++;
+        if (limit > top)
+            top = limit;
+    }
+
+    return top;
+}
+
+// Find room for the PMM's frame tables: the lowest usable range past the
+// kernel image that holds them below IDENTITY_MAP_SIZE, where every page
+// directory maps them. If none does, fewer frames are tracked. Returns
+// the (page aligned) address, 0 if nothing fits at all.
+static uint32_t frame_tables_place(uint32_t *mem_size)
+{
+    uint32_t image_end = ((uint32_t)kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    for (; *mem_size >= PAGE_SIZE; *mem_size /= 2)
+    {
+        uint32_t size = pmm_meta_size(*mem_size);
+        uint32_t best = 0;
+        for (uint32_t i = 0; i < mem_region_count; i++)
+        {
+            uint32_t base = mem_region_base[i] > image_end ? mem_region_base[i] : image_end;
+            uint32_t end = mem_region_base[i] + mem_region_size[i];
+            if (end > IDENTITY_MAP_SIZE)
+                end = IDENTITY_MAP_SIZE;
+            if (base < end && end - base >= size && (!best || base < best))
+                best = base;
+        }
+        if (best)
+            return best;
+    }
+
+    return 0;
+}
+
 void kernel_main(void)
 {
     // Print a welcome message
@@ -59,6 +143,7 @@ void kernel_main(void)
 
     // Get multiboot info
     struct multiboot_info *mbi = (struct multiboot_info *)multiboot_info_ptr;
+    uint32_t mem_size = memory_map_read(mbi);
 
     print_string("Initializing IDT...", 1);
 
@@ -76,16 +161,31 @@ void kernel_main(void)
     // Initialize memory management
     print_string("Initializing memory manager...", 5);
 
-    // Calculate total memory (in KB from multiboot)
-    uint32_t mem_size = (mbi->mem_lower + mbi->mem_upper) * 1024;
-    pmm_init(mem_size);
+    // Track every frame up to the highest usable one, if the frame tables
+    // fit in low memory
+    uint32_t meta = frame_tables_place(&mem_size);
+    if (!meta)
+    {
+        print_string("No memory for the frame tables! System Halted!", 6);
+        for (;;)
+        {
+            __asm__ volatile("hlt");
+        }
+    }
+    uint32_t meta_end = pmm_init(mem_size, meta);
 
-    // Mark available memory regions (simple: assume 1MB-16MB is available)
-    pmm_init_region(0x100000, 15 * 1024 * 1024); // 15MB starting at 1MB
+    // Mark available memory regions from the boot loader's memory map
+    for (uint32_t i = 0; i < mem_region_count; i++)
+        pmm_init_region(mem_region_base[i], mem_region_size[i]);
 
     // Reserve kernel memory (first 1MB)
     pmm_deinit_region(0, 0x100000);
 
+    // Reserve the kernel image and the frame tables so that frames handed
+    // out by the PMM never alias kernel code or data
+    pmm_deinit_region(0x100000, (((uint32_t)kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)) - 0x100000);
+    pmm_deinit_region(meta, meta_end - meta);
+
     print_string("Memory manager initialized!", 6);
 
     // Initialize paging
@@ -94,9 +194,9 @@ void kernel_main(void)
     paging_enable();
     print_string("Paging enabled!", 8);
 
-    // Initialize kernel heap (1MB heap starting at 4MB)
+    // Initialize kernel heap (grows from KHEAP_BASE as needed)
     print_string("Initializing kernel heap...", 9);
-    kmalloc_init((void *)0x00400000, 1024 * 1024); // 1MB heap at 4MB
+    kmalloc_init();
     print_string("Heap initialized!", 10);
 
     print_string("Initializing PIC and IRQs...", 11);
@@ -107,6 +207,9 @@ void kernel_main(void)
     // Install IRQ handlers
     irq_install();
 
+    // Program the PIT and calibrate the TSC
+    timer_init(TIMER_HZ);
+
     print_string("Interrupts ready! Enabling...", 12);
 
     // Enable interrupts
@@ -125,6 +228,13 @@ void kernel_main(void)
     task_init();
     print_string("Multitasking enabled!", 17);
 
+    // Lazy FPU/SSE switching (needs a current task for the #NM handler)
+    fpu_init();
+
+    // Per-CPU GDT/TSS, APIC interrupt routing and the other processors
+    // (needs the idle task and the FPU setup the APs copy)
+    smp_init();
+
     // Initialize IPC
     print_string("Initializing IPC...", 18);
     ipc_init();
@@ -284,10 +394,10 @@ void kernel_main(void)
     shell_init();
     keyboard_enable_shell();
 
-    // Loop indefinitely
+    // Idle loop: run ready tasks, otherwise halt (tickless when possible)
     while (1)
     {
-        // Halt CPU until next interrupt
-        __asm__ volatile("hlt");
+        kmalloc_trim();
+        timer_idle();
     }
 }
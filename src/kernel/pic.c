@@ -70,6 +70,17 @@ void pic_send_eoi(uint8_t irq)
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+// Enable an IRQ line (and the cascade for lines on the slave PIC)
+void pic_unmask(uint8_t irq)
+{
+    if (irq >= 8)
+    {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+        irq = 2;
+    }
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+}
+
 // Install IRQ handlers
 void irq_install(void)
 {
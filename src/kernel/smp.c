@@ -0,0 +1,485 @@
+#include "smp.h"
+#include "apic.h"
+#include "idt.h"
+#include "isr.h"
+#include "fpu.h"
+#include "paging.h"
+#include "port_io.h"
+#include "timer.h"
+#include "syscall.h"
+#include <stddef.h>
+
+struct cpu cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+
+static int apic_on;
+
+// ============= GDT and TSS =============
+
+static uint64_t gdt[GDT_ENTRIES];
+
+static struct
+{
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_desc;
+
+static uint64_t gdt_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags)
+{
+    uint64_t e = limit & 0xFFFF;
+    e |= (uint64_t)(base & 0xFFFFFF) << 16;
+    e |= (uint64_t)access << 40;
+    e |= (uint64_t)((limit >> 16) & 0xF) << 48;
+    e |= (uint64_t)(flags & 0xF) << 52;
+    e |= (uint64_t)((base >> 24) & 0xFF) << 56;
+    return e;
+}
+
+// Same segments as boot.s, plus one TSS per CPU
+static void gdt_init(void)
+{
+    gdt[0] = 0;
+    gdt[1] = gdt_entry(0, 0xFFFFF, 0x9A, 0xC); // Kernel code
+    gdt[2] = gdt_entry(0, 0xFFFFF, 0x92, 0xC); // Kernel data
+    gdt[3] = gdt_entry(0, 0xFFFFF, 0xFA, 0xC); // User code
+    gdt[4] = gdt_entry(0, 0xFFFFF, 0xF2, 0xC); // User data
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++)
+    {
+        struct tss *tss = &cpus[i].tss;
+        uint8_t *p = (uint8_t *)tss;
+        for (uint32_t j = 0; j < sizeof(struct tss); j++)
+            p[j] = 0;
+        tss->ss0 = GDT_KERNEL_DATA;
+        tss->iomap_base = sizeof(struct tss); // No I/O bitmap
+
+        cpus[i].index = i;
+        gdt[GDT_TSS_FIRST + i] = gdt_entry((uint32_t)tss, sizeof(struct tss) - 1, 0x89, 0x0);
+    }
+
+    gdt_desc.limit = sizeof(gdt) - 1;
+    gdt_desc.base = (uint32_t)gdt;
+}
+
+// Load the GDT and this CPU's TSS. The code and data descriptors match
+// the ones already in the segment registers, so those need no reload.
+static void gdt_load(struct cpu *cpu)
+{
+    __asm__ volatile("lgdt %0" : : "m"(gdt_desc));
+    __asm__ volatile("ltr %w0" : : "r"((GDT_TSS_FIRST + cpu->index) * 8));
+}
+
+// ============= MP configuration table =============
+
+struct mp_float
+{
+    char signature[4]; // "_MP_"
+    uint32_t config;   // Physical address of the configuration table
+    uint8_t length;    // In 16-byte units
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t feature1;  // Nonzero: a default configuration, no table
+    uint8_t feature2;  // Bit 7: IMCR present
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct mp_config
+{
+    char signature[4]; // "PCMP"
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem[8];
+    char product[12];
+    uint32_t oem_table;
+    uint16_t oem_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed));
+
+#define MP_PROCESSOR 0
+#define MP_BUS 1
+#define MP_IOAPIC 2
+#define MP_IOINT 3
+#define MP_LINT 4
+
+#define MP_CPU_ENABLED 0x01
+#define MP_CPU_BSP 0x02
+#define MP_IMCR 0x80
+
+#define MP_BUS_MAX 32
+#define BUS_OTHER 0
+#define BUS_ISA 1
+#define BUS_PCI 2
+
+struct mp_processor
+{
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed));
+
+struct mp_bus
+{
+    uint8_t type;
+    uint8_t bus_id;
+    char bus_type[6];
+} __attribute__((packed));
+
+struct mp_ioapic
+{
+    uint8_t type;
+    uint8_t id;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t addr;
+} __attribute__((packed));
+
+struct mp_ioint
+{
+    uint8_t type;
+    uint8_t int_type; // 0 = vectored interrupt
+    uint16_t flags;   // Polarity (bits 0-1), trigger (bits 2-3)
+    uint8_t src_bus;
+    uint8_t src_irq;
+    uint8_t dst_ioapic;
+    uint8_t dst_pin;
+} __attribute__((packed));
+
+static int mp_checksum(const void *p, uint32_t len)
+{
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++)
+        sum += ((const uint8_t *)p)[i];
+    return sum == 0;
+}
+
+static struct mp_float *mp_scan(uint32_t base, uint32_t len)
+{
+    for (uint32_t p = base; p + sizeof(struct mp_float) <= base + len; p += 16)
+    {
+        struct mp_float *mp = (struct mp_float *)p;
+        if (mp->signature[0] == '_' && mp->signature[1] == 'M' &&
+            mp->signature[2] == 'P' && mp->signature[3] == '_' &&
+            mp->length == 1 && mp_checksum(mp, 16))
+            return mp;
+    }
+    return NULL;
+}
+
+// The floating pointer is in the first KB of the EBDA, the last KB of
+// base memory or the BIOS ROM
+static struct mp_float *mp_find(void)
+{
+    struct mp_float *mp;
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t *)0x40E) << 4;
+    uint32_t base_kb = *(volatile uint16_t *)0x413;
+
+    if (ebda && (mp = mp_scan(ebda, 1024)))
+        return mp;
+    if (base_kb >= 1 && (mp = mp_scan(base_kb * 1024 - 1024, 1024)))
+        return mp;
+    return mp_scan(0xF0000, 0x10000);
+}
+
+// Polarity and trigger of an interrupt entry; "conforms to bus" means
+// active high/edge for ISA and active low/level for PCI
+static uint32_t mp_pin_flags(uint16_t flags, int bus)
+{
+    uint32_t polarity = flags & 3;
+    uint32_t trigger = (flags >> 2) & 3;
+    uint32_t out = 0;
+
+    if (polarity == 3 || (polarity == 0 && bus == BUS_PCI))
+        out |= IOAPIC_ACTIVE_LOW;
+    if (trigger == 3 || (trigger == 0 && bus == BUS_PCI))
+        out |= IOAPIC_LEVEL;
+    return out;
+}
+
+// Walk the table: CPUs go to cpus[] (the BSP first), the first I/O APIC
+// and its interrupt routing go to the APIC driver
+static uint32_t mp_parse(struct mp_config *cfg, uint32_t *ioapic_addr)
+{
+    uint8_t bus_type[MP_BUS_MAX];
+    uint32_t ioapic_id = 0xFF;
+    uint32_t ncpus = 1;
+    uint8_t *p = (uint8_t *)(cfg + 1);
+
+    for (int i = 0; i < MP_BUS_MAX; i++)
+        bus_type[i] = BUS_OTHER;
+    *ioapic_addr = 0;
+
+    for (uint32_t i = 0; i < cfg->entry_count && p < (uint8_t *)cfg + cfg->length; i++)
+    {
+        switch (*p)
+        {
+        case MP_PROCESSOR:
+        {
+            struct mp_processor *proc = (struct mp_processor *)p;
+            if (!(proc->flags & MP_CPU_ENABLED))
+                break;
+            if (proc->flags & MP_CPU_BSP)
+                cpus[0].apic_id = proc->apic_id;
+            else if (ncpus < MAX_CPUS)
+                cpus[ncpus++].apic_id = proc->apic_id;
+            break;
+        }
+        case MP_BUS:
+        {
+            struct mp_bus *bus = (struct mp_bus *)p;
+            if (bus->bus_id < MP_BUS_MAX)
+            {
+                if (bus->bus_type[0] == 'I' && bus->bus_type[1] == 'S' && bus->bus_type[2] == 'A')
+                    bus_type[bus->bus_id] = BUS_ISA;
+                else if (bus->bus_type[0] == 'P' && bus->bus_type[1] == 'C' && bus->bus_type[2] == 'I')
+                    bus_type[bus->bus_id] = BUS_PCI;
+            }
+            break;
+        }
+        case MP_IOAPIC:
+        {
+            struct mp_ioapic *io = (struct mp_ioapic *)p;
+            if ((io->flags & 1) && !*ioapic_addr)
+            {
+                *ioapic_addr = io->addr;
+                ioapic_id = io->id;
+                ioapic_init(io->addr);
+            }
+            break;
+        }
+        case MP_IOINT:
+        {
+            struct mp_ioint *irq = (struct mp_ioint *)p;
+            if (irq->int_type != 0 || !*ioapic_addr)
+                break;
+            if (irq->dst_ioapic != ioapic_id && irq->dst_ioapic != 0xFF)
+                break;
+
+            int bus = irq->src_bus < MP_BUS_MAX ? bus_type[irq->src_bus] : BUS_OTHER;
+            ioapic_set_pin_flags(irq->dst_pin, mp_pin_flags(irq->flags, bus));
+            if (bus == BUS_ISA)
+                ioapic_route_isa(irq->src_irq, irq->dst_pin);
+            break;
+        }
+        default:
+            break;
+        }
+
+        p += *p == MP_PROCESSOR ? sizeof(struct mp_processor) : 8;
+    }
+
+    return ncpus;
+}
+
+// ============= AP startup =============
+
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+extern uint32_t ap_cr3;
+extern uint32_t ap_stack;
+extern uint32_t ap_entry;
+
+static struct cpu *volatile ap_booting;
+
+// Where a trampoline variable lives in the copy
+static inline volatile uint32_t *ap_var(uint32_t *var)
+{
+    return (volatile uint32_t *)(AP_TRAMPOLINE_ADDR + ((uint8_t *)var - ap_trampoline));
+}
+
+static void smp_delay_us(uint32_t us)
+{
+    uint32_t khz = timer_tsc_khz();
+    if (!khz)
+    {
+        // No TSC rate: whole ticks, rounded up
+        uint32_t start = timer_ticks;
+        uint32_t ticks = timer_ms_to_ticks((us + 999) / 1000) + 1;
+        while (timer_ticks - start < ticks)
+            __asm__ volatile("pause");
+        return;
+    }
+
+    uint64_t start = timer_rdtsc();
+    uint64_t target = (uint64_t)us * khz;
+    while ((timer_rdtsc() - start) * 1000 < target)
+        __asm__ volatile("pause");
+}
+
+// First C code on an AP, on its idle task's stack
+static void ap_main(void)
+{
+    struct cpu *cpu = ap_booting;
+
+    gdt_load(cpu);
+    idt_reload();
+    fpu_init_cpu();
+    syscall_init_cpu();
+    lapic_init_ap();
+
+    cpu->online = 1;
+    __asm__ volatile("sti");
+
+    while (1)
+        timer_idle();
+}
+
+static int smp_start_ap(struct cpu *cpu)
+{
+    struct task *idle = task_create_idle(cpu);
+    if (!idle)
+        return -1;
+
+    *ap_var(&ap_cr3) = (uint32_t)paging_get_kernel_directory();
+    *ap_var(&ap_stack) = idle->kernel_stack;
+    *ap_var(&ap_entry) = (uint32_t)ap_main;
+    ap_booting = cpu;
+
+    // INIT, then STARTUP twice (the second one is ignored if the first
+    // got through), as in the MP specification
+    lapic_send_ipi(cpu->apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+    smp_delay_us(200);
+    lapic_send_ipi(cpu->apic_id, ICR_INIT | ICR_LEVEL);
+    smp_delay_us(10000);
+
+    for (int i = 0; i < 2 && !cpu->online; i++)
+    {
+        lapic_send_ipi(cpu->apic_id, ICR_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        smp_delay_us(200);
+    }
+
+    for (int i = 0; i < 100 && !cpu->online; i++)
+        smp_delay_us(1000);
+
+    return cpu->online ? 0 : -1;
+}
+
+void smp_init(void)
+{
+    gdt_init();
+    gdt_load(&cpus[0]);
+    cpus[0].online = 1;
+
+    struct mp_float *mp = mp_find();
+    if (!mp || mp->feature1 != 0 || !mp->config)
+        return;
+
+    struct mp_config *cfg = (struct mp_config *)mp->config;
+    if (cfg->signature[0] != 'P' || cfg->signature[1] != 'C' ||
+        cfg->signature[2] != 'M' || cfg->signature[3] != 'P' ||
+        !mp_checksum(cfg, cfg->length))
+        return;
+
+    if (lapic_init(cfg->lapic_addr) != 0)
+        return;
+
+    uint32_t ioapic_addr;
+    uint32_t ncpus = mp_parse(cfg, &ioapic_addr);
+    cpus[0].apic_id = lapic_id();
+
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uint32_t)irq16, 0x08, 0x8E);
+    idt_set_gate(RESCHED_VECTOR, (uint32_t)irq17, 0x08, 0x8E);
+    idt_set_gate(TLB_VECTOR, (uint32_t)irq18, 0x08, 0x8E);
+    idt_set_gate(SPURIOUS_VECTOR, (uint32_t)irq_spurious, 0x08, 0x8E);
+
+    if (ioapic_addr)
+    {
+        uint32_t flags = irq_save();
+
+        // Route the 8259 output away from the BSP's LINT0
+        if (mp->feature2 & MP_IMCR)
+        {
+            outb(0x22, 0x70);
+            outb(0x23, 0x01);
+        }
+        apic_enable(cpus[0].apic_id);
+        apic_on = 1;
+        irq_restore(flags);
+    }
+
+    uint8_t *src = ap_trampoline;
+    uint8_t *dst = (uint8_t *)AP_TRAMPOLINE_ADDR;
+    for (uint32_t i = 0; i < (uint32_t)(ap_trampoline_end - ap_trampoline); i++)
+        dst[i] = src[i];
+
+    // Boot APs one at a time: they share the trampoline variables
+    for (uint32_t i = 1; i < ncpus; i++)
+    {
+        struct cpu *cpu = &cpus[cpu_count];
+        cpu->apic_id = cpus[i].apic_id;
+        if (smp_start_ap(cpu) == 0)
+            cpu_count++;
+    }
+    ap_booting = NULL;
+}
+
+void smp_send_resched(struct cpu *cpu)
+{
+    if (cpu_count == 1 || !cpu->online || cpu == this_cpu())
+        return;
+    lapic_send_ipi(cpu->apic_id, ICR_FIXED | ICR_ASSERT | RESCHED_VECTOR);
+}
+
+static inline void tlb_reload(void)
+{
+    __asm__ volatile("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+}
+
+// Runs with interrupts off, so nothing on this CPU can re-enter it while
+// flush_lock is held: this CPU flushes itself directly and only the
+// others get the IPI.
+void smp_flush_tlb_all(void)
+{
+    static spinlock_t flush_lock = SPINLOCK_INIT;
+
+    uint32_t flags = irq_save();
+    struct cpu *self = this_cpu();
+    if (cpu_count == 1)
+    {
+        tlb_reload();
+        irq_restore(flags);
+        return;
+    }
+
+    // The CPU holding the lock may be waiting for our flush
+    while (!spin_trylock(&flush_lock))
+    {
+        if (self->tlb_flush)
+        {
+            tlb_reload();
+            self->tlb_flush = 0;
+        }
+        __asm__ volatile("pause");
+    }
+
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        struct cpu *cpu = &cpus[i];
+        if (cpu == self || !cpu->online)
+            continue;
+        cpu->tlb_flush = 1;
+        lapic_send_ipi(cpu->apic_id, ICR_FIXED | ICR_ASSERT | TLB_VECTOR);
+    }
+    tlb_reload();
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        while (cpus[i].tlb_flush)
+            __asm__ volatile("pause");
+    }
+
+    spin_unlock(&flush_lock);
+    irq_restore(flags);
+}
+
+int smp_apic_enabled(void)
+{
+    return apic_on;
+}
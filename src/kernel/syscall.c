@@ -6,10 +6,25 @@
 #include "ipc.h"
 #include "ioport.h"
 #include "irq_bridge.h"
+#include "keyboard.h"
+#include "smp.h"
+#include "paging.h"
 
 // External assembly syscall handler
 extern void syscall_asm_handler(void);
 
+// Fast entry (syscall_asm.s)
+extern void sysenter_entry(void);
+extern uint8_t vsyscall_sysenter_start[], vsyscall_sysenter_end[];
+extern uint8_t vsyscall_int80_start[], vsyscall_int80_end[];
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// Backing page of the stub mapped at VSYSCALL_ADDR
+static uint8_t vsyscall_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
 // System call table
 static syscall_handler_t syscall_table[SYSCALL_MAX];
 
@@ -20,14 +35,7 @@ extern void print_char(char c, int col, int row);
 // Syscall: exit
 int sys_exit(int status)
 {
-    (void)status; // Unused for now
-
-    // For now, just halt
-    while (1)
-    {
-        __asm__ volatile("hlt");
-    }
-
+    task_exit(status);
     return 0;
 }
 
@@ -43,13 +51,12 @@ int sys_write(int fd, const char *buf, int count)
     return count;
 }
 
-// Syscall: read (not implemented yet)
+// Syscall: read (only stdin, from the keyboard)
 int sys_read(int fd, char *buf, int count)
 {
-    (void)fd;
-    (void)buf;
-    (void)count;
-    return 0;
+    if (fd != 0)
+        return 0;
+    return keyboard_read(buf, count);
 }
 
 // Syscall: getpid
@@ -63,6 +70,12 @@ int sys_getpid(void)
     return -1;
 }
 
+// Syscall: null (measures the cost of entering and leaving the kernel)
+int sys_null(void)
+{
+    return 0;
+}
+
 // Syscall: yield
 int sys_yield(void)
 {
@@ -106,6 +119,24 @@ int sys_ipc_send(uint32_t dest_port, uint32_t type, const void *data, uint32_t s
     return ipc_send(dest_port, type, data, size);
 }
 
+// Syscall: IPC send grant (zero-copy pages)
+int sys_ipc_send_grant(uint32_t dest_port, uint32_t type, void *vaddr, uint32_t npages)
+{
+    return ipc_send_grant(dest_port, type, vaddr, npages);
+}
+
+// Syscall: IPC buffer alloc (returns window address, 0 on failure)
+int sys_ipc_buf_alloc(uint32_t npages)
+{
+    return (int)ipc_buf_alloc(npages);
+}
+
+// Syscall: IPC buffer free
+int sys_ipc_buf_free(void *vaddr, uint32_t npages)
+{
+    return ipc_buf_free(vaddr, npages);
+}
+
 // Syscall: IPC recv
 int sys_ipc_recv(uint32_t port_id, void *msg)
 {
@@ -124,6 +155,70 @@ int sys_ipc_find_port(const char *name)
     return ipc_find_port(name);
 }
 
+int sys_ipc_lookup(void *handle)
+{
+    return ipc_lookup((struct ipc_handle *)handle);
+}
+
+int sys_ipc_send_wait(uint32_t src_port, uint32_t dest_port, uint32_t type, const void *data, uint32_t size)
+{
+    return ipc_send_wait(src_port, dest_port, type, data, size);
+}
+
+int sys_ipc_sendv(uint32_t src_port, uint32_t dest_port, const void *vec, uint32_t count, uint32_t flags)
+{
+    return ipc_sendv(src_port, dest_port, (const struct ipc_iovec *)vec, count, flags);
+}
+
+int sys_ipc_recvv(uint32_t port_id, void *msgs, uint32_t max)
+{
+    return ipc_recvv(port_id, (struct ipc_message *)msgs, max);
+}
+
+int sys_ipc_set_queue_depth(uint32_t port_id, uint32_t depth)
+{
+    return ipc_set_queue_depth(port_id, depth);
+}
+
+int sys_ipc_wait_notification(uint32_t port_id, uint32_t *bits)
+{
+    return ipc_wait_notification(port_id, bits);
+}
+
+int sys_ipc_notify(uint32_t port_id, uint32_t bits)
+{
+    return ipc_notify(port_id, bits);
+}
+
+int sys_ipc_poll_notification(uint32_t port_id, uint32_t *bits)
+{
+    return ipc_poll_notification(port_id, bits);
+}
+
+int sys_ipc_wait_any(const uint32_t *ports, uint32_t count, uint32_t timeout, uint32_t *ready)
+{
+    return ipc_wait_any(ports, count, timeout, ready);
+}
+
+// Request and reply are passed as struct ipc_message (type, size, data)
+// because the call needs more arguments than fit in registers
+int sys_ipc_call(uint32_t src_port, uint32_t dest_port, const void *req, void *reply)
+{
+    const struct ipc_message *m = (const struct ipc_message *)req;
+    if (!m)
+        return -1;
+    return ipc_call(src_port, dest_port, m->type, m->data, m->size, (struct ipc_message *)reply);
+}
+
+int sys_ipc_reply_wait(uint32_t port_id, uint32_t reply_port, const void *reply, void *msg)
+{
+    const struct ipc_message *m = (const struct ipc_message *)reply;
+    if (!m)
+        reply_port = IPC_NO_REPLY;
+    return ipc_reply_wait(port_id, reply_port, m ? m->type : 0, m ? m->data : 0, m ? m->size : 0,
+                          (struct ipc_message *)msg);
+}
+
 // System call handler (called from ISR)
 void syscall_handler(struct registers *regs)
 {
@@ -151,6 +246,10 @@ void syscall_handler(struct registers *regs)
 
     // Return value in EAX
     regs->eax = ret;
+
+    // The call woke a task that preempts us
+    if (this_cpu()->need_resched)
+        task_resched();
 }
 
 // Initialize system calls
@@ -175,14 +274,71 @@ void syscall_init(void)
     syscall_table[SYS_IPC_CREATE_NAMED_PORT] = (syscall_handler_t)sys_ipc_create_named_port;
     syscall_table[SYS_IPC_DESTROY_PORT] = (syscall_handler_t)sys_ipc_destroy_port;
     syscall_table[SYS_IPC_SEND] = (syscall_handler_t)sys_ipc_send;
+    syscall_table[SYS_IPC_SEND_GRANT] = (syscall_handler_t)sys_ipc_send_grant;
+    syscall_table[SYS_IPC_BUF_ALLOC] = (syscall_handler_t)sys_ipc_buf_alloc;
+    syscall_table[SYS_IPC_BUF_FREE] = (syscall_handler_t)sys_ipc_buf_free;
     syscall_table[SYS_IPC_RECV] = (syscall_handler_t)sys_ipc_recv;
     syscall_table[SYS_IPC_TRY_RECV] = (syscall_handler_t)sys_ipc_try_recv;
     syscall_table[SYS_IPC_FIND_PORT] = (syscall_handler_t)sys_ipc_find_port;
     syscall_table[SYS_REQUEST_IO_PORT] = (syscall_handler_t)sys_request_io_port;
     syscall_table[SYS_REGISTER_IRQ_HANDLER] = (syscall_handler_t)sys_register_irq_handler;
+    syscall_table[SYS_IPC_CALL] = (syscall_handler_t)sys_ipc_call;
+    syscall_table[SYS_IPC_REPLY_WAIT] = (syscall_handler_t)sys_ipc_reply_wait;
+    syscall_table[SYS_IPC_LOOKUP] = (syscall_handler_t)sys_ipc_lookup;
+    syscall_table[SYS_IPC_SET_QUEUE_DEPTH] = (syscall_handler_t)sys_ipc_set_queue_depth;
+    syscall_table[SYS_IPC_SEND_WAIT] = (syscall_handler_t)sys_ipc_send_wait;
+    syscall_table[SYS_IPC_SENDV] = (syscall_handler_t)sys_ipc_sendv;
+    syscall_table[SYS_IPC_RECVV] = (syscall_handler_t)sys_ipc_recvv;
+    syscall_table[SYS_IPC_WAIT_NOTIFICATION] = (syscall_handler_t)sys_ipc_wait_notification;
+    syscall_table[SYS_IPC_NOTIFY] = (syscall_handler_t)sys_ipc_notify;
+    syscall_table[SYS_IPC_POLL_NOTIFICATION] = (syscall_handler_t)sys_ipc_poll_notification;
+    syscall_table[SYS_IPC_WAIT_ANY] = (syscall_handler_t)sys_ipc_wait_any;
+    syscall_table[SYS_NULL] = (syscall_handler_t)sys_null;
 
     // Register INT 0x80 in IDT (0xEE = present, ring 3, 32-bit trap gate)
     idt_set_gate(0x80, (uint32_t)syscall_asm_handler, 0x08, 0xEE);
+
+    // Map the fast entry stub, read-only and executable from ring 3
+    uint8_t *start = syscall_sysenter_ok() ? vsyscall_sysenter_start : vsyscall_int80_start;
+    uint8_t *end = syscall_sysenter_ok() ? vsyscall_sysenter_end : vsyscall_int80_end;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++)
+        vsyscall_page[i] = start + i < end ? start[i] : 0xCC; // int3 past the stub
+    paging_map_page(vsyscall_page, (void *)VSYSCALL_ADDR, PAGE_PRESENT | PAGE_USER);
+
+    syscall_init_cpu();
+}
+
+static inline void wrmsr(uint32_t msr, uint32_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+// SEP in CPUID leaf 1, except on early Pentium Pros, which report it
+// without implementing it
+int syscall_sysenter_ok(void)
+{
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+
+    uint32_t family = (a >> 8) & 0xF;
+    uint32_t model = (a >> 4) & 0xF;
+    uint32_t stepping = a & 0xF;
+    if (family == 6 && model < 3 && stepping < 3)
+        return 0;
+    return (d >> 11) & 1;
+}
+
+// Point SYSENTER at sysenter_entry on this CPU. Its stack pointer is the
+// address of this CPU's tss.esp0, from which the entry code loads the
+// running task's kernel stack.
+void syscall_init_cpu(void)
+{
+    if (!syscall_sysenter_ok())
+        return;
+
+    wrmsr(MSR_SYSENTER_CS, 0x08);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&this_cpu()->tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
 }
 
 // Syscall: request_io_port - 请求 I/O 端口访问权限
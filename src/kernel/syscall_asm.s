@@ -27,7 +27,9 @@ syscall_asm_handler:
     
     # Clean up stack
     add $4, %esp
-    
+
+# A forked child that entered with int $0x80 leaves here too
+syscall_return:
     # Restore data segment
     pop %ebx
     mov %bx, %ds
@@ -41,3 +43,178 @@ syscall_asm_handler:
     sti
     iret
 
+
+# ============= Fast entry =============
+#
+# vsyscall_init() copies one of the stubs below to the page at
+# VSYSCALL_ADDR (see syscall.h), which every task can execute. Callers
+# load the int $0x80 registers and `call VSYSCALL_ADDR`; only EAX changes.
+# The stubs are position independent. Ring 0 callers (the kernel-mode
+# driver tasks) take a direct call instead: SYSEXIT always returns to
+# ring 3, and SYSENTER would reload ESP with the top of the caller's own
+# stack.
+
+.set VSYSCALL_ADDR, 0xFFFFE000
+
+.global vsyscall_sysenter_start
+.global vsyscall_sysenter_end
+.global vsyscall_int80_start
+.global vsyscall_int80_end
+.global sysenter_entry
+.global syscall_kernel_entry
+.global syscall_return
+.global sysenter_return
+.global fork_child_entry
+
+vsyscall_sysenter_start:
+    push %ebp
+    mov %cs, %ebp
+    test $3, %ebp
+    jz 1f
+
+    # Ring 3: SYSEXIT returns to vsyscall_sysexit with ESP = EBP
+    push %ecx
+    push %edx
+    mov %esp, %ebp
+    sysenter
+vsyscall_sysexit:
+    pop %edx
+    pop %ecx
+    pop %ebp
+    ret
+
+1:  mov $syscall_kernel_entry, %ebp
+    call *%ebp
+    pop %ebp
+    ret
+vsyscall_sysenter_end:
+
+# For CPUs without SYSENTER
+vsyscall_int80_start:
+    push %ebp
+    mov %cs, %ebp
+    test $3, %ebp
+    jz 1f
+    int $0x80
+    pop %ebp
+    ret
+
+1:  mov $syscall_kernel_entry, %ebp
+    call *%ebp
+    pop %ebp
+    ret
+vsyscall_int80_end:
+
+# SYSENTER lands here with CS/SS = kernel, interrupts off and ESP set to
+# this CPU's tss.esp0 field (IA32_SYSENTER_ESP), which holds the top of
+# the current task's kernel stack. EBP is the user stack pointer.
+sysenter_entry:
+    mov (%esp), %esp
+
+    # Same frame as syscall_asm_handler
+    pusha
+    mov %ds, %ax
+    push %eax
+
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+
+    push %esp
+    call syscall_handler
+    add $4, %esp
+
+# Same for a forked child that entered with SYSENTER
+sysenter_return:
+    pop %ebx
+    mov %bx, %ds
+    mov %bx, %es
+    mov %bx, %fs
+    mov %bx, %gs
+    popa
+
+    # SYSEXIT: EIP = EDX, ESP = ECX (the stub restores both). sti takes
+    # effect after the next instruction, so no interrupt comes in between.
+    mov %ebp, %ecx
+    mov $(VSYSCALL_ADDR + vsyscall_sysexit - vsyscall_sysenter_start), %edx
+    sti
+    sysexit
+
+# First code of a forked child. task_fork_with_regs() puts a copy of the
+# parent's system call frame at the top of its kernel stack, passes the
+# frame in ESI and the matching exit (syscall_return or sysenter_return)
+# in EDI; both survive the call.
+fork_child_entry:
+    call task_fork_finish
+    mov %esi, %esp
+    jmp *%edi
+
+# Ring 0 callers of the stub: a plain call, no gate, no segment reloads
+syscall_kernel_entry:
+    pushf
+    cli
+    pusha
+    mov %ds, %ax
+    push %eax
+
+    push %esp
+    call syscall_handler
+    add $4, %esp
+
+    pop %ebx
+    popa
+    popf
+    ret
+
+# ============= Benchmark =============
+#
+# Ring 3 half of the null system call benchmark (sched_test.c copies it
+# to a user page at SYS_BENCH_USER). Times SYS_NULL through int $0x80 and
+# through the stub, storing TSC deltas next to the call count, then exits.
+
+.set SYS_BENCH_DATA, 0xFFFFC800 # count, int $0x80 cycles (64-bit), stub cycles (64-bit)
+.set SYS_NULL, 31
+.set SYS_EXIT, 0
+
+.global syscall_bench_user
+.global syscall_bench_user_end
+
+syscall_bench_user:
+    mov $SYS_BENCH_DATA, %ebx
+    mov $VSYSCALL_ADDR, %edi
+
+    mov (%ebx), %esi
+    rdtsc
+    mov %eax, 4(%ebx)
+    mov %edx, 8(%ebx)
+1:  mov $SYS_NULL, %eax
+    int $0x80
+    dec %esi
+    jnz 1b
+    rdtsc
+    sub 4(%ebx), %eax
+    sbb 8(%ebx), %edx
+    mov %eax, 4(%ebx)
+    mov %edx, 8(%ebx)
+
+    mov (%ebx), %esi
+    rdtsc
+    mov %eax, 12(%ebx)
+    mov %edx, 16(%ebx)
+2:  mov $SYS_NULL, %eax
+    call *%edi
+    dec %esi
+    jnz 2b
+    rdtsc
+    sub 12(%ebx), %eax
+    sbb 16(%ebx), %edx
+    mov %eax, 12(%ebx)
+    mov %edx, 16(%ebx)
+
+    mov $SYS_EXIT, %eax
+    xor %ebx, %ebx
+    int $0x80
+3:  jmp 3b
+syscall_bench_user_end:
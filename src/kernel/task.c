@@ -2,109 +2,583 @@
 #include "kmalloc.h"
 #include "paging.h"
 #include "isr.h"
+#include "timer.h"
+#include "slab.h"
+#include "fpu.h"
+#include "smp.h"
+#include "irq_bridge.h"
+#include "ipc.h"
+#include <stddef.h>
 
-#define MAX_TASKS 32
 #define TIME_SLICE 5
+#define TASK_STACK_SIZE 4096
+#define SCHED_CACHE_HOT 2 // Ticks a task's cache lines stay warm after it ran
 
-// Simple single queue
-static struct task *tasks[MAX_TASKS];
-static struct task *current_task = 0;
-static struct task *ready_queue = 0; // Simple circular queue
-static uint32_t next_pid = 1;
+// Scheduler entry reasons
+#define SCHED_TICK 0  // Timer tick: account and preempt at the end of the slice
+#define SCHED_YIELD 1 // Give up the rest of the slice
+#define SCHED_CHECK 2 // Only preempt for a better queued task
+
+// Each CPU has its own run queue, current task and idle task (struct cpu,
+// under cpu->rq_lock). The rq lock is held across task_switch() and
+// released by the task switched to, so no other CPU sees a half-switched
+// task. Lock order: task_lock, then subsystem locks, then rq locks; two
+// rq locks are taken in CPU index order, or with a trylock. timer_lock is
+// a leaf: the budget timer of a deadline task is armed under an rq lock.
+
+static struct task *idle_task = 0; // CPU 0's idle task, parent of orphans
 static int tasking_enabled = 0;
+static int sched_affinity = 1;     // Wake on the last CPU, co-locate IPC peers
 static uint32_t global_ticks = 0;
+static uint32_t rt_util = 0;       // Permille reserved by deadline tasks (task_lock)
+
+static spinlock_t task_lock; // PID map and the process tree
+
+static struct kmem_cache task_cache;  // struct task
+static struct kmem_cache stack_cache; // Kernel stacks
+
+// ============= PID map =============
+//
+// A PID is a slot index in the low PID_INDEX_BITS and the slot's
+// generation above them. Lookup is one array access plus a generation
+// check; a freed slot is reused with the next generation, so a stale PID
+// never finds the new owner. The table doubles when it fills up.
+
+#define PID_INDEX_BITS 16
+#define PID_INDEX_MASK ((1u << PID_INDEX_BITS) - 1)
+#define PID_GEN_MASK 0x7FFF // Keep PIDs positive
+#define PID_TABLE_INIT 64
+#define PID_TABLE_MAX (1u << PID_INDEX_BITS)
+
+struct pid_slot
+{
+    struct task *task;  // NULL when free
+    uint32_t gen;       // Generation of the current (or next) owner
+    uint32_t next_free; // Free list link (0 = end; slot 0 is idle's)
+};
+
+static struct pid_slot *pid_table;
+static uint32_t pid_table_size;
+static uint32_t pid_slots_used; // Slots ever handed out (high-water mark)
+static uint32_t pid_free_head;
+static uint32_t pid_free_tail;
+static uint32_t task_count;
+
+static inline uint32_t pid_make(uint32_t index, uint32_t gen)
+{
+    return (gen << PID_INDEX_BITS) | index;
+}
+
+static int pid_table_grow(void)
+{
+    if (pid_table_size >= PID_TABLE_MAX)
+        return -1;
 
-// Simple queue operations
-static void simple_queue_add(struct task *task)
+    uint32_t size = pid_table_size ? pid_table_size * 2 : PID_TABLE_INIT;
+    struct pid_slot *table = (struct pid_slot *)kmalloc(size * sizeof(struct pid_slot));
+    if (!table)
+        return -1;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (i < pid_table_size)
+            table[i] = pid_table[i];
+        else
+        {
+            table[i].task = 0;
+            table[i].gen = 0;
+            table[i].next_free = 0;
+        }
+    }
+
+    struct pid_slot *old = pid_table;
+    pid_table = table;
+    pid_table_size = size;
+    if (old)
+        kfree(old);
+    return 0;
+}
+
+// Bind `task` to a slot and return its PID, -1 if the table is full
+// (task_lock held)
+static int pid_alloc(struct task *task)
 {
-    if (!ready_queue)
+    uint32_t index;
+
+    // Reuse the longest-free slot first so generations advance slowly
+    if (pid_free_head)
     {
-        ready_queue = task;
-        task->next = task;
+        index = pid_free_head;
+        pid_free_head = pid_table[index].next_free;
+        if (!pid_free_head)
+            pid_free_tail = 0;
     }
     else
     {
-        task->next = ready_queue->next;
-        ready_queue->next = task;
-        ready_queue = task;
+        if (pid_slots_used == pid_table_size && pid_table_grow() != 0)
+            return -1;
+        index = pid_slots_used++;
     }
+
+    pid_table[index].task = task;
+    pid_table[index].next_free = 0;
+    task_count++;
+    return (int)pid_make(index, pid_table[index].gen);
+}
+
+// Release a PID; the slot's next owner gets a new generation
+static void pid_free(uint32_t pid)
+{
+    uint32_t index = pid & PID_INDEX_MASK;
+
+    pid_table[index].task = 0;
+    pid_table[index].gen = (pid_table[index].gen + 1) & PID_GEN_MASK;
+    if (pid_free_tail)
+        pid_table[pid_free_tail].next_free = index;
+    else
+        pid_free_head = index;
+    pid_free_tail = index;
+    task_count--;
+}
+
+// ============= Run queues =============
+//
+// One FIFO per priority level and a bitmap of the non-empty levels, so
+// picking the next task is a bsf plus a list unlink however many tasks
+// exist. Deadline tasks are few and kept sorted on a separate list that
+// is served first. Blocked, throttled and zombie tasks are not on any
+// queue.
+
+static inline int deadline_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+void rq_init(struct run_queue *rq)
+{
+    rq->rt_head = 0;
+    rq->bitmap = 0;
+    rq->count = 0;
+    for (int i = 0; i < PRIORITY_LEVELS; i++)
+    {
+        rq->head[i] = 0;
+        rq->tail[i] = 0;
+    }
+}
+
+// Insert a deadline task behind those with an earlier or equal deadline
+static void rq_enqueue_rt(struct run_queue *rq, struct task *task)
+{
+    struct task *prev = 0;
+    struct task *next = rq->rt_head;
+    while (next && !deadline_before(task->rt_deadline, next->rt_deadline))
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    task->prev = prev;
+    task->next = next;
+    if (prev)
+        prev->next = task;
+    else
+        rq->rt_head = task;
+    if (next)
+        next->prev = task;
+}
+
+void rq_enqueue(struct run_queue *rq, struct task *task)
+{
+    uint32_t prio = task->priority;
+
+    rq->count++;
+    task->queued = 1;
+    if (task->rt_period)
+    {
+        rq_enqueue_rt(rq, task);
+        return;
+    }
+
+    task->next = 0;
+    task->prev = rq->tail[prio];
+    if (rq->tail[prio])
+        rq->tail[prio]->next = task;
+    else
+        rq->head[prio] = task;
+    rq->tail[prio] = task;
+
+    rq->bitmap |= 1u << prio;
+}
+
+void rq_remove(struct run_queue *rq, struct task *task)
+{
+    uint32_t prio = task->priority;
+
+    if (!task->queued)
+        return;
+
+    if (task->rt_period)
+    {
+        if (task->prev)
+            task->prev->next = task->next;
+        else
+            rq->rt_head = task->next;
+        if (task->next)
+            task->next->prev = task->prev;
+    }
+    else
+    {
+        if (task->prev)
+            task->prev->next = task->next;
+        else
+            rq->head[prio] = task->next;
+        if (task->next)
+            task->next->prev = task->prev;
+        else
+            rq->tail[prio] = task->prev;
+
+        if (!rq->head[prio])
+            rq->bitmap &= ~(1u << prio);
+    }
+    rq->count--;
+    task->next = 0;
+    task->prev = 0;
+    task->queued = 0;
+}
+
+// Dequeue the earliest deadline task, else the first task of the highest
+// non-empty priority (NULL if none)
+struct task *rq_pick(struct run_queue *rq)
+{
+    while (rq->rt_head || rq->bitmap)
+    {
+        struct task *task = rq->rt_head ? rq->rt_head : rq->head[__builtin_ctz(rq->bitmap)];
+        rq_remove(rq, task);
+        if (task->state != TASK_ZOMBIE)
+            return task;
+    }
+    return 0;
+}
+
+// Highest queued priority, PRIORITY_LEVELS if nothing is queued
+static inline uint32_t rq_top(struct run_queue *rq)
+{
+    return rq->bitmap ? (uint32_t)__builtin_ctz(rq->bitmap) : PRIORITY_LEVELS;
+}
+
+static inline int task_is_idle(struct task *task)
+{
+    return task == cpus[task->cpu].idle;
+}
+
+// Should `task`, queued on `cpu`, preempt the task running there? Deadline
+// tasks beat normal ones and each other by earlier deadline; a normal
+// task never preempts a deadline task.
+static int task_preempts(struct task *task, struct cpu *cpu)
+{
+    struct task *current = cpu->current;
+    if (current == cpu->idle)
+        return 1;
+    if (task->rt_period)
+        return !current->rt_period || deadline_before(task->rt_deadline, current->rt_deadline);
+    return !current->rt_period && task->priority < current->priority;
+}
+
+// Does anything queued on `cpu` preempt its running task (rq lock held)?
+static int rq_preempts(struct cpu *cpu)
+{
+    struct run_queue *rq = &cpu->rq;
+    if (rq->rt_head)
+        return task_preempts(rq->rt_head, cpu);
+    return rq->bitmap && task_preempts(rq->head[rq_top(rq)], cpu);
+}
+
+static void task_rt_replenish(void *arg);
+
+// Fields shared by every new task
+static void task_setup(struct task *task, const char *name, task_priority_t priority)
+{
+    int i;
+    for (i = 0; i < 31 && name[i]; i++)
+        task->name[i] = name[i];
+    task->name[i] = '\0';
+
+    task->time_slice = TIME_SLICE;
+    task->priority = priority;
+    task->base_priority = priority;
+    task->quantum = TIME_SLICE;
+    task->ticks_used = 0;
+    task->total_ticks = 0;
+    task->context_switches = 0;
+    task->created_time = global_ticks;
+    task->nvcsw = 0;
+    task->nivcsw = 0;
+    task->cpu_cycles = 0;
+    task->run_delay = 0;
+    task->run_delay_max = 0;
+    task->ready_tsc = 0;
+    task->run_tsc = 0;
+    task->sleep_until = 0;
+    task->wait_on = 0;
+    task->parent = 0;
+    task->child = 0;
+    task->sibling = 0;
+    task->exit_code = 0;
+    task->exited = 0;
+    wait_queue_init(&task->child_exit);
+    task->fpu_state = NULL;
+    task->iopb = NULL; // Initialize I/O permission bitmap
+    task->next = 0;
+    task->prev = 0;
+    task->queued = 0;
+    task->entry = 0;
+    task->last_ran = 0;
+    task->migrations = 0;
+    task->rt_budget = 0;
+    task->rt_period = 0;
+    task->rt_deadline = 0;
+    task->rt_remaining = 0;
+    task->rt_util = 0;
+    task->rt_throttled = 0;
+    task->rt_throttles = 0;
+    task->rt_misses = 0;
+    timer_setup(&task->rt_timer, task_rt_replenish, task);
+    task->irq_tsc = 0;
+}
+
+// Make `task` the running idle task of `cpu`
+static void task_setup_idle(struct task *task, struct cpu *cpu)
+{
+    task->state = TASK_RUNNING;
+    task->cpu = cpu->index;
+    task->on_cpu = 1;
+    task->run_tsc = timer_rdtsc();
+
+    spin_init(&cpu->rq_lock);
+    rq_init(&cpu->rq);
+    cpu->idle = task;
+    cpu->current = task;
+    cpu->prev = 0;
+    cpu->need_resched = 0;
 }
 
 // Initialize tasking
 void task_init(void)
 {
-    for (int i = 0; i < MAX_TASKS; i++)
-        tasks[i] = 0;
-
-    current_task = (struct task *)kmalloc(sizeof(struct task));
-    current_task->pid = 0;
-
-    // Set name
-    current_task->name[0] = 'i';
-    current_task->name[1] = 'd';
-    current_task->name[2] = 'l';
-    current_task->name[3] = 'e';
-    current_task->name[4] = '\0';
-
-    current_task->state = TASK_RUNNING;
-    current_task->time_slice = TIME_SLICE;
-    current_task->priority = PRIORITY_IDLE;
-    current_task->base_priority = PRIORITY_IDLE;
-    current_task->quantum = TIME_SLICE;
-    current_task->ticks_used = 0;
-    current_task->total_ticks = 0;
-    current_task->context_switches = 0;
-    current_task->created_time = 0;
-    current_task->sleep_until = 0;
-    current_task->wait_on = 0;
-    current_task->parent = 0;
-    current_task->child = 0;
-    current_task->sibling = 0;
-    current_task->exit_code = 0;
-    current_task->iopb = NULL; // Initialize I/O permission bitmap
-
-    // IMPORTANT: Idle task must be in the queue!
-    current_task->next = current_task; // Points to itself
-    ready_queue = current_task;        // Queue contains only idle
-
-    tasks[0] = current_task;
+    kmem_cache_init(&task_cache, "task", sizeof(struct task));
+    kmem_cache_init(&stack_cache, "kstack", TASK_STACK_SIZE);
+
+    // The boot code becomes CPU 0's idle task; it keeps the boot stack
+    struct task *idle = (struct task *)kmem_cache_alloc(&task_cache);
+    idle->pid = pid_alloc(idle); // Slot 0, PID 0
+    task_setup(idle, "idle", PRIORITY_IDLE);
+    idle->kernel_stack = 0;
+    task_setup_idle(idle, &cpus[0]);
+    idle_task = idle;
+
     tasking_enabled = 1;
 }
 
-// Create a task
-uint32_t task_create(const char *name, void (*entry_point)(void))
+// Idle task for an application processor; smp_init() boots the AP on its
+// stack
+struct task *task_create_idle(struct cpu *cpu)
 {
-    // Disable interrupts during task creation to prevent scheduling
-    __asm__ volatile("cli");
+    uint32_t flags = spin_lock_irqsave(&task_lock);
 
-    struct task *new_task = (struct task *)kmalloc(sizeof(struct task));
-    if (!new_task)
+    struct task *idle = (struct task *)kmem_cache_alloc(&task_cache);
+    void *stack = kmem_cache_alloc(&stack_cache);
+    int pid = (idle && stack) ? pid_alloc(idle) : -1;
+    if (pid < 0)
     {
-        __asm__ volatile("sti");
+        kmem_cache_free(&stack_cache, stack);
+        kmem_cache_free(&task_cache, idle);
+        spin_unlock_irqrestore(&task_lock, flags);
         return 0;
     }
 
-    new_task->pid = next_pid++;
+    char name[8] = "idle";
+    name[4] = '0' + cpu->index;
+    name[5] = '\0';
 
-    // Copy name
-    int i;
-    for (i = 0; i < 31 && name[i]; i++)
-        new_task->name[i] = name[i];
-    new_task->name[i] = '\0';
+    idle->pid = pid;
+    task_setup(idle, name, PRIORITY_IDLE);
+    idle->kernel_stack = (uint32_t)stack + TASK_STACK_SIZE;
+    idle->parent = idle_task;
+    idle->sibling = idle_task->child;
+    idle_task->child = idle;
+    task_setup_idle(idle, cpu);
+
+    spin_unlock_irqrestore(&task_lock, flags);
+    return idle;
+}
+
+// Least loaded online CPU for a new task (racy reads are fine for a hint)
+static struct cpu *task_pick_cpu(void)
+{
+    struct cpu *best = this_cpu();
+    uint32_t best_load = best->rq.count + (best->current != best->idle);
+
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        struct cpu *cpu = &cpus[i];
+        uint32_t load = cpu->rq.count + (cpu->current != cpu->idle);
+        if (cpu->online && load < best_load)
+        {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// A task was queued behind a running one on `cpu`: wake an idle CPU so
+// it comes and steals it (racy reads, a missed kick costs one steal)
+static void task_kick_idle(struct cpu *cpu)
+{
+    struct cpu *self = this_cpu();
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        struct cpu *other = &cpus[i];
+        if (other != cpu && other != self && other->online &&
+            other->current == other->idle && other->rq.count == 0)
+        {
+            smp_send_resched(other);
+            return;
+        }
+    }
+}
+
+// Tell `cpu` about a task just queued there: preempt its current task,
+// or let an idle CPU pull the new one (interrupts disabled). Here, the
+// interrupt or system call we are in reschedules on its way out.
+static void task_notify_queued(struct cpu *cpu, int preempt)
+{
+    if (preempt && cpu == this_cpu())
+        cpu->need_resched = 1;
+    else if (preempt && cpu_count > 1)
+        smp_send_resched(cpu);
+    else if (cpu_count > 1)
+        task_kick_idle(cpu);
+}
+
+// Queue a READY task on `cpu` and poke that CPU if the task should
+// preempt what it is running (interrupts disabled)
+static void task_enqueue(struct cpu *cpu, struct task *task)
+{
+    spin_lock(&cpu->rq_lock);
+    task->cpu = cpu->index;
+    rq_enqueue(&cpu->rq, task);
+    int preempt = task_preempts(task, cpu);
+    spin_unlock(&cpu->rq_lock);
+
+    task_notify_queued(cpu, preempt);
+}
+
+// Lock the run queue that owns `task` (interrupts disabled). The task may
+// move while we spin, so the owner is checked again under the lock.
+static struct cpu *task_rq_lock(struct task *task)
+{
+    while (1)
+    {
+        struct cpu *cpu = &cpus[task->cpu];
+        spin_lock(&cpu->rq_lock);
+        if (cpu->index == task->cpu)
+            return cpu;
+        spin_unlock(&cpu->rq_lock);
+    }
+}
+
+// Take two rq locks in index order (`a` may equal `b`)
+static void rq_lock_two(struct cpu *a, struct cpu *b)
+{
+    if (a == b)
+    {
+        spin_lock(&a->rq_lock);
+        return;
+    }
+    spin_lock(a->index < b->index ? &a->rq_lock : &b->rq_lock);
+    spin_lock(a->index < b->index ? &b->rq_lock : &a->rq_lock);
+}
+
+static void rq_unlock_two(struct cpu *a, struct cpu *b)
+{
+    spin_unlock(&a->rq_lock);
+    if (a != b)
+        spin_unlock(&b->rq_lock);
+}
+
+// Can a queued or blocked task move to another CPU (its rq lock held)?
+// Not while its context is live, nor while its FPU registers are: lazy
+// switching left them in the old CPU, which only that CPU can save.
+static int task_can_migrate(struct task *task)
+{
+    return !task->on_cpu && !task_is_idle(task) && cpus[task->cpu].fpu_owner != task;
+}
+
+// Re-home a task that is on no run queue (both rq locks held)
+static void task_move(struct task *task, struct cpu *to)
+{
+    task->cpu = to->index;
+    task->migrations++;
+}
+
+// Finish a switch on the CPU we now run on: the previous task's context
+// is saved, so it may run elsewhere or be freed
+static void task_finish_switch(void)
+{
+    struct cpu *cpu = this_cpu();
+    if (cpu->switch_tsc)
+    {
+        uint64_t delta = timer_rdtsc() - cpu->switch_tsc;
+        uint32_t cycles = (delta >> 32) ? 0xFFFFFFFF : (uint32_t)delta;
+        uint32_t b = cycles ? 32 - __builtin_clz(cycles) : 0;
+        cpu->switch_hist[b < SCHED_LAT_BUCKETS ? b : SCHED_LAT_BUCKETS - 1]++;
+        cpu->switch_tsc = 0;
+    }
+    if (cpu->prev)
+    {
+        cpu->prev->on_cpu = 0;
+        cpu->prev = 0;
+    }
+    spin_unlock(&cpu->rq_lock);
+}
+
+// First code of every new task
+static void task_start(void)
+{
+    task_finish_switch();
+    void (*entry)(void) = this_cpu()->current->entry;
+    __asm__ volatile("sti");
+
+    entry();
+    task_exit(0);
+}
+
+// Create a task
+uint32_t task_create(const char *name, void (*entry_point)(void))
+{
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    struct task *parent = this_cpu()->current;
 
+    struct task *new_task = (struct task *)kmem_cache_alloc(&task_cache);
+    void *stack = kmem_cache_alloc(&stack_cache);
+    int pid = (new_task && stack) ? pid_alloc(new_task) : -1;
+    if (pid < 0)
+    {
+        kmem_cache_free(&stack_cache, stack);
+        kmem_cache_free(&task_cache, new_task);
+        spin_unlock_irqrestore(&task_lock, flags);
+        return 0;
+    }
+
+    new_task->pid = pid;
+    task_setup(new_task, name, PRIORITY_NORMAL);
     new_task->state = TASK_READY;
-    new_task->time_slice = TIME_SLICE;
-    new_task->priority = PRIORITY_NORMAL;
-    new_task->base_priority = PRIORITY_NORMAL;
-    new_task->quantum = TIME_SLICE;
-    new_task->ticks_used = 0;
-    new_task->total_ticks = 0;
-    new_task->context_switches = 0;
-    new_task->created_time = global_ticks;
-    new_task->sleep_until = 0;
-    new_task->wait_on = 0;
-
-    new_task->kernel_stack = (uint32_t)kmalloc(4096) + 4096;
+    new_task->on_cpu = 0;
+    new_task->entry = entry_point;
+    new_task->ready_tsc = timer_rdtsc();
+
+    new_task->kernel_stack = (uint32_t)stack + TASK_STACK_SIZE;
 
     new_task->regs.eax = 0;
     new_task->regs.ebx = 0;
@@ -114,38 +588,29 @@ uint32_t task_create(const char *name, void (*entry_point)(void))
     new_task->regs.edi = 0;
     new_task->regs.ebp = 0;
     new_task->regs.esp = new_task->kernel_stack;
-    new_task->regs.eip = (uint32_t)entry_point;
-    new_task->regs.eflags = 0x202; // NOTE: Interrupts enabled in new task
+    new_task->regs.eip = (uint32_t)task_start;
+    new_task->regs.eflags = 0x002; // task_start enables interrupts after the rq unlock
     new_task->regs.cr3 = (uint32_t)paging_get_kernel_directory();
 
-    new_task->parent = current_task;
-    new_task->child = 0;
-    new_task->sibling = 0;
-    new_task->exit_code = 0;
-    new_task->iopb = NULL; // Initialize I/O permission bitmap
+    new_task->parent = parent;
+    new_task->sibling = parent->child;
+    parent->child = new_task;
 
-    // Add to tasks array
-    for (int i = 1; i < MAX_TASKS; i++)
-    {
-        if (!tasks[i])
-        {
-            tasks[i] = new_task;
-            break;
-        }
-    }
+    spin_unlock(&task_lock);
 
-    // Add to ready queue
-    simple_queue_add(new_task);
+    task_enqueue(task_pick_cpu(), new_task);
 
-    // Re-enable interrupts
-    __asm__ volatile("sti");
+    irq_restore(flags);
 
-    return new_task->pid;
+    return pid;
 }
 
 struct task *task_get_current(void)
 {
-    return current_task;
+    uint32_t flags = irq_save();
+    struct task *task = this_cpu()->current;
+    irq_restore(flags);
+    return task;
 }
 
 // Alias for compatibility
@@ -154,92 +619,408 @@ struct task *get_current_task(void)
     return task_get_current();
 }
 
-// Simplified scheduler
-void task_schedule(void)
+// Switch from `old` to `next` (rq lock held, released on return by
+// whichever switch brings us back). `preempted` tells whether `old`
+// could have kept running.
+static void task_switch_to(struct cpu *cpu, struct task *old, struct task *next, int preempted)
 {
-    if (!tasking_enabled || !ready_queue)
-        return;
+    uint64_t now = timer_rdtsc();
+    old->cpu_cycles += now - old->run_tsc;
+    if (old->state == TASK_READY)
+        old->ready_tsc = now;
+    if (old != cpu->idle)
+    {
+        if (preempted)
+            old->nivcsw++;
+        else
+            old->nvcsw++;
+    }
+    if (next->ready_tsc)
+    {
+        uint64_t delay = now - next->ready_tsc;
+        next->run_delay += delay;
+        if (delay > next->run_delay_max)
+            next->run_delay_max = (delay >> 32) ? 0xFFFFFFFF : (uint32_t)delay;
+        next->ready_tsc = 0;
+    }
+    next->run_tsc = now;
+    cpu->switch_tsc = now;
+
+    next->state = TASK_RUNNING;
+    next->time_slice = TIME_SLICE;
+    next->context_switches++;
+    next->cpu = cpu->index;
+    next->on_cpu = 1;
+    cpu->current = next;
+    cpu->prev = old;
+    cpu->switches++;
+    cpu->tss.esp0 = next->kernel_stack;
+    old->last_ran = timer_ticks;
+    if (next->irq_tsc)
+        irq_bridge_account(next);
+    if (old == cpu->idle)
+        timer_tick_resume();
 
-    global_ticks++;
+    fpu_switch(next);
+    task_switch(&old->regs, &next->regs);
 
-    if (current_task && current_task->state == TASK_RUNNING)
+    task_finish_switch();
+}
+
+// First migratable task of `victim`'s queue, best priority first; unless
+// `hot_ok`, tasks that ran in the last SCHED_CACHE_HOT ticks are skipped
+static struct task *task_steal_pick(struct cpu *victim, int hot_ok)
+{
+    for (uint32_t prio = 0; prio < PRIORITY_LEVELS; prio++)
     {
-        current_task->total_ticks++;
+        for (struct task *task = victim->rq.head[prio]; task; task = task->next)
+        {
+            if (task->state == TASK_ZOMBIE || !task_can_migrate(task))
+                continue;
+            if (hot_ok || timer_ticks - task->last_ran >= SCHED_CACHE_HOT)
+                return task;
+        }
     }
+    return 0;
+}
 
-    if (current_task->time_slice > 0)
+// Pull one queued task from the busiest other CPU onto `cpu` (its rq lock
+// held). The victim's lock is only tried, so two CPUs stealing from each
+// other cannot deadlock; a busy lock means that CPU is scheduling anyway.
+static struct task *task_steal_locked(struct cpu *cpu)
+{
+    struct cpu *victim = 0;
+    uint32_t most = 0;
+    for (uint32_t i = 0; i < cpu_count; i++)
     {
-        current_task->time_slice--;
+        struct cpu *other = &cpus[i];
+        if (other != cpu && other->online && other->rq.count > most)
+        {
+            victim = other;
+            most = other->rq.count;
+        }
     }
+    if (!victim || !spin_trylock(&victim->rq_lock))
+        return 0;
 
-    if (current_task->time_slice == 0 ||
-        current_task->state == TASK_ZOMBIE ||
-        current_task->state == TASK_BLOCKED)
+    // Cold tasks first: moving them costs no warm cache
+    struct task *task = 0;
+    if (sched_affinity)
+        task = task_steal_pick(victim, 0);
+    if (!task)
+        task = task_steal_pick(victim, 1);
+
+    if (task)
     {
-        struct task *old_task = current_task;
+        rq_remove(&victim->rq, task);
+        task_move(task, cpu);
+        rq_enqueue(&cpu->rq, task);
+        cpu->steals++;
+    }
 
-        // Find next non-zombie task
-        struct task *next = ready_queue->next;
-        int attempts = 0;
-        int max_tasks = 32;
+    spin_unlock(&victim->rq_lock);
+    return task;
+}
 
-        // Skip zombie tasks
-        while (next->state == TASK_ZOMBIE && attempts < max_tasks)
-        {
-            ready_queue = ready_queue->next;
-            next = ready_queue->next;
-            attempts++;
-        }
+int task_steal(void)
+{
+    if (!tasking_enabled || cpu_count == 1)
+        return 0;
 
-        current_task = next;
-        ready_queue = next;
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    spin_lock(&cpu->rq_lock);
+    struct task *task = cpu->rq.count == 0 ? task_steal_locked(cpu) : 0;
+    spin_unlock(&cpu->rq_lock);
+    irq_restore(flags);
+    return task != 0;
+}
+
+void task_set_affinity(int on)
+{
+    sched_affinity = on;
+}
+
+int task_get_affinity(void)
+{
+    return sched_affinity;
+}
+
+// Switch to the best queued task (rq lock held, released on return). The
+// current task, if still running, goes to the back of its own level
+// first, so equal priorities round-robin and a lower priority never
+// displaces it. A throttled deadline task stays off the queue until its
+// budget is replenished. `preempt` is set when the switch was not asked
+// for by the current task.
+static void task_switch_next(struct cpu *cpu, int preempt)
+{
+    struct task *old_task = cpu->current;
+    int preempted = preempt && old_task->state == TASK_RUNNING;
+
+    if (old_task->state == TASK_RUNNING && old_task != cpu->idle)
+    {
+        old_task->state = TASK_READY;
+        if (!old_task->rt_throttled)
+            rq_enqueue(&cpu->rq, old_task);
+    }
+
+    struct task *next = rq_pick(&cpu->rq);
+    if (!next && cpu_count > 1 && task_steal_locked(cpu))
+        next = rq_pick(&cpu->rq);
+    if (!next)
+        next = cpu->idle;
+
+    if (next == old_task)
+    {
+        old_task->state = TASK_RUNNING;
+        old_task->time_slice = TIME_SLICE;
+        spin_unlock(&cpu->rq_lock);
+        return;
+    }
 
-        // Only set to RUNNING if not already ZOMBIE
-        if (current_task->state != TASK_ZOMBIE)
+    if (old_task->state == TASK_RUNNING)
+        old_task->state = TASK_READY;
+
+    task_switch_to(cpu, old_task, next, preempted);
+}
+
+// Charge a tick to the running deadline task (rq lock held). A deadline
+// that passed with budget left is a miss and starts the next period; out
+// of budget, the task is throttled until its deadline.
+static void task_rt_tick(struct task *task)
+{
+    if (!deadline_before(timer_ticks, task->rt_deadline))
+    {
+        task->rt_misses++;
+        task->rt_deadline = timer_ticks + task->rt_period;
+        task->rt_remaining = task->rt_budget;
+    }
+
+    // If no timer can be armed the task keeps running and tries again on
+    // the next tick, rather than staying throttled for good
+    if (task->rt_remaining > 0)
+        task->rt_remaining--;
+    if (task->rt_remaining == 0 && timer_add(&task->rt_timer, task->rt_deadline) == 0)
+    {
+        task->rt_throttled = 1;
+        task->rt_throttles++;
+        task->time_slice = 0;
+    }
+}
+
+// Budget timer: a throttled deadline task starts its next period
+// (timer interrupt on CPU 0)
+static void task_rt_replenish(void *arg)
+{
+    struct task *task = (struct task *)arg;
+    struct cpu *cpu = task_rq_lock(task);
+
+    int queued = 0;
+    int preempt = 0;
+    if (task->rt_throttled)
+    {
+        task->rt_throttled = 0;
+        task->rt_remaining = task->rt_budget;
+        task->rt_deadline = timer_ticks + task->rt_period;
+        if (task->state == TASK_READY && !task->queued)
         {
-            current_task->time_slice = TIME_SLICE;
-            current_task->state = TASK_RUNNING;
-            current_task->context_switches++;
+            rq_enqueue(&cpu->rq, task);
+            task->ready_tsc = timer_rdtsc();
+            queued = 1;
+            preempt = task_preempts(task, cpu);
         }
+    }
+
+    spin_unlock(&cpu->rq_lock);
+    if (queued)
+        task_notify_queued(cpu, preempt);
+}
+
+static void task_schedule_cpu(int reason)
+{
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    spin_lock(&cpu->rq_lock);
+
+    struct task *current = cpu->current;
+    cpu->need_resched = 0;
+
+    if (reason == SCHED_TICK)
+    {
+        if (cpu->index == 0)
+            global_ticks++;
+        cpu->ticks++;
+        if (current != cpu->idle)
+            cpu->busy_ticks++;
+        if (current->state == TASK_RUNNING)
+            current->total_ticks++;
 
-        if (old_task->state == TASK_RUNNING)
+        // Deadline tasks have no time slice, only a budget
+        if (current->rt_period)
         {
-            old_task->state = TASK_READY;
+            if (current->state == TASK_RUNNING)
+                task_rt_tick(current);
         }
-
-        if (old_task != current_task)
+        else if (current->time_slice > 0)
         {
-            task_switch(&old_task->regs, &current_task->regs);
+            current->time_slice--;
         }
     }
+    else if (reason == SCHED_YIELD)
+    {
+        current->time_slice = 0;
+    }
+    else
+    {
+        cpu->resched_ipis++;
+    }
+
+    // Nothing to do here: look for work on the other CPUs
+    if (current == cpu->idle && !cpu->rq.count && cpu_count > 1)
+        task_steal_locked(cpu);
+
+    // Also preempt when a higher priority or earlier deadline task became
+    // ready
+    if (current->time_slice == 0 ||
+        current->state != TASK_RUNNING ||
+        rq_preempts(cpu))
+        task_switch_next(cpu, reason != SCHED_YIELD);
+    else
+        spin_unlock(&cpu->rq_lock);
+
+    irq_restore(flags);
+}
+
+// Timer tick path
+void task_schedule(void)
+{
+    if (tasking_enabled)
+        task_schedule_cpu(SCHED_TICK);
+}
+
+void task_resched(void)
+{
+    if (tasking_enabled)
+        task_schedule_cpu(SCHED_CHECK);
 }
 
 void task_yield(void)
 {
-    if (!tasking_enabled)
+    if (tasking_enabled)
+        task_schedule_cpu(SCHED_YIELD);
+}
+
+// Direct handoff: run `next` immediately (used by synchronous IPC so a
+// call/reply pair costs one context switch each way instead of waiting
+// for the scheduler to reach the peer). Only a task queued on this CPU
+// can be handed the CPU, and not past a queued deadline task; otherwise
+// this is a yield.
+void task_handoff(struct task *next)
+{
+    if (!tasking_enabled || !next)
+    {
+        task_yield();
         return;
-    current_task->time_slice = 0;
-    task_schedule();
+    }
+
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    spin_lock(&cpu->rq_lock);
+
+    struct task *old_task = cpu->current;
+    if (next == old_task || next->state != TASK_READY || !next->queued || next->cpu != cpu->index ||
+        (cpu->rq.rt_head && cpu->rq.rt_head != next))
+    {
+        spin_unlock(&cpu->rq_lock);
+        irq_restore(flags);
+        task_yield();
+        return;
+    }
+
+    rq_remove(&cpu->rq, next);
+    if (old_task->state == TASK_RUNNING)
+    {
+        old_task->state = TASK_READY;
+        if (old_task != cpu->idle)
+            rq_enqueue(&cpu->rq, old_task);
+    }
+
+    task_switch_to(cpu, old_task, next, 0);
+
+    irq_restore(flags);
 }
 
 struct task *task_find_by_pid(int pid)
 {
-    for (int i = 0; i < MAX_TASKS; i++)
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+
+    struct task *task = 0;
+    uint32_t index = (uint32_t)pid & PID_INDEX_MASK;
+    if (pid >= 0 && index < pid_slots_used)
     {
-        if (tasks[i] && tasks[i]->pid == (uint32_t)pid)
-            return tasks[i];
+        task = pid_table[index].task;
+        if (task && task->pid != (uint32_t)pid)
+            task = 0; // Stale PID: the slot has a newer owner
     }
-    return 0;
+
+    spin_unlock_irqrestore(&task_lock, flags);
+    return task;
+}
+
+// Next live task at or after slot *pos, advancing *pos (start at 0)
+struct task *task_iterate(uint32_t *pos)
+{
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+
+    struct task *task = 0;
+    while (!task && *pos < pid_slots_used)
+        task = pid_table[(*pos)++].task;
+
+    spin_unlock_irqrestore(&task_lock, flags);
+    return task;
+}
+
+void task_get_stats(struct task_stats *stats)
+{
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    stats->tasks = task_count;
+    stats->pid_slots = pid_slots_used;
+    stats->pid_table_size = pid_table_size;
+    stats->task_objs = task_cache.in_use;
+    stats->task_pages = task_cache.pages;
+    stats->stack_objs = stack_cache.in_use;
+    stats->stack_pages = stack_cache.pages;
+    spin_unlock_irqrestore(&task_lock, flags);
+}
+
+void task_get_switch_hist(uint32_t *hist)
+{
+    for (uint32_t b = 0; b < SCHED_LAT_BUCKETS; b++)
+        hist[b] = 0;
+    for (uint32_t i = 0; i < cpu_count; i++)
+        for (uint32_t b = 0; b < SCHED_LAT_BUCKETS; b++)
+            hist[b] += cpus[i].switch_hist[b];
 }
 
-// Stub implementations for compatibility
 void task_set_priority(struct task *task, task_priority_t priority)
 {
-    if (task)
-    {
-        task->priority = priority;
-        task->base_priority = priority;
-    }
+    if (!task || (uint32_t)priority >= PRIORITY_LEVELS)
+        return;
+
+    uint32_t flags = irq_save();
+    struct cpu *cpu = task_rq_lock(task);
+
+    // A queued task moves to the tail of its new level
+    int queued = task->queued;
+    if (queued)
+        rq_remove(&cpu->rq, task);
+    task->priority = priority;
+    task->base_priority = priority;
+    if (queued)
+        rq_enqueue(&cpu->rq, task);
+
+    spin_unlock(&cpu->rq_lock);
+    irq_restore(flags);
 }
 
 task_priority_t task_get_priority(struct task *task)
@@ -247,28 +1028,476 @@ task_priority_t task_get_priority(struct task *task)
     return task ? task->priority : PRIORITY_IDLE;
 }
 
-void task_sleep(uint32_t ticks) { (void)ticks; }
-void task_wake(struct task *task) { (void)task; }
-void task_check_sleeping(void) {}
+// Permille of a CPU that `budget` ticks every `period` ticks take,
+// rounded up so admission never over-commits
+static uint32_t task_rt_share(uint32_t budget, uint32_t period)
+{
+    return (budget * 1000 + period - 1) / period;
+}
+
+// Give back a task's reservation (task_lock held)
+static void task_rt_unreserve(struct task *task)
+{
+    rt_util -= task->rt_util;
+    task->rt_util = 0;
+}
+
+int task_set_deadline(struct task *task, uint32_t budget, uint32_t period)
+{
+    if (!task || task_is_idle(task))
+        return -1;
+    if (budget && (budget > period || period > 0x3FFFFF))
+        return -1;
+
+    uint32_t share = budget ? task_rt_share(budget, period) : 0;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    if (task->state == TASK_ZOMBIE || rt_util - task->rt_util + share > RT_UTIL_MAX)
+    {
+        spin_unlock_irqrestore(&task_lock, flags);
+        return -1;
+    }
+    rt_util = rt_util - task->rt_util + share;
+    task->rt_util = share;
+
+    // A pending replenishment would put the task back on a queue
+    timer_cancel(&task->rt_timer);
+
+    struct cpu *rt_cpu = &cpus[0];
+    struct cpu *cpu;
+    while (1)
+    {
+        cpu = &cpus[task->cpu];
+        rq_lock_two(cpu, rt_cpu);
+        if (cpu->index == task->cpu)
+            break;
+        rq_unlock_two(cpu, rt_cpu);
+    }
+
+    // Off the queue while the list it belongs to changes
+    int queued = task->queued || (task->rt_throttled && task->state == TASK_READY);
+    rq_remove(&cpu->rq, task);
+
+    task->rt_budget = budget;
+    task->rt_period = budget ? period : 0;
+    task->rt_deadline = timer_ticks + period;
+    task->rt_remaining = budget;
+    task->rt_throttled = 0;
+
+    struct cpu *dest = cpu;
+    if (budget && cpu != rt_cpu && task_can_migrate(task))
+    {
+        dest = rt_cpu;
+        task_move(task, dest);
+    }
+
+    int preempt = 0;
+    if (queued)
+    {
+        rq_enqueue(&dest->rq, task);
+        preempt = task_preempts(task, dest);
+    }
+
+    rq_unlock_two(cpu, rt_cpu);
+    spin_unlock(&task_lock);
+    if (queued)
+        task_notify_queued(dest, preempt);
+    irq_restore(flags);
+    return 0;
+}
+
+uint32_t task_get_rt_util(void)
+{
+    return rt_util;
+}
+
+// Make a blocked task runnable again on `target`, or where it last ran
+// if `target` is NULL or the task cannot move. Deadline tasks go to CPU
+// 0, where the interrupts that wake them arrive.
+static void task_wake_on(struct task *task, struct cpu *target)
+{
+    uint32_t flags = irq_save();
+
+    if (task->rt_period)
+        target = &cpus[0];
+
+    // Lock the owning CPU and the target together, rechecking the owner
+    struct cpu *cpu;
+    while (1)
+    {
+        cpu = &cpus[task->cpu];
+        if (!target)
+            target = cpu;
+        rq_lock_two(cpu, target);
+        if (cpu->index == task->cpu)
+            break;
+        rq_unlock_two(cpu, target);
+    }
+
+    struct cpu *dest = cpu;
+    int queued = 0;
+    int preempt = 0;
+    if (task->state == TASK_BLOCKED)
+    {
+        if (task == cpu->current)
+        {
+            // Woken before it got to switch away
+            task->state = TASK_RUNNING;
+        }
+        else
+        {
+            // Switched out: its context is saved, so it may move
+            if (target != cpu && task_can_migrate(task))
+            {
+                dest = target;
+                task_move(task, dest);
+            }
+            task->state = TASK_READY;
+
+            // Slept through its deadline: the old budget is of no use
+            if (task->rt_period && !deadline_before(timer_ticks, task->rt_deadline))
+            {
+                task->rt_deadline = timer_ticks + task->rt_period;
+                task->rt_remaining = task->rt_budget;
+            }
+
+            rq_enqueue(&dest->rq, task);
+            task->ready_tsc = timer_rdtsc();
+            queued = 1;
+            preempt = task_preempts(task, dest);
+        }
+    }
+
+    rq_unlock_two(cpu, target);
+    if (queued && (preempt || dest != this_cpu()))
+        task_notify_queued(dest, preempt);
+    irq_restore(flags);
+}
+
+// Make a blocked task runnable again: on the CPU it last ran on (its
+// cache is there), or on the least loaded CPU with affinity hints off
+void task_wake(struct task *task)
+{
+    if (!task)
+        return;
+    task_wake_on(task, sched_affinity ? 0 : task_pick_cpu());
+}
+
+// Wake the peer of a synchronous IPC on the calling CPU, so the caller
+// can hand it the CPU directly and both share one cache
+void task_wake_here(struct task *task)
+{
+    if (!task)
+        return;
+    task_wake_on(task, sched_affinity ? this_cpu() : task_pick_cpu());
+}
+
+// Stop a task: it leaves the run queue and never runs again
+void task_kill(struct task *task)
+{
+    if (!task || task_is_idle(task))
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    task_rt_unreserve(task);
+    spin_unlock(&task_lock);
+
+    struct cpu *cpu = task_rq_lock(task);
+    rq_remove(&cpu->rq, task);
+    task->state = TASK_ZOMBIE;
+    int running = task == cpu->current;
+    spin_unlock(&cpu->rq_lock);
+
+    if (running && cpu != this_cpu())
+        smp_send_resched(cpu);
+    irq_restore(flags);
+
+    // Its IPC window pages go back once it can no longer touch them
+    if (task != task_get_current())
+    {
+        while (task->on_cpu)
+            __asm__ volatile("pause");
+    }
+    ipc_release_task(task);
+
+    if (task == task_get_current())
+        task_yield();
+}
+
+static void task_timeout(void *arg)
+{
+    task_wake((struct task *)arg);
+}
+
+// From here on any CPU may wake us (interrupts disabled)
+static struct task *task_set_blocked(void)
+{
+    struct cpu *cpu = this_cpu();
+    spin_lock(&cpu->rq_lock);
+    struct task *current = cpu->current;
+    if (current->state == TASK_RUNNING)
+        current->state = TASK_BLOCKED;
+    spin_unlock(&cpu->rq_lock);
+    return current;
+}
+
+// Block the current task until task_wake() or until `timeout` ticks pass.
+// The caller queued itself wherever its wakeup comes from and re-checks
+// its condition afterwards. Returns -1 without blocking if no timer could
+// be armed for the timeout, which the caller treats as having timed out.
+int task_block(spinlock_t *lock, uint32_t timeout)
+{
+    struct timer timer;
+    struct task *current = task_set_blocked();
+
+    timer_setup(&timer, task_timeout, current);
+    if (timeout != TASK_WAIT_FOREVER && timer_add(&timer, timer_ticks + timeout) < 0)
+    {
+        // Never sleep without a wakeup
+        struct cpu *cpu = this_cpu();
+        spin_lock(&cpu->rq_lock);
+        if (current->state == TASK_BLOCKED)
+            current->state = TASK_RUNNING;
+        spin_unlock(&cpu->rq_lock);
+        return -1;
+    }
+
+    if (lock)
+        spin_unlock(lock);
+    task_yield();
+    timer_cancel(&timer);
+    if (lock)
+        spin_lock(lock);
+    return 0;
+}
+
+void task_block_handoff(spinlock_t *lock, struct task *next)
+{
+    task_set_blocked();
+    if (lock)
+        spin_unlock(lock);
+    if (next)
+        task_handoff(next);
+    else
+        task_yield();
+    if (lock)
+        spin_lock(lock);
+}
+
+void task_sleep(uint32_t ticks)
+{
+    uint32_t flags = irq_save();
+    uint32_t deadline = timer_ticks + ticks;
+    while ((int32_t)(timer_ticks - deadline) < 0)
+        task_block(NULL, deadline - timer_ticks);
+    irq_restore(flags);
+}
+
+// Is any task other than the idle task ready to run on this CPU?
+int task_runnable(void)
+{
+    return this_cpu()->rq.count != 0;
+}
+
 uint32_t task_get_ticks(void) { return global_ticks; }
 void task_print_stats(struct task *task) { (void)task; }
 
-// Keep fork/exit/waitpid stubs for now
+// Kernel stack bytes of a ring 3 system call frame (syscall_asm.s): the
+// saved registers sit at the top of the stack after SYSENTER, and below
+// the CPU's iret frame after int $0x80
+#define FORK_FRAME_SYSENTER (9 * 4)
+#define FORK_FRAME_INT80 (FORK_FRAME_SYSENTER + 5 * 4)
+
+extern void fork_child_entry(void);
+extern void syscall_return(void);
+extern void sysenter_return(void);
+
+// First C code of a forked child (fork_child_entry)
+void task_fork_finish(void)
+{
+    task_finish_switch();
+}
+
+// Fork the calling ring 3 task: the child runs in a copy-on-write clone
+// of the parent's directory and leaves the system call through a copy of
+// the parent's frame, so it resumes at the same point with 0 in EAX. It
+// starts with a fresh FPU state and without the parent's I/O permissions
+// or IPC window pages. Returns the child's PID to the parent.
 int task_fork_with_regs(struct registers *regs)
 {
-    (void)regs;
-    return -1;
+    struct task *parent = task_get_current();
+    uint32_t size = parent->kernel_stack - (uint32_t)regs;
+    if (size != FORK_FRAME_SYSENTER && size != FORK_FRAME_INT80)
+        return -1; // A ring 0 caller has no user context to copy
+
+    page_directory *parent_dir = (page_directory *)parent->regs.cr3;
+    page_directory *dir = paging_clone_directory(parent_dir);
+    if (!dir)
+        return -1;
+
+    // Tasks on other CPUs may share the kernel directory and still hold
+    // writable translations for pages that are copy-on-write now
+    if (parent_dir == paging_get_kernel_directory())
+        smp_flush_tlb_all();
+
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    struct task *child = (struct task *)kmem_cache_alloc(&task_cache);
+    void *stack = kmem_cache_alloc(&stack_cache);
+    int pid = (child && stack) ? pid_alloc(child) : -1;
+    if (pid < 0)
+    {
+        kmem_cache_free(&stack_cache, stack);
+        kmem_cache_free(&task_cache, child);
+        spin_unlock_irqrestore(&task_lock, flags);
+        paging_free_directory(dir);
+        return -1;
+    }
+
+    child->pid = pid;
+    task_setup(child, parent->name, parent->base_priority);
+    child->state = TASK_READY;
+    child->on_cpu = 0;
+    child->ready_tsc = timer_rdtsc();
+
+    child->kernel_stack = (uint32_t)stack + TASK_STACK_SIZE;
+
+    // The child's copy of the frame, returning 0 from fork()
+    uint32_t *src = (uint32_t *)regs;
+    uint32_t *frame = (uint32_t *)(child->kernel_stack - size);
+    for (uint32_t i = 0; i < size / sizeof(uint32_t); i++)
+        frame[i] = src[i];
+    ((struct registers *)frame)->eax = 0;
+
+    // fork_child_entry takes the frame in ESI and the way out in EDI
+    child->regs.eax = 0;
+    child->regs.ebx = 0;
+    child->regs.ecx = 0;
+    child->regs.edx = 0;
+    child->regs.esi = (uint32_t)frame;
+    child->regs.edi = size == FORK_FRAME_INT80 ? (uint32_t)syscall_return : (uint32_t)sysenter_return;
+    child->regs.ebp = 0;
+    child->regs.esp = (uint32_t)frame;
+    child->regs.eip = (uint32_t)fork_child_entry;
+    child->regs.eflags = 0x002; // The way out restores the user's flags
+    child->regs.cr3 = (uint32_t)dir;
+
+    child->parent = parent;
+    child->sibling = parent->child;
+    parent->child = child;
+
+    spin_unlock(&task_lock);
+
+    task_enqueue(task_pick_cpu(), child);
+
+    irq_restore(flags);
+
+    return pid;
 }
+
 void task_exit(int exit_code)
 {
-    (void)exit_code;
-    current_task->state = TASK_ZOMBIE;
+    ipc_release_task(task_get_current());
+
+    spin_lock_irqsave(&task_lock);
+    struct task *current = this_cpu()->current;
+
+    current->exit_code = exit_code;
+
+    // Orphans go to the idle task
+    struct task *child = current->child;
+    while (child)
+    {
+        struct task *next = child->sibling;
+        child->parent = idle_task;
+        child->sibling = idle_task->child;
+        idle_task->child = child;
+        child = next;
+    }
+    current->child = 0;
+
+    // Give up the FPU registers now: the parent may free the state area
+    // while another CPU would otherwise still save into it
+    fpu_release(current);
+    task_rt_unreserve(current);
+
+    current->exited = 1;
+    wait_wake_all(&current->parent->child_exit);
+    spin_unlock(&task_lock);
+
+    struct cpu *cpu = this_cpu();
+    spin_lock(&cpu->rq_lock);
+    current->state = TASK_ZOMBIE;
+    task_switch_next(cpu, 0);
+
     while (1)
-        ;
+        task_yield();
 }
+
+// Free everything a task that called task_exit() owns (task_lock held)
+static void task_release(struct task *task)
+{
+    struct task **link = &task->parent->child;
+    while (*link && *link != task)
+        link = &(*link)->sibling;
+    if (*link)
+        *link = task->sibling;
+
+    // Its last CPU may still be switching away from it
+    while (task->on_cpu)
+        __asm__ volatile("pause");
+
+    pid_free(task->pid);
+    fpu_release(task);
+    timer_cancel(&task->rt_timer);
+    if (task->iopb)
+        kfree(task->iopb);
+    paging_free_directory((page_directory *)task->regs.cr3); // Its own one (fork, exec)
+    kmem_cache_free(&stack_cache, (void *)(task->kernel_stack - TASK_STACK_SIZE));
+    kmem_cache_free(&task_cache, task);
+}
+
+// Wait for a child to exit and reap it. `pid` -1 takes any child.
+// Returns the child's PID and stores its exit code; -1 if there is no
+// such child or it was killed (killed tasks are never reaped, they may
+// still be linked into wait queues from their stack).
 int task_waitpid(int pid, int *status)
 {
-    (void)pid;
-    (void)status;
-    return -1;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    struct task *current = this_cpu()->current;
+
+    while (1)
+    {
+        struct task *found = 0;
+        int waitable = 0;
+
+        for (struct task *child = current->child; child; child = child->sibling)
+        {
+            if (pid != -1 && child->pid != (uint32_t)pid)
+                continue;
+            if (child->exited)
+            {
+                found = child;
+                break;
+            }
+            if (child->state != TASK_ZOMBIE)
+                waitable = 1;
+        }
+
+        if (found)
+        {
+            int child_pid = found->pid;
+            if (status)
+                *status = found->exit_code;
+            task_release(found);
+            spin_unlock_irqrestore(&task_lock, flags);
+            return child_pid;
+        }
+
+        if (!waitable)
+        {
+            spin_unlock_irqrestore(&task_lock, flags);
+            return -1;
+        }
+
+        wait_sleep(&current->child_exit, &task_lock, TASK_WAIT_FOREVER);
+    }
 }
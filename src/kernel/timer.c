@@ -0,0 +1,433 @@
+#include "timer.h"
+#include "task.h"
+#include "port_io.h"
+#include "pic.h"
+#include "isr.h"
+#include "apic.h"
+#include "smp.h"
+#include "kmalloc.h"
+#include <stddef.h>
+
+// PIT ports and commands
+#define PIT_CH0 0x40
+#define PIT_CH2 0x42
+#define PIT_CMD 0x43
+#define PIT_GATE 0x61             // Channel 2 gate (bit 0) and output (bit 5)
+
+#define PIT_CMD_CH0_RATE 0x34     // Channel 0, lo/hi byte, mode 2 (rate generator)
+#define PIT_CMD_CH0_ONESHOT 0x30  // Channel 0, lo/hi byte, mode 0 (terminal count)
+#define PIT_CMD_CH0_LATCH 0x00    // Latch channel 0 count
+#define PIT_CMD_CH0_READBACK 0xC2 // Latch channel 0 status and count
+#define PIT_CMD_CH2_ONESHOT 0xB0  // Channel 2, lo/hi byte, mode 0
+#define PIT_STATUS_OUT 0x80       // Read-back status: output pin level
+
+#define TSC_CALIBRATE_MS 10
+
+volatile uint32_t timer_ticks = 0;
+
+static uint32_t timer_hz = TIMER_HZ;
+static uint32_t pit_divisor;     // PIT counts per tick
+static uint32_t pit_residue;     // Counts elapsed since the last whole tick
+static uint32_t oneshot_ticks;   // Ticks covered by the armed one-shot (0 = periodic)
+static uint32_t oneshot_max;     // Longest one-shot the 16-bit counter allows
+
+static uint32_t tsc_khz;
+static uint32_t tsc_ns_mult;     // Nanoseconds per cycle, 12.20 fixed point
+
+static uint32_t timer_interrupts;
+static uint32_t timer_oneshots;
+
+// Pending software timers, min-heap on `expires`. Starts in a static
+// array and moves to a doubled kmalloc() array whenever it fills up.
+static struct timer *heap_initial[TIMER_HEAP_MAX];
+static struct timer **heap = heap_initial;
+static uint32_t heap_max = TIMER_HEAP_MAX;
+static uint32_t heap_size;
+static spinlock_t timer_lock;
+static struct timer *volatile timer_running; // Callback in progress (CPU 0)
+
+// 64-by-32 division; the quotient must fit in 32 bits
+static inline uint32_t div64_32(uint64_t n, uint32_t d)
+{
+    uint32_t q, r;
+    __asm__("divl %4" : "=a"(q), "=d"(r) : "a"((uint32_t)n), "d"((uint32_t)(n >> 32)), "rm"(d));
+    return q;
+}
+
+static inline int timer_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+// ============= PIT =============
+
+static void pit_set_periodic(void)
+{
+    outb(PIT_CMD, PIT_CMD_CH0_RATE);
+    outb(PIT_CH0, pit_divisor & 0xFF);
+    outb(PIT_CH0, (pit_divisor >> 8) & 0xFF);
+}
+
+// Measure the TSC against a PIT channel 2 countdown
+static void tsc_calibrate(void)
+{
+    uint32_t count = PIT_BASE_HZ * TSC_CALIBRATE_MS / 1000;
+
+    // Gate on, speaker off
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+    outb(PIT_CMD, PIT_CMD_CH2_ONESHOT);
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, (count >> 8) & 0xFF);
+
+    uint64_t start = timer_rdtsc();
+    uint32_t spins = 0;
+    while (!(inb(PIT_GATE) & 0x20))
+    {
+        if (++spins == 10000000)
+            return; // No channel 2: leave the TSC uncalibrated
+    }
+    uint64_t cycles = timer_rdtsc() - start;
+
+    tsc_khz = div64_32(cycles, TSC_CALIBRATE_MS);
+    if (tsc_khz > 1000)
+        tsc_ns_mult = div64_32((uint64_t)1000000 << 20, tsc_khz);
+}
+
+void timer_init(uint32_t hz)
+{
+    if (hz < 19 || hz > PIT_BASE_HZ / 2)
+        hz = TIMER_HZ; // The 16-bit divisor cannot go below 18.2 Hz
+
+    timer_hz = hz;
+    pit_divisor = (PIT_BASE_HZ + hz / 2) / hz;
+    oneshot_max = 0xFFFF / pit_divisor;
+    pit_residue = 0;
+    oneshot_ticks = 0;
+    heap_size = 0;
+
+    uint32_t flags = irq_save();
+    tsc_calibrate();
+    pit_set_periodic();
+    irq_restore(flags);
+}
+
+uint32_t timer_get_hz(void)
+{
+    return timer_hz;
+}
+
+uint32_t timer_ms_to_ticks(uint32_t ms)
+{
+    return (ms / 1000) * timer_hz + ((ms % 1000) * timer_hz + 999) / 1000;
+}
+
+uint32_t timer_tsc_khz(void)
+{
+    return tsc_khz;
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles)
+{
+    return (cycles * tsc_ns_mult) >> 20;
+}
+
+uint32_t timer_cycles_to_us(uint64_t cycles)
+{
+    uint64_t ns = timer_cycles_to_ns(cycles);
+    if ((ns >> 32) >= 1000)
+        return 0xFFFFFFFF;
+    return div64_32(ns, 1000);
+}
+
+// ============= Software timers =============
+
+static void heap_swap(uint32_t a, uint32_t b)
+{
+    struct timer *t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    heap[a]->index = a;
+    heap[b]->index = b;
+}
+
+static void heap_up(uint32_t i)
+{
+    while (i > 0)
+    {
+        uint32_t parent = (i - 1) / 2;
+        if (!timer_before(heap[i]->expires, heap[parent]->expires))
+            break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(uint32_t i)
+{
+    while (1)
+    {
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        uint32_t min = i;
+
+        if (left < heap_size && timer_before(heap[left]->expires, heap[min]->expires))
+            min = left;
+        if (right < heap_size && timer_before(heap[right]->expires, heap[min]->expires))
+            min = right;
+        if (min == i)
+            break;
+        heap_swap(i, min);
+        i = min;
+    }
+}
+
+static void heap_remove(uint32_t i)
+{
+    heap[i]->index = -1;
+    heap_size--;
+    if (i == heap_size)
+        return;
+
+    heap[i] = heap[heap_size];
+    heap[i]->index = i;
+    heap_up(i);
+    heap_down(i);
+}
+
+void timer_setup(struct timer *t, void (*fn)(void *), void *arg)
+{
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+    t->index = -1;
+}
+
+int timer_add(struct timer *t, uint32_t expires)
+{
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    // Make room first; the allocator is called without timer_lock held
+    while (t->index < 0 && heap_size == heap_max)
+    {
+        uint32_t max = heap_max;
+        spin_unlock_irqrestore(&timer_lock, flags);
+
+        struct timer **grown = kmalloc(2 * max * sizeof(struct timer *));
+        if (!grown)
+            return -1;
+
+        flags = spin_lock_irqsave(&timer_lock);
+        struct timer **old = grown; // Another CPU grew it meanwhile
+        if (heap_max == max)
+        {
+            for (uint32_t i = 0; i < heap_size; i++)
+                grown[i] = heap[i];
+            old = heap == heap_initial ? NULL : heap;
+            heap = grown;
+            heap_max = 2 * max;
+        }
+
+        if (old)
+        {
+            spin_unlock_irqrestore(&timer_lock, flags);
+            kfree(old);
+            flags = spin_lock_irqsave(&timer_lock);
+        }
+    }
+
+    if (t->index >= 0)
+        heap_remove(t->index);
+
+    t->expires = expires;
+    t->index = heap_size;
+    heap[heap_size++] = t;
+    heap_up(t->index);
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return 0;
+}
+
+void timer_cancel(struct timer *t)
+{
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (t->index >= 0)
+        heap_remove(t->index);
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    // Callbacks run on CPU 0 in the timer interrupt; another CPU may have
+    // to wait for one that still uses `t` (usually on the caller's stack)
+    while (timer_running == t)
+        __asm__ volatile("pause");
+}
+
+// Run every timer that is due (interrupts disabled). Callbacks run
+// without timer_lock so they can re-arm timers and wake tasks.
+static void timer_run_expired(void)
+{
+    spin_lock(&timer_lock);
+    while (heap_size > 0 && !timer_before(timer_ticks, heap[0]->expires))
+    {
+        struct timer *t = heap[0];
+        void (*fn)(void *) = t->fn;
+        void *arg = t->arg;
+
+        heap_remove(0);
+        timer_running = t;
+        spin_unlock(&timer_lock);
+
+        fn(arg);
+
+        spin_lock(&timer_lock);
+        timer_running = NULL;
+    }
+    spin_unlock(&timer_lock);
+}
+
+// ============= Tick and idle =============
+
+void timer_interrupt(void)
+{
+    timer_interrupts++;
+
+    if (oneshot_ticks)
+    {
+        // The one-shot ran to completion: go back to periodic ticks
+        timer_ticks += oneshot_ticks;
+        oneshot_ticks = 0;
+        pit_set_periodic();
+    }
+    else
+    {
+        timer_ticks++;
+    }
+
+    timer_run_expired();
+}
+
+static uint32_t pit_read_count(void)
+{
+    outb(PIT_CMD, PIT_CMD_CH0_LATCH);
+    uint32_t lo = inb(PIT_CH0);
+    uint32_t hi = inb(PIT_CH0);
+    return (hi << 8) | lo;
+}
+
+// Replace the periodic tick with a single interrupt `ticks` from now
+// (interrupts disabled)
+static void timer_start_oneshot(uint32_t ticks)
+{
+    // Keep the part of the current period that already elapsed
+    uint32_t count = pit_read_count();
+    if (count > 0 && count <= pit_divisor)
+        pit_residue += pit_divisor - count;
+
+    uint32_t counts = ticks * pit_divisor;
+    outb(PIT_CMD, PIT_CMD_CH0_ONESHOT);
+    outb(PIT_CH0, counts & 0xFF);
+    outb(PIT_CH0, (counts >> 8) & 0xFF);
+
+    oneshot_ticks = ticks;
+    timer_oneshots++;
+}
+
+// Woken early by another interrupt: account for the time that passed and
+// restart the periodic tick (interrupts disabled)
+static void timer_stop_oneshot(void)
+{
+    outb(PIT_CMD, PIT_CMD_CH0_READBACK);
+    uint8_t status = inb(PIT_CH0);
+    uint32_t lo = inb(PIT_CH0);
+    uint32_t hi = inb(PIT_CH0);
+
+    // Already expired: the pending IRQ 0 does the accounting
+    if (status & PIT_STATUS_OUT)
+        return;
+
+    uint32_t elapsed = oneshot_ticks * pit_divisor - ((hi << 8) | lo) + pit_residue;
+    timer_ticks += elapsed / pit_divisor;
+    pit_residue = elapsed % pit_divisor;
+    oneshot_ticks = 0;
+    pit_set_periodic();
+}
+
+// Restart the tick timer_idle() stopped: CPU 0's periodic PIT tick or an
+// AP's local APIC timer (interrupts disabled). An interrupt that wakes a
+// task may switch to it before timer_idle() gets control back, so the
+// scheduler calls this whenever it leaves the idle task.
+void timer_tick_resume(void)
+{
+    struct cpu *cpu = this_cpu();
+    if (cpu->index == 0)
+    {
+        if (oneshot_ticks)
+            timer_stop_oneshot();
+    }
+    else if (cpu->tick_stopped)
+    {
+        cpu->tick_stopped = 0;
+        lapic_timer_enable(1);
+    }
+}
+
+// Body of the idle loop. Runs other tasks if any are ready; otherwise
+// halts, without periodic ticks if no timer is due soon.
+void timer_idle(void)
+{
+    // Pull queued work from a busy CPU before halting
+    if (task_runnable() || task_steal())
+    {
+        task_yield();
+        return;
+    }
+
+    __asm__ volatile("cli");
+
+    // Application processors serve no timers: with the local tick off
+    // only a reschedule IPI (a task was queued here) wakes them
+    struct cpu *cpu = this_cpu();
+    if (cpu->index != 0)
+    {
+        if (!task_runnable())
+        {
+            cpu->tick_stopped = 1;
+            lapic_timer_enable(0);
+            __asm__ volatile("sti; hlt; cli");
+            timer_tick_resume();
+        }
+        __asm__ volatile("sti");
+        return;
+    }
+
+    uint32_t ticks = oneshot_max;
+    spin_lock(&timer_lock);
+    if (heap_size > 0)
+    {
+        int32_t due = (int32_t)(heap[0]->expires - timer_ticks);
+        ticks = due <= 1 ? 0 : ((uint32_t)due < ticks ? (uint32_t)due : ticks);
+    }
+    spin_unlock(&timer_lock);
+
+    if (ticks > 1 && !task_runnable() && !irq_line_pending(0))
+        timer_start_oneshot(ticks);
+
+    // sti takes effect after hlt starts, so no wakeup is lost in between
+    __asm__ volatile("sti; hlt; cli");
+
+    // Timers that came due while the one-shot was armed
+    if (oneshot_ticks)
+    {
+        timer_stop_oneshot();
+        timer_run_expired();
+    }
+
+    __asm__ volatile("sti");
+}
+
+void timer_get_stats(struct timer_stats *stats)
+{
+    stats->hz = timer_hz;
+    stats->tsc_khz = tsc_khz;
+    stats->interrupts = timer_interrupts;
+    stats->idle_oneshots = timer_oneshots;
+    stats->pending = heap_size;
+}
@@ -0,0 +1,81 @@
+#include "wait.h"
+#include "task.h"
+#include <stddef.h>
+
+void wait_queue_init(struct wait_queue *q)
+{
+    q->head = NULL;
+    q->tail = NULL;
+    q->count = 0;
+}
+
+void wait_add(struct wait_queue *q, struct wait_entry *e)
+{
+    e->task = task_get_current();
+    e->woken = 0;
+    e->next = NULL;
+    e->prev = q->tail;
+    if (q->tail)
+        q->tail->next = e;
+    else
+        q->head = e;
+    q->tail = e;
+    q->count++;
+}
+
+static void wait_unlink(struct wait_queue *q, struct wait_entry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        q->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        q->tail = e->prev;
+    q->count--;
+}
+
+void wait_remove(struct wait_queue *q, struct wait_entry *e)
+{
+    if (!e->woken)
+        wait_unlink(q, e);
+}
+
+static struct task *wait_wake_head(struct wait_queue *q, void (*wake)(struct task *))
+{
+    struct wait_entry *e = q->head;
+    if (!e)
+        return NULL;
+
+    wait_unlink(q, e);
+    e->woken = 1;
+    wake(e->task);
+    return e->task;
+}
+
+struct task *wait_wake_one(struct wait_queue *q)
+{
+    return wait_wake_head(q, task_wake);
+}
+
+struct task *wait_wake_one_here(struct wait_queue *q)
+{
+    return wait_wake_head(q, task_wake_here);
+}
+
+void wait_wake_all(struct wait_queue *q)
+{
+    while (wait_wake_one(q))
+        ;
+}
+
+int wait_sleep(struct wait_queue *q, spinlock_t *lock, uint32_t timeout)
+{
+    struct wait_entry e;
+
+    wait_add(q, &e);
+    task_block(lock, timeout);
+    wait_remove(q, &e);
+    return e.woken;
+}
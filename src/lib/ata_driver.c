@@ -15,7 +15,7 @@ static inline int syscall_request_io_port(uint16_t port_start, uint16_t port_end
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_REQUEST_IO_PORT), "b"(port_start), "c"(port_end));
     return ret;
@@ -25,7 +25,7 @@ static inline int syscall_register_irq_handler(uint8_t irq, uint32_t ipc_port)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_REGISTER_IRQ_HANDLER), "b"(irq), "c"(ipc_port));
     return ret;
@@ -35,7 +35,7 @@ static inline int syscall_ipc_create_named_port(const char *name)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_CREATE_NAMED_PORT), "b"(name));
     return ret;
@@ -51,26 +51,33 @@ struct ipc_message_user
     char data[256];
 };
 
-static inline int syscall_ipc_recv(uint32_t port, struct ipc_message_user *msg)
+static inline int syscall_ipc_set_queue_depth(uint32_t port, uint32_t depth)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
-        : "a"(SYS_IPC_RECV), "b"(port), "c"(msg));
+        : "a"(SYS_IPC_SET_QUEUE_DEPTH), "b"(port), "c"(depth));
     return ret;
 }
 
-static inline int syscall_ipc_send(uint32_t src_port, uint32_t dst_port, const void *data, uint32_t size)
+// 请求队列深度：允许大量并发 I/O 请求排队
+#define ATA_QUEUE_DEPTH 256
+
+// IPC_NO_REPLY（与内核 ipc.h 匹配）：第一次等待时没有要回复的调用者
+#define IPC_NO_REPLY 0xFFFFFFFF
+
+// 回复上一个调用者并等待下一个请求（同步 IPC，内核直接切换回调用者）
+static inline int syscall_ipc_reply_wait(uint32_t port, uint32_t reply_port,
+                                         const struct ipc_message_user *reply,
+                                         struct ipc_message_user *msg)
 {
-    // 使用 ipc_send 系统调用
-    // sys_ipc_send(dest_port, type, data, size)
     int ret;
-    (void)src_port; // 暂时不使用
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
-        : "a"(SYS_IPC_SEND), "b"(dst_port), "c"(0), "d"(data), "S"(size));
+        : "a"(SYS_IPC_REPLY_WAIT), "b"(port), "c"(reply_port), "d"(reply), "S"(msg)
+        : "memory");
     return ret;
 }
 
@@ -78,7 +85,7 @@ static inline int syscall_write(int fd, const char *buf, int len)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_WRITE), "b"(fd), "c"(buf), "d"(len));
     return ret;
@@ -243,13 +250,13 @@ static int ata_write_sector(uint8_t drive, uint32_t lba, const uint16_t *buffer)
     return 0;
 }
 
-// 处理块设备请求
-static void handle_request(struct ipc_message_user *msg, uint32_t my_port)
+// 处理块设备请求，响应写入 reply；返回 0 表示需要回复
+static int handle_request(struct ipc_message_user *msg, struct ipc_message_user *reply)
 {
     // 从消息中提取请求
     if (msg->size < sizeof(blkdev_request_t))
     {
-        return;
+        return -1;
     }
 
     blkdev_request_t *req = (blkdev_request_t *)msg->data;
@@ -302,8 +309,11 @@ static void handle_request(struct ipc_message_user *msg, uint32_t my_port)
         break;
     }
 
-    // 发送响应到发送者的端口（sender_port 可以是 0，这是有效的端口）
-    syscall_ipc_send(my_port, msg->sender_port, &resp, sizeof(resp));
+    // 响应由下一次 reply_wait 发给 sender_port（0 也是有效端口）
+    reply->type = 0;
+    reply->size = sizeof(resp);
+    memcpy(reply->data, &resp, sizeof(resp));
+    return 0;
 }
 
 // 用户空间 ATA 驱动主函数
@@ -326,19 +336,29 @@ void ata_driver_main(void)
         return;
     }
 
+    // 加深请求队列（失败时保留默认深度）
+    syscall_ipc_set_queue_depth(port, ATA_QUEUE_DEPTH);
+
     // 3. 注册 IRQ 处理器（可选）
     // syscall_register_irq_handler(ATA_PRIMARY_IRQ, port);
 
-    // 4. 主循环：接收并处理请求
+    // 4. 主循环：回复上一个请求，同时阻塞等待下一个请求
+    struct ipc_message_user msg;
+    struct ipc_message_user reply;
+    uint32_t reply_port = IPC_NO_REPLY;
+
     while (1)
     {
-        struct ipc_message_user msg;
-
-        // 阻塞等待请求
-        if (syscall_ipc_recv(port, &msg) != 0)
+        if (syscall_ipc_reply_wait(port, reply_port, &reply, &msg) != 0)
+        {
+            reply_port = IPC_NO_REPLY;
             continue;
+        }
 
-        // 处理请求并发送响应到 sender_port
-        handle_request(&msg, port);
+        // 处理请求，响应在下一轮发送到 sender_port
+        if (handle_request(&msg, &reply) == 0)
+            reply_port = msg.sender_port;
+        else
+            reply_port = IPC_NO_REPLY;
     }
 }
@@ -1,5 +1,8 @@
 #include "task.h"
 #include "ipc.h"
+#include "syscall.h"
+#include "ipc_ring.h"
+#include "timer.h"
 
 static volatile int server_running = 1;
 static volatile int client_running = 1;
@@ -107,13 +110,624 @@ void ipc_test_stop(void)
         task_yield();
 
     // Find and kill IPC test tasks
-    for (int i = 0; i < 32; i++)
+    uint32_t pos = 0;
+    struct task *t;
+    while ((t = task_iterate(&pos)) != 0)
     {
-        struct task *t = task_find_by_pid(i);
         if (t && ((t->name[0] == 'i' && t->name[1] == 'p' &&
                    t->name[2] == 'c' && t->name[3] == '_')))
         {
-            t->state = TASK_ZOMBIE;
+            task_kill(t);
         }
     }
 }
+
+// ============= IPC bulk transfer benchmark =============
+// Round-trips a payload client -> server -> client, either chunked through
+// the port queue (256 bytes per message, copied twice per hop) or as a
+// zero-copy page grant, and reports throughput for each payload size.
+
+#define BENCH_TICKS (2 * TIMER_HZ) // Measure each case for ~2 seconds
+#define BENCH_MSG_CHUNK 1
+#define BENCH_MSG_GRANT 2
+#define BENCH_MSG_QUIT 3
+
+extern void shell_print_raw(const char *str, int len);
+
+static void bench_print(const char *str)
+{
+    int len = 0;
+    while (str[len])
+        len++;
+    shell_print_raw(str, len);
+}
+
+// Print a number left-aligned in a column of `width` characters
+static void bench_print_num(uint32_t num, int width)
+{
+    char buf[12];
+    int i = 11;
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+
+    bench_print(&buf[i]);
+    for (int pad = 11 - i; pad < width; pad++)
+        bench_print(" ");
+}
+
+// One chunked round trip of `size` bytes
+static void bench_chunked_round(int my_port, int server_port, const char *src, char *dst, uint32_t size)
+{
+    struct ipc_message msg;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+
+    while (received < size)
+    {
+        if (sent < size)
+        {
+            uint32_t n = size - sent;
+            if (n > IPC_MSG_MAX_SIZE)
+                n = IPC_MSG_MAX_SIZE;
+            if (ipc_send_from_port(my_port, server_port, BENCH_MSG_CHUNK, src + sent, n) == 0)
+            {
+                sent += n;
+                continue;
+            }
+        }
+
+        if (ipc_try_recv(my_port, &msg) == 0)
+        {
+            for (uint32_t i = 0; i < msg.size; i++)
+                dst[received + i] = msg.data[i];
+            received += msg.size;
+            continue;
+        }
+
+        task_yield();
+    }
+}
+
+// One grant round trip, returns the buffer the pages came back at
+static uint32_t *bench_grant_round(int my_port, int server_port, uint32_t *buf, uint32_t npages)
+{
+    struct ipc_message msg;
+
+    while (ipc_send_grant_from_port(my_port, server_port, BENCH_MSG_GRANT, buf, npages) != 0)
+        task_yield();
+
+    while (ipc_try_recv(my_port, &msg) != 0)
+        task_yield();
+
+    if (!(msg.type & IPC_TYPE_GRANT))
+        return 0;
+
+    return (uint32_t *)((struct ipc_grant_desc *)msg.data)->vaddr;
+}
+
+// Events per second for `count` events in `ticks` timer ticks
+static uint32_t bench_per_sec(uint32_t count, uint32_t ticks)
+{
+    uint32_t hz = timer_get_hz();
+    if (ticks == 0)
+        ticks = 1;
+    return (count / ticks) * hz + (count % ticks) * hz / ticks;
+}
+
+// Throughput in KB/s for `rounds` round trips of `size` bytes in `ticks`
+static uint32_t bench_kbps(uint32_t rounds, uint32_t size, uint32_t ticks)
+{
+    return bench_per_sec(rounds * (size / 1024), ticks);
+}
+
+static void ipc_bench_server_task(void)
+{
+    int port = ipc_create_named_port("ipc_bench");
+    if (port < 0)
+        task_exit(-1);
+
+    struct ipc_message msg;
+    while (1)
+    {
+        if (ipc_try_recv(port, &msg) != 0)
+        {
+            task_yield();
+            continue;
+        }
+
+        if (msg.type == BENCH_MSG_QUIT)
+            break;
+
+        if (msg.type & IPC_TYPE_GRANT)
+        {
+            // Hand the same pages straight back
+            struct ipc_grant_desc *desc = (struct ipc_grant_desc *)msg.data;
+            while (ipc_send_grant_from_port(port, msg.sender_port, BENCH_MSG_GRANT,
+                                            (void *)desc->vaddr, desc->npages) != 0)
+                task_yield();
+        }
+        else
+        {
+            // Echo the chunk
+            while (ipc_send_from_port(port, msg.sender_port, BENCH_MSG_CHUNK, msg.data, msg.size) != 0)
+                task_yield();
+        }
+    }
+
+    ipc_destroy_port(port);
+    task_exit(0);
+}
+
+static void ipc_bench_client_task(void)
+{
+    static const uint32_t sizes[] = {4096, 64 * 1024, 1024 * 1024};
+    const uint32_t max_pages = (1024 * 1024) / 4096;
+
+    // Give the server time to create its port
+    int server_port = -1;
+    for (int i = 0; i < 100 && server_port < 0; i++)
+    {
+        task_yield();
+        server_port = ipc_find_port("ipc_bench");
+    }
+
+    int my_port = ipc_create_port();
+    char *src = (char *)ipc_buf_alloc(max_pages);
+    char *dst = (char *)ipc_buf_alloc(max_pages);
+
+    if (server_port < 0 || my_port < 0 || !src || !dst)
+    {
+        bench_print("\nipcbench: setup failed\n");
+        if (server_port >= 0)
+            ipc_send(server_port, BENCH_MSG_QUIT, 0, 0);
+        task_exit(-1);
+    }
+
+    for (uint32_t i = 0; i < max_pages * 4096; i++)
+        src[i] = (char)i;
+
+    bench_print("\n=== IPC bulk transfer (round trip) ===\n");
+    bench_print("Size      Chunked KB/s   Grant KB/s     Speedup\n");
+
+    for (int s = 0; s < 3; s++)
+    {
+        uint32_t size = sizes[s];
+        uint32_t npages = size / 4096;
+
+        // Today's path: 256-byte messages through the queue
+        uint32_t rounds = 0;
+        uint32_t start = timer_ticks;
+        while (rounds == 0 || timer_ticks - start < BENCH_TICKS)
+        {
+            bench_chunked_round(my_port, server_port, src, dst, size);
+            rounds++;
+        }
+        uint32_t chunked = bench_kbps(rounds, size, timer_ticks - start);
+
+        // Page grant path
+        uint32_t *buf = (uint32_t *)ipc_buf_alloc(npages);
+        rounds = 0;
+        start = timer_ticks;
+        while (buf && (rounds == 0 || timer_ticks - start < BENCH_TICKS))
+        {
+            buf[0] = rounds;
+            buf = bench_grant_round(my_port, server_port, buf, npages);
+            if (buf && buf[0] != rounds)
+                buf = 0; // Payload did not survive the trip
+            rounds++;
+        }
+        uint32_t granted = buf ? bench_kbps(rounds, size, timer_ticks - start) : 0;
+        if (buf)
+            ipc_buf_free(buf, npages);
+
+        bench_print_num(size / 1024, 0);
+        bench_print("KB");
+        bench_print(size >= 1024 * 1024 ? "    " : (size >= 64 * 1024 ? "      " : "       "));
+        bench_print_num(chunked, 15);
+        bench_print_num(granted, 15);
+        bench_print_num(chunked ? granted / chunked : 0, 0);
+        bench_print("x\n");
+    }
+
+    ipc_send(server_port, BENCH_MSG_QUIT, 0, 0);
+    ipc_buf_free(src, max_pages);
+    ipc_buf_free(dst, max_pages);
+    ipc_destroy_port(my_port);
+    task_exit(0);
+}
+
+// Start the IPC bulk transfer benchmark (results are printed when done)
+void ipc_bench_start(void)
+{
+    task_create("ipc_bench_srv", ipc_bench_server_task);
+    task_create("ipc_bench_cli", ipc_bench_client_task);
+}
+
+// ============= Call/reply ping-pong benchmark =============
+
+#define PINGPONG_MSG_PING 1
+#define PINGPONG_MSG_SWITCH 2 // Server moves from recv/send to reply_wait
+#define PINGPONG_MSG_QUIT 3
+
+// Round trips per second for `rounds` round trips in `ticks`
+static uint32_t bench_rate(uint32_t rounds, uint32_t ticks)
+{
+    return bench_per_sec(rounds, ticks);
+}
+
+static void ipc_pingpong_server_task(void)
+{
+    int port = ipc_create_named_port("ipc_pingpong");
+    if (port < 0)
+        task_exit(-1);
+
+    struct ipc_message msg;
+
+    // Phase 1: separate send and receive
+    while (1)
+    {
+        if (ipc_recv(port, &msg) != 0)
+            continue;
+        if (msg.type != PINGPONG_MSG_PING)
+            break;
+        ipc_send_from_port(port, msg.sender_port, PINGPONG_MSG_PING, msg.data, msg.size);
+    }
+
+    // Phase 2: combined reply + wait with direct handoff
+    uint32_t reply_port = msg.type == PINGPONG_MSG_SWITCH ? msg.sender_port : IPC_NO_REPLY;
+    while (msg.type != PINGPONG_MSG_QUIT)
+    {
+        if (ipc_reply_wait(port, reply_port, PINGPONG_MSG_PING, msg.data, msg.size, &msg) != 0)
+        {
+            reply_port = IPC_NO_REPLY;
+            continue;
+        }
+        reply_port = msg.sender_port;
+    }
+
+    ipc_destroy_port(port);
+    task_exit(0);
+}
+
+static void ipc_pingpong_client_task(void)
+{
+    // Give the server time to create its port
+    int server_port = -1;
+    for (int i = 0; i < 100 && server_port < 0; i++)
+    {
+        task_yield();
+        server_port = ipc_find_port("ipc_pingpong");
+    }
+
+    int my_port = ipc_create_port();
+    if (server_port < 0 || my_port < 0)
+    {
+        bench_print("\nipcpingpong: setup failed\n");
+        if (server_port >= 0)
+            ipc_send(server_port, PINGPONG_MSG_QUIT, 0, 0);
+        task_exit(-1);
+    }
+
+    struct ipc_message msg;
+    uint32_t payload[4] = {0, 1, 2, 3};
+
+    // ipc_send + ipc_recv on both sides
+    uint32_t rounds = 0;
+    uint32_t start = timer_ticks;
+    while (rounds == 0 || timer_ticks - start < BENCH_TICKS)
+    {
+        payload[0] = rounds;
+        if (ipc_send_from_port(my_port, server_port, PINGPONG_MSG_PING, payload, sizeof(payload)) != 0)
+        {
+            task_yield();
+            continue;
+        }
+        while (ipc_recv(my_port, &msg) != 0)
+            ;
+        rounds++;
+    }
+    uint32_t split = bench_rate(rounds, timer_ticks - start);
+
+    // ipc_call against ipc_reply_wait
+    ipc_call(my_port, server_port, PINGPONG_MSG_SWITCH, 0, 0, &msg);
+    rounds = 0;
+    start = timer_ticks;
+    while (rounds == 0 || timer_ticks - start < BENCH_TICKS)
+    {
+        payload[0] = rounds;
+        if (ipc_call(my_port, server_port, PINGPONG_MSG_PING, payload, sizeof(payload), &msg) != 0)
+            break;
+        rounds++;
+    }
+    uint32_t call = bench_rate(rounds, timer_ticks - start);
+
+    ipc_send(server_port, PINGPONG_MSG_QUIT, 0, 0);
+
+    bench_print("\n=== IPC ping-pong (16-byte round trips) ===\n");
+    bench_print("send+recv:        ");
+    bench_print_num(split, 10);
+    bench_print("/s\n");
+    bench_print("call/reply_wait:  ");
+    bench_print_num(call, 10);
+    bench_print("/s\n");
+
+    ipc_destroy_port(my_port);
+    task_exit(0);
+}
+
+// Start the call/reply round-trip benchmark (results are printed when done)
+void ipc_pingpong_start(void)
+{
+    task_create("ipc_pp_srv", ipc_pingpong_server_task);
+    task_create("ipc_pp_cli", ipc_pingpong_client_task);
+}
+
+// ============= Batched send/recv benchmark =============
+
+#define BATCH_MSG_DATA 1
+#define BATCH_MSG_QUIT 2
+#define BATCH_MSG_SIZE 32
+#define BATCH_MAX 32
+
+// Go through the trap like a driver would: the point is trap amortization
+static inline int bench_sys_sendv(uint32_t src, uint32_t dest, const struct ipc_iovec *vec, uint32_t count)
+{
+    int ret;
+    __asm__ volatile("int $0x80"
+                     : "=a"(ret)
+                     : "a"(SYS_IPC_SENDV), "b"(src), "c"(dest), "d"(vec), "S"(count), "D"(IPC_SEND_BLOCK)
+                     : "memory");
+    return ret;
+}
+
+static inline int bench_sys_recvv(uint32_t port, struct ipc_message *msgs, uint32_t max)
+{
+    int ret;
+    __asm__ volatile("int $0x80"
+                     : "=a"(ret)
+                     : "a"(SYS_IPC_RECVV), "b"(port), "c"(msgs), "d"(max)
+                     : "memory");
+    return ret;
+}
+
+static volatile uint32_t batch_recv_size = 1; // Consumer batch, set per phase
+
+static void ipc_batch_consumer_task(void)
+{
+    static struct ipc_message msgs[BATCH_MAX]; // Too big for the task stack
+
+    int port = ipc_create_named_port("ipc_batch");
+    if (port < 0 || ipc_set_queue_depth(port, 2 * BATCH_MAX) != 0)
+        task_exit(-1);
+
+    while (1)
+    {
+        int n = bench_sys_recvv(port, msgs, batch_recv_size);
+        if (n > 0 && msgs[n - 1].type == BATCH_MSG_QUIT)
+            break;
+    }
+
+    ipc_destroy_port(port);
+    task_exit(0);
+}
+
+static void ipc_batch_producer_task(void)
+{
+    static const uint32_t batches[] = {1, 8, 32};
+
+    // Give the consumer time to create its port
+    int consumer_port = -1;
+    for (int i = 0; i < 100 && consumer_port < 0; i++)
+    {
+        task_yield();
+        consumer_port = ipc_find_port("ipc_batch");
+    }
+
+    if (consumer_port < 0)
+    {
+        bench_print("\nipcbatch: setup failed\n");
+        task_exit(-1);
+    }
+
+    char payload[BATCH_MSG_SIZE];
+    for (int i = 0; i < BATCH_MSG_SIZE; i++)
+        payload[i] = (char)i;
+
+    struct ipc_iovec vec[BATCH_MAX];
+    for (int i = 0; i < BATCH_MAX; i++)
+    {
+        vec[i].type = BATCH_MSG_DATA;
+        vec[i].size = BATCH_MSG_SIZE;
+        vec[i].data = payload;
+    }
+
+    bench_print("\n=== IPC batched send/recv (32-byte messages) ===\n");
+    bench_print("Batch     Messages/s\n");
+
+    for (int b = 0; b < 3; b++)
+    {
+        uint32_t batch = batches[b];
+        batch_recv_size = batch;
+
+        uint32_t sent = 0;
+        uint32_t start = timer_ticks;
+        while (sent == 0 || timer_ticks - start < BENCH_TICKS)
+        {
+            int n = bench_sys_sendv(0, consumer_port, vec, batch);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        uint32_t rate = bench_rate(sent, timer_ticks - start);
+
+        bench_print_num(batch, 10);
+        bench_print_num(rate, 0);
+        bench_print("\n");
+    }
+
+    vec[0].type = BATCH_MSG_QUIT;
+    bench_sys_sendv(0, consumer_port, vec, 1);
+    task_exit(0);
+}
+
+// Start the batched send/recv benchmark (results are printed when done)
+void ipc_batch_start(void)
+{
+    task_create("ipc_batch_cons", ipc_batch_consumer_task);
+    task_create("ipc_batch_prod", ipc_batch_producer_task);
+}
+
+// ============= Shared-memory ring benchmark =============
+
+#define RING_MSG_DATA 1
+#define RING_MSG_QUIT 2
+#define RING_BENCH_PAGES 17 // Control page + 64KB of data
+
+// KB/s for `msgs` messages of `size` bytes in `ticks`
+static uint32_t bench_kbps_msgs(uint32_t msgs, uint32_t size, uint32_t ticks)
+{
+    uint32_t kb = (msgs / 1024) * size + (msgs % 1024) * size / 1024;
+    return bench_per_sec(kb, ticks);
+}
+
+static void ipc_ring_consumer_task(void)
+{
+    int port = ipc_create_named_port("ipc_ring");
+    if (port < 0)
+        task_exit(-1);
+
+    struct ipc_ring_ctrl *ring = 0;
+    volatile uint32_t sink = 0;
+    struct ipc_message msg;
+
+    while (1)
+    {
+        if (ipc_recv(port, &msg) != 0)
+            continue;
+
+        if (msg.type == RING_MSG_QUIT)
+        {
+            // Acknowledge so the producer can free the ring pages
+            ipc_send_from_port(port, msg.sender_port, RING_MSG_QUIT, 0, 0);
+            break;
+        }
+
+        if (msg.type == IPC_RING_TYPE_SETUP)
+            ring = ipc_ring_attach((const struct ipc_ring_desc *)msg.data);
+        else if (msg.type == RING_MSG_DATA)
+            sink += msg.data[0];
+
+        // Drain until the ring is really empty, then wait for the doorbell
+        while (ring)
+        {
+            struct ipc_ring_rec *rec;
+            while ((rec = ipc_ring_peek(ring)) != 0)
+            {
+                sink += rec->data[0];
+                ipc_ring_pop(ring, rec);
+            }
+            if (ipc_ring_idle(ring))
+                break;
+        }
+    }
+
+    ipc_destroy_port(port);
+    task_exit(0);
+}
+
+static void ipc_ring_producer_task(void)
+{
+    static char payload[1500];
+
+    // Give the consumer time to create its port
+    int consumer_port = -1;
+    for (int i = 0; i < 100 && consumer_port < 0; i++)
+    {
+        task_yield();
+        consumer_port = ipc_find_port("ipc_ring");
+    }
+
+    int my_port = ipc_create_port();
+    void *pages = ipc_buf_alloc(RING_BENCH_PAGES);
+    struct ipc_ring_ctrl *ring = ipc_ring_init(pages, RING_BENCH_PAGES);
+    struct ipc_ring_desc desc = {(uint32_t)pages, RING_BENCH_PAGES};
+
+    if (consumer_port < 0 || my_port < 0 || !ring ||
+        ipc_send_wait(my_port, consumer_port, IPC_RING_TYPE_SETUP, &desc, sizeof(desc)) != 0)
+    {
+        bench_print("\nipcring: setup failed\n");
+        if (consumer_port >= 0)
+            ipc_send(consumer_port, RING_MSG_QUIT, 0, 0);
+        task_exit(-1);
+    }
+
+    for (int i = 0; i < 1500; i++)
+        payload[i] = (char)i;
+
+    bench_print("\n=== IPC ipc_send vs shared-memory ring ===\n");
+    bench_print("Path            Size   Messages/s  KB/s\n");
+
+    // Today's path: one kernel copy in and one out per message
+    uint32_t msgs = 0;
+    uint32_t start = timer_ticks;
+    while (msgs == 0 || timer_ticks - start < BENCH_TICKS)
+    {
+        if (ipc_send_wait(my_port, consumer_port, RING_MSG_DATA, payload, IPC_MSG_MAX_SIZE) != 0)
+            break;
+        msgs++;
+    }
+    uint32_t ticks = timer_ticks - start;
+    bench_print("ipc_send_wait   256    ");
+    bench_print_num(bench_rate(msgs, ticks), 12);
+    bench_print_num(bench_kbps_msgs(msgs, IPC_MSG_MAX_SIZE, ticks), 0);
+    bench_print("\n");
+
+    // Ring: no syscall unless the consumer drained the ring
+    static const uint32_t sizes[] = {IPC_MSG_MAX_SIZE, 1500};
+    for (int s = 0; s < 2; s++)
+    {
+        uint32_t doorbells = 0;
+        msgs = 0;
+        start = timer_ticks;
+        while (msgs == 0 || timer_ticks - start < BENCH_TICKS)
+        {
+            int r = ipc_ring_put(ring, RING_MSG_DATA, payload, sizes[s]);
+            if (r < 0)
+            {
+                task_yield(); // Full: let the consumer catch up
+                continue;
+            }
+            if (r == 1)
+            {
+                ipc_send(consumer_port, IPC_RING_TYPE_DOORBELL, 0, 0);
+                doorbells++;
+            }
+            msgs++;
+        }
+        ticks = timer_ticks - start;
+        bench_print("ring            ");
+        bench_print_num(sizes[s], 7);
+        bench_print_num(bench_rate(msgs, ticks), 12);
+        bench_print_num(bench_kbps_msgs(msgs, sizes[s], ticks), 0);
+        bench_print(" (doorbells: ");
+        bench_print_num(doorbells, 0);
+        bench_print(")\n");
+    }
+
+    struct ipc_message ack;
+    if (ipc_call(my_port, consumer_port, RING_MSG_QUIT, 0, 0, &ack) == 0)
+        ipc_buf_free(pages, RING_BENCH_PAGES);
+    ipc_destroy_port(my_port);
+    task_exit(0);
+}
+
+// Start the shared-memory ring benchmark (results are printed when done)
+void ipc_ring_bench_start(void)
+{
+    task_create("ipc_ring_cons", ipc_ring_consumer_task);
+    task_create("ipc_ring_prod", ipc_ring_producer_task);
+}
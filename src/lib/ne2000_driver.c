@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include "netdev_ipc.h"
+#include "ipc_ring.h"
 
 // NE2000 寄存器定义
 #define NE2000_BASE 0x300
@@ -56,6 +57,9 @@
 #define NE2000_CMD_RWRITE 0x10
 #define NE2000_CMD_NODMA 0x20
 
+// 快速系统调用入口（内核映射的 vsyscall 页，见 syscall.h），代替 int $0x80
+#define VSYSCALL "call 0xFFFFE000"
+
 // 系统调用号
 #define SYS_WRITE 1
 #define SYS_YIELD 4
@@ -67,6 +71,12 @@
 #define SYS_IPC_TRY_RECV 14
 #define SYS_REQUEST_IO_PORT 15
 #define SYS_REGISTER_IRQ_HANDLER 16
+#define SYS_IPC_BUF_ALLOC 18
+#define SYS_IPC_LOOKUP 22
+#define SYS_IPC_SEND_WAIT 24
+#define SYS_IPC_SENDV 25
+#define SYS_IPC_POLL_NOTIFICATION 29
+#define SYS_IPC_WAIT_ANY 30
 
 // IPC 消息结构（与内核匹配）
 struct ipc_message_user
@@ -81,14 +91,14 @@ struct ipc_message_user
 // 系统调用封装
 static inline void syscall_write(const char *msg, int len)
 {
-    __asm__ volatile("int $0x80" : : "a"(1), "b"(1), "c"(msg), "d"(len)); // SYS_WRITE = 1
+    __asm__ volatile(VSYSCALL : : "a"(1), "b"(1), "c"(msg), "d"(len)); // SYS_WRITE = 1
 }
 
 static inline int syscall_request_io_port(uint16_t port_start, uint16_t port_end)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_REQUEST_IO_PORT), "b"(port_start), "c"(port_end));
     return ret;
@@ -98,7 +108,7 @@ static inline int syscall_ipc_create_named_port(const char *name)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_CREATE_NAMED_PORT), "b"(name));
     return ret;
@@ -108,7 +118,7 @@ static inline int syscall_ipc_recv(uint32_t port, struct ipc_message_user *msg)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_RECV), "b"(port), "c"(msg));
     return ret;
@@ -118,29 +128,130 @@ static inline int syscall_ipc_send(uint32_t dest_port, uint32_t type, const void
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_SEND), "b"(dest_port), "c"(type), "d"(data), "S"(size));
     return ret;
 }
 
+// 批量发送的消息描述（与内核 struct ipc_iovec 匹配）
+struct ipc_iovec_user
+{
+    uint32_t type;
+    uint32_t size;
+    const void *data;
+};
+
+#define IPC_SEND_BLOCK 0x1 // 队列满时等待（与内核 ipc.h 匹配）
+#define NE2000_RX_BATCH 8  // 每次 PRX 最多转发的数据包数
+
+// 到 netstack 的共享内存环：1 页控制页 + 16 页数据（64KB）
+#define NE2000_RING_PAGES 17
+#define NE2000_RING_RETRIES 100 // 环满时最多让出 CPU 的次数，之后丢弃数据包
+
+// 中断驱动的主循环
+#define NE2000_IRQ 11           // 与内核 ne2000.h 匹配
+#define NE2000_ISR_PRX 0x01     // 接收完成
+#define NE2000_IDLE_TIMEOUT 1000 // 1 秒（1000 Hz 时钟）：中断沿丢失时的兜底轮询
+
+// 在 IPC 窗口分配页（返回虚拟地址，失败返回 0）
+static inline uint32_t syscall_ipc_buf_alloc(uint32_t npages)
+{
+    uint32_t ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_BUF_ALLOC), "b"(npages)
+        : "memory");
+    return ret;
+}
+
+// 批量发送：一次陷入发送 count 条消息
+static inline int syscall_ipc_sendv(uint32_t src_port, uint32_t dest_port,
+                                    const struct ipc_iovec_user *vec, uint32_t count, uint32_t flags)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_SENDV), "b"(src_port), "c"(dest_port), "d"(vec), "S"(count), "D"(flags)
+        : "memory");
+    return ret;
+}
+
+// 阻塞发送：目标队列满时等待，而不是丢弃
+static inline int syscall_ipc_send_wait(uint32_t src_port, uint32_t dest_port, uint32_t type,
+                                        const void *data, uint32_t size)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_SEND_WAIT), "b"(src_port), "c"(dest_port), "d"(type), "S"(data), "D"(size)
+        : "memory");
+    return ret;
+}
+
 static inline int syscall_ipc_try_recv(uint32_t port, struct ipc_message_user *msg)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_TRY_RECV), "b"(port), "c"(msg));
     return ret;
 }
 
-static inline int syscall_ipc_find_port(const char *name)
+static inline int syscall_register_irq_handler(uint8_t irq, uint32_t port)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_REGISTER_IRQ_HANDLER), "b"(irq), "c"(port));
+    return ret;
+}
+
+// 取走并清零端口上的通知位（IRQ 通过通知位投递）
+static inline int syscall_ipc_poll_notification(uint32_t port, uint32_t *bits)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
-        : "a"(SYS_IPC_FIND_PORT), "b"(name));
+        : "a"(SYS_IPC_POLL_NOTIFICATION), "b"(port), "c"(bits)
+        : "memory");
+    return ret;
+}
+
+// 阻塞直到任一端口有消息或通知位，timeout 以调度 tick 计
+static inline int syscall_ipc_wait_any(const uint32_t *ports, uint32_t count, uint32_t timeout, uint32_t *ready)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_WAIT_ANY), "b"(ports), "c"(count), "d"(timeout), "S"(ready)
+        : "memory");
+    return ret;
+}
+
+// 端口句柄（与内核 struct ipc_handle 匹配）：首次解析后缓存，之后只校验代数计数器
+struct ipc_handle_user
+{
+    uint32_t port_id;
+    uint32_t generation;
+    const char *name;
+};
+
+static inline int syscall_ipc_lookup(struct ipc_handle_user *handle)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_LOOKUP), "b"(handle)
+        : "memory");
     return ret;
 }
 
@@ -385,7 +496,26 @@ static void handle_request(struct ipc_message_user *msg)
 // 系统调用：yield
 static inline void syscall_yield(void)
 {
-    __asm__ volatile("int $0x80" : : "a"(4)); // SYS_YIELD = 4
+    __asm__ volatile(VSYSCALL : : "a"(4)); // SYS_YIELD = 4
+}
+
+// 把网卡中的数据包直接拷进共享内存环（不经过内核），只在环由空变非空时敲门铃
+static void forward_to_ring(struct ipc_ring_ctrl *ring, uint32_t netstack_port)
+{
+    static uint8_t packet[NETDEV_MAX_PACKET_SIZE];
+    int len;
+
+    while ((len = ne2000_recv(packet, sizeof(packet))) > 0)
+    {
+        // 环满时让 netstack 先消费（背压），超过重试次数才丢包
+        int r;
+        int tries = 0;
+        while ((r = ipc_ring_put(ring, 1, packet, len)) < 0 && tries++ < NE2000_RING_RETRIES)
+            syscall_yield();
+
+        if (r == 1)
+            syscall_ipc_send(netstack_port, IPC_RING_TYPE_DOORBELL, 0, 0);
+    }
 }
 
 // 用户空间 NE2000 驱动主函数
@@ -413,45 +543,79 @@ void ne2000_driver_main(void)
     // 清除中断状态
     outb(NE2000_ISR, 0xFF);
 
-    // 查找 netstack 端口（用于转发接收到的数据包）
-    int netstack_port = -1;
-    int poll_count = 0;
+    // netstack 端口句柄（用于转发接收到的数据包）
+    struct ipc_handle_user netstack_handle = {0xFFFFFFFF, 0, "net.stack"};
+
+    // 共享内存环（按 netstack 端口的代数记录握手是否完成，0 表示未建立）
+    uint32_t ring_pages = syscall_ipc_buf_alloc(NE2000_RING_PAGES);
+    struct ipc_ring_ctrl *rx_ring = 0;
+    uint32_t ring_generation = 0;
+
+    // 网卡中断以通知位投递到本端口；只打开 PRX 中断，
+    // 其他状态位（如 PTX）不清除会让中断线一直保持有效
+    outb(NE2000_CMD, NE2000_CMD_PAGE0 | NE2000_CMD_START | NE2000_CMD_NODMA);
+    outb(NE2000_IMR, NE2000_ISR_PRX);
+    int irq_ok = syscall_register_irq_handler(NE2000_IRQ, port) == 0;
+    uint32_t wait_ports[1] = {port};
 
-    // 主循环：接收并处理请求 + 轮询网络数据包
+    // 主循环：睡眠直到有请求或网卡中断（不再 try_recv + yield 轮询）
     while (1)
     {
         struct ipc_message_user msg;
+        uint32_t ready, bits;
 
-        // 使用非阻塞接收，避免阻塞数据包接收
-        if (syscall_ipc_try_recv(port, &msg) == 0)
-            handle_request(&msg);
+        syscall_ipc_wait_any(wait_ports, 1, irq_ok ? NE2000_IDLE_TIMEOUT : 1, &ready);
+        syscall_ipc_poll_notification(port, &bits);
 
-        // 每 100 次循环查找一次 netstack（如果还没找到）
-        poll_count++;
-        if (netstack_port < 0 && (poll_count % 100) == 0)
-            netstack_port = syscall_ipc_find_port("net.stack");
+        while (syscall_ipc_try_recv(port, &msg) == 0)
+            handle_request(&msg);
 
-        // 检查是否有新的网络数据包（轮询）
+        // 中断合并：一次唤醒处理网卡中已到达的所有数据包
         uint8_t isr = inb(NE2000_ISR);
 
         // 如果有接收中断标志（PRX）
-        if (isr & 0x01)
+        if (isr & NE2000_ISR_PRX)
         {
-            // 清除中断标志
-            outb(NE2000_ISR, 0x01);
+            // 先清除中断标志，之后到达的数据包会产生新的中断
+            outb(NE2000_ISR, NE2000_ISR_PRX);
 
-            // 读取接收到的数据包
-            uint8_t packet_buffer[1518]; // 最大以太网帧大小
-            int packet_len = ne2000_recv(packet_buffer, sizeof(packet_buffer));
+            int netstack_port = syscall_ipc_lookup(&netstack_handle);
 
-            // 如果成功接收到数据包，并且找到了 netstack，转发数据包
-            if (packet_len > 0 && netstack_port >= 0)
+            // 首次（或 netstack 重启后）通过 IPC 握手把共享内存环交给 netstack
+            if (netstack_port >= 0 && ring_pages && ring_generation != netstack_handle.generation)
             {
-                // type = 1 表示接收到的网络数据包
-                syscall_ipc_send(netstack_port, 1, packet_buffer, packet_len);
+                struct ipc_ring_desc desc = {ring_pages, NE2000_RING_PAGES};
+                rx_ring = ipc_ring_init((void *)ring_pages, NE2000_RING_PAGES);
+                if (rx_ring && syscall_ipc_send_wait(port, netstack_port, IPC_RING_TYPE_SETUP,
+                                                     &desc, sizeof(desc)) == 0)
+                    ring_generation = netstack_handle.generation;
             }
-        }
 
-        syscall_yield(); // 让出 CPU
+            if (netstack_port >= 0 && ring_generation == netstack_handle.generation)
+            {
+                forward_to_ring(rx_ring, netstack_port);
+            }
+            else
+            {
+                // 没有共享内存环：一次取出一批数据包，用一次系统调用转发
+                static uint8_t rx_batch[NE2000_RX_BATCH][1518]; // 最大以太网帧大小
+                struct ipc_iovec_user vec[NE2000_RX_BATCH];
+                uint32_t count = 0;
+                while (count < NE2000_RX_BATCH)
+                {
+                    int packet_len = ne2000_recv(rx_batch[count], sizeof(rx_batch[count]));
+                    if (packet_len <= 0)
+                        break;
+                    vec[count].type = 1; // type = 1 表示接收到的网络数据包
+                    vec[count].size = packet_len;
+                    vec[count].data = rx_batch[count];
+                    count++;
+                }
+
+                // netstack 队列满时阻塞等待（背压），不再静默丢帧
+                if (netstack_port >= 0 && count > 0)
+                    syscall_ipc_sendv(port, netstack_port, vec, count, IPC_SEND_BLOCK);
+            }
+        }
     }
 }
@@ -9,6 +9,10 @@
  */
 
 #include <stdint.h>
+#include "ipc_ring.h"
+
+// 快速系统调用入口（内核映射的 vsyscall 页，见 syscall.h），代替 int $0x80
+#define VSYSCALL "call 0xFFFFE000"
 
 // 系统调用
 #define SYS_YIELD 4
@@ -17,17 +21,19 @@
 #define SYS_IPC_CREATE_NAMED_PORT 12
 #define SYS_IPC_FIND_PORT 13
 #define SYS_IPC_TRY_RECV 14
+#define SYS_IPC_LOOKUP 22
+#define SYS_IPC_RECVV 26
 
 static inline void syscall_yield(void)
 {
-    __asm__ volatile("int $0x80" : : "a"(SYS_YIELD));
+    __asm__ volatile(VSYSCALL : : "a"(SYS_YIELD));
 }
 
 static inline int syscall_ipc_create_named_port(const char *name)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_CREATE_NAMED_PORT), "b"(name));
     return ret;
@@ -47,7 +53,7 @@ static inline int syscall_ipc_recv(uint32_t port, struct ipc_message_user *msg)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_RECV), "b"(port), "c"(msg));
     return ret;
@@ -57,12 +63,26 @@ static inline int syscall_ipc_try_recv(uint32_t port, struct ipc_message_user *m
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_TRY_RECV), "b"(port), "c"(msg));
     return ret;
 }
 
+// 批量接收：一次陷入最多取出 max 条消息，队列为空时阻塞
+#define NETSTACK_RECV_BATCH 8
+
+static inline int syscall_ipc_recvv(uint32_t port, struct ipc_message_user *msgs, uint32_t max)
+{
+    int ret;
+    __asm__ volatile(
+        VSYSCALL
+        : "=a"(ret)
+        : "a"(SYS_IPC_RECVV), "b"(port), "c"(msgs), "d"(max)
+        : "memory");
+    return ret;
+}
+
 // ============= 网络协议栈数据结构 =============
 
 // 网络字节序转换
@@ -247,7 +267,8 @@ static void process_arp(const arp_packet_t *arp)
 
 // 系统调用前置声明
 static inline int syscall_ipc_send(int dest_port, uint32_t type, const void *data, uint32_t size);
-static inline int syscall_ipc_find_port(const char *name);
+struct ipc_handle_user;
+static inline int syscall_ipc_lookup(struct ipc_handle_user *handle);
 
 // 处理 ICMP 包 (ping)
 static void process_icmp(const icmp_header_t *icmp, const uint8_t *data, uint32_t len, ip_addr_t src_ip)
@@ -424,7 +445,7 @@ static void debug_print(const char *msg)
     while (msg[len])
         len++;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : : "a"(SYS_WRITE), "b"(1), "c"(msg), "d"(len));
 }
 
@@ -433,36 +454,42 @@ static inline int syscall_ipc_send(int dest_port, uint32_t type, const void *dat
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
         : "a"(SYS_IPC_SEND), "b"(dest_port), "c"(type), "d"(data), "S"(size));
     return ret;
 }
 
-// 系统调用：查找命名端口（实现）
-static inline int syscall_ipc_find_port(const char *name)
+// 端口句柄（与内核 struct ipc_handle 匹配）：首次解析后缓存，之后只校验代数计数器
+struct ipc_handle_user
+{
+    uint32_t port_id;
+    uint32_t generation;
+    const char *name;
+};
+
+// 系统调用：解析/校验端口句柄（实现）
+static inline int syscall_ipc_lookup(struct ipc_handle_user *handle)
 {
     int ret;
     __asm__ volatile(
-        "int $0x80"
+        VSYSCALL
         : "=a"(ret)
-        : "a"(SYS_IPC_FIND_PORT), "b"(name));
+        : "a"(SYS_IPC_LOOKUP), "b"(handle)
+        : "memory");
     return ret;
 }
 
-// 全局变量：NE2000 驱动端口（用于发送）
-static int ne2000_port = -1;
+// 全局变量：NE2000 驱动端口句柄（用于发送，驱动重启后自动重新解析）
+static struct ipc_handle_user ne2000_handle = {0xFFFFFFFF, 0, "netdev.ne2000"};
 
 // 发送以太网帧到 NE2000 驱动（实现）
 static void send_frame_to_driver(const uint8_t *frame, uint32_t len)
 {
+    // 解析 NE2000 驱动端口
+    int ne2000_port = syscall_ipc_lookup(&ne2000_handle);
     if (ne2000_port < 0)
-    {
-        // 查找 NE2000 驱动端口
-        ne2000_port = syscall_ipc_find_port("netdev.ne2000");
-        if (ne2000_port < 0)
-            return;
-    }
+        return;
 
     // 通过 IPC 发送数据包给 NE2000 驱动
     // 使用 type = 2 表示发送请求（NETDEV_OP_SEND_PACKET）
@@ -486,28 +513,51 @@ void netstack_driver_main(void)
     }
 
     // 主循环：接收网络数据包和应用请求
+    // 一次系统调用取出一批消息，没有消息时阻塞（不再轮询 + yield）
+    static struct ipc_message_user batch[NETSTACK_RECV_BATCH];
+    struct ipc_ring_ctrl *rx_ring = 0; // NE2000 驱动建立的共享内存环
     while (1)
     {
-        struct ipc_message_user msg;
+        int n = syscall_ipc_recvv(port, batch, NETSTACK_RECV_BATCH);
 
-        // 使用非阻塞接收，避免阻塞整个系统
-        int recv_result = syscall_ipc_try_recv(port, &msg);
-        if (recv_result == 0)
+        for (int i = 0; i < n; i++)
         {
+            struct ipc_message_user *msg = &batch[i];
+
             // 判断消息类型
-            if (msg.type == 1) // 网络数据包
+            if (msg->type == IPC_RING_TYPE_SETUP && msg->size >= sizeof(struct ipc_ring_desc))
+            {
+                // 握手：接管 NE2000 驱动分配的共享内存环
+                rx_ring = ipc_ring_attach((const struct ipc_ring_desc *)msg->data);
+            }
+            else if (msg->type == IPC_RING_TYPE_DOORBELL)
+            {
+                // 门铃：环由空变非空，下面统一处理
+            }
+            else if (msg->type == 1) // 网络数据包
             {
                 // 处理接收到的以太网帧
-                process_ethernet_frame((const uint8_t *)msg.data, msg.size);
+                process_ethernet_frame((const uint8_t *)msg->data, msg->size);
             }
-            else if (msg.type == 2) // 应用程序请求
+            else if (msg->type == 2) // 应用程序请求
             {
                 // 处理应用程序的网络请求（socket, send, recv等）
                 // 这需要实现完整的 socket API
             }
         }
 
-        // 让出 CPU，让其他任务运行
-        syscall_yield();
+        // 处理共享内存环中的数据包，直到确认环为空再回去睡眠（等待下一次门铃）
+        while (rx_ring)
+        {
+            struct ipc_ring_rec *rec;
+            while ((rec = ipc_ring_peek(rx_ring)) != 0)
+            {
+                if (rec->type == 1)
+                    process_ethernet_frame(rec->data, rec->len);
+                ipc_ring_pop(rx_ring, rec);
+            }
+            if (ipc_ring_idle(rx_ring))
+                break;
+        }
     }
 }
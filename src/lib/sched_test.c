@@ -1,4 +1,14 @@
 #include "task.h"
+#include "kmalloc.h"
+#include "timer.h"
+#include "isr.h"
+#include "fpu.h"
+#include "smp.h"
+#include "blkdev_ipc_client.h"
+#include "syscall.h"
+#include "paging.h"
+#include "usermode.h"
+#include "pmm.h"
 
 // Simple test task 1
 static void test_task_1(void)
@@ -37,13 +47,903 @@ void sched_test_create_tasks(void)
 void sched_test_stop_tasks(void)
 {
     // Find and kill test tasks
-    for (int i = 0; i < 32; i++)
+    uint32_t pos = 0;
+    struct task *t;
+    while ((t = task_iterate(&pos)) != 0)
     {
-        struct task *t = task_find_by_pid(i);
         if (t && (t->name[0] == 't' && t->name[1] == 'e' &&
                   t->name[2] == 's' && t->name[3] == 't'))
         {
-            t->state = TASK_ZOMBIE;
+            task_kill(t);
         }
     }
 }
+
+// ============= Pick-next benchmark =============
+// Times one scheduling decision (pick the next task, put it back at the
+// tail) on a private run queue holding N ready tasks, against a walk of
+// the old circular task list where every other task is blocked.
+
+#define SCHED_BENCH_ROUNDS 10000
+
+extern void shell_print_raw(const char *str);
+
+static void sched_bench_print(const char *str)
+{
+    shell_print_raw(str);
+}
+
+static void sched_bench_print_num(uint32_t num, int width)
+{
+    char buf[12];
+    int i = 11;
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+
+    sched_bench_print(&buf[i]);
+    for (int pad = 11 - i; pad < width; pad++)
+        sched_bench_print(" ");
+}
+
+// Average cycles per pick from the bitmap run queue
+static uint32_t sched_bench_bitmap(struct task *pool, uint32_t ntasks)
+{
+    struct run_queue rq;
+    rq_init(&rq);
+    for (uint32_t i = 0; i < ntasks; i++)
+    {
+        pool[i].state = TASK_READY;
+        pool[i].priority = (i & 1) ? PRIORITY_NORMAL : PRIORITY_LOW;
+        pool[i].queued = 0;
+        rq_enqueue(&rq, &pool[i]);
+    }
+
+    uint32_t flags = irq_save();
+    uint64_t start = timer_rdtsc();
+    for (uint32_t r = 0; r < SCHED_BENCH_ROUNDS; r++)
+    {
+        struct task *t = rq_pick(&rq);
+        rq_enqueue(&rq, t);
+    }
+    uint32_t cycles = (uint32_t)(timer_rdtsc() - start);
+    irq_restore(flags);
+
+    return cycles / SCHED_BENCH_ROUNDS;
+}
+
+// Average cycles per pick from the old circular list: skip blocked tasks
+// until the single runnable one comes round again
+static uint32_t sched_bench_scan(struct task *pool, uint32_t ntasks)
+{
+    for (uint32_t i = 0; i < ntasks; i++)
+    {
+        pool[i].state = TASK_BLOCKED;
+        pool[i].next = &pool[(i + 1) % ntasks];
+    }
+    pool[0].state = TASK_READY;
+
+    uint32_t flags = irq_save();
+    uint64_t start = timer_rdtsc();
+    for (uint32_t r = 0; r < SCHED_BENCH_ROUNDS; r++)
+    {
+        volatile struct task *next = pool[0].next;
+        while (next->state == TASK_ZOMBIE || next->state == TASK_BLOCKED)
+            next = next->next;
+    }
+    uint32_t cycles = (uint32_t)(timer_rdtsc() - start);
+    irq_restore(flags);
+
+    return cycles / SCHED_BENCH_ROUNDS;
+}
+
+static void sched_bench_task(void)
+{
+    static const uint32_t sizes[] = {1, 32, 1000};
+
+    sched_bench_print("\nPick-next latency (cycles per decision)\n");
+    sched_bench_print("Tasks   Bitmap   Scan     Bitmap(ns)\n");
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint32_t n = sizes[i];
+        struct task *pool = (struct task *)kmalloc(n * sizeof(struct task));
+        if (!pool)
+        {
+            sched_bench_print("Out of memory\n");
+            break;
+        }
+
+        uint32_t bitmap = sched_bench_bitmap(pool, n);
+        uint32_t scan = sched_bench_scan(pool, n);
+        kfree(pool);
+
+        sched_bench_print_num(n, 8);
+        sched_bench_print_num(bitmap, 9);
+        sched_bench_print_num(scan, 9);
+        if (timer_tsc_khz())
+            sched_bench_print_num((uint32_t)timer_cycles_to_ns(bitmap), 0);
+        else
+            sched_bench_print("-");
+        sched_bench_print("\n");
+    }
+
+    task_exit(0);
+}
+
+// Start the scheduler benchmark (results are printed when done)
+void sched_bench_start(void)
+{
+    task_create("sched_bench", sched_bench_task);
+}
+
+// ============= Task create/exit stress test =============
+// Creates and reaps STRESS_TASKS short-lived tasks, at most STRESS_BATCH
+// alive at a time, and reports create and exit+reap throughput.
+
+#define STRESS_TASKS 10000
+#define STRESS_BATCH 64
+
+static void stress_child_task(void)
+{
+    task_exit(0);
+}
+
+// Cycles per operation, without 64-bit division
+static uint32_t cycles_per_op(uint64_t cycles, uint32_t count)
+{
+    uint32_t shift = 0;
+    while (cycles >> 32)
+    {
+        cycles >>= 1;
+        shift++;
+    }
+    return count ? ((uint32_t)cycles / count) << shift : 0;
+}
+
+static uint32_t stress_per_sec(uint32_t count, uint64_t cycles)
+{
+    uint32_t khz = timer_tsc_khz();
+    uint32_t per_op = cycles_per_op(cycles, count);
+    if (!khz || !per_op)
+        return 0;
+    return (khz / per_op) * 1000 + ((khz % per_op) * 1000) / per_op;
+}
+
+static void stress_task(void)
+{
+    static uint32_t pids[STRESS_BATCH];
+    uint32_t created = 0;
+    uint32_t reaped = 0;
+    uint32_t failed = 0;
+    uint32_t max_pid = 0;
+    uint64_t create_cycles = 0;
+    uint64_t reap_cycles = 0;
+    struct task_stats stats;
+
+    while (created < STRESS_TASKS)
+    {
+        uint32_t batch = STRESS_TASKS - created < STRESS_BATCH ? STRESS_TASKS - created : STRESS_BATCH;
+        uint32_t n = 0;
+
+        uint64_t start = timer_rdtsc();
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            uint32_t pid = task_create("stress", stress_child_task);
+            if (pid)
+                pids[n++] = pid;
+        }
+        create_cycles += timer_rdtsc() - start;
+        created += batch;
+        failed += batch - n;
+
+        start = timer_rdtsc();
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int status;
+            if (task_waitpid(pids[i], &status) < 0)
+                continue;
+            if (pids[i] > max_pid)
+                max_pid = pids[i];
+            reaped++;
+        }
+        reap_cycles += timer_rdtsc() - start;
+    }
+
+    task_get_stats(&stats);
+
+    sched_bench_print("\nTask stress: ");
+    sched_bench_print_num(created, 0);
+    sched_bench_print(" created, ");
+    sched_bench_print_num(reaped, 0);
+    sched_bench_print(" reaped, ");
+    sched_bench_print_num(failed, 0);
+    sched_bench_print(" failed\n");
+
+    sched_bench_print("  Create:      ");
+    sched_bench_print_num(stress_per_sec(reaped, create_cycles), 0);
+    sched_bench_print(" tasks/s\n");
+    sched_bench_print("  Exit + reap: ");
+    sched_bench_print_num(stress_per_sec(reaped, reap_cycles), 0);
+    sched_bench_print(" tasks/s\n");
+
+    sched_bench_print("  Highest PID: ");
+    sched_bench_print_num(max_pid, 0);
+    sched_bench_print(", PID slots used: ");
+    sched_bench_print_num(stats.pid_slots, 0);
+    sched_bench_print("\n  Task cache: ");
+    sched_bench_print_num(stats.task_pages, 0);
+    sched_bench_print(" pages, stack cache: ");
+    sched_bench_print_num(stats.stack_pages, 0);
+    sched_bench_print(" pages\n");
+
+    task_exit(0);
+}
+
+// Start the task stress test (results are printed when done)
+void sched_stress_start(void)
+{
+    task_create("task_stress", stress_task);
+}
+
+// ============= Lazy FPU test =============
+// Two tasks keep different values in xmm0-xmm7 across many task switches
+// and check that they survive; a third never touches the FPU and must not
+// cost any save or restore.
+
+#define FPU_TEST_ROUNDS 1000
+
+static volatile uint32_t fpu_test_errors;
+
+static void fpu_test_run(uint32_t seed)
+{
+    uint32_t in[32] __attribute__((aligned(16)));
+    uint32_t out[32] __attribute__((aligned(16)));
+
+    for (uint32_t i = 0; i < 32; i++)
+        in[i] = seed * 0x01010101 + i;
+
+    __asm__ volatile("movaps 0(%0), %%xmm0\n"
+                     "movaps 16(%0), %%xmm1\n"
+                     "movaps 32(%0), %%xmm2\n"
+                     "movaps 48(%0), %%xmm3\n"
+                     "movaps 64(%0), %%xmm4\n"
+                     "movaps 80(%0), %%xmm5\n"
+                     "movaps 96(%0), %%xmm6\n"
+                     "movaps 112(%0), %%xmm7\n"
+                     :
+                     : "r"(in)
+                     : "memory");
+
+    for (uint32_t r = 0; r < FPU_TEST_ROUNDS; r++)
+    {
+        task_yield();
+
+        __asm__ volatile("movaps %%xmm0, 0(%0)\n"
+                         "movaps %%xmm1, 16(%0)\n"
+                         "movaps %%xmm2, 32(%0)\n"
+                         "movaps %%xmm3, 48(%0)\n"
+                         "movaps %%xmm4, 64(%0)\n"
+                         "movaps %%xmm5, 80(%0)\n"
+                         "movaps %%xmm6, 96(%0)\n"
+                         "movaps %%xmm7, 112(%0)\n"
+                         :
+                         : "r"(out)
+                         : "memory");
+
+        for (uint32_t i = 0; i < 32; i++)
+        {
+            if (out[i] != in[i])
+            {
+                fpu_test_errors++;
+                break;
+            }
+        }
+    }
+
+    task_exit(0);
+}
+
+static void fpu_test_a(void)
+{
+    fpu_test_run(0x11);
+}
+
+static void fpu_test_b(void)
+{
+    fpu_test_run(0x77);
+}
+
+static void fpu_test_integer(void)
+{
+    for (uint32_t r = 0; r < FPU_TEST_ROUNDS; r++)
+        task_yield();
+    task_exit(0);
+}
+
+static void fpu_test_task(void)
+{
+    struct fpu_stats before, after;
+
+    fpu_get_stats(&before);
+    if (before.mode == FPU_MODE_NONE)
+    {
+        sched_bench_print("\nFPU test: no FXSAVE/SSE support, skipped\n");
+        task_exit(0);
+    }
+
+    fpu_test_errors = 0;
+    task_create("fpu_a", fpu_test_a);
+    task_create("fpu_b", fpu_test_b);
+    task_create("fpu_int", fpu_test_integer);
+    while (task_waitpid(-1, 0) > 0)
+        ;
+
+    fpu_get_stats(&after);
+
+    sched_bench_print("\nFPU test (");
+    sched_bench_print(after.mode == FPU_MODE_XSAVE ? "XSAVE" : "FXSAVE");
+    sched_bench_print(", ");
+    sched_bench_print_num(after.state_size, 0);
+    sched_bench_print(" bytes/task): ");
+    sched_bench_print(fpu_test_errors ? "FAILED, " : "OK, ");
+    sched_bench_print_num(fpu_test_errors, 0);
+    sched_bench_print(" corrupted rounds\n");
+    sched_bench_print("  #NM traps: ");
+    sched_bench_print_num(after.traps - before.traps, 0);
+    sched_bench_print(", saves: ");
+    sched_bench_print_num(after.saves - before.saves, 0);
+    sched_bench_print(", restores: ");
+    sched_bench_print_num(after.restores - before.restores, 0);
+    sched_bench_print(" over ");
+    sched_bench_print_num(3 * FPU_TEST_ROUNDS, 0);
+    sched_bench_print(" yields\n");
+
+    task_exit(0);
+}
+
+// Start the lazy FPU test (results are printed when done)
+void sched_fpu_test_start(void)
+{
+    task_create("fpu_test", fpu_test_task);
+}
+
+// ============= SMP scaling benchmark =============
+// A fixed amount of CPU-bound work split evenly across 1 to 4 tasks.
+// With one CPU per task the wall time should drop almost linearly;
+// speedup is reported x100 against the single-task run.
+
+#define SMP_BENCH_WORK (1u << 28) // Loop iterations in total
+#define SMP_BENCH_MAX_TASKS 4
+
+static volatile uint32_t smp_bench_share;
+static volatile uint32_t smp_bench_sink;
+
+static void smp_bench_worker(void)
+{
+    uint32_t x = task_get_current()->pid;
+    for (uint32_t i = smp_bench_share; i > 0; i--)
+        x = x * 1664525u + 1013904223u;
+    smp_bench_sink = x;
+    task_exit(0);
+}
+
+static void smp_bench_task(void)
+{
+    uint32_t t1 = 0;
+
+    sched_bench_print("\nSMP scaling (");
+    sched_bench_print_num(cpu_count, 0);
+    sched_bench_print(cpu_count == 1 ? " CPU online)\n" : " CPUs online)\n");
+    sched_bench_print("Tasks   Ticks    Speedup(x100)\n");
+
+    for (uint32_t n = 1; n <= SMP_BENCH_MAX_TASKS; n++)
+    {
+        smp_bench_share = SMP_BENCH_WORK / n;
+
+        // Workers are placed on the least loaded CPUs; we only wait
+        uint32_t start = timer_ticks;
+        for (uint32_t i = 0; i < n; i++)
+            task_create("smp_work", smp_bench_worker);
+        while (task_waitpid(-1, 0) > 0)
+            ;
+        uint32_t ticks = timer_ticks - start;
+        if (ticks == 0)
+            ticks = 1;
+        if (n == 1)
+            t1 = ticks;
+
+        sched_bench_print_num(n, 8);
+        sched_bench_print_num(ticks, 9);
+        sched_bench_print_num(t1 * 100 / ticks, 0);
+        sched_bench_print("\n");
+    }
+
+    sched_bench_print("CPU  Ticks    Busy     Switches  IPIs     Steals\n");
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        struct cpu *cpu = &cpus[i];
+        sched_bench_print_num(i, 5);
+        sched_bench_print_num(cpu->ticks, 9);
+        sched_bench_print_num(cpu->busy_ticks, 9);
+        sched_bench_print_num(cpu->switches, 10);
+        sched_bench_print_num(cpu->resched_ipis, 9);
+        sched_bench_print_num(cpu->steals, 0);
+        sched_bench_print("\n");
+    }
+
+    task_exit(0);
+}
+
+// Start the SMP scaling benchmark (results are printed when done)
+void sched_smp_bench_start(void)
+{
+    task_create("smp_bench", smp_bench_task);
+}
+
+// ============= Placement benchmark (blkdev IPC) =============
+// Reads sector 0 through the user-space ATA driver with the scheduler's
+// placement hints on and off. With hints the driver is woken on the
+// client's CPU and runs through a direct handoff; without them each
+// request and reply crosses CPUs with a reschedule IPI.
+
+#define BLK_BENCH_OPS 1000
+
+static void blk_bench_totals(uint32_t *ipis, uint32_t *steals)
+{
+    *ipis = 0;
+    *steals = 0;
+    for (uint32_t i = 0; i < cpu_count; i++)
+    {
+        *ipis += cpus[i].resched_ipis;
+        *steals += cpus[i].steals;
+    }
+}
+
+static void blk_bench_task(void)
+{
+    static uint8_t buffer[512];
+    int saved = task_get_affinity();
+
+    sched_bench_print("\nblkdev IPC placement (");
+    sched_bench_print_num(cpu_count, 0);
+    sched_bench_print(" CPUs, ");
+    sched_bench_print_num(BLK_BENCH_OPS, 0);
+    sched_bench_print(" reads)\n");
+    sched_bench_print("Hints  Reads/s   Cycles/read  IPIs     Steals\n");
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int on = pass == 0;
+        uint32_t ipis0, steals0, ipis1, steals1;
+        uint32_t failed = 0;
+
+        task_set_affinity(on);
+        blkdev_ipc_read(0, 0, 1, buffer); // Warm up: place the driver
+        blk_bench_totals(&ipis0, &steals0);
+
+        uint64_t start = timer_rdtsc();
+        for (uint32_t i = 0; i < BLK_BENCH_OPS; i++)
+        {
+            if (blkdev_ipc_read(0, 0, 1, buffer) <= 0)
+                failed++;
+        }
+        uint64_t cycles = timer_rdtsc() - start;
+        blk_bench_totals(&ipis1, &steals1);
+
+        sched_bench_print(on ? "on     " : "off    ");
+        sched_bench_print_num(stress_per_sec(BLK_BENCH_OPS, cycles), 10);
+        sched_bench_print_num(cycles_per_op(cycles, BLK_BENCH_OPS), 13);
+        sched_bench_print_num(ipis1 - ipis0, 9);
+        sched_bench_print_num(steals1 - steals0, 0);
+        if (failed)
+        {
+            sched_bench_print("  (");
+            sched_bench_print_num(failed, 0);
+            sched_bench_print(" failed)");
+        }
+        sched_bench_print("\n");
+    }
+
+    task_set_affinity(saved);
+    task_exit(0);
+}
+
+// Start the placement benchmark (needs the ATA driver; results are
+// printed when done)
+void sched_blk_bench_start(void)
+{
+    task_create("blk_bench", blk_bench_task);
+}
+
+// ============= Null system call benchmark =============
+// Cost of entering and leaving the kernel for SYS_NULL through int $0x80
+// and through the stub at VSYSCALL_ADDR, from ring 0 (the driver tasks)
+// and from ring 3. The ring 3 loop (syscall_asm.s) runs in a task of its
+// own on two user pages and leaves its results in the first one.
+
+#define SYS_BENCH_CALLS 100000
+#define SYS_BENCH_USER 0xFFFFC000 // Code, then data at +0x800
+#define SYS_BENCH_STACK 0xFFFFD000
+
+extern uint8_t syscall_bench_user[], syscall_bench_user_end[];
+
+static uint8_t sys_bench_code[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static uint8_t sys_bench_stack[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+// Shared with syscall_bench_user (SYS_BENCH_DATA)
+struct sys_bench_data
+{
+    uint32_t calls;
+    uint64_t int80_cycles;
+    uint64_t vsyscall_cycles;
+} __attribute__((packed));
+
+static void sys_bench_user_task(void)
+{
+    enter_usermode((void *)SYS_BENCH_USER, (void *)(SYS_BENCH_STACK + PAGE_SIZE));
+}
+
+static void sys_bench_print_row(const char *name, uint64_t cycles)
+{
+    uint32_t per_call = cycles_per_op(cycles, SYS_BENCH_CALLS);
+    sched_bench_print(name);
+    sched_bench_print_num(per_call, 10);
+    if (timer_tsc_khz())
+        sched_bench_print_num((uint32_t)timer_cycles_to_ns(per_call), 0);
+    else
+        sched_bench_print("-");
+    sched_bench_print("\n");
+}
+
+static void sys_bench_task(void)
+{
+    sched_bench_print("\nNull system call (");
+    sched_bench_print_num(SYS_BENCH_CALLS, 0);
+    sched_bench_print(" calls, SYSENTER ");
+    sched_bench_print(syscall_sysenter_ok() ? "available)\n" : "not available)\n");
+    sched_bench_print("Caller  Entry       Cycles    ns\n");
+
+    // Ring 0
+    uint64_t start = timer_rdtsc();
+    for (uint32_t i = 0; i < SYS_BENCH_CALLS; i++)
+    {
+        int ret;
+        __asm__ volatile("int $0x80" : "=a"(ret) : "a"(SYS_NULL) : "memory");
+    }
+    sys_bench_print_row("ring 0  int $0x80   ", timer_rdtsc() - start);
+
+    start = timer_rdtsc();
+    for (uint32_t i = 0; i < SYS_BENCH_CALLS; i++)
+    {
+        int ret;
+        __asm__ volatile(VSYSCALL : "=a"(ret) : "a"(SYS_NULL) : "memory");
+    }
+    sys_bench_print_row("ring 0  vsyscall    ", timer_rdtsc() - start);
+
+    // Ring 3: copy the loop to a user page and run it in a child task
+    uint32_t size = syscall_bench_user_end - syscall_bench_user;
+    for (uint32_t i = 0; i < size; i++)
+        sys_bench_code[i] = syscall_bench_user[i];
+    struct sys_bench_data *data = (struct sys_bench_data *)(sys_bench_code + 0x800);
+    data->calls = SYS_BENCH_CALLS;
+    paging_map_page(sys_bench_code, (void *)SYS_BENCH_USER, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    paging_map_page(sys_bench_stack, (void *)SYS_BENCH_STACK, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+
+    int pid = (int)task_create("sys_bench_user", sys_bench_user_task);
+    if (pid > 0 && task_waitpid(pid, 0) == pid)
+    {
+        sys_bench_print_row("ring 3  int $0x80   ", data->int80_cycles);
+        sys_bench_print_row(syscall_sysenter_ok() ? "ring 3  sysenter    " : "ring 3  vsyscall    ",
+                            data->vsyscall_cycles);
+    }
+    else
+    {
+        sched_bench_print("ring 3  could not start the user task\n");
+    }
+
+    paging_unmap_page((void *)SYS_BENCH_USER);
+    paging_unmap_page((void *)SYS_BENCH_STACK);
+    task_exit(0);
+}
+
+// Start the null system call benchmark (results are printed when done)
+void sched_sys_bench_start(void)
+{
+    task_create("sys_bench", sys_bench_task);
+}
+
+// ============= Heap allocator benchmark =============
+// Keeps HEAP_BENCH_SLOTS allocations of 16-600 bytes alive (a quarter of
+// them 512-byte sector buffers) and replaces a random one per step, once
+// on the first-fit heap alone and once through kmalloc's size classes.
+// Reports free+alloc pairs per second, the memory the survivors hold
+// against what was asked for, and the first-fit heap's free-list shape.
+
+#define HEAP_BENCH_SLOTS 512
+#define HEAP_BENCH_OPS 20000
+
+static void *heap_bench_ptrs[HEAP_BENCH_SLOTS];
+static uint32_t heap_bench_sizes[HEAP_BENCH_SLOTS];
+static uint32_t heap_bench_seed;
+
+static uint32_t heap_bench_size(void)
+{
+    heap_bench_seed = heap_bench_seed * 1103515245 + 12345;
+    uint32_t r = heap_bench_seed >> 16;
+    return (r & 3) == 0 ? 512 : 16 + r % 585;
+}
+
+// Run the workload with `alloc`; returns cycles spent in the replace loop
+// and leaves the survivors allocated
+static uint64_t heap_bench_run(void *(*alloc)(size_t), uint32_t *requested, uint32_t *failed)
+{
+    heap_bench_seed = 1;
+    *failed = 0;
+    for (uint32_t i = 0; i < HEAP_BENCH_SLOTS; i++)
+    {
+        heap_bench_sizes[i] = heap_bench_size();
+        heap_bench_ptrs[i] = alloc(heap_bench_sizes[i]);
+    }
+
+    uint64_t start = timer_rdtsc();
+    for (uint32_t i = 0; i < HEAP_BENCH_OPS; i++)
+    {
+        uint32_t slot = (heap_bench_seed >> 8) % HEAP_BENCH_SLOTS;
+        kfree(heap_bench_ptrs[slot]);
+        heap_bench_sizes[slot] = heap_bench_size();
+        heap_bench_ptrs[slot] = alloc(heap_bench_sizes[slot]);
+    }
+    uint64_t cycles = timer_rdtsc() - start;
+
+    *requested = 0;
+    for (uint32_t i = 0; i < HEAP_BENCH_SLOTS; i++)
+    {
+        if (heap_bench_ptrs[i])
+            *requested += heap_bench_sizes[i];
+        else
+            (*failed)++;
+    }
+    return cycles;
+}
+
+static void heap_bench_free_all(void)
+{
+    for (uint32_t i = 0; i < HEAP_BENCH_SLOTS; i++)
+    {
+        kfree(heap_bench_ptrs[i]);
+        heap_bench_ptrs[i] = 0;
+    }
+}
+
+static void heap_bench_print_row(const char *name, uint64_t cycles, uint32_t requested, uint32_t held,
+                                 uint32_t failed)
+{
+    sched_bench_print(name);
+    sched_bench_print_num(stress_per_sec(HEAP_BENCH_OPS, cycles), 11);
+    sched_bench_print_num(cycles_per_op(cycles, HEAP_BENCH_OPS), 8);
+    sched_bench_print_num(held / 1024, 9);
+    sched_bench_print_num(held > requested ? (held - requested) * 100 / held : 0, 7);
+    sched_bench_print_num(failed, 0);
+    sched_bench_print("\n");
+}
+
+static void heap_bench_task(void)
+{
+    uint32_t total, used_before, used_after, free_mem;
+    uint32_t requested, failed, free_blocks, largest;
+    uint32_t pages_before, small_before, pages_after, small_after;
+
+    sched_bench_print("\nHeap allocator (");
+    sched_bench_print_num(HEAP_BENCH_OPS, 0);
+    sched_bench_print(" free+alloc, ");
+    sched_bench_print_num(HEAP_BENCH_SLOTS, 0);
+    sched_bench_print(" live, 16-600 bytes)\n");
+    sched_bench_print("Allocator   Pairs/s    Cycles  Held KB  Waste% Failed\n");
+
+    // First-fit: held is block sizes plus headers
+    kmalloc_stats(&total, &used_before, &free_mem);
+    uint64_t cycles = heap_bench_run(kmalloc_heap, &requested, &failed);
+    kmalloc_stats(&total, &used_after, &free_mem);
+    kmalloc_heap_frag(&free_blocks, &largest);
+    heap_bench_print_row("first-fit   ", cycles, requested, used_after - used_before, failed);
+    heap_bench_free_all();
+
+    // Size classes: held is the class sizes handed out
+    kmalloc_small_stats(&pages_before, &small_before);
+    cycles = heap_bench_run(kmalloc, &requested, &failed);
+    kmalloc_small_stats(&pages_after, &small_after);
+    heap_bench_print_row("size class  ", cycles, requested, small_after - small_before, failed);
+    heap_bench_free_all();
+
+    // External fragmentation: free memory the first-fit heap had left in
+    // pieces, measured with the survivors still allocated
+    sched_bench_print("First-fit free list: ");
+    sched_bench_print_num(free_blocks, 0);
+    sched_bench_print(" blocks, largest ");
+    sched_bench_print_num(largest / 1024, 0);
+    sched_bench_print(" KB of ");
+    sched_bench_print_num(free_mem / 1024, 0);
+    sched_bench_print(" KB free\nSize classes took ");
+    sched_bench_print_num(pages_after - pages_before, 0);
+    sched_bench_print(" new pages\n");
+
+    task_exit(0);
+}
+
+// Start the heap allocator benchmark (results are printed when done)
+void sched_heap_bench_start(void)
+{
+    task_create("heap_bench", heap_bench_task);
+}
+
+// ============= Page allocator benchmark =============
+// Allocates up to PMM_BENCH_BLOCKS blocks of each order from 0 to
+// PMM_MAX_ORDER and frees them again, timing both. Then fragments memory
+// on purpose (allocate single frames, free every other one) and shows the
+// free blocks per order before, during and after, when the buddies have
+// merged back.
+
+#define PMM_BENCH_BLOCKS 512
+
+static void *pmm_bench_blocks[PMM_BENCH_BLOCKS];
+
+static void pmm_bench_print_counts(const char *label)
+{
+    uint32_t counts[PMM_MAX_ORDER + 1];
+    pmm_get_free_counts(PMM_ZONE_NORMAL, counts);
+    sched_bench_print(label);
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+        sched_bench_print_num(counts[o], 6);
+    sched_bench_print("\n");
+}
+
+static void pmm_bench_task(void)
+{
+    sched_bench_print("\nPage allocator (up to ");
+    sched_bench_print_num(PMM_BENCH_BLOCKS, 0);
+    sched_bench_print(" blocks per order)\n");
+    sched_bench_print("Order Blocks Alloc cyc Free cyc  Allocs/s\n");
+
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++)
+    {
+        uint32_t n = 0;
+        uint64_t start = timer_rdtsc();
+        while (n < PMM_BENCH_BLOCKS && (pmm_bench_blocks[n] = pmm_alloc_pages(order)) != 0)
+            n++;
+        uint64_t alloc_cycles = timer_rdtsc() - start;
+
+        start = timer_rdtsc();
+        for (uint32_t i = 0; i < n; i++)
+            pmm_free_pages(pmm_bench_blocks[i], order);
+        uint64_t free_cycles = timer_rdtsc() - start;
+
+        sched_bench_print_num(order, 6);
+        sched_bench_print_num(n, 7);
+        sched_bench_print_num(cycles_per_op(alloc_cycles, n), 10);
+        sched_bench_print_num(cycles_per_op(free_cycles, n), 10);
+        sched_bench_print_num(stress_per_sec(n, alloc_cycles), 0);
+        sched_bench_print("\n");
+    }
+
+    sched_bench_print("Free blocks, orders 0-");
+    sched_bench_print_num(PMM_MAX_ORDER, 0);
+    sched_bench_print(":\n");
+    pmm_bench_print_counts("  before      ");
+
+    uint32_t n = 0;
+    while (n < PMM_BENCH_BLOCKS && (pmm_bench_blocks[n] = pmm_alloc_block()) != 0)
+        n++;
+    for (uint32_t i = 1; i < n; i += 2)
+        pmm_free_block(pmm_bench_blocks[i]);
+    pmm_bench_print_counts("  fragmented  ");
+
+    for (uint32_t i = 0; i < n; i += 2)
+        pmm_free_block(pmm_bench_blocks[i]);
+    pmm_bench_print_counts("  after       ");
+
+    task_exit(0);
+}
+
+// Start the page allocator benchmark (results are printed when done)
+void sched_pmm_bench_start(void)
+{
+    task_create("pmm_bench", pmm_bench_task);
+}
+
+// ============= Fork benchmark =============
+// Fork+exec at the page table level: a parent with 1MB or 16MB resident
+// is cloned, then the clone is torn down, which is what exec does with
+// the image it replaces. "copy" duplicates every page at fork, "cow"
+// shares the frames read-only. The deferred cost is in the last column:
+// the clone writing each page once, which breaks the sharing.
+
+#define FORK_BENCH_ROUNDS 8
+#define FORK_BENCH_BASE 0x08000000 // Where exec loads user text
+
+static void fork_bench_size(uint32_t pages, const char *label)
+{
+    page_directory *parent = paging_create_directory();
+    uint32_t mapped = 0;
+    while (parent && mapped < pages)
+    {
+        void *frame = pmm_alloc_high_block();
+        if (!frame)
+            break;
+        paging_map_page_in(parent, frame, (void *)(FORK_BENCH_BASE + mapped * PAGE_SIZE),
+                           PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+        mapped++;
+    }
+    if (mapped < pages)
+    {
+        sched_bench_print(label);
+        sched_bench_print("out of memory\n");
+        paging_free_directory(parent);
+        return;
+    }
+
+    for (int cow = 0; cow <= 1; cow++)
+    {
+        uint64_t fork_cycles = 0, total_cycles = 0;
+        uint32_t rounds = 0;
+        for (; rounds < FORK_BENCH_ROUNDS; rounds++)
+        {
+            uint64_t start = timer_rdtsc();
+            page_directory *child = cow ? paging_clone_directory(parent) : paging_copy_directory(parent);
+            uint64_t forked = timer_rdtsc();
+            if (!child)
+                break;
+            paging_free_directory(child);
+            fork_cycles += forked - start;
+            total_cycles += timer_rdtsc() - start;
+        }
+
+        sched_bench_print(label);
+        sched_bench_print(cow ? "cow   " : "copy  ");
+        sched_bench_print_num(cycles_per_op(fork_cycles, rounds), 11);
+        sched_bench_print_num(timer_cycles_to_us(cycles_per_op(total_cycles, rounds)), 11);
+
+        if (cow)
+        {
+            // Write faults without the trap: break every shared page
+            page_directory *child = paging_clone_directory(parent);
+            if (child)
+            {
+                uint64_t start = timer_rdtsc();
+                for (uint32_t i = 0; i < pages; i++)
+                    paging_cow_break(child, (void *)(FORK_BENCH_BASE + i * PAGE_SIZE));
+                sched_bench_print_num(cycles_per_op(timer_rdtsc() - start, pages), 0);
+                paging_free_directory(child);
+            }
+        }
+        else
+        {
+            sched_bench_print("-");
+        }
+        sched_bench_print("\n");
+    }
+
+    paging_free_directory(parent);
+}
+
+static void fork_bench_task(void)
+{
+    sched_bench_print("\nFork + exec (");
+    sched_bench_print_num(FORK_BENCH_ROUNDS, 0);
+    sched_bench_print(" rounds, address space only)\n");
+    sched_bench_print("Resident Mode  Fork cyc   F+exec us  Write cyc/page\n");
+
+    fork_bench_size(256, "1MB      ");
+    fork_bench_size(4096, "16MB     ");
+
+    task_exit(0);
+}
+
+// Start the fork benchmark (results are printed when done)
+void sched_fork_bench_start(void)
+{
+    task_create("fork_bench", fork_bench_task);
+}
@@ -2,6 +2,7 @@
 #include "pmm.h"
 #include "paging.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "task.h"
 #include "syscall.h"
 #include "vfs.h"
@@ -12,6 +13,9 @@
 #include "mount.h"
 #include "ne2000.h"
 #include "netif.h"
+#include "ipc.h"
+#include "irq_bridge.h"
+#include "timer.h"
 #include <stdint.h>
 
 // External functions
@@ -434,9 +438,23 @@ static void cmd_help(void)
     shell_print("  rmdir    - Remove directory\n");
     shell_print("  schedtest - Test scheduler (MLFQ)\n");
     shell_print("  schedstop - Stop scheduler test\n");
+    shell_print("  schedbench - Benchmark pick-next latency (1/32/1000 tasks)\n");
+    shell_print("  taskstress - Create and reap 10,000 tasks\n");
+    shell_print("  fputest  - Check SSE state across lazy FPU switches\n");
+    shell_print("  smpbench - CPU-bound scaling across 1-4 tasks/CPUs\n");
+    shell_print("  blkbench - blkdev IPC reads with/without CPU affinity hints\n");
+    shell_print("  rtlat    - IRQ-to-driver latency and deadline tasks (rtlat reset)\n");
+    shell_print("  sysbench - Null syscall cost: int $0x80 vs SYSENTER/vsyscall\n");
+    shell_print("  heapbench - kmalloc size classes vs first-fit heap\n");
+    shell_print("  pmmbench - Page allocator throughput at orders 0-10\n");
+    shell_print("  forkbench - Copying vs copy-on-write fork+exec\n");
     shell_print("  ipctest  - Test IPC (Inter-Process Communication)\n");
     shell_print("  ipcstop  - Stop IPC test\n");
     shell_print("  ipcinfo  - Show IPC statistics and ports\n");
+    shell_print("  ipcbench - Benchmark chunked vs page-grant IPC\n");
+    shell_print("  ipcpp    - Benchmark send/recv vs call/reply round trips\n");
+    shell_print("  ipcbatch - Benchmark batched ipc_sendv/ipc_recvv (1/8/32)\n");
+    shell_print("  ipcring  - Benchmark ipc_send vs shared-memory SPSC ring\n");
     shell_print("  drvtest  - Test user-space driver (microkernel demo)\n");
     shell_print("  drvstop  - Stop driver test\n");
     shell_print("  iotest   - Test I/O port permissions and IRQ bridge\n");
@@ -563,6 +581,18 @@ static void cmd_page(void)
     shell_print("Paging is active!\n");
 }
 
+// Print `num` left-aligned in a `width`-character column
+static void shell_print_col(uint32_t num, int width)
+{
+    char buf[16];
+    int_to_str(num, buf);
+    shell_print(buf);
+    for (int len = 0; buf[len]; len++)
+        width--;
+    while (width-- > 0)
+        shell_print(" ");
+}
+
 // Command: heap
 static void cmd_heap(void)
 {
@@ -590,6 +620,42 @@ static void cmd_heap(void)
     int_to_str(free_mem / 1024, buffer);
     shell_print(buffer);
     shell_print(" KB\n");
+
+    // Growth
+    struct kmalloc_heap_stats heap;
+    kmalloc_get_heap_stats(&heap);
+    shell_print("  Peak:   ");
+    shell_print_col(heap.peak_size / 1024, 0);
+    shell_print(" KB mapped, ");
+    shell_print_col(heap.peak_used / 1024, 0);
+    shell_print(" KB used (max ");
+    shell_print_col(heap.max_size / 1024, 0);
+    shell_print(" KB)\n  Grown ");
+    shell_print_col(heap.grows, 0);
+    shell_print(" times, trimmed ");
+    shell_print_col(heap.trims, 0);
+    shell_print(" times (");
+    shell_print_col(heap.trimmed_pages, 0);
+    shell_print(" pages returned)\n");
+
+    // Object caches, including kmalloc's size classes
+    shell_print("\nCache         Size  In use  Total   Pages\n");
+    uint32_t pos = 0;
+    struct kmem_cache *cache;
+    while ((cache = kmem_cache_iterate(&pos)) != 0)
+    {
+        int len = 0;
+        while (cache->name[len])
+            len++;
+        shell_print(cache->name);
+        while (len++ < 14)
+            shell_print(" ");
+        shell_print_col(cache->obj_size, 6);
+        shell_print_col(cache->in_use, 8);
+        shell_print_col(cache->total, 8);
+        shell_print_col(cache->pages, 0);
+        shell_print("\n");
+    }
 }
 
 // Command: malloc (test memory allocation)
@@ -667,56 +733,57 @@ static void cmd_ps(void)
     shell_print("---  -----------  --------  --------  ----------  --------\n");
 
     // Show all tasks
-    for (int i = 0; i < 32; i++)
+    uint32_t pos = 0;
+    struct task *t;
+    while ((t = task_iterate(&pos)) != 0)
     {
-        extern struct task *task_find_by_pid(int pid);
-        struct task *t = task_find_by_pid(i);
+        // PID
+        int_to_str(t->pid, buffer);
+        shell_print(buffer);
+        if (t->pid < 10)
+            shell_print("    ");
+        else
+            shell_print("   ");
 
-        if (t)
+        // Name (truncate to 11 chars)
+        int name_len = 0;
+        while (t->name[name_len] && name_len < 11)
         {
-            // PID
-            int_to_str(t->pid, buffer);
-            shell_print(buffer);
-            if (t->pid < 10)
-                shell_print("    ");
-            else
-                shell_print("   ");
-
-            // Name (truncate to 11 chars)
-            int name_len = 0;
-            while (t->name[name_len] && name_len < 11)
-            {
-                char ch[2] = {t->name[name_len], '\0'};
-                shell_print(ch);
-                name_len++;
-            }
-            while (name_len < 13)
-            {
-                shell_print(" ");
-                name_len++;
-            }
+            char ch[2] = {t->name[name_len], '\0'};
+            shell_print(ch);
+            name_len++;
+        }
+        while (name_len < 13)
+        {
+            shell_print(" ");
+            name_len++;
+        }
 
-            // State
-            switch (t->state)
-            {
-            case TASK_RUNNING:
-                shell_print("RUNNING   ");
-                break;
-            case TASK_READY:
-                shell_print("READY     ");
-                break;
-            case TASK_BLOCKED:
-                shell_print("BLOCKED   ");
-                break;
-            case TASK_SLEEPING:
-                shell_print("SLEEPING  ");
-                break;
-            case TASK_ZOMBIE:
-                shell_print("ZOMBIE    ");
-                break;
-            }
+        // State
+        switch (t->state)
+        {
+        case TASK_RUNNING:
+            shell_print("RUNNING   ");
+            break;
+        case TASK_READY:
+            shell_print("READY     ");
+            break;
+        case TASK_BLOCKED:
+            shell_print("BLOCKED   ");
+            break;
+        case TASK_SLEEPING:
+            shell_print("SLEEPING  ");
+            break;
+        case TASK_ZOMBIE:
+            shell_print("ZOMBIE    ");
+            break;
+        }
 
-            // Priority
+        // Priority (deadline tasks run ahead of every level)
+        if (t->rt_period)
+            shell_print("DEADLINE  ");
+        else
+        {
             switch (t->priority)
             {
             case 0:
@@ -735,26 +802,57 @@ static void cmd_ps(void)
                 shell_print("?         ");
                 break;
             }
+        }
 
-            // Total ticks
-            int_to_str(t->total_ticks, buffer);
-            shell_print(buffer);
+        // Total ticks
+        int_to_str(t->total_ticks, buffer);
+        shell_print(buffer);
 
-            int tick_len = 0;
-            while (buffer[tick_len])
-                tick_len++;
-            while (tick_len < 12)
-            {
-                shell_print(" ");
-                tick_len++;
-            }
+        int tick_len = 0;
+        while (buffer[tick_len])
+            tick_len++;
+        while (tick_len < 12)
+        {
+            shell_print(" ");
+            tick_len++;
+        }
 
-            // Context switches
-            int_to_str(t->context_switches, buffer);
-            shell_print(buffer);
+        // Context switches
+        int_to_str(t->context_switches, buffer);
+        shell_print(buffer);
 
-            shell_print("\n");
+        shell_print("\n");
+    }
+
+    // Who waits for a CPU: voluntary switches are blocks and yields,
+    // involuntary ones preemptions. Delay is time ready but not running.
+    shell_print("\nPID  Name         Vol     Invol   CPU(us)    Delay(us)  MaxDly(us)\n");
+    shell_print("---  -----------  ------  ------  ---------  ---------  ----------\n");
+
+    pos = 0;
+    while ((t = task_iterate(&pos)) != 0)
+    {
+        shell_print_col(t->pid, 5);
+
+        int name_len = 0;
+        while (t->name[name_len] && name_len < 11)
+        {
+            char ch[2] = {t->name[name_len], '\0'};
+            shell_print(ch);
+            name_len++;
+        }
+        while (name_len < 13)
+        {
+            shell_print(" ");
+            name_len++;
         }
+
+        shell_print_col(t->nvcsw, 8);
+        shell_print_col(t->nivcsw, 8);
+        shell_print_col(timer_cycles_to_us(t->cpu_cycles), 11);
+        shell_print_col(timer_cycles_to_us(t->run_delay), 11);
+        shell_print_col(timer_cycles_to_us(t->run_delay_max), 0);
+        shell_print("\n");
     }
 }
 
@@ -1302,10 +1400,6 @@ static void cmd_forktest(void)
         shell_print(pid_str);
         shell_print("\n");
     }
-    else if (result == -2)
-    {
-        shell_print("  Child still running\n");
-    }
     else
     {
         shell_print("  waitpid() failed\n");
@@ -1448,6 +1542,186 @@ static void cmd_schedstop(void)
     shell_print("Test tasks stopped.\n");
 }
 
+// Command: schedbench
+static void cmd_schedbench(void)
+{
+    shell_print("\nScheduler benchmark: bitmap run queue vs circular scan\n");
+    shell_print("Running...\n");
+
+    extern void sched_bench_start(void);
+    sched_bench_start();
+}
+
+// Command: taskstress
+static void cmd_taskstress(void)
+{
+    shell_print("\nTask stress test: create and reap 10,000 tasks\n");
+    shell_print("Running...\n");
+
+    extern void sched_stress_start(void);
+    sched_stress_start();
+}
+
+// Command: fputest
+static void cmd_fputest(void)
+{
+    shell_print("\nLazy FPU test: 2 SSE tasks + 1 integer-only task\n");
+    shell_print("Running...\n");
+
+    extern void sched_fpu_test_start(void);
+    sched_fpu_test_start();
+}
+
+// Command: smpbench
+static void cmd_smpbench(void)
+{
+    shell_print("\nSMP scaling benchmark: fixed work split across 1-4 tasks\n");
+    shell_print("Running...\n");
+
+    extern void sched_smp_bench_start(void);
+    sched_smp_bench_start();
+}
+
+// Command: blkbench
+static void cmd_blkbench(void)
+{
+    extern int blkdev_ipc_driver_available(void);
+    if (!blkdev_ipc_driver_available())
+    {
+        shell_print("\nATA driver is not running. Run 'atadrv' first.\n");
+        return;
+    }
+
+    shell_print("\nblkdev IPC placement benchmark: affinity hints on, then off\n");
+    shell_print("Running...\n");
+
+    extern void sched_blk_bench_start(void);
+    sched_blk_bench_start();
+}
+
+// Command: sysbench
+static void cmd_sysbench(void)
+{
+    shell_print("\nNull system call benchmark: ring 0 and ring 3 callers\n");
+    shell_print("Running...\n");
+
+    extern void sched_sys_bench_start(void);
+    sched_sys_bench_start();
+}
+
+// Command: heapbench
+static void cmd_heapbench(void)
+{
+    shell_print("\nHeap allocator benchmark: first-fit heap, then size classes\n");
+    shell_print("Running...\n");
+
+    extern void sched_heap_bench_start(void);
+    sched_heap_bench_start();
+}
+
+// Command: pmmbench
+static void cmd_pmmbench(void)
+{
+    shell_print("\nPage allocator benchmark: alloc/free per order, then fragmentation\n");
+    shell_print("Running...\n");
+
+    extern void sched_pmm_bench_start(void);
+    sched_pmm_bench_start();
+}
+
+// Command: forkbench
+static void cmd_forkbench(void)
+{
+    shell_print("\nFork benchmark: clone + teardown, 1MB and 16MB resident\n");
+    shell_print("Running...\n");
+
+    extern void sched_fork_bench_start(void);
+    sched_fork_bench_start();
+}
+
+// Command: rtlat
+static void cmd_rtlat(void)
+{
+    struct irq_latency_stats stats;
+    irq_bridge_get_latency(&stats);
+
+    shell_print("\nIRQ-to-driver latency (IRQ to the woken driver running)\n");
+    shell_print("Samples: ");
+    shell_print_col(stats.samples, 0);
+    if (stats.samples > 0)
+    {
+        uint32_t p50 = ipc_hist_percentile(stats.hist, IRQ_LAT_BUCKETS, 50);
+        uint32_t p99 = ipc_hist_percentile(stats.hist, IRQ_LAT_BUCKETS, 99);
+        shell_print("  p50/p99/max: ");
+        shell_print_col(p50, 0);
+        shell_print("/");
+        shell_print_col(p99, 0);
+        shell_print("/");
+        shell_print_col(stats.max_cycles, 0);
+        shell_print(" cycles (");
+        shell_print_col((uint32_t)timer_cycles_to_ns(p50), 0);
+        shell_print("/");
+        shell_print_col((uint32_t)timer_cycles_to_ns(p99), 0);
+        shell_print("/");
+        shell_print_col((uint32_t)timer_cycles_to_ns(stats.max_cycles), 0);
+        shell_print(" ns)\n");
+
+        uint32_t most = 1;
+        for (int i = 0; i < IRQ_LAT_BUCKETS; i++)
+            if (stats.hist[i] > most)
+                most = stats.hist[i];
+
+        shell_print("  <= cycles    Count     \n");
+        for (int i = 0; i < IRQ_LAT_BUCKETS; i++)
+        {
+            if (!stats.hist[i])
+                continue;
+            shell_print("  ");
+            shell_print_col(i == 0 ? 0 : (1u << i) - 1, 12);
+            shell_print_col(stats.hist[i], 10);
+            for (uint32_t n = (stats.hist[i] * 40 + most - 1) / most; n > 0; n--)
+                shell_print("#");
+            shell_print("\n");
+        }
+    }
+    else
+    {
+        shell_print("\n");
+    }
+
+    shell_print("\nDeadline tasks (CPU 0 reserved: ");
+    shell_print_col(task_get_rt_util(), 0);
+    shell_print("/");
+    shell_print_col(RT_UTIL_MAX, 0);
+    shell_print(" permille)\n");
+    shell_print("PID  Name           Budget  Period  Util  Throttles  Misses\n");
+
+    uint32_t pos = 0;
+    struct task *t;
+    while ((t = task_iterate(&pos)) != 0)
+    {
+        if (!t->rt_period)
+            continue;
+        shell_print_col(t->pid, 5);
+        int len = 0;
+        while (t->name[len] && len < 14)
+        {
+            char ch[2] = {t->name[len], '\0'};
+            shell_print(ch);
+            len++;
+        }
+        while (len++ < 15)
+            shell_print(" ");
+        shell_print_col(t->rt_budget, 8);
+        shell_print_col(t->rt_period, 8);
+        shell_print_col(t->rt_util, 6);
+        shell_print_col(t->rt_throttles, 11);
+        shell_print_col(t->rt_misses, 0);
+        shell_print("\n");
+    }
+    shell_print("(budget/period in ticks, util in permille)\n");
+}
+
 // Command: ipctest
 static void cmd_ipctest(void)
 {
@@ -1482,16 +1756,7 @@ static void cmd_ipcstop(void)
 // Command: ipcinfo
 static void cmd_ipcinfo(void)
 {
-    extern void ipc_get_stats(void *);
-    extern struct ipc_port *ipc_get_port(uint32_t);
-
-    struct
-    {
-        uint32_t total_ports;
-        uint32_t active_ports;
-        uint32_t total_messages;
-        uint32_t blocked_tasks;
-    } stats;
+    struct ipc_stats stats;
 
     ipc_get_stats(&stats);
 
@@ -1520,62 +1785,119 @@ static void cmd_ipcinfo(void)
     if (stats.active_ports > 0)
     {
         shell_print("\n=== Active Ports ===\n");
-        for (int i = 0; i < 32; i++)
+        for (uint32_t i = 0; i < stats.total_ports; i++)
         {
-            void *port = ipc_get_port(i);
+            struct ipc_port *port = ipc_get_port(i);
             if (port)
             {
-                // Port structure access
-                uint32_t *port_data = (uint32_t *)port;
-                uint32_t port_id = port_data[0];
-                uint32_t owner_pid = port_data[1];
-                // uint32_t in_use = port_data[2];
-                char *name = (char *)&port_data[3];
-                uint32_t queue_count = port_data[19]; // After name[32]
-                uint32_t total_sent = port_data[20];
-                uint32_t total_received = port_data[21];
-                uint32_t drops = port_data[22];
-
                 shell_print("Port ");
-                int_to_str(port_id, buf);
+                int_to_str(port->port_id, buf);
                 shell_print(buf);
                 shell_print(": Owner=");
-                int_to_str(owner_pid, buf);
+                int_to_str(port->owner_pid, buf);
                 shell_print(buf);
 
-                if (name[0] != '\0')
+                if (port->name[0] != '\0')
                 {
                     shell_print(" Name=\"");
-                    shell_print(name);
+                    shell_print(port->name);
                     shell_print("\"");
                 }
 
                 shell_print(" Queue=");
-                int_to_str(queue_count, buf);
+                int_to_str(port->queue_count, buf);
+                shell_print(buf);
+                shell_print("/");
+                int_to_str(port->queue_depth, buf);
                 shell_print(buf);
-                shell_print("/16");
 
                 shell_print(" Sent=");
-                int_to_str(total_sent, buf);
+                int_to_str(port->total_sent, buf);
                 shell_print(buf);
 
                 shell_print(" Recv=");
-                int_to_str(total_received, buf);
+                int_to_str(port->total_received, buf);
                 shell_print(buf);
 
-                if (drops > 0)
+                if (port->drops > 0)
                 {
                     shell_print(" Drops=");
-                    int_to_str(drops, buf);
+                    int_to_str(port->drops, buf);
+                    shell_print(buf);
+                }
+
+                if (port->send_blocks > 0)
+                {
+                    shell_print(" SendBlk=");
+                    int_to_str(port->send_blocks, buf);
                     shell_print(buf);
                 }
 
                 shell_print("\n");
+
+                // Queue depth and time spent queued (p50/p99 bucket bounds)
+                if (port->total_received > 0)
+                {
+                    shell_print("    Depth p50/p99=");
+                    int_to_str(ipc_hist_percentile(port->depth_hist, IPC_DEPTH_BUCKETS, 50), buf);
+                    shell_print(buf);
+                    shell_print("/");
+                    int_to_str(ipc_hist_percentile(port->depth_hist, IPC_DEPTH_BUCKETS, 99), buf);
+                    shell_print(buf);
+                    shell_print(" Latency p50/p99=");
+                    int_to_str(ipc_hist_percentile(port->lat_hist, IPC_LAT_BUCKETS, 50), buf);
+                    shell_print(buf);
+                    shell_print("/");
+                    int_to_str(ipc_hist_percentile(port->lat_hist, IPC_LAT_BUCKETS, 99), buf);
+                    shell_print(buf);
+                    shell_print(" cycles\n");
+                }
             }
         }
     }
 }
 
+// Command: ipcbench
+static void cmd_ipcbench(void)
+{
+    shell_print("\nStarting IPC bulk transfer benchmark...\n");
+    shell_print("Comparing 256-byte chunked messages with page grants\n");
+    shell_print("for 4KB, 64KB and 1MB payloads (~2s per case).\n");
+
+    extern void ipc_bench_start(void);
+    ipc_bench_start();
+}
+
+// Command: ipcpp
+static void cmd_ipcpp(void)
+{
+    shell_print("\nStarting IPC ping-pong benchmark...\n");
+    shell_print("Comparing ipc_send+ipc_recv with ipc_call+ipc_reply_wait (~2s each).\n");
+
+    extern void ipc_pingpong_start(void);
+    ipc_pingpong_start();
+}
+
+// Command: ipcbatch
+static void cmd_ipcbatch(void)
+{
+    shell_print("\nStarting IPC batch benchmark...\n");
+    shell_print("Measuring messages/s for batch sizes 1, 8 and 32 (~2s each).\n");
+
+    extern void ipc_batch_start(void);
+    ipc_batch_start();
+}
+
+// Command: ipcring
+static void cmd_ipcring(void)
+{
+    shell_print("\nStarting shared-memory ring benchmark...\n");
+    shell_print("Comparing ipc_send_wait with an SPSC ring (~2s per case).\n");
+
+    extern void ipc_ring_bench_start(void);
+    ipc_ring_bench_start();
+}
+
 // Command: drvtest
 static void cmd_drvtest(void)
 {
@@ -1928,7 +2250,6 @@ static void cmd_netstacktest(void)
         test_frame[i] = 0x00;
 
     // 通过 IPC 发送给 netstack
-    extern int ipc_send(int dest_port, uint32_t type, const void *data, uint32_t size);
     int result = ipc_send(netstack_port, 1, test_frame, 60); // type=1 表示网络数据包
 
     if (result == 0)
@@ -2157,7 +2478,6 @@ static void cmd_ping(const char *ip_str)
     packet[37] = checksum & 0xFF;
 
     // 通过 IPC 发送给 netstack
-    extern int ipc_send(int dest_port, uint32_t type, const void *data, uint32_t size);
     int result = ipc_send(netstack_port, 1, packet, 98);
 
     if (result == 0)
@@ -2231,7 +2551,7 @@ static void cmd_iotest(void)
         if (result == 0)
         {
             shell_print("[OK] IRQ handler registered!\n");
-            shell_print("Note: IRQ messages will be sent to port ");
+            shell_print("Note: IRQ notification bits will be set on port ");
             int_to_str(port, num);
             shell_print(num);
             shell_print(" on keyboard events\n");
@@ -3291,6 +3611,51 @@ static void shell_execute_command(void)
     {
         cmd_schedstop();
     }
+    else if (strcmp(command_buffer, "schedbench") == 0)
+    {
+        cmd_schedbench();
+    }
+    else if (strcmp(command_buffer, "taskstress") == 0)
+    {
+        cmd_taskstress();
+    }
+    else if (strcmp(command_buffer, "fputest") == 0)
+    {
+        cmd_fputest();
+    }
+    else if (strcmp(command_buffer, "smpbench") == 0)
+    {
+        cmd_smpbench();
+    }
+    else if (strcmp(command_buffer, "blkbench") == 0)
+    {
+        cmd_blkbench();
+    }
+    else if (strcmp(command_buffer, "sysbench") == 0)
+    {
+        cmd_sysbench();
+    }
+    else if (strcmp(command_buffer, "heapbench") == 0)
+    {
+        cmd_heapbench();
+    }
+    else if (strcmp(command_buffer, "pmmbench") == 0)
+    {
+        cmd_pmmbench();
+    }
+    else if (strcmp(command_buffer, "forkbench") == 0)
+    {
+        cmd_forkbench();
+    }
+    else if (strcmp(command_buffer, "rtlat") == 0)
+    {
+        cmd_rtlat();
+    }
+    else if (strcmp(command_buffer, "rtlat reset") == 0)
+    {
+        irq_bridge_reset_latency();
+        shell_print("\nIRQ latency histogram cleared\n");
+    }
     else if (strcmp(command_buffer, "ipctest") == 0)
     {
         cmd_ipctest();
@@ -3303,6 +3668,22 @@ static void shell_execute_command(void)
     {
         cmd_ipcinfo();
     }
+    else if (strcmp(command_buffer, "ipcbench") == 0)
+    {
+        cmd_ipcbench();
+    }
+    else if (strcmp(command_buffer, "ipcpp") == 0)
+    {
+        cmd_ipcpp();
+    }
+    else if (strcmp(command_buffer, "ipcbatch") == 0)
+    {
+        cmd_ipcbatch();
+    }
+    else if (strcmp(command_buffer, "ipcring") == 0)
+    {
+        cmd_ipcring();
+    }
     else if (strcmp(command_buffer, "drvtest") == 0)
     {
         cmd_drvtest();
@@ -175,12 +175,13 @@ void userspace_driver_stop(void)
         task_yield();
 
     // Kill all driver-related tasks
-    for (int i = 0; i < 32; i++)
+    uint32_t pos = 0;
+    struct task *t;
+    while ((t = task_iterate(&pos)) != 0)
     {
-        struct task *t = task_find_by_pid(i);
         if (t && ((t->name[0] == 'k' && t->name[1] == 'b' && t->name[2] == 'd')))
         {
-            t->state = TASK_ZOMBIE;
+            task_kill(t);
         }
     }
 }
@@ -1,41 +1,154 @@
 #include "kmalloc.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "pmm.h"
+#include "paging.h"
+#include "smp.h"
 
-// Heap start and size
+// The heap starts at KHEAP_BASE and is mapped up to heap_end. Blocks tile
+// the mapped range in address order; when none fits, fresh frames are
+// mapped at the top, and kmalloc_trim() hands a large free top back.
 static struct heap_block *heap_start = 0;
-static uint32_t heap_size = 0;
+static uint32_t heap_end = 0;
+static spinlock_t heap_lock = SPINLOCK_INIT; // Block list, shared by all CPUs
+
+// Growth statistics (heap_lock)
+static uint32_t heap_used;      // Allocated blocks, headers included
+static uint32_t heap_peak_used;
+static uint32_t heap_peak_size;
+static uint32_t heap_grows;
+static uint32_t heap_trims;
+static uint32_t heap_trimmed_pages;
+static volatile int heap_trim_wanted;
 
 // Minimum block size (to avoid too much fragmentation)
 #define MIN_BLOCK_SIZE 16
 
+#define KHEAP_INITIAL (256 * 1024)      // Mapped at boot and never trimmed
+#define KHEAP_GROW_MIN (16 * PAGE_SIZE) // Smallest extension
+#define KHEAP_TRIM_MIN (64 * 1024)      // Free top worth handing back
+
+// Size classes, 16 to 2048 bytes
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+static struct kmem_cache size_caches[KMALLOC_CLASSES];
+static const char *size_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+// Map fresh frames at the top of the heap (heap_lock held). Returns the
+// bytes mapped, short if the PMM runs out or the range is full.
+static uint32_t heap_map(uint32_t bytes)
+{
+    uint32_t mapped = 0;
+    while (mapped < bytes && heap_end < KHEAP_BASE + KHEAP_MAX)
+    {
+        void *frame = pmm_alloc_block();
+        if (!frame)
+            break;
+        paging_map_page(frame, (void *)heap_end, PAGE_PRESENT | PAGE_WRITE);
+        heap_end += PAGE_SIZE;
+        mapped += PAGE_SIZE;
+    }
+
+    if (heap_end - KHEAP_BASE > heap_peak_size)
+        heap_peak_size = heap_end - KHEAP_BASE;
+    return mapped;
+}
+
 // Initialize the heap
-void kmalloc_init(void *start, uint32_t size)
+void kmalloc_init(void)
 {
-    heap_start = (struct heap_block *)start;
-    heap_size = size;
+    heap_start = (struct heap_block *)KHEAP_BASE;
+    heap_end = KHEAP_BASE;
+    heap_map(KHEAP_INITIAL);
 
     // Initialize the first free block
-    heap_start->size = size - sizeof(struct heap_block);
+    heap_start->size = heap_end - KHEAP_BASE - sizeof(struct heap_block);
     heap_start->is_free = 1;
     heap_start->next = 0;
+
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++)
+        kmem_cache_init(&size_caches[i], size_names[i], 1u << (KMALLOC_MIN_SHIFT + i));
+}
+
+// Smallest size class that holds `size` bytes (size <= KMALLOC_MAX_SMALL)
+static inline uint32_t size_class(size_t size)
+{
+    if (size <= (1u << KMALLOC_MIN_SHIFT))
+        return 0;
+    return 32 - __builtin_clz(size - 1) - KMALLOC_MIN_SHIFT;
 }
 
-// Find a free block using first-fit algorithm
-static struct heap_block *find_free_block(size_t size)
+// Merge the free blocks that follow a free `block` into it
+static void merge_free_run(struct heap_block *block)
+{
+    while (block->next && block->next->is_free)
+    {
+        block->size += sizeof(struct heap_block) + block->next->size;
+        block->next = block->next->next;
+    }
+}
+
+// Find a free block using first-fit algorithm. kfree() only merges a
+// block with the one after it, so runs of free blocks are merged here as
+// the scan passes them. Without a fit, *tail is the last block.
+static struct heap_block *find_free_block(size_t size, struct heap_block **tail)
 {
     struct heap_block *current = heap_start;
 
-    while (current)
+    while (1)
     {
-        if (current->is_free && current->size >= size)
+        if (current->is_free)
         {
-            return current;
+            merge_free_run(current);
+            if (current->size >= size)
+                return current;
         }
+        if (!current->next)
+            break;
         current = current->next;
     }
 
+    *tail = current;
     return 0;
 }
 
+// Map more of the heap so a block of `size` bytes fits at the top
+// (heap_lock held). Returns that block, or 0 when out of frames or range.
+static struct heap_block *heap_grow(size_t size, struct heap_block *tail)
+{
+    uint32_t need = size + sizeof(struct heap_block);
+    if (tail->is_free)
+        need = size - tail->size;
+    need = (need + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (need < KHEAP_GROW_MIN)
+        need = KHEAP_GROW_MIN;
+
+    uint32_t top = heap_end;
+    uint32_t got = heap_map(need);
+    if (!got)
+        return 0;
+    heap_grows++;
+
+    if (tail->is_free)
+    {
+        tail->size += got;
+    }
+    else
+    {
+        struct heap_block *block = (struct heap_block *)top;
+        block->size = got - sizeof(struct heap_block);
+        block->is_free = 1;
+        block->next = 0;
+        tail->next = block;
+        tail = block;
+    }
+
+    return tail->size >= size ? tail : 0;
+}
+
 // Split a block if it's too large
 static void split_block(struct heap_block *block, size_t size)
 {
@@ -52,28 +165,8 @@ static void split_block(struct heap_block *block, size_t size)
     }
 }
 
-// Merge adjacent free blocks
-static void merge_free_blocks(void)
-{
-    struct heap_block *current = heap_start;
-
-    while (current && current->next)
-    {
-        if (current->is_free && current->next->is_free)
-        {
-            // Merge current with next
-            current->size += sizeof(struct heap_block) + current->next->size;
-            current->next = current->next->next;
-        }
-        else
-        {
-            current = current->next;
-        }
-    }
-}
-
-// Allocate memory
-void *kmalloc(size_t size)
+// Allocate from the first-fit heap
+void *kmalloc_heap(size_t size)
 {
     if (size == 0)
     {
@@ -86,10 +179,16 @@ void *kmalloc(size_t size)
         size += 4 - (size % 4);
     }
 
-    // Find a free block
-    struct heap_block *block = find_free_block(size);
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    // Find a free block, or grow the heap for one
+    struct heap_block *tail;
+    struct heap_block *block = find_free_block(size, &tail);
+    if (!block)
+        block = heap_grow(size, tail);
     if (!block)
     {
+        spin_unlock_irqrestore(&heap_lock, flags);
         return 0; // Out of memory
     }
 
@@ -98,11 +197,34 @@ void *kmalloc(size_t size)
 
     // Mark as allocated
     block->is_free = 0;
+    heap_used += block->size + sizeof(struct heap_block);
+    if (heap_used > heap_peak_used)
+        heap_peak_used = heap_used;
+    spin_unlock_irqrestore(&heap_lock, flags);
 
     // Return pointer to data (after header)
     return (void *)((char *)block + sizeof(struct heap_block));
 }
 
+// Allocate memory
+void *kmalloc(size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if (size <= KMALLOC_MAX_SMALL)
+    {
+        void *obj = kmem_cache_alloc(&size_caches[size_class(size)]);
+        if (obj)
+            return obj;
+        // Out of frames: the heap may still have room
+    }
+
+    return kmalloc_heap(size);
+}
+
 // Free memory
 void kfree(void *ptr)
 {
@@ -111,23 +233,151 @@ void kfree(void *ptr)
         return;
     }
 
+    if ((uint32_t)ptr < KHEAP_BASE || (uint32_t)ptr >= KHEAP_BASE + KHEAP_MAX)
+    {
+        struct kmem_cache *cache = kmem_cache_of(ptr);
+        if (cache)
+            kmem_cache_free(cache, ptr);
+        return;
+    }
+
     // Get block header
     struct heap_block *block = (struct heap_block *)((char *)ptr - sizeof(struct heap_block));
 
-    // Mark as free
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    // Mark as free and merge with the next block if it is free too;
+    // find_free_block() merges the rest
+    heap_used -= block->size + sizeof(struct heap_block);
     block->is_free = 1;
+    if (block->next && block->next->is_free)
+    {
+        block->size += sizeof(struct heap_block) + block->next->size;
+        block->next = block->next->next;
+    }
+
+    // A large free top can go back to the PMM, from the idle loop
+    if (!block->next && block->size >= KHEAP_TRIM_MIN && heap_end - KHEAP_BASE > KHEAP_INITIAL)
+        heap_trim_wanted = 1;
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Unmap a large free top of the heap and return its frames to the PMM.
+// Called from the idle loop, with interrupts on and no lock held, because
+// every CPU has to drop the old translations before the frames are reused.
+void kmalloc_trim(void)
+{
+    if (!heap_trim_wanted)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    heap_trim_wanted = 0;
 
-    // Merge adjacent free blocks
-    merge_free_blocks();
+    struct heap_block *tail = heap_start;
+    while (tail->next)
+    {
+        if (tail->is_free)
+            merge_free_run(tail);
+        if (tail->next)
+            tail = tail->next;
+    }
+
+    // Keep the boot-time heap and, below `start`, the top block's header
+    // with room for a minimal block and for the fence's header
+    uint32_t start = ((uint32_t)tail + 2 * sizeof(struct heap_block) + MIN_BLOCK_SIZE + PAGE_SIZE - 1) &
+                     ~(PAGE_SIZE - 1);
+    if (start < KHEAP_BASE + KHEAP_INITIAL)
+        start = KHEAP_BASE + KHEAP_INITIAL;
+    if (!tail->is_free || start >= heap_end || heap_end - start < KHEAP_TRIM_MIN)
+    {
+        spin_unlock_irqrestore(&heap_lock, flags);
+        return;
+    }
+
+    // Fence the range off with an allocated block while it is unmapped;
+    // allocations that need more space grow the heap above it
+    uint32_t end = heap_end;
+    struct heap_block *fence = (struct heap_block *)(start - sizeof(struct heap_block));
+    fence->size = end - start;
+    fence->is_free = 0;
+    fence->next = 0;
+    tail->size = (uint32_t)fence - (uint32_t)tail - sizeof(struct heap_block);
+    tail->next = fence;
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    // Heap frames are low, so in the direct map: chain them through their
+    // first word until the TLBs are clean
+    void *frames = 0;
+    uint32_t pages = 0;
+    for (uint32_t va = start; va < end; va += PAGE_SIZE)
+    {
+        void **frame = (void **)phys_to_virt(paging_unmap_page_get((void *)va));
+        *frame = frames;
+        frames = frame;
+        pages++;
+    }
+    smp_flush_tlb_all();
+    while (frames)
+    {
+        void *next = *(void **)frames;
+        pmm_free_block(virt_to_phys(frames));
+        frames = next;
+    }
+
+    flags = spin_lock_irqsave(&heap_lock);
+    if (!fence->next)
+    {
+        // Still the top: the heap ends at the fence, whose header goes
+        // to the block below it
+        struct heap_block *below = heap_start;
+        while (below->next != fence)
+            below = below->next;
+        below->size += sizeof(struct heap_block);
+        below->next = 0;
+        if (!below->is_free)
+            heap_used += sizeof(struct heap_block);
+        heap_end = start;
+    }
+    else
+    {
+        // The heap grew above the fence meanwhile: map the range again as
+        // free space, or leave the address range fenced off
+        uint32_t va = start;
+        while (va < end)
+        {
+            void *frame = pmm_alloc_block();
+            if (!frame)
+                break;
+            paging_map_page(frame, (void *)va, PAGE_PRESENT | PAGE_WRITE);
+            va += PAGE_SIZE;
+        }
+        if (va == end)
+        {
+            fence->is_free = 1;
+        }
+        else
+        {
+            while (va > start)
+            {
+                va -= PAGE_SIZE;
+                pmm_free_block(paging_unmap_page_get((void *)va));
+            }
+        }
+    }
+    heap_trims++;
+    heap_trimmed_pages += pages;
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 // Get heap statistics
 void kmalloc_stats(uint32_t *total, uint32_t *used, uint32_t *free_mem)
 {
-    *total = heap_size;
     *used = 0;
     *free_mem = 0;
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    *total = heap_end - KHEAP_BASE;
     struct heap_block *current = heap_start;
     while (current)
     {
@@ -141,4 +391,59 @@ void kmalloc_stats(uint32_t *total, uint32_t *used, uint32_t *free_mem)
         }
         current = current->next;
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Free block count and largest free block of the first-fit heap; many
+// small free blocks and a small largest one mean external fragmentation
+void kmalloc_heap_frag(uint32_t *free_blocks, uint32_t *largest_free)
+{
+    *free_blocks = 0;
+    *largest_free = 0;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    struct heap_block *current = heap_start;
+    while (current)
+    {
+        if (current->is_free)
+        {
+            // Count a run of free blocks as one, as the next scan will
+            uint32_t run = current->size;
+            while (current->next && current->next->is_free)
+            {
+                current = current->next;
+                run += sizeof(struct heap_block) + current->size;
+            }
+            (*free_blocks)++;
+            if (run > *largest_free)
+                *largest_free = run;
+        }
+        current = current->next;
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void kmalloc_small_stats(uint32_t *pages, uint32_t *used)
+{
+    *pages = 0;
+    *used = 0;
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++)
+    {
+        *pages += size_caches[i].pages;
+        *used += size_caches[i].in_use * size_caches[i].obj_size;
+    }
+}
+
+void kmalloc_get_heap_stats(struct kmalloc_heap_stats *stats)
+{
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    stats->size = heap_end - KHEAP_BASE;
+    stats->peak_size = heap_peak_size;
+    stats->max_size = KHEAP_MAX;
+    stats->used = heap_used;
+    stats->peak_used = heap_peak_used;
+    stats->grows = heap_grows;
+    stats->trims = heap_trims;
+    stats->trimmed_pages = heap_trimmed_pages;
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
@@ -1,22 +1,47 @@
 #include "paging.h"
 #include "pmm.h"
+#include "spinlock.h"
+#include "smp.h"
 
-// Kernel page directory (identity mapped for first 4MB)
+// Kernel page directory (identity mapped for the first 16MB)
 static page_directory kernel_directory __attribute__((aligned(4096)));
-static page_table kernel_tables[4] __attribute__((aligned(4096)));
+static page_table kernel_tables[IDENTITY_MAP_TABLES] __attribute__((aligned(4096)));
 
-// Current page directory
-static page_directory *current_directory = 0;
+// Page tables backing the kernel heap range
+#define KHEAP_TABLES (KHEAP_MAX / (PAGES_PER_TABLE * PAGE_SIZE))
+static page_table kheap_tables[KHEAP_TABLES] __attribute__((aligned(4096)));
 
-// Get page table entry
-static pt_entry *paging_get_page(void *virt, int create)
+// Temporary mapping slots, KMAP_SLOTS per CPU
+static page_table kmap_table __attribute__((aligned(4096)));
+
+// End of the direct map (physical), at most PHYS_MAP_MAX
+static uint32_t phys_map_end;
+
+// Page fault error code
+#define PF_PRESENT 0x01 // Protection violation, not a missing page
+#define PF_WRITE 0x02
+
+// Page table updates; the tables are shared by every CPU
+static spinlock_t paging_lock = SPINLOCK_INIT;
+
+// Directory this CPU runs in (kernel address). CPUs run different
+// directories, so it comes from CR3 rather than from a global.
+static page_directory *current_directory(void)
+{
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return (page_directory *)phys_to_virt((void *)(cr3 & 0xFFFFF000));
+}
+
+// Get page table entry in `dir` (kernel address)
+static pt_entry *paging_get_page(page_directory *dir, void *virt, int create)
 {
     uint32_t addr = (uint32_t)virt;
     uint32_t dir_index = addr >> 22;             // Top 10 bits
     uint32_t table_index = (addr >> 12) & 0x3FF; // Middle 10 bits
 
     // Check if page table exists
-    if (!(current_directory->entries[dir_index] & PAGE_PRESENT))
+    if (!(dir->entries[dir_index] & PAGE_PRESENT))
     {
         if (!create)
         {
@@ -31,36 +56,60 @@ static pt_entry *paging_get_page(void *virt, int create)
         }
 
         // Clear page table
-        uint32_t *ptr = (uint32_t *)table;
+        uint32_t *ptr = (uint32_t *)phys_to_virt(table);
         for (int i = 0; i < PAGES_PER_TABLE; i++)
         {
             ptr[i] = 0;
         }
 
         // Add to page directory
-        current_directory->entries[dir_index] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE;
+        dir->entries[dir_index] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE;
     }
 
     // Get page table address
-    page_table *table = (page_table *)(current_directory->entries[dir_index] & 0xFFFFF000);
+    page_table *table = (page_table *)phys_to_virt((void *)(dir->entries[dir_index] & 0xFFFFF000));
 
     return &table->entries[table_index];
 }
 
-// Map a physical page to a virtual address
-void paging_map_page(void *phys, void *virt, uint32_t flags)
+// Map a physical page at `virt` in `dir` (kernel address, paging_lock held)
+static void paging_map_locked(page_directory *dir, void *phys, void *virt, uint32_t flags)
 {
-    pt_entry *page = paging_get_page(virt, 1);
+    pt_entry *page = paging_get_page(dir, virt, 1);
     if (page)
     {
         *page = ((uint32_t)phys & 0xFFFFF000) | flags | PAGE_PRESENT;
+
+        // Ring 3 needs the user bit at both levels
+        if (flags & PAGE_USER)
+            dir->entries[(uint32_t)virt >> 22] |= PAGE_USER;
+
+        // The virtual address may have been mapped elsewhere before
+        __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
     }
 }
 
+// Map a physical page to a virtual address
+void paging_map_page(void *phys, void *virt, uint32_t flags)
+{
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+    paging_map_locked(current_directory(), phys, virt, flags);
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+}
+
+// Map a physical page in a directory that need not be the current one
+void paging_map_page_in(page_directory *dir, void *phys, void *virt, uint32_t flags)
+{
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+    paging_map_locked((page_directory *)phys_to_virt(dir), phys, virt, flags);
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+}
+
 // Unmap a virtual page
 void paging_unmap_page(void *virt)
 {
-    pt_entry *page = paging_get_page(virt, 0);
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    pt_entry *page = paging_get_page(current_directory(), virt, 0);
     if (page)
     {
         *page = 0;
@@ -68,12 +117,45 @@ void paging_unmap_page(void *virt)
         // Flush TLB
         __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
     }
+    spin_unlock_irqrestore(&paging_lock, flags);
+}
+
+// Unmap a virtual page in `dir` (kernel address) and return the frame it
+// was mapped to
+static void *paging_unmap_get(page_directory *dir, void *virt)
+{
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    pt_entry *page = paging_get_page(dir, virt, 0);
+    if (!page || !(*page & PAGE_PRESENT))
+    {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        return 0;
+    }
+
+    void *phys = (void *)(*page & 0xFFFFF000);
+    *page = 0;
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    spin_unlock_irqrestore(&paging_lock, flags);
+
+    return phys;
+}
+
+// Unmap a virtual page and return the frame it was mapped to
+void *paging_unmap_page_get(void *virt)
+{
+    return paging_unmap_get(current_directory(), virt);
+}
+
+// Same in a directory that need not be the current one
+void *paging_unmap_page_get_in(page_directory *dir, void *virt)
+{
+    return paging_unmap_get((page_directory *)phys_to_virt(dir), virt);
 }
 
 // Get physical address from virtual address
 void *paging_get_physical_address(void *virt)
 {
-    pt_entry *page = paging_get_page(virt, 0);
+    pt_entry *page = paging_get_page(current_directory(), virt, 0);
     if (!page || !(*page & PAGE_PRESENT))
     {
         return 0;
@@ -93,7 +175,7 @@ void paging_init(void)
 
     // Identity map first 16MB (0x00000000 - 0x01000000)
     // This covers the kernel and video memory
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < IDENTITY_MAP_TABLES; i++)
     {
         // Clear page table
         for (int j = 0; j < PAGES_PER_TABLE; j++)
@@ -112,7 +194,46 @@ void paging_init(void)
         kernel_directory.entries[i] = (uint32_t)&kernel_tables[i] | PAGE_PRESENT | PAGE_WRITE;
     }
 
-    current_directory = &kernel_directory;
+    // Preallocate the kernel heap tables so that every directory created
+    // from the kernel one shares the same heap mappings
+    for (uint32_t i = 0; i < KHEAP_TABLES; i++)
+    {
+        for (int j = 0; j < PAGES_PER_TABLE; j++)
+        {
+            kheap_tables[i].entries[j] = 0;
+        }
+
+        uint32_t dir_index = (KHEAP_BASE >> 22) + i;
+        kernel_directory.entries[dir_index] = (uint32_t)&kheap_tables[i] | PAGE_PRESENT | PAGE_WRITE;
+    }
+
+    for (int j = 0; j < PAGES_PER_TABLE; j++)
+    {
+        kmap_table.entries[j] = 0;
+    }
+    kernel_directory.entries[KMAP_BASE >> 22] = (uint32_t)&kmap_table | PAGE_PRESENT | PAGE_WRITE;
+
+    // Direct map all low memory at PHYS_MAP_BASE. Paging is still off, so
+    // the tables can be filled through their physical addresses.
+    uint32_t mem_size = pmm_get_memory_size();
+    phys_map_end = mem_size < PHYS_MAP_MAX ? (mem_size + 0x3FFFFF) & ~0x3FFFFFu : PHYS_MAP_MAX;
+    for (uint32_t i = 0; i < phys_map_end / (PAGES_PER_TABLE * PAGE_SIZE); i++)
+    {
+        page_table *table = (page_table *)pmm_alloc_block();
+        if (!table)
+        {
+            phys_map_end = i * PAGES_PER_TABLE * PAGE_SIZE;
+            break;
+        }
+
+        for (int j = 0; j < PAGES_PER_TABLE; j++)
+        {
+            uint32_t phys = (i * PAGES_PER_TABLE + j) * PAGE_SIZE;
+            table->entries[j] = phys | PAGE_PRESENT | PAGE_WRITE;
+        }
+
+        kernel_directory.entries[(PHYS_MAP_BASE >> 22) + i] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE;
+    }
 }
 
 // Enable paging
@@ -121,10 +242,11 @@ void paging_enable(void)
     // Load page directory into CR3
     __asm__ volatile("mov %0, %%cr3" : : "r"(&kernel_directory));
 
-    // Enable paging by setting bit 31 of CR0
+    // Enable paging by setting bit 31 of CR0, and write protection (bit
+    // 16) so that kernel writes to copy-on-write pages fault as well
     uint32_t cr0;
     __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80010000;
     __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
 }
 
@@ -134,15 +256,75 @@ page_directory *paging_get_kernel_directory(void)
     return &kernel_directory;
 }
 
-// Switch to a different page directory
+// Map a frame for the kernel: low frames are already in the direct map
+void *paging_kmap(void *phys, uint32_t slot)
+{
+    uint32_t addr = (uint32_t)phys;
+    if (addr < phys_map_end)
+        return phys_to_virt(phys);
+
+    uint32_t index = this_cpu()->index * KMAP_SLOTS + slot;
+    uint32_t virt = KMAP_BASE + index * PAGE_SIZE;
+    kmap_table.entries[index] = (addr & 0xFFFFF000) | PAGE_PRESENT | PAGE_WRITE;
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    return (void *)(virt | (addr & 0xFFF));
+}
+
+// Drop this CPU's mapping at `slot` (a no-op for direct mapped frames)
+void paging_kunmap(uint32_t slot)
+{
+    uint32_t index = this_cpu()->index * KMAP_SLOTS + slot;
+    kmap_table.entries[index] = 0;
+    __asm__ volatile("invlpg (%0)" : : "r"(KMAP_BASE + index * PAGE_SIZE) : "memory");
+}
+
+// Switch to a different page directory (physical address, as in CR3)
 void paging_switch_directory(page_directory *dir)
 {
-    current_directory = dir;
     __asm__ volatile("mov %0, %%cr3" : : "r"(dir) : "memory");
 }
 
-// Clone a page directory (for fork)
-page_directory *paging_clone_directory(page_directory *src)
+// Copy a page between frames, either of which may be highmem
+static void copy_frame(void *dst, void *src)
+{
+    uint32_t irq_flags = irq_save();
+    uint32_t *src_ptr = (uint32_t *)paging_kmap(src, 0);
+    uint32_t *dst_ptr = (uint32_t *)paging_kmap(dst, 1);
+
+    for (uint32_t k = 0; k < PAGE_SIZE / sizeof(uint32_t); k++)
+    {
+        dst_ptr[k] = src_ptr[k];
+    }
+
+    paging_kunmap(1);
+    paging_kunmap(0);
+    irq_restore(irq_flags);
+}
+
+// New directory (physical address) with an empty user space and the
+// kernel's identity map and kernel space
+page_directory *paging_create_directory(void)
+{
+    page_directory *phys = (page_directory *)pmm_alloc_block();
+    if (!phys)
+    {
+        return 0;
+    }
+
+    page_directory *dir = (page_directory *)phys_to_virt(phys);
+    for (int i = 0; i < PAGES_PER_DIR; i++)
+    {
+        dir->entries[i] = PDE_KERNEL(i) ? kernel_directory.entries[i] : 0;
+    }
+
+    return phys;
+}
+
+// Clone the user space of `src` into a new directory. With `cow` the
+// frames are shared and writable pages turn read-only in both, to be
+// copied by the first write; otherwise every page is copied now.
+// Directories are passed and returned by physical address.
+static page_directory *clone_directory(page_directory *src, int cow)
 {
     if (!src)
     {
@@ -150,11 +332,13 @@ page_directory *paging_clone_directory(page_directory *src)
     }
 
     // Allocate new page directory
-    page_directory *new_dir = (page_directory *)pmm_alloc_block();
-    if (!new_dir)
+    page_directory *new_phys = (page_directory *)pmm_alloc_block();
+    if (!new_phys)
     {
         return 0;
     }
+    page_directory *new_dir = (page_directory *)phys_to_virt(new_phys);
+    page_directory *src_dir = (page_directory *)phys_to_virt(src);
 
     // Clear new directory
     for (int i = 0; i < PAGES_PER_DIR; i++)
@@ -162,34 +346,47 @@ page_directory *paging_clone_directory(page_directory *src)
         new_dir->entries[i] = 0;
     }
 
+    // Sharing frames changes the source's entries: keep faults out
+    uint32_t irq_flags = cow ? spin_lock_irqsave(&paging_lock) : 0;
+
     // Copy all page directory entries
     for (int i = 0; i < PAGES_PER_DIR; i++)
     {
         // Skip if page table not present
-        if (!(src->entries[i] & PAGE_PRESENT))
+        if (!(src_dir->entries[i] & PAGE_PRESENT))
         {
             continue;
         }
 
-        // For kernel space (top 256 entries), share the same page tables
-        // This ensures kernel is accessible from all processes
-        if (i >= 768) // 768 * 4MB = 3GB (kernel space starts at 3GB)
+        // The identity map and kernel space (top 256 entries, from 3GB)
+        // share the same page tables, so the kernel is reachable from
+        // every process
+        if (PDE_KERNEL(i))
+        {
+            new_dir->entries[i] = src_dir->entries[i];
+            continue;
+        }
+
+        // Window pages belong to one task (see ipc.c), not to the copy
+        if (PDE_IPC_WINDOW(i))
         {
-            new_dir->entries[i] = src->entries[i];
             continue;
         }
 
         // For user space, we need to copy the page table
-        page_table *src_table = (page_table *)(src->entries[i] & 0xFFFFF000);
+        page_table *src_table = (page_table *)phys_to_virt((void *)(src_dir->entries[i] & 0xFFFFF000));
 
         // Allocate new page table
-        page_table *new_table = (page_table *)pmm_alloc_block();
-        if (!new_table)
+        void *table_phys = pmm_alloc_block();
+        if (!table_phys)
         {
             // Clean up and return failure
-            paging_free_directory(new_dir);
+            if (cow)
+                spin_unlock_irqrestore(&paging_lock, irq_flags);
+            paging_free_directory(new_phys);
             return 0;
         }
+        page_table *new_table = (page_table *)phys_to_virt(table_phys);
 
         // Clear new table
         for (int j = 0; j < PAGES_PER_TABLE; j++)
@@ -197,64 +394,144 @@ page_directory *paging_clone_directory(page_directory *src)
             new_table->entries[j] = 0;
         }
 
+        // Set page directory entry now, so a failure below frees the table
+        uint32_t flags = src_dir->entries[i] & 0xFFF;
+        new_dir->entries[i] = (uint32_t)table_phys | flags;
+
         // Copy all page table entries
         for (int j = 0; j < PAGES_PER_TABLE; j++)
         {
-            if (!(src_table->entries[j] & PAGE_PRESENT))
+            uint32_t entry = src_table->entries[j];
+            if (!(entry & PAGE_PRESENT))
             {
                 continue;
             }
 
+            if (cow)
+            {
+                if (entry & (PAGE_WRITE | PAGE_COW))
+                {
+                    entry = (entry & ~PAGE_WRITE) | PAGE_COW;
+                    src_table->entries[j] = entry;
+                }
+                pmm_ref_block((void *)(entry & 0xFFFFF000));
+                new_table->entries[j] = entry;
+                continue;
+            }
+
             // Allocate new physical page
-            void *new_page = pmm_alloc_block();
+            void *new_page = pmm_alloc_high_block();
             if (!new_page)
             {
                 // Clean up
-                pmm_free_block(new_table);
-                paging_free_directory(new_dir);
+                paging_free_directory(new_phys);
                 return 0;
             }
 
-            // Copy page content
-            void *src_page = (void *)(src_table->entries[j] & 0xFFFFF000);
-            uint32_t *src_ptr = (uint32_t *)src_page;
-            uint32_t *dst_ptr = (uint32_t *)new_page;
-
-            for (int k = 0; k < (PAGE_SIZE / sizeof(uint32_t)); k++)
-            {
-                dst_ptr[k] = src_ptr[k];
-            }
+            copy_frame(new_page, (void *)(entry & 0xFFFFF000));
 
             // Set new page table entry with same flags
-            uint32_t flags = src_table->entries[j] & 0xFFF;
-            new_table->entries[j] = ((uint32_t)new_page) | flags;
+            new_table->entries[j] = ((uint32_t)new_page) | (entry & 0xFFF);
+        }
+    }
+
+    if (cow)
+    {
+        // Only the CPU running the forking task can have the source's
+        // user pages in its TLB
+        uint32_t cr3;
+        __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+        if (cr3 == (uint32_t)src)
+            __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+        spin_unlock_irqrestore(&paging_lock, irq_flags);
+    }
+
+    return new_phys;
+}
+
+// Clone a page directory for fork: user pages are copied on write
+page_directory *paging_clone_directory(page_directory *src)
+{
+    return clone_directory(src, 1);
+}
+
+// Clone a page directory with private copies of every user page
+page_directory *paging_copy_directory(page_directory *src)
+{
+    return clone_directory(src, 0);
+}
+
+// Make the copy-on-write page at `virt` in `dir` (physical) writable:
+// copy it, or take the frame over if no other directory maps it.
+// Returns 0 if the page is writable now.
+int paging_cow_break(page_directory *dir, void *virt)
+{
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    pt_entry *page = paging_get_page((page_directory *)phys_to_virt(dir), virt, 0);
+    if (!page || (*page & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW))
+    {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        return -1;
+    }
+
+    void *frame = (void *)(*page & 0xFFFFF000);
+    uint32_t page_flags = (*page & 0xFFF & ~PAGE_COW) | PAGE_WRITE;
+    if (pmm_get_refs(frame) > 1)
+    {
+        void *copy = pmm_alloc_high_block();
+        if (!copy)
+        {
+            spin_unlock_irqrestore(&paging_lock, flags);
+            return -1;
         }
+        copy_frame(copy, frame);
+        *page = (uint32_t)copy | page_flags;
+        pmm_free_block(frame); // Drops this directory's reference
+    }
+    else
+    {
+        *page = (uint32_t)frame | page_flags;
+    }
 
-        // Set page directory entry
-        uint32_t flags = src->entries[i] & 0xFFF;
-        new_dir->entries[i] = ((uint32_t)new_table) | flags;
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    spin_unlock_irqrestore(&paging_lock, flags);
+    return 0;
+}
+
+// Page fault hook: 0 if it was a write to a copy-on-write page, now fixed
+int paging_handle_fault(uint32_t err_code)
+{
+    // Only writes to present pages can be copy-on-write
+    if ((err_code & (PF_PRESENT | PF_WRITE)) != (PF_PRESENT | PF_WRITE))
+    {
+        return -1;
     }
 
-    return new_dir;
+    uint32_t addr, cr3;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return paging_cow_break((page_directory *)(cr3 & 0xFFFFF000), (void *)addr);
 }
 
-// Free a page directory and all its page tables
+// Free a page directory (physical address) and all its user page tables
 void paging_free_directory(page_directory *dir)
 {
     if (!dir || dir == &kernel_directory)
     {
         return; // Don't free kernel directory
     }
+    page_directory *dir_virt = (page_directory *)phys_to_virt(dir);
 
-    // Free all user space page tables (entries 0-767)
+    // Free all user space page tables (entries 0-767, past the identity map)
     for (int i = 0; i < 768; i++)
     {
-        if (!(dir->entries[i] & PAGE_PRESENT))
+        if (PDE_KERNEL(i) || !(dir_virt->entries[i] & PAGE_PRESENT))
         {
             continue;
         }
 
-        page_table *table = (page_table *)(dir->entries[i] & 0xFFFFF000);
+        void *table_phys = (void *)(dir_virt->entries[i] & 0xFFFFF000);
+        page_table *table = (page_table *)phys_to_virt(table_phys);
 
         // Free all pages in this table
         for (int j = 0; j < PAGES_PER_TABLE; j++)
@@ -267,7 +544,7 @@ void paging_free_directory(page_directory *dir)
         }
 
         // Free the page table itself
-        pmm_free_block(table);
+        pmm_free_block(table_phys);
     }
 
     // Free the page directory
@@ -1,63 +1,164 @@
 #include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
 
-// Memory bitmap (each bit represents one 4KB page)
-#define MAX_BLOCKS 32768 // 32768 blocks = 128MB
-static uint32_t memory_map[MAX_BLOCKS / 32];
+// Buddy allocator. Free memory is kept as blocks of 2^order frames,
+// aligned to their size, on one free list per order. Allocation splits
+// the smallest big enough block; freeing merges a block with its buddy
+// (the other half of the block of the next order) while that is free.
+//
+// Frames may not be mapped at all (highmem), so the lists live in the
+// tables below rather than in the free frames. The tables are sized from
+// the memory size at boot and placed by pmm_init(); they have to stay in
+// the identity mapped low 16MB.
+//
+// Each zone has its own lists. The zone boundary is aligned to the
+// largest block, so buddies are always in the same zone.
+
+#define FRAME_NONE 0xFFFFFFFF // End of a free list
+#define LOW_FRAMES (PHYS_MAP_MAX / PAGE_SIZE)
+
+// Per-frame state, meaningful at the first frame of a block
+#define FRAME_RESERVED 0x00    // Not managed, or inside a block
+#define FRAME_FREE 0x80        // | order: head of a free block
+#define FRAME_ALLOCATED 0x40   // | order: head of an allocated block
+
+static uint8_t *frame_state;
+static uint32_t *frame_next; // Free list links
+static uint32_t *frame_prev;
+static uint16_t *frame_refs; // Mappings of an allocated block, for copy-on-write
+
+static uint32_t free_head[PMM_ZONES][PMM_MAX_ORDER + 1];
+static uint32_t free_count[PMM_ZONES][PMM_MAX_ORDER + 1]; // Blocks on each list
+static uint32_t zone_blocks[PMM_ZONES];
 
 // Memory statistics
 static uint32_t memory_size = 0;
 static uint32_t used_blocks = 0;
 static uint32_t max_blocks = 0;
 
-// Set a bit in the bitmap
-static inline void bitmap_set(uint32_t bit)
+static spinlock_t pmm_lock = SPINLOCK_INIT; // Free lists, frame states and counters
+
+static inline uint32_t frame_zone(uint32_t frame)
 {
-    memory_map[bit / 32] |= (1 << (bit % 32));
+    return frame < LOW_FRAMES ? PMM_ZONE_NORMAL : PMM_ZONE_HIGH;
 }
 
-// Clear a bit in the bitmap
-static inline void bitmap_clear(uint32_t bit)
+static void free_list_push(uint32_t frame, uint32_t order)
 {
-    memory_map[bit / 32] &= ~(1 << (bit % 32));
+    uint32_t zone = frame_zone(frame);
+    frame_state[frame] = FRAME_FREE | order;
+    frame_prev[frame] = FRAME_NONE;
+    frame_next[frame] = free_head[zone][order];
+    if (free_head[zone][order] != FRAME_NONE)
+        frame_prev[free_head[zone][order]] = frame;
+    free_head[zone][order] = frame;
+    free_count[zone][order]++;
 }
 
-// Test if a bit is set
-static inline int bitmap_test(uint32_t bit)
+static void free_list_remove(uint32_t frame, uint32_t order)
 {
-    return memory_map[bit / 32] & (1 << (bit % 32));
+    uint32_t zone = frame_zone(frame);
+    if (frame_prev[frame] != FRAME_NONE)
+        frame_next[frame_prev[frame]] = frame_next[frame];
+    else
+        free_head[zone][order] = frame_next[frame];
+    if (frame_next[frame] != FRAME_NONE)
+        frame_prev[frame_next[frame]] = frame_prev[frame];
+    frame_state[frame] = FRAME_RESERVED;
+    free_count[zone][order]--;
+}
+
+// Put a block on the free lists, merging it with free buddies
+static void buddy_free(uint32_t frame, uint32_t order)
+{
+    frame_state[frame] = FRAME_RESERVED;
+    while (order < PMM_MAX_ORDER)
+    {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= max_blocks || frame_state[buddy] != (FRAME_FREE | order))
+            break;
+        free_list_remove(buddy, order);
+        frame &= ~(1u << order);
+        order++;
+    }
+    free_list_push(frame, order);
+}
+
+// Take a block of 2^order frames off a zone's lists; FRAME_NONE if none
+static uint32_t buddy_alloc(uint32_t zone, uint32_t order)
+{
+    uint32_t o = order;
+    while (o <= PMM_MAX_ORDER && free_head[zone][o] == FRAME_NONE)
+        o++;
+    if (o > PMM_MAX_ORDER)
+        return FRAME_NONE;
+
+    uint32_t frame = free_head[zone][o];
+    free_list_remove(frame, o);
+
+    // Hand the upper halves back until the block is the right size
+    while (o > order)
+    {
+        o--;
+        free_list_push(frame + (1u << o), o);
+    }
+    return frame;
 }
 
-// Find first free block
-static int bitmap_first_free(void)
+// Free block that contains `frame`, or FRAME_NONE; *order is its order
+static uint32_t buddy_find(uint32_t frame, uint32_t *order)
 {
-    for (uint32_t i = 0; i < max_blocks / 32; i++)
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
     {
-        if (memory_map[i] != 0xFFFFFFFF)
+        uint32_t head = frame & ~((1u << o) - 1);
+        if (frame_state[head] == (FRAME_FREE | o))
         {
-            for (int j = 0; j < 32; j++)
-            {
-                if (!(memory_map[i] & (1 << j)))
-                {
-                    return i * 32 + j;
-                }
-            }
+            *order = o;
+            return head;
         }
     }
-    return -1;
+    return FRAME_NONE;
+}
+
+// Initialize PMM for mem_size bytes of physical address space. The frame
+// tables (11 bytes per frame) go at `meta`, in usable RAM below 16MB;
+// returns the page aligned end of them for the caller to reserve.
+// Bytes of frame tables pmm_init() needs for `mem_size`, page aligned
+uint32_t pmm_meta_size(uint32_t mem_size)
+{
+    uint32_t bytes = mem_size / PAGE_SIZE * (2 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+    return (bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 }
 
-// Initialize PMM
-void pmm_init(uint32_t mem_size)
+uint32_t pmm_init(uint32_t mem_size, uint32_t meta)
 {
     memory_size = mem_size;
     max_blocks = mem_size / PAGE_SIZE;
     used_blocks = max_blocks;
 
-    // Mark all blocks as used initially
-    for (uint32_t i = 0; i < MAX_BLOCKS / 32; i++)
+    meta = (meta + 3) & ~3u;
+    frame_next = (uint32_t *)meta;
+    frame_prev = frame_next + max_blocks;
+    frame_refs = (uint16_t *)(frame_prev + max_blocks);
+    frame_state = (uint8_t *)(frame_refs + max_blocks);
+
+    // Nothing is free until a region is marked available
+    for (uint32_t i = 0; i < max_blocks; i++)
     {
-        memory_map[i] = 0xFFFFFFFF;
+        frame_state[i] = FRAME_RESERVED;
     }
+    for (uint32_t z = 0; z < PMM_ZONES; z++)
+    {
+        for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+        {
+            free_head[z][o] = FRAME_NONE;
+            free_count[z][o] = 0;
+        }
+        zone_blocks[z] = 0;
+    }
+
+    return ((uint32_t)(frame_state + max_blocks) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 }
 
 // Mark a region of memory as available
@@ -66,11 +167,18 @@ void pmm_init_region(uint32_t base, uint32_t size)
     uint32_t blocks = size / PAGE_SIZE;
     uint32_t start_block = base / PAGE_SIZE;
 
-    for (uint32_t i = 0; i < blocks; i++)
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    for (uint32_t i = start_block; i < start_block + blocks && i < max_blocks; i++)
     {
-        bitmap_clear(start_block + i);
-        used_blocks--;
+        uint32_t order;
+        if (buddy_find(i, &order) == FRAME_NONE)
+        {
+            buddy_free(i, 0);
+            zone_blocks[frame_zone(i)]++;
+            used_blocks--;
+        }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 // Mark a region of memory as unavailable
@@ -79,45 +187,148 @@ void pmm_deinit_region(uint32_t base, uint32_t size)
     uint32_t blocks = size / PAGE_SIZE;
     uint32_t start_block = base / PAGE_SIZE;
 
-    for (uint32_t i = 0; i < blocks; i++)
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    for (uint32_t i = start_block; i < start_block + blocks && i < max_blocks; i++)
     {
-        bitmap_set(start_block + i);
+        uint32_t order;
+        uint32_t head = buddy_find(i, &order);
+        if (head == FRAME_NONE)
+            continue;
+
+        // Split the free block around frame i, keeping the other halves
+        free_list_remove(head, order);
+        while (order > 0)
+        {
+            order--;
+            uint32_t half = 1u << order;
+            if (i >= head + half)
+            {
+                free_list_push(head, order);
+                head += half;
+            }
+            else
+            {
+                free_list_push(head + half, order);
+            }
+        }
+        zone_blocks[frame_zone(i)]--;
         used_blocks++;
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
-// Allocate a single 4KB block
-void *pmm_alloc_block(void)
+// Allocate 2^order contiguous low frames, aligned to their size
+void *pmm_alloc_pages(uint32_t order)
 {
-    if (used_blocks >= max_blocks)
+    if (order > PMM_MAX_ORDER)
+        return 0;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame = buddy_alloc(PMM_ZONE_NORMAL, order);
+    if (frame == FRAME_NONE)
     {
-        return 0; // Out of memory
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0; // Out of memory, or too fragmented
     }
 
-    int block = bitmap_first_free();
-    if (block == -1)
+    frame_state[frame] = FRAME_ALLOCATED | order;
+    frame_refs[frame] = 1;
+    used_blocks += 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    return (void *)(frame * PAGE_SIZE);
+}
+
+// Allocate a single frame for use through a mapping only. Highmem goes
+// first, to keep the direct map for the kernel's own allocations.
+void *pmm_alloc_high_block(void)
+{
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame = buddy_alloc(PMM_ZONE_HIGH, 0);
+    if (frame == FRAME_NONE)
+        frame = buddy_alloc(PMM_ZONE_NORMAL, 0);
+    if (frame == FRAME_NONE)
     {
-        return 0; // No free blocks
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
     }
 
-    bitmap_set(block);
+    frame_state[frame] = FRAME_ALLOCATED;
+    frame_refs[frame] = 1;
     used_blocks++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
 
-    return (void *)(block * PAGE_SIZE);
+    return (void *)(frame * PAGE_SIZE);
 }
 
-// Free a single 4KB block
-void pmm_free_block(void *addr)
+// Drop a reference to a block from pmm_alloc_pages(order); the last one
+// frees it
+void pmm_free_pages(void *addr, uint32_t order)
 {
-    uint32_t block = (uint32_t)addr / PAGE_SIZE;
+    uint32_t frame = (uint32_t)addr / PAGE_SIZE;
+    if (frame >= max_blocks || order > PMM_MAX_ORDER)
+        return;
 
-    if (!bitmap_test(block))
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (frame_state[frame] == (FRAME_ALLOCATED | order)) // Already free otherwise
     {
-        return; // Already free
+        if (--frame_refs[frame] == 0)
+        {
+            buddy_free(frame, order);
+            used_blocks -= 1u << order;
+        }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Take one more reference to an allocated frame (shared copy-on-write);
+// frames the PMM did not hand out are ignored
+void pmm_ref_block(void *addr)
+{
+    uint32_t frame = (uint32_t)addr / PAGE_SIZE;
+    if (frame >= max_blocks)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (frame_state[frame] == FRAME_ALLOCATED)
+        frame_refs[frame]++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
 
-    bitmap_clear(block);
-    used_blocks--;
+// References to an allocated frame, 0 if the PMM does not own it
+uint32_t pmm_get_refs(void *addr)
+{
+    uint32_t frame = (uint32_t)addr / PAGE_SIZE;
+    if (frame >= max_blocks || frame_state[frame] != FRAME_ALLOCATED)
+        return 0;
+    return frame_refs[frame];
+}
+
+// Allocate a single 4KB low block
+void *pmm_alloc_block(void)
+{
+    return pmm_alloc_pages(0);
+}
+
+// Free a single 4KB block
+void pmm_free_block(void *addr)
+{
+    pmm_free_pages(addr, 0);
+}
+
+// Free blocks on each of a zone's lists (PMM_MAX_ORDER + 1 entries)
+void pmm_get_free_counts(uint32_t zone, uint32_t *counts)
+{
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++)
+        counts[o] = zone < PMM_ZONES ? free_count[zone][o] : 0;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Frames available to a zone, free or not
+uint32_t pmm_get_zone_blocks(uint32_t zone)
+{
+    return zone < PMM_ZONES ? zone_blocks[zone] : 0;
 }
 
 // Get total memory size
@@ -0,0 +1,109 @@
+#include "slab.h"
+#include "pmm.h"
+#include "paging.h"
+
+// Owner of every carved page, by low frame: registry slot + 1 (0 = none).
+// Written once when the page is carved, so readers need no lock.
+static uint8_t page_owner[PHYS_MAP_MAX / PAGE_SIZE];
+static struct kmem_cache *registry[KMEM_CACHE_MAX];
+static uint32_t registry_count;
+static spinlock_t registry_lock = SPINLOCK_INIT;
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, uint32_t obj_size)
+{
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+
+    cache->name = name;
+    cache->obj_size = (obj_size + 3) & ~3u;
+    cache->free_list = 0;
+    cache->pages = 0;
+    cache->total = 0;
+    cache->in_use = 0;
+    cache->id = 0;
+    spin_init(&cache->lock);
+
+    // Unregistered caches still work, but kmem_cache_of() cannot see them
+    uint32_t flags = spin_lock_irqsave(&registry_lock);
+    if (registry_count < KMEM_CACHE_MAX)
+    {
+        registry[registry_count++] = cache;
+        cache->id = registry_count;
+    }
+    spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+// Carve one more page into free objects (cache->lock held)
+static int kmem_cache_grow(struct kmem_cache *cache)
+{
+    if (cache->obj_size > PAGE_SIZE)
+        return -1;
+
+    void *frame_addr = pmm_alloc_block();
+    if (!frame_addr)
+        return -1;
+    uint8_t *page = (uint8_t *)phys_to_virt(frame_addr); // Low frame
+
+    uint32_t count = PAGE_SIZE / cache->obj_size;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        void **obj = (void **)(page + i * cache->obj_size);
+        *obj = cache->free_list;
+        cache->free_list = obj;
+    }
+
+    page_owner[ADDR_TO_PAGE((uint32_t)frame_addr)] = cache->id;
+
+    cache->pages++;
+    cache->total += count;
+    return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (!cache->free_list && kmem_cache_grow(cache) != 0)
+    {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return 0;
+    }
+
+    void **obj = (void **)cache->free_list;
+    cache->free_list = *obj;
+    cache->in_use++;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    if (!obj)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    *(void **)obj = cache->free_list;
+    cache->free_list = obj;
+    cache->in_use--;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+struct kmem_cache *kmem_cache_of(const void *obj)
+{
+    uint32_t offset = (uint32_t)obj - PHYS_MAP_BASE; // Slab pages are in the direct map
+    if (offset >= PHYS_MAP_MAX)
+        return 0;
+    uint32_t frame = ADDR_TO_PAGE(offset);
+    if (!page_owner[frame])
+        return 0;
+    return registry[page_owner[frame] - 1];
+}
+
+struct kmem_cache *kmem_cache_iterate(uint32_t *pos)
+{
+    uint32_t flags = spin_lock_irqsave(&registry_lock);
+    struct kmem_cache *cache = *pos < registry_count ? registry[(*pos)++] : 0;
+    spin_unlock_irqrestore(&registry_lock, flags);
+    return cache;
+}